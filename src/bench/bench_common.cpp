@@ -0,0 +1,53 @@
+// bench_common.cpp
+
+#include "bench_common.h"
+#include <algorithm>
+#include <cmath>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+ScopedSilence::ScopedSilence() {
+    cout_buffer_ = std::cout.rdbuf(&null_buffer_);
+    cerr_buffer_ = std::cerr.rdbuf(&null_buffer_);
+    wcout_buffer_ = std::wcout.rdbuf(&null_wbuffer_);
+    wcerr_buffer_ = std::wcerr.rdbuf(&null_wbuffer_);
+}
+
+ScopedSilence::~ScopedSilence() {
+    std::cout.rdbuf(cout_buffer_);
+    std::cerr.rdbuf(cerr_buffer_);
+    std::wcout.rdbuf(wcout_buffer_);
+    std::wcerr.rdbuf(wcerr_buffer_);
+}
+
+size_t peak_rss_bytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return static_cast<size_t>(usage.ru_maxrss) * 1024; // ru_maxrss is in KiB on Linux
+    }
+    return 0;
+#endif
+}
+
+double percentile(std::vector<double>& samples, double p) {
+    if (samples.empty()) return 0.0;
+    std::sort(samples.begin(), samples.end());
+    double rank = (p / 100.0) * (samples.size() - 1);
+    size_t lower = static_cast<size_t>(std::floor(rank));
+    size_t upper = static_cast<size_t>(std::ceil(rank));
+    double fraction = rank - lower;
+    return samples[lower] + (samples[upper] - samples[lower]) * fraction;
+}
@@ -0,0 +1,46 @@
+#pragma once
+// bench_common.h
+
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Discards everything written to it
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+};
+
+class NullWBuffer : public std::wstreambuf {
+protected:
+    std::wint_t overflow(std::wint_t c) override { return c; }
+};
+
+// Silences std::cout/std::wcout/std::cerr/std::wcerr for the lifetime of the object,
+// so per-paragraph console output does not skew timings.
+class ScopedSilence {
+public:
+    ScopedSilence();
+    ~ScopedSilence();
+
+private:
+    NullBuffer null_buffer_;
+    NullWBuffer null_wbuffer_;
+    std::streambuf* cout_buffer_;
+    std::streambuf* cerr_buffer_;
+    std::wstreambuf* wcout_buffer_;
+    std::wstreambuf* wcerr_buffer_;
+};
+
+// Peak resident set size of this process in bytes
+size_t peak_rss_bytes();
+
+// Value at percentile p (0-100) of the samples; sorts the input
+double percentile(std::vector<double>& samples, double p);
+
+#endif // BENCH_COMMON_H
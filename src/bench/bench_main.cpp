@@ -0,0 +1,220 @@
+// bench_main.cpp
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include "e2e_bench.h"
+#include "micro_bench.h"
+#include "eval_bench.h"
+#include "mock_openai_server.h"
+#include "encoding_utils.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace {
+
+void print_usage() {
+    std::wcout << L"Usage: ragcpp_bench [options]\n"
+        L"Runs the end-to-end benchmark by default.\n"
+        L"Options:\n"
+        L"  --micro                Run the hot-kernel microbenchmarks instead\n"
+        L"  --eval DB              Evaluate search quality against speed on an existing database instead\n"
+        L"  --mock-only PORT       Only run the mock OpenAI server on PORT until killed\n"
+        L"  --filter NAME          Only run microbenchmarks whose name contains NAME\n"
+        L"  --min-time S           Minimum seconds measured per microbenchmark (default 0.5)\n"
+        L"  --chunks N             Number of synthetic paragraphs to ingest (default 1000)\n"
+        L"  --chunks-per-file N    Paragraphs per generated file (default 1000)\n"
+        L"  --lang cjk|en          Corpus language (default cjk)\n"
+        L"  --queries N            Number of queries to run (default 50)\n"
+        L"  --eval-queries FILE    Queries for --eval, one per line (default: N sampled stored paragraphs)\n"
+        L"  --sweep-dims LIST      Reduced dimensions --eval tries, e.g. 0,128,256 (default 0 = full)\n"
+        L"  --reduce-method M      pca or truncate, for --sweep-dims (default pca)\n"
+        L"  --sweep-coarse LIST    Coarse document counts --eval tries, e.g. 0,16,64 (default 0 = off)\n"
+        L"  --sweep-shards LIST    Segment counts --eval tries, e.g. 1,4 (default 1)\n"
+        L"  --sweep-binary LIST    Binary prefilter candidates --eval tries, e.g. 0,1000,4000 (default 0 = off)\n"
+        L"  --dim D                Mock embedding dimension (default 1536)\n"
+        L"  --latency-ms L         Mock server latency per request (default 0)\n"
+        L"  --error-rate R         Fraction of mock requests that fail (default 0)\n"
+        L"  --token-interval-ms T  Mock delay between streamed answer tokens (default 0)\n"
+        L"  --rate-limit RPS       Mock requests per second before it answers 429 (default unlimited)\n"
+        L"  --shards N             Split the scratch database into N shards (default 1)\n"
+        L"  --work-dir DIR         Directory for the run's own scratch subdirectory (default bench_work)\n"
+        L"  --json FILE            Also write the report as JSON\n"
+        L"  --csv FILE             Also write the --eval report as CSV\n"
+        L"  --keep                 Keep the run's scratch subdirectory afterwards\n"
+        L"  -h, --help             Display this help message\n";
+}
+
+// Fetch the value following an option or exit with an error
+std::wstring option_value(const std::vector<std::wstring>& args, size_t& i) {
+    if (i + 1 >= args.size()) {
+        std::wcerr << L"Error: " << args[i] << L" requires a value." << std::endl;
+        exit(1);
+    }
+    return args[++i];
+}
+
+// Comma-separated sizes, e.g. "0,128,256"
+std::vector<size_t> option_list(const std::vector<std::wstring>& args, size_t& i) {
+    std::wstring list = option_value(args, i);
+    std::vector<size_t> values;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(L',', begin);
+        if (end == std::wstring::npos) {
+            end = list.size();
+        }
+        values.push_back(std::stoull(list.substr(begin, end - begin)));
+        begin = end + 1;
+    }
+    return values;
+}
+
+} // namespace
+
+int wmain(int argc, wchar_t* argv[]) {
+#ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+#endif
+
+    E2EBenchOptions options;
+    MicroBenchOptions micro_options;
+    EvalBenchOptions eval_options;
+    bool micro = false;
+    bool eval = false;
+    int mock_only_port = -1;
+    std::vector<std::wstring> args(argv + 1, argv + argc);
+
+    try {
+        for (size_t i = 0; i < args.size(); ++i) {
+            const std::wstring& arg = args[i];
+
+            if (arg == L"-h" || arg == L"--help") {
+                print_usage();
+                return 0;
+            }
+            else if (arg == L"--micro") {
+                micro = true;
+            }
+            else if (arg == L"--eval") {
+                eval = true;
+                eval_options.db_path = option_value(args, i);
+            }
+            else if (arg == L"--eval-queries") {
+                eval_options.queries_path = option_value(args, i);
+            }
+            else if (arg == L"--sweep-dims") {
+                eval_options.dims = option_list(args, i);
+            }
+            else if (arg == L"--reduce-method") {
+                eval_options.reduce_method = wstring_to_utf8(option_value(args, i));
+            }
+            else if (arg == L"--sweep-coarse") {
+                eval_options.coarse = option_list(args, i);
+            }
+            else if (arg == L"--sweep-shards") {
+                eval_options.shards = option_list(args, i);
+            }
+            else if (arg == L"--sweep-binary") {
+                eval_options.binary = option_list(args, i);
+            }
+            else if (arg == L"--csv") {
+                eval_options.csv_path = option_value(args, i);
+            }
+            else if (arg == L"--mock-only") {
+                mock_only_port = std::stoi(option_value(args, i));
+            }
+            else if (arg == L"--filter") {
+                micro_options.filter = wstring_to_utf8(option_value(args, i));
+            }
+            else if (arg == L"--min-time") {
+                micro_options.min_seconds = std::stod(option_value(args, i));
+            }
+            else if (arg == L"--chunks") {
+                options.chunks = std::stoull(option_value(args, i));
+            }
+            else if (arg == L"--chunks-per-file") {
+                options.chunks_per_file = std::stoull(option_value(args, i));
+            }
+            else if (arg == L"--lang") {
+                std::wstring lang = option_value(args, i);
+                if (lang != L"cjk" && lang != L"en") {
+                    std::wcerr << L"Error: --lang must be cjk or en." << std::endl;
+                    return 1;
+                }
+                options.cjk = lang == L"cjk";
+            }
+            else if (arg == L"--queries") {
+                options.queries = std::stoull(option_value(args, i));
+            }
+            else if (arg == L"--dim") {
+                options.embedding_dim = std::stoi(option_value(args, i));
+            }
+            else if (arg == L"--latency-ms") {
+                options.latency_ms = std::stoi(option_value(args, i));
+            }
+            else if (arg == L"--error-rate") {
+                options.error_rate = std::stod(option_value(args, i));
+            }
+            else if (arg == L"--token-interval-ms") {
+                options.token_interval_ms = std::stoi(option_value(args, i));
+            }
+            else if (arg == L"--rate-limit") {
+                options.rate_limit_rps = std::stoi(option_value(args, i));
+            }
+            else if (arg == L"--shards") {
+                options.shards = std::stoi(option_value(args, i));
+            }
+            else if (arg == L"--work-dir") {
+                options.work_dir = option_value(args, i);
+            }
+            else if (arg == L"--json") {
+                options.json_path = option_value(args, i);
+            }
+            else if (arg == L"--keep") {
+                options.keep_work_dir = true;
+            }
+            else {
+                std::wcerr << L"Unknown option or argument: " << arg << std::endl;
+                return 1;
+            }
+        }
+    }
+    catch (const std::exception&) {
+        std::wcerr << L"Invalid numeric option value." << std::endl;
+        return 1;
+    }
+
+    if (mock_only_port >= 0) {
+        // Point ragcpp at it with OPENAI_API_BASE=http://127.0.0.1:PORT
+        MockServerOptions server_options;
+        server_options.port = mock_only_port;
+        server_options.embedding_dim = options.embedding_dim;
+        server_options.latency_ms = options.latency_ms;
+        server_options.error_rate = options.error_rate;
+        server_options.token_interval_ms = options.token_interval_ms;
+        server_options.requests_per_second = options.rate_limit_rps;
+        MockOpenAIServer server(server_options);
+        if (!server.start()) {
+            return 1;
+        }
+        std::cout << "Mock OpenAI server listening on " << server.base_url() << std::endl;
+        std::this_thread::sleep_until(std::chrono::steady_clock::time_point::max());
+    }
+
+    if (eval) {
+        eval_options.queries = options.queries;
+        eval_options.json_path = options.json_path;
+        return run_eval_benchmark(eval_options);
+    }
+    if (micro) {
+        micro_options.json_path = options.json_path;
+        return run_micro_benchmarks(micro_options);
+    }
+    return run_e2e_benchmark(options);
+}
@@ -0,0 +1,195 @@
+// e2e_bench.cpp
+
+#include "e2e_bench.h"
+#include "bench_common.h"
+#include "mock_openai_server.h"
+#include "synthetic_corpus.h"
+#include "database.h"
+#include "document_manager.h"
+#include "openai_api.h"
+#include "shards.h"
+#include "encoding_utils.h"
+#include <nlohmann/json.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <vector>
+
+namespace {
+
+long long count_rows(sqlite3* db, const char* sql) {
+    sqlite3_stmt* stmt;
+    long long count = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            count = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return count;
+}
+
+// A new directory runN inside parent, creating parent if needed; empty when
+// none could be created. Only this directory is ever deleted, so a mistyped
+// --work-dir cannot cost the user anything already there.
+std::filesystem::path create_run_dir(const std::filesystem::path& parent, bool& created_parent) {
+    std::error_code error;
+    created_parent = std::filesystem::create_directories(parent, error);
+    if (error) {
+        std::wcerr << L"Cannot create work directory " << parent.wstring() << std::endl;
+        return {};
+    }
+    for (int n = 1; n < 10000; ++n) {
+        std::filesystem::path run_dir = parent / (L"run" + std::to_wstring(n));
+        if (std::filesystem::create_directory(run_dir, error)) {
+            return run_dir;
+        }
+        if (error) break;
+    }
+    std::wcerr << L"Cannot create a run directory in " << parent.wstring() << std::endl;
+    return {};
+}
+
+} // namespace
+
+int run_e2e_benchmark(const E2EBenchOptions& options) {
+    using clock = std::chrono::steady_clock;
+    const std::string api_key = "bench";
+
+    bool created_parent = false;
+    std::filesystem::path work_dir = create_run_dir(options.work_dir, created_parent);
+    if (work_dir.empty()) {
+        return 1;
+    }
+    std::filesystem::path corpus_dir = work_dir / L"corpus";
+    std::filesystem::path db_path = work_dir / L"bench.db";
+    std::filesystem::create_directories(corpus_dir);
+
+    // Start the local API stand-in
+    MockServerOptions server_options;
+    server_options.embedding_dim = options.embedding_dim;
+    server_options.latency_ms = options.latency_ms;
+    server_options.error_rate = options.error_rate;
+    server_options.token_interval_ms = options.token_interval_ms;
+    server_options.requests_per_second = options.rate_limit_rps;
+
+    MockOpenAIServer server(server_options);
+    if (!server.start()) {
+        std::cerr << "Failed to start mock OpenAI server." << std::endl;
+        return 1;
+    }
+    set_api_base_url(server.base_url());
+    std::cout << "Mock server listening on " << server.base_url() << std::endl;
+
+    // Generate the corpus
+    CorpusOptions corpus_options;
+    corpus_options.chunks = options.chunks;
+    corpus_options.chunks_per_file = options.chunks_per_file;
+    corpus_options.cjk = options.cjk;
+    CorpusInfo corpus = generate_corpus(corpus_dir.wstring(), corpus_options);
+    std::cout << "Generated " << options.chunks << " chunks in " << corpus.file_paths.size()
+        << " files (" << corpus.total_bytes << " bytes)." << std::endl;
+
+    sqlite3* db = nullptr;
+    initialize_database(db, wstring_to_utf8(db_path.wstring()).c_str());
+    if (!db || !open_shards(db, options.shards, {})) {
+        sqlite3_close(db);
+        server.stop();
+        return 1;
+    }
+
+    // Ingestion
+    auto ingest_start = clock::now();
+    {
+        ScopedSilence silence;
+        process_paths({ corpus_dir.wstring() }, api_key, db);
+    }
+    double ingest_seconds = std::chrono::duration<double>(clock::now() - ingest_start).count();
+    long long embedded_chunks = 0;
+    for (sqlite3* shard : shard_connections(db)) {
+        embedded_chunks += count_rows(shard, "SELECT COUNT(*) FROM embeddings;");
+    }
+
+    // Queries
+    std::vector<std::wstring> queries = generate_queries(options.queries, options.cjk, 7);
+    std::vector<double> latencies_ms;
+    latencies_ms.reserve(queries.size());
+    for (const auto& query : queries) {
+        auto query_start = clock::now();
+        {
+            ScopedSilence silence;
+            generate_answer(query, api_key, db);
+        }
+        latencies_ms.push_back(std::chrono::duration<double, std::milli>(clock::now() - query_start).count());
+    }
+
+    close_shards(db);
+    sqlite3_close(db);
+    server.stop();
+
+    // The primary and any shard files next to it
+    uintmax_t db_size = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(work_dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == L".db") {
+            db_size += entry.file_size();
+        }
+    }
+    double chunks_per_second = ingest_seconds > 0 ? embedded_chunks / ingest_seconds : 0.0;
+    double mb_per_second = ingest_seconds > 0 ? (corpus.total_bytes / (1024.0 * 1024.0)) / ingest_seconds : 0.0;
+    double p50 = percentile(latencies_ms, 50);
+    double p99 = percentile(latencies_ms, 99);
+    size_t peak_rss = peak_rss_bytes();
+
+    std::cout << "\nEnd-to-end benchmark (" << (options.cjk ? "CJK" : "English") << ", dim " << options.embedding_dim << ")\n"
+        << "  Chunks embedded:      " << embedded_chunks << " / " << options.chunks << "\n"
+        << "  Ingestion time:       " << ingest_seconds << " s\n"
+        << "  Ingestion throughput: " << chunks_per_second << " chunks/s, " << mb_per_second << " MB/s\n"
+        << "  Query latency p50:    " << p50 << " ms\n"
+        << "  Query latency p99:    " << p99 << " ms\n"
+        << "  Peak RSS:             " << peak_rss / (1024.0 * 1024.0) << " MB\n"
+        << "  Shards:               " << options.shards << "\n"
+        << "  DB size:              " << db_size / (1024.0 * 1024.0) << " MB\n"
+        << "  Mock requests:        " << server.request_count() << " (" << server.error_count() << " injected errors, "
+        << server.rate_limited_count() << " rate limited)" << std::endl;
+
+    if (!options.json_path.empty()) {
+        nlohmann::json report;
+        report["corpus"] = options.cjk ? "cjk" : "english";
+        report["embedding_dim"] = options.embedding_dim;
+        report["chunks_requested"] = options.chunks;
+        report["chunks_embedded"] = embedded_chunks;
+        report["corpus_bytes"] = corpus.total_bytes;
+        report["ingest_seconds"] = ingest_seconds;
+        report["ingest_chunks_per_second"] = chunks_per_second;
+        report["ingest_mb_per_second"] = mb_per_second;
+        report["query_count"] = queries.size();
+        report["query_p50_ms"] = p50;
+        report["query_p99_ms"] = p99;
+        report["peak_rss_bytes"] = peak_rss;
+        report["db_size_bytes"] = db_size;
+        report["shards"] = options.shards;
+        report["mock_latency_ms"] = options.latency_ms;
+        report["mock_error_rate"] = options.error_rate;
+        report["mock_requests"] = server.request_count();
+        report["mock_errors"] = server.error_count();
+        report["mock_rate_limit_rps"] = options.rate_limit_rps;
+        report["mock_rate_limited"] = server.rate_limited_count();
+
+        std::ofstream json_file(std::filesystem::path(options.json_path));
+        json_file << report.dump(2) << std::endl;
+    }
+
+    if (options.keep_work_dir) {
+        std::wcout << L"Kept " << work_dir.wstring() << std::endl;
+    }
+    else {
+        std::error_code error;
+        std::filesystem::remove_all(work_dir, error);
+        if (created_parent) {
+            std::filesystem::remove(options.work_dir, error);    // Only if nothing else is in it
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+// e2e_bench.h
+
+#ifndef E2E_BENCH_H
+#define E2E_BENCH_H
+
+#include <string>
+#include <cstddef>
+
+struct E2EBenchOptions {
+    size_t chunks = 1000;
+    size_t chunks_per_file = 1000;
+    bool cjk = true;
+    size_t queries = 50;
+    int embedding_dim = 1536;
+    int latency_ms = 0;
+    double error_rate = 0.0;
+    int token_interval_ms = 0;
+    int rate_limit_rps = 0;     // Mock requests per second before it answers 429; 0 = unlimited
+    int shards = 1;             // Shard files the scratch database is split into
+    std::wstring work_dir = L"bench_work";
+    std::wstring json_path;     // Optional JSON report
+    bool keep_work_dir = false;
+};
+
+// Generate a corpus, ingest it against a local mock API, run queries and
+// print ingestion throughput, query latency percentiles, peak RSS and DB size.
+int run_e2e_benchmark(const E2EBenchOptions& options);
+
+#endif // E2E_BENCH_H
@@ -0,0 +1,439 @@
+// eval_bench.cpp
+
+#include "eval_bench.h"
+#include "bench_common.h"
+#include "database.h"
+#include "document_manager.h"
+#include "openai_api.h"
+#include "shards.h"
+#include "vector_index.h"
+#include "vector_projection.h"
+#include "encoding_utils.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <unordered_set>
+
+namespace {
+
+// Hits scored per query, and the cut-offs recall is reported at
+const size_t eval_top_k = 10;
+const size_t recall_cutoffs[] = { 1, 5, 10 };
+
+// Query texts embedded per API request
+const size_t query_batch_size = 64;
+
+struct EvalQuery {
+    std::vector<float> embedding;
+    int exclude_id = -1;    // A sampled paragraph is left out of its own hits
+};
+
+struct EvalResult {
+    std::string backend;    // "scan" (SQLite) or "memory" (resident segments)
+    size_t dim = 0;         // Dimension of the first-stage scan
+    size_t shards = 0;
+    size_t coarse = 0;
+    size_t binary = 0;      // Binary prefilter candidates
+    double recall[3] = { 0.0, 0.0, 0.0 };
+    double mrr = 0.0;
+    double p50_ms = 0.0;
+    double p99_ms = 0.0;
+    double qps = 0.0;
+    size_t index_bytes = 0;
+};
+
+// Every stored embedding of the first dimension seen, across all shards, as
+// one index. Only rows, ids and norms are filled in.
+bool load_all_embeddings(sqlite3* primary, VectorIndex& all) {
+    all = VectorIndex();
+    for (sqlite3* shard : shard_connections(primary)) {
+        VectorIndex segment;
+        if (!load_vector_index(shard, segment)) {
+            return false;
+        }
+        if (segment.size() == 0) continue;
+        if (all.dim == 0) {
+            all.dim = segment.dim;
+        }
+        if (segment.dim != all.dim) {
+            std::cerr << "Skipped " << segment.size() << " embeddings with a dimension other than " << all.dim << "." << std::endl;
+            continue;
+        }
+        all.ids.insert(all.ids.end(), segment.ids.begin(), segment.ids.end());
+        all.doc_ids.insert(all.doc_ids.end(), segment.doc_ids.begin(), segment.doc_ids.end());
+        all.vectors.insert(all.vectors.end(), segment.vectors.begin(), segment.vectors.end());
+        all.norms.insert(all.norms.end(), segment.norms.begin(), segment.norms.end());
+    }
+    return true;
+}
+
+// Split the rows into count segments by doc_id % count, the way a database
+// split into count shards holds them, projecting each row when given a projection
+std::vector<VectorIndex> split_segments(const VectorIndex& all, size_t count, const std::shared_ptr<const VectorProjection>& projection) {
+    std::vector<VectorIndex> segments(count);
+    int dim = projection ? projection->output_dim : all.dim;
+    for (auto& segment : segments) {
+        segment.dim = dim;
+        segment.projection = projection;
+    }
+
+    std::vector<float> row(all.dim);
+    for (size_t i = 0; i < all.size(); ++i) {
+        VectorIndex& segment = segments[static_cast<size_t>(all.doc_ids[i]) % count];
+        float norm = all.norms[i];
+        if (projection) {
+            memcpy(row.data(), all.row(i), all.dim * sizeof(float));
+            std::vector<float> reduced = project_vector(*projection, row);
+            segment.vectors.insert(segment.vectors.end(), reduced.begin(), reduced.end());
+            norm = 1.0f;
+        }
+        else {
+            segment.vectors.insert(segment.vectors.end(), all.row(i), all.row(i) + all.dim);
+        }
+        segment.ids.push_back(all.ids[i]);
+        segment.doc_ids.push_back(all.doc_ids[i]);
+        segment.norms.push_back(norm);
+    }
+    for (auto& segment : segments) {
+        index_documents(segment);
+    }
+    return segments;
+}
+
+size_t resident_bytes(const std::vector<VectorIndex>& segments) {
+    size_t bytes = 0;
+    for (const auto& segment : segments) {
+        bytes += (segment.vectors.size() + segment.norms.size() + segment.centroids.size()) * sizeof(float)
+            + (segment.ids.size() + segment.doc_ids.size()) * sizeof(int)
+            + segment.documents.size() * sizeof(DocumentRange)
+            + segment.codes.size() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+// Stored paragraphs drawn at random, each searched for with its own embedding
+std::vector<EvalQuery> sample_stored_queries(const VectorIndex& all, size_t count, unsigned int seed) {
+    std::vector<size_t> rows(all.size());
+    std::iota(rows.begin(), rows.end(), 0);
+    std::mt19937 rng(seed);
+    std::shuffle(rows.begin(), rows.end(), rng);
+    rows.resize(std::min(count, rows.size()));
+
+    std::vector<EvalQuery> queries;
+    for (size_t row : rows) {
+        EvalQuery query;
+        query.embedding.assign(all.row(row), all.row(row) + all.dim);
+        query.exclude_id = all.ids[row];
+        queries.push_back(std::move(query));
+    }
+    return queries;
+}
+
+// Embed the non-empty lines of a UTF-8 file
+bool embed_query_file(const std::wstring& path, int dim, std::vector<EvalQuery>& queries) {
+    const char* api_key = std::getenv("OPENAI_API_KEY");
+    if (!api_key) {
+        std::cerr << "Please set the OPENAI_API_KEY environment variable to embed the queries." << std::endl;
+        return false;
+    }
+
+    std::ifstream file{ std::filesystem::path(path) };
+    if (!file) {
+        std::wcerr << L"Cannot open query file: " << path << std::endl;
+        return false;
+    }
+    std::vector<std::wstring> texts;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (texts.empty() && line.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+            line.erase(0, 3);
+        }
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            texts.push_back(utf8_to_wstring(line));
+        }
+    }
+
+    size_t failed = 0;
+    for (size_t begin = 0; begin < texts.size(); begin += query_batch_size) {
+        std::vector<std::wstring> batch(texts.begin() + begin, texts.begin() + std::min(begin + query_batch_size, texts.size()));
+        for (auto& embedding : get_embeddings(batch, api_key)) {
+            if (static_cast<int>(embedding.size()) != dim) {
+                failed++;
+                continue;
+            }
+            EvalQuery query;
+            query.embedding = std::move(embedding);
+            queries.push_back(std::move(query));
+        }
+    }
+    if (failed > 0) {
+        std::cerr << "Left out " << failed << " queries that could not be embedded at dimension " << dim << "." << std::endl;
+    }
+    return !queries.empty();
+}
+
+// The first eval_top_k hits other than the query's own paragraph
+std::vector<SimilarityResult> top_hits(const std::vector<SimilarityResult>& hits, int exclude_id) {
+    std::vector<SimilarityResult> top;
+    for (const auto& hit : hits) {
+        if (top.size() == eval_top_k) break;
+        if (hit.id != exclude_id) {
+            top.push_back(hit);
+        }
+    }
+    return top;
+}
+
+// Time search on every query, after one untimed warm-up, and score its hits
+// against the ground truth. Recall@k is the share of the exact top k found in
+// the first k hits; MRR averages 1 / rank of the exact best hit (0 if missed).
+void evaluate(const std::vector<EvalQuery>& queries, const std::vector<std::vector<SimilarityResult>>& truth,
+    const std::function<std::vector<SimilarityResult>(const EvalQuery&)>& search, EvalResult& result) {
+    using clock = std::chrono::steady_clock;
+    search(queries[0]);
+
+    std::vector<double> latencies_ms;
+    double total_seconds = 0.0;
+    size_t scored = 0;
+    for (size_t q = 0; q < queries.size(); ++q) {
+        auto start = clock::now();
+        std::vector<SimilarityResult> hits = search(queries[q]);
+        auto elapsed = clock::now() - start;
+        latencies_ms.push_back(std::chrono::duration<double, std::milli>(elapsed).count());
+        total_seconds += std::chrono::duration<double>(elapsed).count();
+
+        if (truth[q].empty()) continue;
+        hits = top_hits(hits, queries[q].exclude_id);
+        scored++;
+        for (size_t c = 0; c < 3; ++c) {
+            size_t k = std::min(recall_cutoffs[c], truth[q].size());
+            std::unordered_set<int> expected;
+            for (size_t i = 0; i < k; ++i) {
+                expected.insert(truth[q][i].id);
+            }
+            size_t found = 0;
+            for (size_t i = 0; i < std::min(k, hits.size()); ++i) {
+                found += expected.count(hits[i].id);
+            }
+            result.recall[c] += static_cast<double>(found) / k;
+        }
+        for (size_t i = 0; i < hits.size(); ++i) {
+            if (hits[i].id == truth[q][0].id) {
+                result.mrr += 1.0 / (i + 1);
+                break;
+            }
+        }
+    }
+
+    if (scored > 0) {
+        for (double& recall : result.recall) {
+            recall /= scored;
+        }
+        result.mrr /= scored;
+    }
+    result.p50_ms = percentile(latencies_ms, 50);
+    result.p99_ms = percentile(latencies_ms, 99);
+    result.qps = total_seconds > 0 ? queries.size() / total_seconds : 0.0;
+}
+
+void print_results(const std::vector<EvalResult>& results) {
+    std::cout << "\n" << std::left << std::setw(8) << "Backend"
+        << std::right << std::setw(7) << "Dim"
+        << std::setw(8) << "Shards"
+        << std::setw(8) << "Coarse"
+        << std::setw(8) << "Binary"
+        << std::setw(10) << "R@1"
+        << std::setw(10) << "R@5"
+        << std::setw(10) << "R@10"
+        << std::setw(10) << "MRR"
+        << std::setw(11) << "p50 ms"
+        << std::setw(11) << "p99 ms"
+        << std::setw(11) << "QPS"
+        << std::setw(12) << "Index MB" << "\n";
+    std::cout << std::string(124, '-') << "\n";
+    for (const auto& result : results) {
+        std::cout << std::left << std::setw(8) << result.backend
+            << std::right << std::setw(7) << result.dim
+            << std::setw(8) << result.shards
+            << std::setw(8) << result.coarse
+            << std::setw(8) << result.binary
+            << std::fixed << std::setprecision(4)
+            << std::setw(10) << result.recall[0]
+            << std::setw(10) << result.recall[1]
+            << std::setw(10) << result.recall[2]
+            << std::setw(10) << result.mrr
+            << std::setprecision(3)
+            << std::setw(11) << result.p50_ms
+            << std::setw(11) << result.p99_ms
+            << std::setprecision(1)
+            << std::setw(11) << result.qps
+            << std::setw(12) << result.index_bytes / (1024.0 * 1024.0) << "\n";
+    }
+    std::cout << std::defaultfloat << std::flush;
+}
+
+void write_csv(const std::wstring& path, const std::vector<EvalResult>& results) {
+    std::ofstream csv_file{ std::filesystem::path(path) };
+    csv_file << "backend,dim,shards,coarse,binary,recall_at_1,recall_at_5,recall_at_10,mrr,p50_ms,p99_ms,qps,index_bytes\n";
+    for (const auto& result : results) {
+        csv_file << result.backend << ',' << result.dim << ',' << result.shards << ',' << result.coarse << ',' << result.binary << ','
+            << result.recall[0] << ',' << result.recall[1] << ',' << result.recall[2] << ',' << result.mrr << ','
+            << result.p50_ms << ',' << result.p99_ms << ',' << result.qps << ',' << result.index_bytes << '\n';
+    }
+}
+
+void write_json(const std::wstring& path, const EvalBenchOptions& options, size_t embeddings, int dim, size_t queries,
+    const std::vector<EvalResult>& results) {
+    nlohmann::json report;
+    report["database"] = wstring_to_utf8(options.db_path);
+    report["embeddings"] = embeddings;
+    report["embedding_dim"] = dim;
+    report["queries"] = queries;
+    report["query_source"] = options.queries_path.empty() ? "stored paragraphs" : wstring_to_utf8(options.queries_path);
+    report["top_k"] = eval_top_k;
+    report["reduce_method"] = options.reduce_method;
+    report["configurations"] = nlohmann::json::array();
+    for (const auto& result : results) {
+        report["configurations"].push_back({
+            {"backend", result.backend},
+            {"dim", result.dim},
+            {"shards", result.shards},
+            {"coarse", result.coarse},
+            {"binary", result.binary},
+            {"recall_at_1", result.recall[0]},
+            {"recall_at_5", result.recall[1]},
+            {"recall_at_10", result.recall[2]},
+            {"mrr", result.mrr},
+            {"p50_ms", result.p50_ms},
+            {"p99_ms", result.p99_ms},
+            {"qps", result.qps},
+            {"index_bytes", result.index_bytes}
+        });
+    }
+    std::ofstream json_file{ std::filesystem::path(path) };
+    json_file << report.dump(2) << std::endl;
+}
+
+} // namespace
+
+int run_eval_benchmark(const EvalBenchOptions& options) {
+    using clock = std::chrono::steady_clock;
+
+    if (!std::filesystem::exists(std::filesystem::path(options.db_path))) {
+        std::wcerr << L"Database not found: " << options.db_path << std::endl;
+        return 1;
+    }
+    sqlite3* db = nullptr;
+    initialize_database(db, wstring_to_utf8(options.db_path).c_str());
+    if (!db || !open_shards(db, 0, {})) {
+        sqlite3_close(db);
+        return 1;
+    }
+
+    VectorIndex all;
+    std::vector<EvalQuery> queries;
+    bool loaded = load_all_embeddings(db, all);
+    if (loaded && all.size() == 0) {
+        std::cerr << "No embeddings to evaluate." << std::endl;
+        loaded = false;
+    }
+    if (loaded) {
+        if (options.queries_path.empty()) {
+            queries = sample_stored_queries(all, options.queries, options.seed);
+        }
+        else {
+            loaded = embed_query_file(options.queries_path, all.dim, queries);
+        }
+    }
+    if (loaded && queries.empty()) {
+        std::cerr << "No queries to evaluate." << std::endl;
+        loaded = false;
+    }
+    if (!loaded) {
+        close_shards(db);
+        sqlite3_close(db);
+        return 1;
+    }
+
+    // Exact ground truth, computed once: every stored embedding scored at full dimension
+    auto truth_start = clock::now();
+    std::vector<std::vector<SimilarityResult>> truth(queries.size());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        truth[q] = top_hits(search_vector_index(all, queries[q].embedding, eval_top_k + 1), queries[q].exclude_id);
+    }
+    std::cout << "Ground truth: exact top " << eval_top_k << " of " << queries.size()
+        << (options.queries_path.empty() ? " sampled paragraphs" : " queries") << " over " << all.size()
+        << " embeddings (dim " << all.dim << ", " << shard_count(db) << " shards) in "
+        << std::chrono::duration<double>(clock::now() - truth_start).count() << " s." << std::endl;
+
+    size_t saved_coarse = coarse_documents();
+    std::vector<EvalResult> results;
+
+    // The SQLite scan, as queries without resident segments run it
+    std::shared_ptr<const VectorProjection> stored_projection = load_projection(db);
+    for (size_t coarse : options.coarse) {
+        set_coarse_documents(coarse);
+        EvalResult result;
+        result.backend = "scan";
+        result.dim = stored_projection ? stored_projection->output_dim : all.dim;
+        result.shards = shard_count(db);
+        result.coarse = coarse;
+        evaluate(queries, truth, [&](const EvalQuery& query) {
+            return retrieve_similar_embeddings(query.embedding, db);
+        }, result);
+        results.push_back(result);
+    }
+
+    // Resident segments, as the query server searches them
+    for (size_t dim : options.dims) {
+        std::shared_ptr<const VectorProjection> projection;
+        if (dim > 0 && dim != static_cast<size_t>(all.dim)) {
+            projection = train_projection(db, static_cast<int>(dim), options.reduce_method);
+            if (!projection) continue;
+        }
+        for (size_t shards : options.shards) {
+            std::vector<VectorIndex> segments = split_segments(all, std::max<size_t>(shards, 1), projection);
+            for (size_t coarse : options.coarse) {
+                set_coarse_documents(coarse);
+                for (size_t binary : options.binary) {
+                    EvalResult result;
+                    result.backend = "memory";
+                    result.dim = projection ? projection->output_dim : all.dim;
+                    result.shards = segments.size();
+                    result.coarse = coarse;
+                    result.binary = binary;
+                    result.index_bytes = resident_bytes(segments);
+                    evaluate(queries, truth, [&](const EvalQuery& query) {
+                        return search_segments_reranked(db, segments, { query.embedding }, eval_top_k + 1, binary)[0];
+                    }, result);
+                    results.push_back(result);
+                }
+            }
+        }
+    }
+    set_coarse_documents(saved_coarse);
+
+    print_results(results);
+    if (!options.csv_path.empty()) {
+        write_csv(options.csv_path, results);
+    }
+    if (!options.json_path.empty()) {
+        write_json(options.json_path, options, all.size(), all.dim, queries.size(), results);
+    }
+
+    close_shards(db);
+    sqlite3_close(db);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+// eval_bench.h
+
+#ifndef EVAL_BENCH_H
+#define EVAL_BENCH_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+struct EvalBenchOptions {
+    std::wstring db_path;               // Existing database to evaluate, with its shards; only read
+    std::wstring queries_path;          // UTF-8 queries, one per line, embedded through the API
+    size_t queries = 50;                // Stored paragraphs sampled as queries when there is no query file
+    std::vector<size_t> dims = { 0 };           // Reduced dimensions to sweep; 0 = full dimension
+    std::string reduce_method = "pca";
+    std::vector<size_t> coarse = { 0 };         // coarse_documents values to sweep
+    std::vector<size_t> shards = { 1 };         // In-memory segment counts to sweep
+    std::vector<size_t> binary = { 0 };         // Binary prefilter candidates to sweep; 0 = off
+    unsigned int seed = 42;
+    std::wstring json_path;             // Optional JSON report
+    std::wstring csv_path;              // Optional CSV report
+};
+
+// Score every configuration against the exact ground truth of the database:
+// recall@1/5/10 and MRR of its top 10 hits, p50/p99 latency, QPS and resident
+// index size. The SQLite scan (retrieve_similar_embeddings) is evaluated once
+// per coarse value, the resident segments once per dimension, segment count,
+// coarse value and binary prefilter.
+int run_eval_benchmark(const EvalBenchOptions& options);
+
+#endif // EVAL_BENCH_H
@@ -0,0 +1,457 @@
+// micro_bench.cpp
+
+#include "micro_bench.h"
+#include "utils.h"
+#include "text_processing.h"
+#include "encoding_utils.h"
+#include "openai_api.h"
+#include "database.h"
+#include "document_manager.h"
+#include "bpe_tokenizer.h"
+#include "vector_projection.h"
+#include "near_duplicates.h"
+#include "vector_index.h"
+#include "text_store.h"
+#include "mock_openai_server.h"
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <vector>
+
+// Allocation accounting for the whole benchmark binary. Only C++ allocations
+// are counted; SQLite and cURL allocate through malloc directly.
+static std::atomic<uint64_t> g_alloc_count{ 0 };
+static std::atomic<uint64_t> g_alloc_bytes{ 0 };
+
+void* operator new(size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+volatile float g_float_sink;
+volatile size_t g_size_sink;
+
+struct MicroResult {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double bytes_per_op;
+    double allocs_per_op;
+};
+
+// Double the iteration count until one timed batch runs for at least min_seconds
+template <typename F>
+MicroResult measure(const std::string& name, double min_seconds, F&& fn) {
+    using clock = std::chrono::steady_clock;
+    fn(); // Warm up caches and lazily initialized state
+
+    uint64_t iterations = 1;
+    while (true) {
+        uint64_t allocs_before = g_alloc_count.load(std::memory_order_relaxed);
+        uint64_t bytes_before = g_alloc_bytes.load(std::memory_order_relaxed);
+        auto start = clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            fn();
+        }
+        double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        uint64_t allocs = g_alloc_count.load(std::memory_order_relaxed) - allocs_before;
+        uint64_t bytes = g_alloc_bytes.load(std::memory_order_relaxed) - bytes_before;
+
+        if (elapsed >= min_seconds || iterations >= (1ULL << 32)) {
+            return {
+                name,
+                iterations,
+                elapsed * 1e9 / iterations,
+                static_cast<double>(bytes) / iterations,
+                static_cast<double>(allocs) / iterations
+            };
+        }
+        iterations *= 2;
+    }
+}
+
+std::vector<float> random_vector(std::mt19937& rng, int dim) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> vec(dim);
+    for (float& value : vec) {
+        value = dist(rng);
+    }
+    return vec;
+}
+
+std::wstring sample_cjk_text(std::mt19937& rng, size_t chars) {
+    std::uniform_int_distribution<int> dist(0x4E00, 0x4FFF);
+    std::wstring text;
+    text.reserve(chars);
+    for (size_t i = 0; i < chars; ++i) {
+        text += (i % 24 == 23) ? L'\x3002' : static_cast<wchar_t>(dist(rng));
+    }
+    return text;
+}
+
+std::wstring sample_english_text(std::mt19937& rng, size_t chars) {
+    static const wchar_t* const words[] = { L"retrieval ", L"augmented ", L"generation ", L"vector ", L"index ", L"query ", L"the ", L"of " };
+    std::uniform_int_distribution<size_t> dist(0, 7);
+    std::wstring text;
+    while (text.size() < chars) {
+        text += words[dist(rng)];
+    }
+    text.resize(chars);
+    return text;
+}
+
+// Build an in-memory database with rows random embeddings spread over 10
+// documents; null when any row could not be stored, so nothing is timed on
+// a partial corpus
+sqlite3* build_corpus_db(std::mt19937& rng, int rows, int dim) {
+    sqlite3* db = nullptr;
+    initialize_database(db, ":memory:");
+    if (!db) return nullptr;
+
+    for (int d = 0; d < 10; ++d) {
+        insert_document(db, L"doc_" + std::to_wstring(d) + L".txt");
+    }
+
+    sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    for (int i = 0; i < rows; ++i) {
+        if (insert_embedding(db, 1 + i % 10, L"paragraph " + std::to_wstring(i), random_vector(rng, dim)) < 0) {
+            std::cerr << "Failed to build the benchmark corpus; stopping." << std::endl;
+            sqlite3_close(db);
+            return nullptr;
+        }
+    }
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    return db;
+}
+
+bool selected(const MicroBenchOptions& options, const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+} // namespace
+
+int run_micro_benchmarks(const MicroBenchOptions& options) {
+    const int dims[] = { 384, 768, 1536, 3072 };
+    const int corpus_rows[] = { 1000, 10000 };
+    std::mt19937 rng(42);
+    std::vector<MicroResult> results;
+
+    // cosine_similarity across embedding dimensions
+    for (int dim : dims) {
+        std::string name = "cosine_similarity/dim=" + std::to_string(dim);
+        if (!selected(options, name)) continue;
+        std::vector<float> a = random_vector(rng, dim);
+        std::vector<float> b = random_vector(rng, dim);
+        results.push_back(measure(name, options.min_seconds, [&] {
+            g_float_sink = cosine_similarity(a, b);
+        }));
+    }
+
+    // Encoding conversions on a 1 KB CJK paragraph and an English one
+    std::wstring cjk_text = sample_cjk_text(rng, 1024);
+    std::wstring english_text = sample_english_text(rng, 1024);
+    std::string cjk_utf8 = wstring_to_utf8(cjk_text);
+    std::string english_utf8 = wstring_to_utf8(english_text);
+
+    if (selected(options, "wstring_to_utf8/cjk")) {
+        results.push_back(measure("wstring_to_utf8/cjk", options.min_seconds, [&] {
+            g_size_sink = wstring_to_utf8(cjk_text).size();
+        }));
+    }
+    if (selected(options, "wstring_to_utf8/english")) {
+        results.push_back(measure("wstring_to_utf8/english", options.min_seconds, [&] {
+            g_size_sink = wstring_to_utf8(english_text).size();
+        }));
+    }
+    if (selected(options, "utf8_to_wstring/cjk")) {
+        results.push_back(measure("utf8_to_wstring/cjk", options.min_seconds, [&] {
+            g_size_sink = utf8_to_wstring(cjk_utf8).size();
+        }));
+    }
+    if (selected(options, "utf8_to_wstring/english")) {
+        results.push_back(measure("utf8_to_wstring/english", options.min_seconds, [&] {
+            g_size_sink = utf8_to_wstring(english_utf8).size();
+        }));
+    }
+
+    // split_paragraphs over a 1000-line document
+    if (selected(options, "split_paragraphs/lines=1000")) {
+        std::wstring document;
+        for (int i = 0; i < 1000; ++i) {
+            document += sample_cjk_text(rng, 80) + L"\n";
+        }
+        results.push_back(measure("split_paragraphs/lines=1000", options.min_seconds, [&] {
+            g_size_sink = split_paragraphs(document).size();
+        }));
+    }
+
+    // Jieba tokenization of a single paragraph
+    if (selected(options, "tokenize_text/cjk")) {
+        std::wstring paragraph = cjk_text.substr(0, 200);
+        results.push_back(measure("tokenize_text/cjk", options.min_seconds, [&] {
+            g_size_sink = tokenize_text(paragraph).size();
+        }));
+    }
+    if (selected(options, "tokenize_text/english")) {
+        std::wstring paragraph = english_text.substr(0, 200);
+        results.push_back(measure("tokenize_text/english", options.min_seconds, [&] {
+            g_size_sink = tokenize_text(paragraph).size();
+        }));
+    }
+
+    // MinHash signature of a paragraph, as computed for near-duplicate detection
+    if (selected(options, "minhash_signature/cjk")) {
+        std::wstring paragraph = cjk_text.substr(0, 200);
+        results.push_back(measure("minhash_signature/cjk", options.min_seconds, [&] {
+            g_size_sink = minhash_signature(paragraph)[0];
+        }));
+    }
+    if (selected(options, "minhash_signature/english")) {
+        std::wstring paragraph = english_text.substr(0, 200);
+        results.push_back(measure("minhash_signature/english", options.min_seconds, [&] {
+            g_size_sink = minhash_signature(paragraph)[0];
+        }));
+    }
+
+    // BPE token counting; estimated when dict/cl100k_base.tiktoken is missing
+    if (selected(options, "count_tokens/cjk")) {
+        results.push_back(measure("count_tokens/cjk", options.min_seconds, [&] {
+            g_size_sink = count_tokens(cjk_utf8);
+        }));
+    }
+    if (selected(options, "count_tokens/english")) {
+        results.push_back(measure("count_tokens/english", options.min_seconds, [&] {
+            g_size_sink = count_tokens(english_utf8);
+        }));
+    }
+
+    // Embedding response parsing across dimensions, as decimal floats and as base64
+    for (int dim : dims) {
+        for (bool base64 : { false, true }) {
+            std::string name = std::string("parse_embedding_response/") + (base64 ? "base64/" : "") + "dim=" + std::to_string(dim);
+            if (!selected(options, name)) continue;
+            std::vector<float> embedding = random_vector(rng, dim);
+            nlohmann::json response;
+            response["object"] = "list";
+            response["data"] = nlohmann::json::array({ {{"object", "embedding"}, {"index", 0},
+                {"embedding", base64 ? nlohmann::json(encode_embedding_base64(embedding)) : nlohmann::json(embedding)}} });
+            response["model"] = "text-embedding-ada-002";
+            std::string body = response.dump();
+            results.push_back(measure(name, options.min_seconds, [&] {
+                g_size_sink = parse_embedding_response(body).size();
+            }));
+        }
+    }
+
+    // Full corpus scan across row counts and dimensions
+    for (int rows : corpus_rows) {
+        for (int dim : dims) {
+            std::string name = "retrieve_similar_embeddings/rows=" + std::to_string(rows) + "/dim=" + std::to_string(dim);
+            if (!selected(options, name)) continue;
+            sqlite3* db = build_corpus_db(rng, rows, dim);
+            if (!db) return 1;
+            std::vector<float> query = random_vector(rng, dim);
+            results.push_back(measure(name, options.min_seconds, [&] {
+                g_size_sink = retrieve_similar_embeddings(query, db).size();
+            }));
+            sqlite3_close(db);
+        }
+    }
+
+    // Reduced first-stage scan plus full-dimension re-rank of the best candidates.
+    // Truncation keeps setup cheap; a PCA projection of the same width scans the same bytes.
+    for (int reduced_dim : { 128, 256 }) {
+        std::string name = "retrieve_similar_embeddings/rows=10000/dim=1536/reduced=" + std::to_string(reduced_dim);
+        if (!selected(options, name)) continue;
+        sqlite3* db = build_corpus_db(rng, 10000, 1536);
+        if (!db) return 1;
+        if (!reduce_embeddings(db, reduced_dim, "truncate")) {
+            sqlite3_close(db);
+            continue;
+        }
+        std::vector<float> query = random_vector(rng, 1536);
+        results.push_back(measure(name, options.min_seconds, [&] {
+            g_size_sink = retrieve_similar_embeddings(query, db).size();
+        }));
+        sqlite3_close(db);
+    }
+
+    // Resident-index search over 500 documents of 40 paragraphs, scanning every
+    // row or only the paragraphs of the documents with the best centroids
+    for (size_t coarse : { 0, 25 }) {
+        std::string name = "search_vector_segments/rows=20000/dim=768/coarse=" + std::to_string(coarse);
+        if (!selected(options, name)) continue;
+        VectorIndex index;
+        index.dim = 768;
+        for (int i = 0; i < 20000; ++i) {
+            std::vector<float> row = random_vector(rng, index.dim);
+            float norm = 0.0f;
+            for (float value : row) {
+                norm += value * value;
+            }
+            index.ids.push_back(i + 1);
+            index.doc_ids.push_back(1 + i / 40);
+            index.vectors.insert(index.vectors.end(), row.begin(), row.end());
+            index.norms.push_back(std::sqrt(norm));
+        }
+        index_documents(index);
+        std::vector<VectorIndex> segments(1);
+        segments[0] = std::move(index);
+        std::vector<float> query = random_vector(rng, 768);
+        set_coarse_documents(coarse);
+        results.push_back(measure(name, options.min_seconds, [&] {
+            g_size_sink = search_vector_segments(segments, query, 10).size();
+        }));
+        set_coarse_documents(0);
+    }
+
+    // The same search through the binary prefilter: Hamming distances over the
+    // sign codes of all rows, then exact scores for the closest N
+    for (size_t candidates : { 500, 2000 }) {
+        std::string name = "search_vector_segments/rows=20000/dim=768/binary=" + std::to_string(candidates);
+        if (!selected(options, name)) continue;
+        VectorIndex index;
+        index.dim = 768;
+        for (int i = 0; i < 20000; ++i) {
+            std::vector<float> row = random_vector(rng, index.dim);
+            float norm = 0.0f;
+            for (float value : row) {
+                norm += value * value;
+            }
+            index.ids.push_back(i + 1);
+            index.doc_ids.push_back(1 + i / 40);
+            index.vectors.insert(index.vectors.end(), row.begin(), row.end());
+            index.norms.push_back(std::sqrt(norm));
+        }
+        index_documents(index);
+        std::vector<VectorIndex> segments(1);
+        segments[0] = std::move(index);
+        std::vector<float> query = random_vector(rng, 768);
+        results.push_back(measure(name, options.min_seconds, [&] {
+            g_size_sink = search_vector_segments_batch(segments, { query }, 10, candidates)[0].size();
+        }));
+    }
+
+    // The texts of a prompt's 5 paragraphs, out of 2000 CJK paragraphs of 150
+    // two-character words from a 3000-word vocabulary: stored inline, or
+    // packed and inflated from the blocks, or packed and served from the block cache
+    std::vector<std::wstring> vocabulary;
+    for (int i = 0; i < 3000; ++i) {
+        vocabulary.push_back(sample_cjk_text(rng, 2));
+    }
+    for (const char* layout : { "inline", "packed/inflate", "packed/cached" }) {
+        std::string name = std::string("get_texts_by_ids/") + layout;
+        if (!selected(options, name)) continue;
+        sqlite3* db = nullptr;
+        initialize_database(db, ":memory:");
+        if (!db) return 1;
+        for (int d = 0; d < 10; ++d) {
+            insert_document(db, L"doc_" + std::to_wstring(d) + L".txt");
+        }
+        sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+        std::uniform_int_distribution<size_t> word(0, vocabulary.size() - 1);
+        for (int i = 0; i < 2000; ++i) {
+            std::wstring paragraph;
+            for (int w = 0; w < 150; ++w) {
+                paragraph += vocabulary[word(rng)];
+            }
+            if (insert_embedding(db, 1 + i / 200, paragraph, random_vector(rng, 16)) < 0) {
+                std::cerr << "Failed to build the benchmark corpus; stopping." << std::endl;
+                sqlite3_close(db);
+                return 1;
+            }
+        }
+        sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+        bool packed = std::string(layout) != "inline";
+        if (packed) {
+            pack_stored_paragraphs(db);
+        }
+        bool inflate = std::string(layout) == "packed/inflate";
+        std::uniform_int_distribution<int> pick(1, 2000);
+        std::vector<int> ids;
+        for (int i = 0; i < 5; ++i) {
+            ids.push_back(pick(rng));
+        }
+        results.push_back(measure(name, options.min_seconds, [&] {
+            if (inflate) {
+                clear_text_block_cache();
+            }
+            g_size_sink = get_texts_by_ids(db, ids).size();
+        }));
+        sqlite3_close(db);
+    }
+
+    // Prompt assembly for top_k hits; the first call warms the paragraph cache
+    for (int top_k : { 5, 50 }) {
+        std::string name = "build_context/top_k=" + std::to_string(top_k);
+        if (!selected(options, name)) continue;
+        sqlite3* db = build_corpus_db(rng, 10000, 384);
+        if (!db) return 1;
+        std::vector<SimilarityResult> hits;
+        for (int i = 0; i < top_k; ++i) {
+            hits.push_back({ 1 + i * 97, 1 + i % 10, 0.0f });
+        }
+        std::wstring context;
+        std::wstring citations;
+        results.push_back(measure(name, options.min_seconds, [&] {
+            build_context(hits, db, top_k, 1 << 20, context, citations);
+            g_size_sink = context.size();
+        }));
+        sqlite3_close(db);
+    }
+
+    std::cout << std::left << std::setw(52) << "Benchmark"
+        << std::right << std::setw(14) << "ns/op"
+        << std::setw(14) << "bytes/op"
+        << std::setw(12) << "allocs/op"
+        << std::setw(14) << "iterations" << "\n";
+    std::cout << std::string(106, '-') << "\n";
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto& result : results) {
+        std::cout << std::left << std::setw(52) << result.name
+            << std::right << std::setw(14) << result.ns_per_op
+            << std::setw(14) << result.bytes_per_op
+            << std::setw(12) << result.allocs_per_op
+            << std::setw(14) << result.iterations << "\n";
+    }
+    std::cout << std::defaultfloat << std::flush;
+
+    if (!options.json_path.empty()) {
+        nlohmann::json report = nlohmann::json::array();
+        for (const auto& result : results) {
+            report.push_back({
+                {"name", result.name},
+                {"iterations", result.iterations},
+                {"ns_per_op", result.ns_per_op},
+                {"bytes_per_op", result.bytes_per_op},
+                {"allocs_per_op", result.allocs_per_op}
+            });
+        }
+        std::ofstream json_file(std::filesystem::path(options.json_path));
+        json_file << report.dump(2) << std::endl;
+    }
+
+    return 0;
+}
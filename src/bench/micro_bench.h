@@ -0,0 +1,18 @@
+#pragma once
+// micro_bench.h
+
+#ifndef MICRO_BENCH_H
+#define MICRO_BENCH_H
+
+#include <string>
+
+struct MicroBenchOptions {
+    std::string filter;         // Only run kernels whose name contains this
+    double min_seconds = 0.5;   // Minimum measured time per case
+    std::wstring json_path;     // Optional JSON report
+};
+
+// Run the hot-kernel microbenchmarks and print ns/op, bytes/op and allocations/op
+int run_micro_benchmarks(const MicroBenchOptions& options);
+
+#endif // MICRO_BENCH_H
@@ -0,0 +1,245 @@
+// mock_openai_server.cpp
+
+#include "mock_openai_server.h"
+#include <nlohmann/json.hpp>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+
+std::vector<float> mock_embedding(const std::string& text, int dim) {
+    // FNV-1a hash of the text seeds a xorshift generator
+    uint64_t state = 14695981039346656037ULL;
+    for (unsigned char c : text) {
+        state ^= c;
+        state *= 1099511628211ULL;
+    }
+    if (state == 0) state = 1;
+
+    std::vector<float> embedding(dim);
+    float norm = 0.0f;
+    for (int i = 0; i < dim; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        float value = static_cast<float>(static_cast<double>(state >> 11) / 9007199254740992.0) * 2.0f - 1.0f;
+        embedding[i] = value;
+        norm += value * value;
+    }
+
+    norm = std::sqrt(norm) + 1e-8f;
+    for (float& value : embedding) {
+        value /= norm;
+    }
+    return embedding;
+}
+
+std::string encode_embedding_base64(const std::vector<float>& embedding) {
+    static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string bytes;
+    bytes.reserve(embedding.size() * 4);
+    for (float value : embedding) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        for (int b = 0; b < 4; ++b) {
+            bytes += static_cast<char>((bits >> (8 * b)) & 0xFF);
+        }
+    }
+
+    std::string encoded;
+    encoded.reserve((bytes.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t chunk = static_cast<unsigned char>(bytes[i]) << 16;
+        if (i + 1 < bytes.size()) chunk |= static_cast<unsigned char>(bytes[i + 1]) << 8;
+        if (i + 2 < bytes.size()) chunk |= static_cast<unsigned char>(bytes[i + 2]);
+        encoded += alphabet[(chunk >> 18) & 0x3F];
+        encoded += alphabet[(chunk >> 12) & 0x3F];
+        encoded += i + 1 < bytes.size() ? alphabet[(chunk >> 6) & 0x3F] : '=';
+        encoded += i + 2 < bytes.size() ? alphabet[chunk & 0x3F] : '=';
+    }
+    return encoded;
+}
+
+MockOpenAIServer::MockOpenAIServer(const MockServerOptions& options)
+    : options_(options), rng_(options.seed) {
+}
+
+bool MockOpenAIServer::start() {
+    return server_.start(options_.port, [this](const HttpRequest& request) { return handle(request); });
+}
+
+void MockOpenAIServer::stop() {
+    server_.stop();
+}
+
+std::string MockOpenAIServer::base_url() const {
+    return "http://127.0.0.1:" + std::to_string(server_.port());
+}
+
+bool MockOpenAIServer::should_fail() {
+    if (options_.error_rate <= 0.0) return false;
+    std::lock_guard<std::mutex> lock(rng_mutex_);
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < options_.error_rate;
+}
+
+bool MockOpenAIServer::over_rate_limit(HttpResponse& response) {
+    if (options_.requests_per_second <= 0) return false;
+
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(rate_mutex_);
+    if (now - window_start_ >= std::chrono::seconds(1)) {
+        window_start_ = now;
+        window_requests_ = 0;
+    }
+    bool limited = window_requests_ >= options_.requests_per_second;
+    if (!limited) {
+        window_requests_++;
+    }
+
+    long long reset_ms = std::chrono::duration_cast<std::chrono::milliseconds>(window_start_ + std::chrono::seconds(1) - now).count();
+    response.headers["x-ratelimit-limit-requests"] = std::to_string(options_.requests_per_second);
+    response.headers["x-ratelimit-remaining-requests"] = std::to_string(options_.requests_per_second - window_requests_);
+    response.headers["x-ratelimit-reset-requests"] = std::to_string(reset_ms) + "ms";
+    if (limited) {
+        response.headers["retry-after-ms"] = std::to_string(reset_ms);
+    }
+    return limited;
+}
+
+HttpResponse MockOpenAIServer::handle(const HttpRequest& request) {
+    request_count_++;
+
+    HttpResponse rate_limit;
+    if (over_rate_limit(rate_limit)) {
+        rate_limited_count_++;
+        rate_limit.status = 429;
+        rate_limit.body = "{\"error\":{\"message\":\"Rate limit reached\",\"type\":\"requests\"}}";
+        return rate_limit;
+    }
+
+    if (options_.latency_ms > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(options_.latency_ms));
+    }
+
+    if (should_fail()) {
+        error_count_++;
+        HttpResponse response;
+        response.status = 500;
+        response.body = "{\"error\":{\"message\":\"Injected failure\",\"type\":\"server_error\"}}";
+        return response;
+    }
+
+    if (request.method == "POST" && request.path == "/v1/embeddings") {
+        HttpResponse response = handle_embeddings(request);
+        response.headers.insert(rate_limit.headers.begin(), rate_limit.headers.end());
+        return response;
+    }
+    if (request.method == "POST" && request.path == "/v1/chat/completions") {
+        HttpResponse response = handle_chat(request);
+        response.headers.insert(rate_limit.headers.begin(), rate_limit.headers.end());
+        return response;
+    }
+
+    HttpResponse response;
+    response.status = 404;
+    response.body = "{\"error\":{\"message\":\"Unknown endpoint\"}}";
+    return response;
+}
+
+HttpResponse MockOpenAIServer::handle_embeddings(const HttpRequest& request) {
+    HttpResponse response;
+    auto request_json = nlohmann::json::parse(request.body, nullptr, false);
+    if (request_json.is_discarded() || !request_json.contains("input")) {
+        response.status = 400;
+        response.body = "{\"error\":{\"message\":\"Invalid request body\"}}";
+        return response;
+    }
+
+    // The API accepts either a single string or an array of strings
+    std::vector<std::string> inputs;
+    if (request_json["input"].is_array()) {
+        inputs = request_json["input"].get<std::vector<std::string>>();
+    }
+    else {
+        inputs.push_back(request_json["input"].get<std::string>());
+    }
+
+    bool base64 = request_json.value("encoding_format", "float") == "base64";
+    nlohmann::json data = nlohmann::json::array();
+    size_t total_chars = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        std::vector<float> embedding = mock_embedding(inputs[i], options_.embedding_dim);
+        data.push_back({
+            {"object", "embedding"},
+            {"index", i},
+            {"embedding", base64 ? nlohmann::json(encode_embedding_base64(embedding)) : nlohmann::json(embedding)}
+        });
+        total_chars += inputs[i].size();
+    }
+
+    nlohmann::json response_json;
+    response_json["object"] = "list";
+    response_json["data"] = data;
+    response_json["model"] = request_json.value("model", "text-embedding-ada-002");
+    response_json["usage"] = { {"prompt_tokens", total_chars / 4}, {"total_tokens", total_chars / 4} };
+
+    response.body = response_json.dump();
+    return response;
+}
+
+HttpResponse MockOpenAIServer::handle_chat(const HttpRequest& request) {
+    HttpResponse response;
+    auto request_json = nlohmann::json::parse(request.body, nullptr, false);
+    if (request_json.is_discarded() || !request_json.contains("messages")) {
+        response.status = 400;
+        response.body = "{\"error\":{\"message\":\"Invalid request body\"}}";
+        return response;
+    }
+
+    std::string answer = "This is a mock answer based on the provided context [1].";
+    std::string model = request_json.value("model", "gpt-4");
+
+    if (request_json.value("stream", false)) {
+        // Split the answer into word-sized deltas sent as server-sent events
+        std::vector<std::string> tokens;
+        size_t start = 0;
+        while (start < answer.size()) {
+            size_t end = answer.find(' ', start + 1);
+            if (end == std::string::npos) end = answer.size();
+            tokens.push_back(answer.substr(start, end - start));
+            start = end;
+        }
+
+        int token_interval_ms = options_.token_interval_ms;
+        response.content_type = "text/event-stream";
+        response.stream = [tokens, model, token_interval_ms](const HttpChunkWriter& write) {
+            for (const auto& token : tokens) {
+                nlohmann::json chunk;
+                chunk["object"] = "chat.completion.chunk";
+                chunk["model"] = model;
+                chunk["choices"] = nlohmann::json::array({ {{"index", 0}, {"delta", {{"content", token}}}, {"finish_reason", nullptr}} });
+                if (!write("data: " + chunk.dump() + "\n\n")) return;
+                if (token_interval_ms > 0) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(token_interval_ms));
+                }
+            }
+            write("data: [DONE]\n\n");
+        };
+        return response;
+    }
+
+    nlohmann::json response_json;
+    response_json["object"] = "chat.completion";
+    response_json["model"] = model;
+    response_json["choices"] = nlohmann::json::array({
+        {
+            {"index", 0},
+            {"message", {{"role", "assistant"}, {"content", answer}}},
+            {"finish_reason", "stop"}
+        }
+    });
+
+    response.body = response_json.dump();
+    return response;
+}
@@ -0,0 +1,66 @@
+#pragma once
+// mock_openai_server.h
+
+#ifndef MOCK_OPENAI_SERVER_H
+#define MOCK_OPENAI_SERVER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include "http_server.h"
+
+struct MockServerOptions {
+    int port = 0;               // 0 picks a free port
+    int embedding_dim = 1536;
+    int latency_ms = 0;         // Added to every response
+    double error_rate = 0.0;    // Fraction of requests answered with HTTP 500
+    int token_interval_ms = 0;  // Delay between streamed chat tokens
+    int requests_per_second = 0;    // Answer requests over this rate with HTTP 429; 0 = unlimited
+    unsigned int seed = 42;
+};
+
+// Local stand-in for the OpenAI API implementing /v1/embeddings and
+// /v1/chat/completions, including "stream": true. Embeddings are
+// deterministic per input text so repeated runs rank the same paragraphs.
+class MockOpenAIServer {
+public:
+    explicit MockOpenAIServer(const MockServerOptions& options);
+
+    bool start();
+    void stop();
+
+    std::string base_url() const;
+    long long request_count() const { return request_count_; }
+    long long error_count() const { return error_count_; }
+    long long rate_limited_count() const { return rate_limited_count_; }
+
+private:
+    HttpResponse handle(const HttpRequest& request);
+    HttpResponse handle_embeddings(const HttpRequest& request);
+    HttpResponse handle_chat(const HttpRequest& request);
+    bool should_fail();
+    // Fixed one-second window; fills in the x-ratelimit-* headers either way
+    bool over_rate_limit(HttpResponse& response);
+
+    MockServerOptions options_;
+    HttpServer server_;
+    std::mutex rng_mutex_;
+    std::mt19937 rng_;
+    std::atomic<long long> request_count_{ 0 };
+    std::atomic<long long> error_count_{ 0 };
+    std::atomic<long long> rate_limited_count_{ 0 };
+    std::mutex rate_mutex_;
+    std::chrono::steady_clock::time_point window_start_;
+    int window_requests_ = 0;
+};
+
+// Deterministic unit-length pseudo-embedding derived from a hash of the text
+std::vector<float> mock_embedding(const std::string& text, int dim);
+
+// Little-endian float32 bytes in base64, as the API returns for "encoding_format": "base64"
+std::string encode_embedding_base64(const std::vector<float>& embedding);
+
+#endif // MOCK_OPENAI_SERVER_H
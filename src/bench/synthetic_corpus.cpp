@@ -0,0 +1,120 @@
+// synthetic_corpus.cpp
+
+#include "synthetic_corpus.h"
+#include "encoding_utils.h"
+#include <random>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <cwctype>
+
+namespace {
+
+const wchar_t* const ENGLISH_SYLLABLES[] = {
+    L"ka", L"ro", L"mi", L"ten", L"sa", L"lo", L"ver", L"pa", L"dis", L"un",
+    L"con", L"tra", L"ble", L"ing", L"ment", L"pro", L"re", L"de", L"ex", L"ion"
+};
+
+// Common CJK Unified Ideographs live near the start of the block
+wchar_t random_cjk_char(std::mt19937& rng) {
+    return static_cast<wchar_t>(std::uniform_int_distribution<int>(0x4E00, 0x4FFF)(rng));
+}
+
+std::wstring random_cjk_paragraph(std::mt19937& rng) {
+    std::wstring paragraph;
+    int sentences = std::uniform_int_distribution<int>(2, 5)(rng);
+    for (int s = 0; s < sentences; ++s) {
+        int clauses = std::uniform_int_distribution<int>(1, 3)(rng);
+        for (int c = 0; c < clauses; ++c) {
+            int chars = std::uniform_int_distribution<int>(6, 16)(rng);
+            for (int i = 0; i < chars; ++i) {
+                paragraph += random_cjk_char(rng);
+            }
+            paragraph += (c + 1 < clauses) ? L'\xFF0C' : L'\x3002';
+        }
+    }
+    return paragraph;
+}
+
+std::wstring random_english_word(std::mt19937& rng) {
+    std::uniform_int_distribution<size_t> pick(0, sizeof(ENGLISH_SYLLABLES) / sizeof(ENGLISH_SYLLABLES[0]) - 1);
+    int syllables = std::uniform_int_distribution<int>(1, 3)(rng);
+    std::wstring word;
+    for (int i = 0; i < syllables; ++i) {
+        word += ENGLISH_SYLLABLES[pick(rng)];
+    }
+    return word;
+}
+
+std::wstring random_english_paragraph(std::mt19937& rng) {
+    std::wstring paragraph;
+    int sentences = std::uniform_int_distribution<int>(2, 5)(rng);
+    for (int s = 0; s < sentences; ++s) {
+        int words = std::uniform_int_distribution<int>(6, 18)(rng);
+        for (int i = 0; i < words; ++i) {
+            std::wstring word = random_english_word(rng);
+            if (i == 0) word[0] = static_cast<wchar_t>(towupper(word[0]));
+            paragraph += word;
+            paragraph += (i + 1 < words) ? L" " : L". ";
+        }
+    }
+    return paragraph;
+}
+
+} // namespace
+
+CorpusInfo generate_corpus(const std::wstring& out_dir, const CorpusOptions& options) {
+    CorpusInfo info;
+    std::filesystem::create_directories(out_dir);
+
+    std::mt19937 rng(options.seed);
+    size_t chunks_per_file = options.chunks_per_file > 0 ? options.chunks_per_file : 1000;
+    size_t written = 0;
+    size_t file_index = 0;
+
+    while (written < options.chunks) {
+        std::filesystem::path file_path = std::filesystem::path(out_dir) / (L"corpus_" + std::to_wstring(file_index++) + L".txt");
+        std::ofstream file(file_path, std::ios::binary);
+        if (!file) {
+            std::wcerr << L"Cannot create corpus file: " << file_path.wstring() << std::endl;
+            break;
+        }
+
+        for (size_t i = 0; i < chunks_per_file && written < options.chunks; ++i, ++written) {
+            std::wstring paragraph = options.cjk ? random_cjk_paragraph(rng) : random_english_paragraph(rng);
+            std::string line = wstring_to_utf8(paragraph) + "\n";
+            file.write(line.data(), line.size());
+            info.total_bytes += line.size();
+        }
+
+        info.file_paths.push_back(file_path.wstring());
+    }
+
+    return info;
+}
+
+std::vector<std::wstring> generate_queries(size_t count, bool cjk, unsigned int seed) {
+    std::mt19937 rng(seed);
+    std::vector<std::wstring> queries;
+    queries.reserve(count);
+
+    for (size_t q = 0; q < count; ++q) {
+        std::wstring query;
+        if (cjk) {
+            int chars = std::uniform_int_distribution<int>(6, 14)(rng);
+            for (int i = 0; i < chars; ++i) {
+                query += random_cjk_char(rng);
+            }
+            query += L'\xFF1F';
+        }
+        else {
+            int words = std::uniform_int_distribution<int>(4, 10)(rng);
+            for (int i = 0; i < words; ++i) {
+                query += random_english_word(rng) + ((i + 1 < words) ? L" " : L"?");
+            }
+        }
+        queries.push_back(query);
+    }
+
+    return queries;
+}
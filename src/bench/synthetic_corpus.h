@@ -0,0 +1,29 @@
+#pragma once
+// synthetic_corpus.h
+
+#ifndef SYNTHETIC_CORPUS_H
+#define SYNTHETIC_CORPUS_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+struct CorpusOptions {
+    size_t chunks = 1000;           // Total paragraphs across all files
+    size_t chunks_per_file = 1000;
+    bool cjk = true;                // CJK or English text
+    unsigned int seed = 42;
+};
+
+struct CorpusInfo {
+    std::vector<std::wstring> file_paths;
+    size_t total_bytes = 0;
+};
+
+// Write a synthetic corpus of one-paragraph-per-line .txt files into out_dir
+CorpusInfo generate_corpus(const std::wstring& out_dir, const CorpusOptions& options);
+
+// Generate query strings in the same language as the corpus
+std::vector<std::wstring> generate_queries(size_t count, bool cjk, unsigned int seed);
+
+#endif // SYNTHETIC_CORPUS_H
@@ -0,0 +1,25 @@
+#pragma once
+// answer_cache.h
+
+#ifndef ANSWER_CACHE_H
+#define ANSWER_CACHE_H
+
+#include <string>
+#include <vector>
+#include "sqlite3.h"
+#include "vector_index.h"
+
+// A cached answer is reused when the new query's context is built from exactly
+// the same chunks, in the same order, and its embedding is at least threshold-similar
+// to the cached query's. Entries are dropped by database triggers when any
+// cited chunk is deleted or rewritten, and the oldest ones when storing an
+// answer takes the cache past max_entries.
+void configure_answer_cache(bool enabled, float threshold, size_t max_entries);
+
+bool lookup_cached_answer(sqlite3* db, const std::vector<float>& query_embedding, const std::vector<SimilarityResult>& hits,
+    std::wstring& answer, std::wstring& citations);
+
+void store_cached_answer(sqlite3* db, const std::wstring& user_query, const std::vector<float>& query_embedding,
+    const std::vector<SimilarityResult>& hits, const std::wstring& answer, const std::wstring& citations);
+
+#endif // ANSWER_CACHE_H
@@ -9,13 +9,36 @@
 
 struct ProgramOptions {
     bool embed = false;
-    std::vector<std::wstring> file_paths;
+    bool watch = false;
+    std::vector<std::wstring> file_paths;   // Embedded by --embed, kept in sync by --watch
     bool query = false;
     std::wstring user_query;
     bool delete_docs = false;
     std::vector<int> doc_ids_to_delete;
     bool list_docs = false;
     bool monitor_progress = false;
+    bool serve = false;
+    int server_port = 8765;         // Port used by --serve and by --query to reach a running server
+    bool no_server = false;         // Answer --query in-process even if a server is running
+    bool answer_cache = true;
+    float cache_threshold = 0.95f;  // Minimum query similarity for reusing a cached answer
+    int cache_entries = 10000;      // Most cached answers kept; the oldest go first
+    int context_tokens = 3000;      // Token budget for retrieved paragraphs in the prompt
+    bool profile = false;           // Print per-stage timings when the command finishes
+    int shard_count = 0;            // Shards for a new database; 0 = whatever the database already uses
+    std::vector<std::wstring> shard_dirs;   // Where new shard files go, round-robin
+    bool reduce = false;
+    int reduce_dim = 0;             // Reduced search dimension; 0 turns reduction off
+    std::wstring reduce_method = L"pca";    // "pca" or "truncate"
+    bool resume = false;
+    int max_concurrency = 16;       // Upper bound on API requests in flight per endpoint
+    bool embedding_base64 = true;   // Request base64 rather than decimal embeddings
+    bool export_snapshot = false;
+    bool import_snapshot = false;
+    std::wstring snapshot_path;     // Written by --export-snapshot, read by --import-snapshot and --serve --snapshot
+    float dedup_threshold = 0.0f;   // Minimum MinHash similarity for linking a near-duplicate paragraph; 0 = off
+    int coarse_documents = 0;       // Documents whose paragraphs a search scores after ranking centroids; 0 = all
+    int binary_candidates = -1;     // Rows a search scores exactly after the Hamming prefilter; 0 = off, -1 = not given
 };
 ProgramOptions parse_arguments(int argc, wchar_t* argv[]);
 
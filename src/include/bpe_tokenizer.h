@@ -0,0 +1,53 @@
+#pragma once
+// bpe_tokenizer.h
+
+#ifndef BPE_TOKENIZER_H
+#define BPE_TOKENIZER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// Byte-level BPE tokenizer for cl100k-style vocabularies (the .tiktoken
+// format: one "base64-token rank" pair per line). Text is split with the
+// cl100k pre-tokenization rules, then each piece is merged by rank.
+class BpeTokenizer {
+public:
+    bool load(const std::string& vocab_path);
+    bool loaded() const { return !slots_.empty(); }
+
+    size_t count_tokens(std::string_view text) const;
+    void encode(std::string_view text, std::vector<int>& tokens) const;
+
+private:
+    struct Slot {
+        uint64_t prefix = 0;        // First eight bytes, zero padded; decides most probes
+        uint32_t offset = 0;
+        uint32_t length = 0;        // 0 marks an empty slot
+        int rank = -1;
+    };
+
+    // Rank of a byte sequence, or -1 when it is not in the vocabulary
+    int rank_of(const char* bytes, size_t length) const;
+    void insert(const std::string& bytes, int rank);
+
+    // Merge one pre-tokenized piece; appends token ranks when tokens is not null
+    size_t merge_piece(const char* piece, size_t length, std::vector<int>* tokens) const;
+    size_t merge_long_piece(const char* piece, size_t length, std::vector<int>* tokens) const;
+
+    std::string arena_;             // All vocabulary byte strings back to back
+    std::vector<Slot> slots_;       // Open-addressed merge-rank table
+    uint64_t mask_ = 0;
+    int shift_ = 64;
+};
+
+// Token counts with the process-wide tokenizer, loaded on first use from
+// ./dict/cl100k_base.tiktoken. Without that file the counts are estimated.
+size_t count_tokens(std::string_view utf8_text);
+size_t count_tokens(const std::wstring& text);
+
+// Whether counts are exact, i.e. the vocabulary file was found
+bool bpe_vocabulary_loaded();
+
+#endif // BPE_TOKENIZER_H
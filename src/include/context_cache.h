@@ -0,0 +1,26 @@
+#pragma once
+// context_cache.h
+
+#ifndef CONTEXT_CACHE_H
+#define CONTEXT_CACHE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "sqlite3.h"
+#include "vector_index.h"
+
+// Paragraph text, its BPE token count and source file name for one search hit
+struct ContextEntry {
+    std::shared_ptr<const std::wstring> text;
+    size_t token_count = 0;
+    std::shared_ptr<const std::wstring> file_name;
+};
+
+// Resolve every hit to its text and file name. Hot paragraphs and documents
+// come from a process-wide LRU cache; the misses are fetched with one batched
+// query per table. The cache is dropped whenever the database changes.
+// Hits whose rows no longer exist get empty strings.
+void fetch_context_entries(sqlite3* db, const std::vector<SimilarityResult>& hits, std::vector<ContextEntry>& entries);
+
+#endif // CONTEXT_CACHE_H
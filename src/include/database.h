@@ -6,13 +6,39 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include "sqlite3.h"
 
-void initialize_database(sqlite3*& db);
+void initialize_database(sqlite3*& db, const char* db_path = "embeddings.db");
 
-int insert_document(sqlite3* db, const std::wstring& file_name);
+// Size and modification time of a file when it was embedded; a file whose
+// version differs has changed since
+struct FileVersion {
+    long long size = 0;
+    long long modified = 0;
 
-void insert_embedding(sqlite3* db, int doc_id, const std::wstring& text, const std::vector<float>& embedding);
+    bool operator==(const FileVersion& other) const { return size == other.size && modified == other.modified; }
+    bool operator!=(const FileVersion& other) const { return !(*this == other); }
+};
+
+// file_path (normalized, see normalize_path) and version are recorded so
+// --watch can tell which documents a file change affects
+int insert_document(sqlite3* db, const std::wstring& file_name, const std::wstring& file_path = L"",
+    const FileVersion& version = FileVersion());
+
+// Documents embedded from a recorded path
+struct StoredFile {
+    int doc_id;
+    std::wstring file_path;
+    FileVersion version;
+};
+std::vector<StoredFile> get_stored_files(sqlite3* db);
+
+// Point a document at the new path of its renamed file, without re-embedding it
+bool move_document(sqlite3* db, int doc_id, const std::wstring& file_path);
+
+// Returns the new embedding id, or -1
+int insert_embedding(sqlite3* db, int doc_id, const std::wstring& text, const std::vector<float>& embedding);
 
 void delete_documents(const std::vector<int>& doc_ids, sqlite3* db);
 
@@ -22,8 +48,45 @@ std::wstring get_text_by_id(sqlite3* db, int id);
 
 std::wstring get_document_info(sqlite3* db, int doc_id);
 
+// Batched forms of the two lookups above: one query for the whole id list.
+// Ids with no matching row are absent from the result.
+std::unordered_map<int, std::wstring> get_texts_by_ids(sqlite3* db, const std::vector<int>& ids);
+std::unordered_map<int, std::wstring> get_document_infos(sqlite3* db, const std::vector<int>& doc_ids);
+
+// Stored full-dimension embeddings by embedding id, looked up in the owning shards
+std::unordered_map<int, std::vector<float>> get_embeddings_by_ids(sqlite3* db, const std::vector<int>& ids);
+
+// PRAGMA data_version: changes whenever another connection commits, e.g. an
+// --embed or --delete run while a server has the database open
+int get_data_version(sqlite3* db);
+
+// Changes whenever this process writes to documents or embeddings; together
+// with get_data_version it tells whether rows read earlier may be stale
+int get_content_generation();
+
 void insert_progress(sqlite3* db, int doc_id, int total_paragraphs, int paragraphs_processed, const std::string& status);
 void update_progress(sqlite3* db, int doc_id, int paragraphs_processed);
 void update_progress_status(sqlite3* db, int doc_id, const std::string& status);
+void advance_progress(sqlite3* db, int doc_id, int paragraphs);
+
+// Paragraphs waiting in the persisted embedding queue
+struct QueuedParagraph {
+    int id;
+    int doc_id;
+    std::wstring text;
+    int attempts;       // Runs that already failed to embed it
+};
+
+// Queue a file's paragraphs in one commit; returned in paragraph order, or
+// empty when the queue could not be written
+std::vector<QueuedParagraph> enqueue_paragraphs(sqlite3* db, int doc_id, const std::vector<std::wstring>& paragraphs);
+std::vector<QueuedParagraph> get_queued_paragraphs(sqlite3* db);
+int count_queued_paragraphs(sqlite3* db, int doc_id);
+void dequeue_paragraphs(sqlite3* db, const std::vector<int>& queue_ids);
+void record_paragraph_failure(sqlite3* db, int queue_id, const std::string& error);
+
+// Whether the paragraph was already stored, embedded or as a link to a near-duplicate,
+// e.g. by a run interrupted before it dequeued it
+bool has_embedding(sqlite3* db, int doc_id, const std::wstring& text);
 
 #endif // DATABASE_H
@@ -0,0 +1,35 @@
+#pragma once
+// document_centroids.h
+
+#ifndef DOCUMENT_CENTROIDS_H
+#define DOCUMENT_CENTROIDS_H
+
+#include <vector>
+#include <cstddef>
+#include "sqlite3.h"
+
+// Document-level summary vectors for coarse-to-fine retrieval. The shard
+// holding a document's embeddings keeps, in document_centroids, the sum of
+// their normalized vectors and how many there are; its direction is the
+// document centroid. Ingestion adds to the sum as paragraphs are stored,
+// deleting any of the document's embeddings drops the row, and documents
+// without one are summed from their stored rows again.
+
+// Register vector_sum(a, b), the element-wise sum of two float blobs, on a
+// connection; initialize_database does this for every database and shard
+void register_vector_functions(sqlite3* db);
+
+// Add the normalized embeddings of paragraphs just stored for doc_id (their
+// sum, and how many) to the document's centroid
+void add_to_document_centroid(sqlite3* primary, int doc_id, const std::vector<float>& sum, int paragraphs);
+
+// Sum the stored embeddings of documents that have no centroid yet, e.g.
+// rows written before centroids existed, imported, or partly deleted.
+// Returns the number of documents summed.
+size_t build_missing_document_centroids(sqlite3* primary);
+
+// The n stored documents whose centroids are most similar to query, best
+// first. Empty when there are no more than n, i.e. nothing would be pruned.
+std::vector<int> rank_stored_documents(sqlite3* primary, const std::vector<float>& query, size_t n);
+
+#endif // DOCUMENT_CENTROIDS_H
@@ -5,14 +5,52 @@
 #define DOCUMENT_MANAGER_H
 
 #include <string>
+#include <vector>
+#include <functional>
 #include "sqlite3.h"
+#include "vector_index.h"
+
+// Score every stored embedding against the query, sorted by descending
+// similarity. The shards of a split database are scanned in parallel.
+std::vector<SimilarityResult> retrieve_similar_embeddings(const std::vector<float>& query_embedding, sqlite3* db);
 
 void embed_file(const std::wstring& file_path, const std::string& api_key, sqlite3* db);
 
+// Embed files and directories, after first finishing any queued paragraphs
 void process_paths(const std::vector<std::wstring>& paths, const std::string& api_key, sqlite3* db);
 
+// Keep the documents embedded from files and directories in sync with them
+// until the process is killed: an initial crawl embeds new and changed files
+// and deletes documents whose file is gone, then file system notifications
+// (debounced per path) drive the same for every later change. Renamed files
+// keep their embeddings.
+void watch_paths(const std::vector<std::wstring>& paths, const std::string& api_key, sqlite3* db);
+
+// Embed the paragraphs earlier runs left in the embedding queue, because they
+// were interrupted or the API kept failing. Stored paragraphs without a
+// near-duplicate signature are signed, and documents without a centroid
+// summed, first.
+void resume_embedding_queue(sqlite3* db, const std::string& api_key);
+
 void generate_answer(const std::wstring& user_query, const std::string& api_key, sqlite3* db);
 
+// Token budget for the paragraphs packed into a prompt (default 3000)
+void set_context_token_budget(size_t tokens);
+size_t context_token_budget();
+
+// Pack the first max_chunks ranked paragraphs, best first, into a numbered
+// prompt context with matching citations. A paragraph that would overflow
+// token_budget is skipped in favour of later, shorter ones. Returns the hits
+// that made it into the context.
+std::vector<SimilarityResult> build_context(const std::vector<SimilarityResult>& results, sqlite3* db, int max_chunks,
+    size_t token_budget, std::wstring& context, std::wstring& citations);
+
+// Retrieve context for the query and stream the answer through on_token.
+// Searches the resident per-shard segments when given, otherwise scans the
+// database. Returns false when no context could be retrieved.
+bool answer_query(const std::wstring& user_query, const std::string& api_key, sqlite3* db, const std::vector<VectorIndex>* segments,
+    const std::function<void(const std::wstring&)>& on_token, std::wstring& citations);
+
 void monitor_progress(sqlite3* db);
 
 #endif // DOCUMENT_MANAGER_H
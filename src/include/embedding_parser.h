@@ -0,0 +1,99 @@
+#pragma once
+// embedding_parser.h
+
+#ifndef EMBEDDING_PARSER_H
+#define EMBEDDING_PARSER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Incremental parser for /v1/embeddings response bodies. Bytes are fed in
+// arbitrary slices straight from the curl write callback; no copy of the body
+// or JSON tree is built. Only the path data[].{index, embedding} is tracked:
+// numbers are converted with std::from_chars and "encoding_format": "base64"
+// strings (little-endian float32) are decoded as they stream past, in both
+// cases directly into the caller's output vectors.
+class EmbeddingResponseParser {
+public:
+    // outputs[i] receives the embedding whose "index" is i
+    EmbeddingResponseParser(std::vector<float>* outputs, size_t count);
+
+    void feed(const char* data, size_t size);
+
+    // True when a complete response with a "data" array was parsed. On
+    // failure every output is cleared, so no half-received row is used.
+    bool finish();
+
+    // Forget everything received so far, e.g. before a retried request
+    void reset();
+
+    // Start of the body, for reporting an error response or malformed input
+    const std::string& excerpt() const { return excerpt_; }
+
+    // curl CURLOPT_WRITEFUNCTION; CURLOPT_WRITEDATA is the parser
+    static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userp);
+
+private:
+    enum class Role : uint8_t { Other, Root, DataArray, Item, EmbeddingArray };
+    enum class Key : uint8_t { Other, Data, Index, Embedding };
+    enum class State : uint8_t { Value, String, Number, Literal };
+
+    struct Frame {
+        Role role;
+        bool is_object;
+        bool expect_key;
+        Key key;
+    };
+
+    static const size_t max_tracked_depth = 16;
+    static const size_t max_number_length = 40;
+
+    const char* parse_row_numbers(const char* p, const char* end);
+    const char* decode_row_base64(const char* p, const char* end);
+    size_t parse_number(const char* p, const char* end);
+    void number_value(const char* first, const char* last);
+    void string_char(char c);
+    void string_end();
+    bool open_container(bool is_object);
+    bool close_container(bool is_object);
+    void begin_row();
+    void end_item();
+    void fail() { failed_ = true; }
+
+    std::vector<float>* outputs_;
+    size_t count_;
+
+    State state_ = State::Value;
+    Frame frames_[max_tracked_depth];
+    size_t depth_ = 0;
+    bool escape_ = false;
+
+    // Strings: a short key being matched, or a base64 row being decoded
+    bool string_is_key_ = false;
+    bool string_is_row_ = false;
+    char key_[16];
+    size_t key_length_ = 0;
+    uint32_t bits_ = 0;
+    int bit_count_ = 0;
+    uint32_t float_bytes_ = 0;
+    int float_byte_count_ = 0;
+
+    // A number split across two slices
+    char number_[max_number_length];
+    size_t number_length_ = 0;
+
+    // The current data[] item. Its index may come after its embedding (keys
+    // are unordered), in which case the row is parsed into pending_ first.
+    long long item_index_ = -1;
+    size_t item_ordinal_ = 0;
+    std::vector<float>* row_ = nullptr;
+    std::vector<float> pending_;
+
+    bool saw_data_ = false;
+    bool failed_ = false;
+    std::string excerpt_;
+};
+
+#endif // EMBEDDING_PARSER_H
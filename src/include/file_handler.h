@@ -10,8 +10,14 @@ std::wstring read_text_file(const std::wstring& file_path);
 
 std::wstring extract_text_from_pdf(const std::wstring& pdf_path);
 
+// Same, from the file already read into memory (see FileReader)
+std::wstring extract_text_from_pdf_data(const std::string& data, const std::wstring& pdf_path);
+
 //std::wstring extract_text_from_image(const std::wstring& image_path);
 
 std::wstring get_file_extension(const std::wstring& file_path);
 
+// Absolute, lexically normalized form of a path, as recorded for embedded files
+std::wstring normalize_path(const std::wstring& path);
+
 #endif // FILE_HANDLER_H
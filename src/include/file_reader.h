@@ -0,0 +1,102 @@
+#pragma once
+// file_reader.h
+
+#ifndef FILE_READER_H
+#define FILE_READER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+class ThreadPool;
+
+// A whole file read ahead by FileReader
+struct FileContents {
+    std::wstring path;
+    std::string data;           // Pooled buffer; hand it back with FileReader::release
+    long long size = 0;         // Size and last write time from before the read, as
+    long long modified = 0;     // std::filesystem reports them (see FileVersion)
+    bool read = false;          // False when the file was too large to read ahead or could not be read
+};
+
+// Files above this size are left for the extractor to read itself
+const size_t max_read_ahead_bytes = 64 * 1024 * 1024;
+
+// Bytes of file data a FileReader holds at most by default, from the moment
+// a read starts until the buffer comes back through release
+const size_t read_ahead_budget_bytes = 256 * 1024 * 1024;
+
+// Reads many files at once ahead of the code that extracts their text, so a
+// directory of small files on network or spinning storage keeps the device
+// busy instead of waiting on one open, stat and read at a time. On Linux the
+// reads go through io_uring when the kernel allows it; elsewhere, or when it
+// does not, depth threads block in them. Files come out in the order given,
+// and at most depth of them are being read or waiting to be taken. Together
+// with the files taken but not released, they hold at most budget_bytes: a
+// read waits until its file fits, unless it is the next one due and only
+// files behind it stand in the way.
+class FileReader {
+public:
+    explicit FileReader(size_t depth, size_t budget_bytes = read_ahead_budget_bytes);
+    // Waits for the reads in flight; files not taken yet are dropped
+    ~FileReader();
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    // Start reading the files; call once
+    void start(std::vector<std::wstring> paths);
+
+    // The next file in order, once it has been read. Several threads may call
+    // this; each gets a different file. Returns false after the last one.
+    bool next(FileContents& file);
+
+    // Return a file's buffer, at the size next() gave it, once its text has
+    // been extracted; this frees its share of the budget for a later read
+    void release(std::string&& buffer);
+
+    bool uses_io_uring() const { return ring_ != nullptr; }
+
+private:
+    std::string acquire_buffer();
+    void recycle(std::string&& buffer);
+    bool fits_budget(size_t index, size_t size) const;
+    void deliver(size_t index, FileContents&& file, size_t reserved);
+    void issue_blocking_reads();
+    void read_blocking(size_t index);
+
+    size_t depth_;
+    size_t budget_bytes_;
+    std::vector<std::wstring> paths_;
+    std::unordered_map<size_t, FileContents> ready_;   // Read and waiting for next()
+    size_t issued_ = 0;         // Files whose read has started
+    size_t claimed_ = 0;        // Files a next() call has picked, maybe still waiting for them
+    size_t taken_ = 0;          // Files next() has returned
+    std::set<size_t> unread_;   // Files issued and not delivered yet
+    size_t held_bytes_ = 0;     // Reserved for reads, or in buffers not released yet
+    size_t ready_bytes_ = 0;    // The part of held_bytes_ in ready_
+    std::vector<std::string> free_buffers_;
+    std::mutex mutex_;
+    std::condition_variable file_ready_;
+    std::condition_variable file_taken_;      // Also when a buffer is released
+    bool stopping_ = false;
+
+    std::unique_ptr<ThreadPool> pool_;      // Blocking reads
+#ifdef __linux__
+    struct Ring;
+    void ring_loop();
+
+    std::unique_ptr<Ring> ring_;            // io_uring reads, submitted and reaped on ring_thread_
+    std::thread ring_thread_;
+#else
+    void* ring_ = nullptr;
+#endif
+};
+
+#endif // FILE_READER_H
@@ -0,0 +1,72 @@
+#pragma once
+// file_watcher.h
+
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+// Every regular file under roots (files among the roots are taken as they
+// are) for which accept returns true. Directories are listed in parallel on
+// threads workers, which keeps a crawl of network or spinning storage from
+// waiting on one directory listing at a time.
+std::vector<std::wstring> crawl_files(const std::vector<std::wstring>& roots,
+    const std::function<bool(const std::wstring&)>& accept, size_t threads);
+
+// Whether path is root or lies inside it; both normalized
+bool path_is_within(const std::wstring& path, const std::wstring& root);
+
+// Change notifications for files and directories under a set of roots:
+// inotify on Linux, ReadDirectoryChangesW on Windows. The watcher only says
+// which paths changed (created, written, deleted, or moved from or to); the
+// caller looks at the file system to find out what happened to them.
+class FileWatcher {
+public:
+    FileWatcher() = default;
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    // Roots that are files are watched through their directory. Returns
+    // false when notifications are unavailable on this platform.
+    bool start(const std::vector<std::wstring>& roots);
+    void stop();
+
+    // Wait up to timeout for changes and append the paths that changed.
+    // Returns false when events were lost (queue overflow), after which the
+    // caller has to rescan the roots.
+    bool wait(std::chrono::milliseconds timeout, std::vector<std::wstring>& changed);
+
+private:
+    bool accepted(const std::wstring& path) const;
+
+    std::vector<std::wstring> roots_;
+    std::vector<std::wstring> root_files_;     // Roots that are files, reported alone from their directory
+#ifdef _WIN32
+    void reader_loop(size_t directory);
+
+    std::vector<void*> directories_;           // One handle per watched directory
+    std::vector<std::wstring> directory_paths_;
+    std::vector<std::thread> readers_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::vector<std::wstring> pending_;        // Filled by the readers, drained by wait()
+    bool overflowed_ = false;
+#else
+    void add_watches(const std::wstring& directory, bool recursive);
+
+    int fd_ = -1;
+    std::unordered_map<int, std::wstring> watches_;    // Watch descriptor -> directory
+#endif
+};
+
+#endif // FILE_WATCHER_H
@@ -0,0 +1,68 @@
+#pragma once
+// http_server.h
+
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include <string>
+#include <map>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+struct HttpRequest {
+    std::string method;
+    std::string path;
+    std::map<std::string, std::string> headers; // Header names are lower-cased
+    std::string body;
+};
+
+// Writes one slice of a streamed body; returns false once the client has gone away
+using HttpChunkWriter = std::function<bool(const std::string& data)>;
+
+struct HttpResponse {
+    int status = 200;
+    std::string content_type = "application/json";
+    std::map<std::string, std::string> headers; // Extra response headers
+    std::string body;
+    // When set, the body is produced incrementally through the writer instead of
+    // being sent from body, and the connection is closed to mark its end.
+    std::function<void(const HttpChunkWriter& write)> stream;
+};
+
+using HttpHandler = std::function<HttpResponse(const HttpRequest&)>;
+
+// Minimal blocking HTTP/1.1 server bound to the loopback interface.
+// Every connection is served on its own thread and closed after one response.
+// Requests are limited in size, peers that stall are dropped after a timeout
+// and connections beyond a fixed number are turned away with 503, so stop()
+// does not wait on idle clients. Exceptions from the handler, including its
+// stream callback, become a 500 when nothing has been sent yet.
+class HttpServer {
+public:
+    HttpServer() = default;
+    ~HttpServer();
+
+    HttpServer(const HttpServer&) = delete;
+    HttpServer& operator=(const HttpServer&) = delete;
+
+    // Pass port 0 to let the OS pick a free port, then read it back with port().
+    bool start(int port, HttpHandler handler);
+    void stop();
+
+    int port() const { return port_; }
+
+private:
+    void accept_loop();
+    void handle_connection(std::intptr_t client);
+
+    HttpHandler handler_;
+    std::intptr_t listen_socket_ = -1;
+    int port_ = 0;
+    std::atomic<bool> running_{ false };
+    std::atomic<int> active_connections_{ 0 };
+    std::thread accept_thread_;
+};
+
+#endif // HTTP_SERVER_H
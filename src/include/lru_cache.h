@@ -0,0 +1,62 @@
+#pragma once
+// lru_cache.h
+
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <cstddef>
+
+// Fixed-capacity map that evicts the least recently used entry. Not
+// synchronized; callers guard it with their own lock.
+template <typename Key, typename Value>
+class LruCache {
+public:
+    explicit LruCache(size_t capacity) : capacity_(capacity) {}
+
+    // Copy the cached value into value and mark it most recently used
+    bool get(const Key& key, Value& value) {
+        auto it = lookup_.find(key);
+        if (it == lookup_.end()) {
+            return false;
+        }
+        entries_.splice(entries_.begin(), entries_, it->second);
+        value = it->second->second;
+        return true;
+    }
+
+    void put(const Key& key, Value value) {
+        auto it = lookup_.find(key);
+        if (it != lookup_.end()) {
+            it->second->second = std::move(value);
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return;
+        }
+
+        if (capacity_ == 0) return;
+        if (entries_.size() >= capacity_) {
+            lookup_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+        entries_.emplace_front(key, std::move(value));
+        lookup_[key] = entries_.begin();
+    }
+
+    void clear() {
+        entries_.clear();
+        lookup_.clear();
+    }
+
+    size_t size() const { return entries_.size(); }
+
+private:
+    using Entry = std::pair<Key, Value>;
+
+    size_t capacity_;
+    std::list<Entry> entries_;     // Most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator> lookup_;
+};
+
+#endif // LRU_CACHE_H
@@ -0,0 +1,71 @@
+#pragma once
+// metrics.h
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+// Pipeline stages with a latency histogram each
+enum class Stage {
+    FileRead,
+    PdfExtract,
+    Chunking,
+    Tokenize,
+    EmbeddingHttp,
+    DbInsert,
+    NearDuplicateCheck,     // MinHash signature and LSH lookup per paragraph
+    VectorSearch,
+    ContextFetch,
+    LlmCall,
+    Count
+};
+
+enum class Counter {
+    BytesRead,              // File bytes read for embedding
+    HttpBytesReceived,
+    Chunks,                 // Paragraphs embedded and stored
+    EmbeddingRequests,
+    ChatRequests,
+    HttpErrors,
+    Retries,
+    AnswerCacheHits,
+    AnswerCacheMisses,
+    ContextCacheHits,
+    ContextCacheMisses,
+    NearDuplicates,         // Paragraphs linked to an embedded copy instead of embedded
+    Count
+};
+
+// Both are a handful of relaxed atomic adds: no allocation, no lock
+void record_stage(Stage stage, uint64_t nanoseconds);
+void add_counter(Counter counter, uint64_t delta = 1);
+
+// Records the time between construction and destruction against a stage
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage) : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+    ~StageTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        record_stage(stage_, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    Stage stage_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Prometheus text exposition format, histograms in seconds
+std::string metrics_prometheus();
+
+std::string metrics_json();
+
+// Human-readable per-stage breakdown for --profile
+void print_profile();
+
+#endif // METRICS_H
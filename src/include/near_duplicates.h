@@ -0,0 +1,86 @@
+#pragma once
+// near_duplicates.h
+
+#ifndef NEAR_DUPLICATES_H
+#define NEAR_DUPLICATES_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <cstdint>
+#include "sqlite3.h"
+#include "vector_index.h"
+
+// Near-duplicate paragraphs (revised versions, mirrored copies, templated
+// reports) are found with MinHash over jieba word 3-shingles. Each stored
+// embedding keeps its signature in its shard, indexed by LSH band keys, so a
+// new paragraph only compares against rows sharing a band. A paragraph at or
+// above the similarity threshold is recorded in near_duplicates (primary) as
+// a link to the existing row instead of being embedded again.
+
+const size_t minhash_size = 64;
+const size_t minhash_bands = 16;    // Of minhash_size / minhash_bands rows each
+
+using MinHashSignature = std::array<uint32_t, minhash_size>;
+
+MinHashSignature minhash_signature(const std::wstring& text);
+
+// Estimated Jaccard similarity of the two shingle sets
+double minhash_similarity(const MinHashSignature& a, const MinHashSignature& b);
+
+// Minimum estimated similarity for a link; 0, the default, turns detection off,
+// both when embedding and when deduplicating query results
+void set_near_duplicate_threshold(double threshold);
+double near_duplicate_threshold();
+
+// Signatures held in memory, for the paragraphs of one batch or the hits of one query
+class MinHashIndex {
+public:
+    void add(int key, const MinHashSignature& signature);
+
+    // Key of the most similar entry at or above threshold, or -1
+    int find(const MinHashSignature& signature, double threshold, double* similarity = nullptr) const;
+
+private:
+    std::vector<std::pair<int, MinHashSignature>> entries_;
+    std::unordered_multimap<int64_t, size_t> bands_;
+};
+
+// Record the signatures of stored embeddings in their shards, with one
+// statement per table and shard
+struct StoredSignature {
+    int id;
+    int doc_id;
+    MinHashSignature signature;
+};
+void insert_minhash_signatures(sqlite3* primary, const std::vector<StoredSignature>& rows);
+
+// The stored embedding most similar to signature at or above threshold, or
+// false when there is none
+struct NearDuplicateMatch {
+    int id = -1;
+    int doc_id = -1;
+    double similarity = 0.0;
+};
+bool find_stored_near_duplicate(sqlite3* primary, const MinHashSignature& signature, double threshold, NearDuplicateMatch& match);
+
+// Sign the stored embeddings that have no signature yet, e.g. rows written
+// before detection existed or by an import. Returns how many were signed.
+size_t sign_stored_paragraphs(sqlite3* primary);
+
+// Record a paragraph of doc_id as a copy of an embedded one
+bool link_near_duplicate(sqlite3* primary, int doc_id, const std::wstring& text, const NearDuplicateMatch& match);
+
+// Links whose embedded paragraph belongs to one of doc_ids are moved back to
+// the embedding queue of their own document, so deleting the original does
+// not take the copies with it. Returns the number of paragraphs re-queued.
+size_t requeue_near_duplicates_of(sqlite3* primary, const std::vector<int>& doc_ids);
+
+// Stored signatures by embedding id; ids without one are absent
+std::unordered_map<int, MinHashSignature> get_minhash_signatures(sqlite3* primary, const std::vector<int>& ids);
+
+// Documents holding a linked copy of each embedding, by embedding id
+std::unordered_map<int, std::vector<int>> get_near_duplicate_documents(sqlite3* primary, const std::vector<int>& ids);
+
+#endif // NEAR_DUPLICATES_H
@@ -6,9 +6,32 @@
 
 #include <string>
 #include <vector>
+#include <functional>
 
 std::vector<float> get_embedding(const std::wstring& text, const std::string& api_key);
 
+// Extract the first embedding from an /v1/embeddings response body (float
+// arrays or base64)
+std::vector<float> parse_embedding_response(const std::string& response_body);
+
+// Embed several texts with a single request. The result has one entry per
+// input, in input order; entries that failed are empty.
+std::vector<std::vector<float>> get_embeddings(const std::vector<std::wstring>& texts, const std::string& api_key);
+
+std::vector<std::vector<float>> parse_embeddings_response(const std::string& response_body, size_t count);
+
 std::wstring generate_answer_from_context(const std::wstring& context, const std::wstring& question, const std::string& api_key);
 
+// Request the completion with "stream": true and call on_token for each delta as it arrives.
+// Returns the full answer once the stream ends.
+std::wstring generate_answer_from_context_stream(const std::wstring& context, const std::wstring& question, const std::string& api_key,
+    const std::function<void(const std::wstring&)>& on_token);
+
+// Ask for "encoding_format": "base64" embeddings (default) or decimal float arrays.
+// Responses in either form are accepted.
+void set_embedding_encoding(bool base64);
+
+// Override the API base URL (defaults to OPENAI_API_BASE or https://api.openai.com)
+void set_api_base_url(const std::string& base_url);
+
 #endif // OPENAI_API_H
@@ -0,0 +1,100 @@
+#pragma once
+// query_scheduler.h
+
+#ifndef QUERY_SCHEDULER_H
+#define QUERY_SCHEDULER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include "sqlite3.h"
+#include "vector_index.h"
+#include "thread_pool.h"
+
+struct QuerySchedulerOptions {
+    size_t scan_threads = 0;        // Batch embedding + scan workers; 0 = one per core
+    size_t answer_threads = 32;     // Concurrent chat completions
+    int batch_window_ms = 5;        // How long the first query of a batch waits for others
+    size_t max_batch_size = 32;
+    int top_k = 20;                 // Candidates packed into the context token budget
+};
+
+// One answer being generated. Every caller that asks the same question while
+// it is in flight shares the execution and sees the same token stream.
+class QueryExecution {
+public:
+    // Replay tokens produced so far, then follow new ones until the answer is
+    // complete. Returns false when no context could be retrieved.
+    bool follow(const std::function<void(const std::wstring&)>& on_token, std::wstring& citations);
+
+private:
+    friend class QueryScheduler;
+
+    void append_token(const std::wstring& token);
+    void finish(bool success, const std::wstring& citations);
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::vector<std::wstring> tokens_;
+    std::wstring citations_;
+    bool done_ = false;
+    bool success_ = false;
+};
+
+// Runs queries from many clients concurrently. Queries arriving within the
+// batch window are embedded with one API request and scored in one blocked
+// pass over each shard's index segment, the segments searched in parallel;
+// identical in-flight queries collapse into one execution. Each query picks
+// its own binary prefilter (see set_binary_candidates); a batch makes one
+// pass per setting among its queries.
+class QueryScheduler {
+public:
+    QueryScheduler(sqlite3* db, const std::string& api_key, const std::vector<VectorIndex>& segments, std::shared_mutex& index_mutex,
+        const QuerySchedulerOptions& options);
+    ~QueryScheduler();
+
+    QueryScheduler(const QueryScheduler&) = delete;
+    QueryScheduler& operator=(const QueryScheduler&) = delete;
+
+    std::shared_ptr<QueryExecution> submit(const std::wstring& query, size_t binary_candidates);
+
+private:
+    struct PendingQuery {
+        std::wstring query;
+        size_t binary_candidates;
+        std::shared_ptr<QueryExecution> execution;
+    };
+
+    void batch_loop();
+    void run_batch(std::vector<PendingQuery> batch);
+    void run_answer(const PendingQuery& pending, const std::vector<float>& embedding, const std::vector<SimilarityResult>& results);
+    void complete(const PendingQuery& pending, bool success, const std::wstring& citations);
+
+    sqlite3* db_;
+    std::string api_key_;
+    const std::vector<VectorIndex>& segments_;
+    std::shared_mutex& index_mutex_;
+    QuerySchedulerOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable pending_changed_;
+    std::vector<PendingQuery> pending_;
+    std::chrono::steady_clock::time_point first_pending_time_;
+    std::map<std::pair<std::wstring, size_t>, std::shared_ptr<QueryExecution>> in_flight_;
+    bool stopping_ = false;
+
+    // Declared so that scan tasks, which hand work to the answer pool, are
+    // drained before the answer pool goes away
+    ThreadPool answer_pool_;
+    ThreadPool scan_pool_;
+    std::thread batch_thread_;
+};
+
+#endif // QUERY_SCHEDULER_H
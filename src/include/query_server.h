@@ -0,0 +1,26 @@
+#pragma once
+// query_server.h
+
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include <string>
+#include "sqlite3.h"
+
+// Load the embeddings into memory once and answer queries over HTTP on the
+// loopback interface until the process is killed.
+//   POST /query   {"query": "..."}  ->  text/event-stream of {"token"} events,
+//                                       then one {"citations"} event and [DONE];
+//                                       "binary_candidates": N picks the binary
+//                                       prefilter for this query (0 = off)
+//   GET  /health                    ->  {"status": "ok", "vectors": N}
+// With a snapshot_path, shards the snapshot still matches are loaded from it
+// instead of being scanned.
+int run_query_server(sqlite3* db, const std::string& api_key, int port, const std::wstring& snapshot_path = L"");
+
+// Forward a query to a running server and print the streamed answer.
+// Returns false without printing anything when no server is listening.
+// Binary_candidates, unless negative, picks the server's binary prefilter for the query.
+bool query_via_server(const std::wstring& user_query, int port, int binary_candidates = -1);
+
+#endif // QUERY_SERVER_H
@@ -0,0 +1,73 @@
+#pragma once
+// request_scheduler.h
+
+#ifndef REQUEST_SCHEDULER_H
+#define REQUEST_SCHEDULER_H
+
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstddef>
+
+// Rate-limit state reported in the headers of an API response. Fields the
+// response did not carry stay negative.
+struct RateLimitHeaders {
+    long remaining_requests = -1;
+    long remaining_tokens = -1;
+    double reset_requests_seconds = -1.0;
+    double reset_tokens_seconds = -1.0;
+    double retry_after_seconds = -1.0;
+
+    // Feed one raw "Name: value\r\n" header line as curl delivers it
+    void parse_header_line(const char* line, size_t length);
+};
+
+// Admission control for one API endpoint. The number of requests in flight
+// is capped by a window that grows by one per window of successes and halves
+// on a 429 or 503 (AIMD), and every request waits out the pause a 429's
+// Retry-After or an exhausted x-ratelimit-remaining-* header asks for.
+class RequestScheduler {
+public:
+    RequestScheduler(double initial_window, size_t max_window);
+
+    RequestScheduler(const RequestScheduler&) = delete;
+    RequestScheduler& operator=(const RequestScheduler&) = delete;
+
+    // Block until the window has room and any pause has passed
+    void acquire();
+
+    // Report how the request admitted by acquire() ended; status 0 means a transport error
+    void release(long status, const RateLimitHeaders& headers);
+
+    void set_max_window(size_t max_window);
+    double window() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    double window_;
+    size_t max_window_;
+    size_t in_flight_ = 0;
+    std::chrono::steady_clock::time_point paused_until_;
+    std::chrono::steady_clock::time_point last_decrease_;
+};
+
+enum class ApiEndpoint { Embeddings, Chat };
+
+// Process-wide scheduler per endpoint; the provider limits each model separately
+RequestScheduler& api_request_scheduler(ApiEndpoint endpoint);
+
+// Cap on concurrent requests per endpoint (default 16); also the number of
+// paragraphs a file keeps in flight while embedding
+void set_max_concurrent_requests(size_t max_requests);
+size_t max_concurrent_requests();
+
+// Attempts per request before it is reported as failed
+const int max_request_attempts = 6;
+
+// Delay before retry number attempt (1-based): jittered exponential backoff
+// from 0.5 s up to 30 s, or the server's Retry-After when it gave one
+std::chrono::milliseconds retry_delay(int attempt, double retry_after_seconds);
+
+#endif // REQUEST_SCHEDULER_H
@@ -0,0 +1,52 @@
+#pragma once
+// shards.h
+
+#ifndef SHARDS_H
+#define SHARDS_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include "sqlite3.h"
+
+// A database can be split into shards, each a separate SQLite file with its
+// own connection and write lock. The primary database (shard 0) keeps the
+// documents, progress and answer cache tables plus the shard layout; the
+// embeddings of document d live in shard d % shard_count, and embedding ids
+// are allocated so that id % shard_count names the shard holding the row.
+// A database opened without a layout is its own single shard.
+
+// Open the layout recorded in the primary database. When there is none yet
+// and shard_count > 1, create one on the (still empty) database: shard files
+// are named embeddings.shardK.db and spread round-robin over shard_dirs,
+// defaulting to the primary's directory. shard_count 0 accepts any layout.
+bool open_shards(sqlite3* primary, int shard_count, const std::vector<std::wstring>& shard_dirs);
+
+// Close the connections opened by open_shards, leaving the primary open
+void close_shards(sqlite3* primary);
+
+size_t shard_count(sqlite3* primary);
+
+// Every shard connection, the primary first
+std::vector<sqlite3*> shard_connections(sqlite3* primary);
+
+// Shard holding a document's embeddings or an embedding row
+size_t shard_index(sqlite3* primary, int id);
+sqlite3* shard_for_id(sqlite3* primary, int id);
+
+// Sum of PRAGMA data_version over all shards: changes when another
+// connection commits to any of them
+int shards_data_version(sqlite3* primary);
+
+// Threads writing through the same connection hold its lock for each write,
+// and from BEGIN to COMMIT or ROLLBACK for a transaction: a statement another
+// thread ran in between would become part of the open transaction, and be
+// undone with it. Recursive, so a transaction can call the other writers.
+std::unique_lock<std::recursive_mutex> lock_connection(sqlite3* db);
+
+// Run task(0) .. task(count - 1) on the shard worker pool and wait for all of
+// them. A single task runs inline on the calling thread.
+void run_on_shards(size_t count, const std::function<void(size_t)>& task);
+
+#endif // SHARDS_H
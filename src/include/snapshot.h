@@ -0,0 +1,35 @@
+#pragma once
+// snapshot.h
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "sqlite3.h"
+#include "vector_index.h"
+
+// Index snapshots: the documents with their progress, every shard's
+// embedding matrix with ids, norms and texts, and the projection with its
+// reduced vectors, in one versioned file. Sections are 64-byte aligned in the
+// layout VectorIndex uses and carry checksums that are verified before
+// anything is read from the memory-mapped file.
+
+// Write a snapshot of the whole (possibly sharded) database. Each shard is
+// read inside one transaction; the file appears under path only once complete.
+bool export_snapshot(sqlite3* primary, const std::wstring& path);
+
+// Restore a snapshot into an empty database, e.g. on a new replica. The
+// stored vectors and reduced vectors are inserted as they are; nothing is
+// re-embedded. Embedding ids are kept unless the shard count differs.
+bool import_snapshot(sqlite3* primary, const std::wstring& path);
+
+// Fill segments (one per shard) straight from a snapshot instead of scanning
+// the database. Only shards whose embeddings are unchanged since the
+// snapshot was written, and only when it holds the same projection, are
+// filled; the result says which.
+std::vector<bool> load_segments_from_snapshot(sqlite3* primary, const std::wstring& path,
+    const std::shared_ptr<const VectorProjection>& projection, std::vector<VectorIndex>& segments);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,38 @@
+#pragma once
+// sse_parser.h
+
+#ifndef SSE_PARSER_H
+#define SSE_PARSER_H
+
+#include <string>
+#include <functional>
+#include <cstddef>
+
+// Incremental parser for text/event-stream bodies. Bytes can be fed in
+// arbitrary slices as they arrive from the network; the callback is invoked
+// with the data payload of every complete event.
+class SseParser {
+public:
+    using EventCallback = std::function<void(const std::string& data)>;
+
+    explicit SseParser(EventCallback on_event);
+
+    void feed(const char* data, size_t size);
+
+    // Dispatch a trailing event that was not terminated by a blank line
+    void finish();
+
+    size_t event_count() const { return event_count_; }
+
+private:
+    void process_line(const std::string& line);
+    void dispatch();
+
+    EventCallback on_event_;
+    std::string line_buffer_;
+    std::string data_buffer_;
+    bool has_data_ = false;
+    size_t event_count_ = 0;
+};
+
+#endif // SSE_PARSER_H
@@ -9,6 +9,9 @@
 
 std::wstring tokenize_text(const std::wstring& text);
 
+// The jieba words of text (accurate mode) as UTF-8, spaces included
+std::vector<std::string> split_words(const std::wstring& text);
+
 std::vector<std::wstring> split_paragraphs(const std::wstring& text);
 
 #endif // TEXT_PROCESSING_H
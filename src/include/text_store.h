@@ -0,0 +1,47 @@
+#pragma once
+// text_store.h
+
+#ifndef TEXT_STORE_H
+#define TEXT_STORE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include "sqlite3.h"
+
+// Compressed paragraph text. A paragraph is stored inline in paragraphs.text
+// when it is embedded; once its document is finished, its paragraphs are
+// packed into blocks of up to text_block_bytes (deflate, primed with a
+// dictionary trained on the paragraphs of the same database file) and the
+// row records the block and the paragraph's byte range in it. Blocks never
+// change and are dropped with their last paragraph. Reads go through the
+// paragraph_texts view, which inflates blocks through a process-wide cache.
+
+// Raw bytes of paragraph text packed into one block; inflating one takes
+// around 20 us, while doubling it saves only 2% of the compressed size
+const size_t text_block_bytes = 4 * 1024;
+
+// Register block_text(block_id, offset, length), which paragraph_texts reads
+// packed paragraphs through; initialize_database does this for every database
+// and shard
+void register_text_functions(sqlite3* db);
+
+// A dictionary of at most capacity bytes for compressing text like samples:
+// the fragments that recur across most samples, the most useful last
+std::string train_text_dictionary(const std::vector<std::string>& samples, size_t capacity);
+
+// Raw deflate primed with dictionary (which may be empty)
+std::string compress_text_block(const std::string& raw, const std::string& dictionary);
+bool decompress_text_block(const void* data, size_t size, size_t raw_size, const std::string& dictionary, std::string& raw);
+
+// Pack the inline paragraphs of one document, after its paragraphs are stored
+void pack_document_texts(sqlite3* primary, int doc_id);
+
+// Pack every inline paragraph in all shards, e.g. rows stored before text
+// was compressed, or imported. Returns the number of paragraphs packed.
+size_t pack_stored_paragraphs(sqlite3* primary);
+
+// Forget the inflated blocks, so the next reads inflate them again (benchmarks)
+void clear_text_block_cache();
+
+#endif // TEXT_STORE_H
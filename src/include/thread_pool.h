@@ -0,0 +1,45 @@
+#pragma once
+// thread_pool.h
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstddef>
+
+// Fixed-size pool of worker threads executing submitted tasks in FIFO order
+class ThreadPool {
+public:
+    // Pass 0 to use one thread per hardware core
+    explicit ThreadPool(size_t thread_count);
+    // Finishes every queued task before joining the workers
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+    // Block until the queue is empty and no task is running
+    void wait_idle();
+
+    size_t size() const { return workers_.size(); }
+
+private:
+    void worker_loop();
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable task_available_;
+    std::condition_variable idle_;
+    size_t running_ = 0;
+    bool stopping_ = false;
+};
+
+#endif // THREAD_POOL_H
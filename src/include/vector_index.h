@@ -0,0 +1,104 @@
+#pragma once
+// vector_index.h
+
+#ifndef VECTOR_INDEX_H
+#define VECTOR_INDEX_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "sqlite3.h"
+
+struct VectorProjection;
+
+struct SimilarityResult {
+    int id;
+    int doc_id;
+    float similarity;
+};
+
+// Rows [begin, end) of a VectorIndex, all belonging to doc_id
+struct DocumentRange {
+    int doc_id;
+    size_t begin;
+    size_t end;
+};
+
+// All stored embeddings held in memory as one contiguous row-major matrix,
+// with norms precomputed so a query only pays for the dot products. Rows are
+// grouped by document, and each document has a normalized centroid of its
+// rows for coarse-to-fine searches. Every row also has a binary code, the sign
+// of each dimension packed into 64-bit words (192 bytes for 1536 dimensions),
+// for the Hamming prefilter.
+struct VectorIndex {
+    int dim = 0;
+    std::vector<int> ids;
+    std::vector<int> doc_ids;
+    std::vector<float> vectors;     // ids.size() * dim floats
+    std::vector<float> norms;
+    std::vector<DocumentRange> documents;
+    std::vector<float> centroids;   // documents.size() * dim floats
+    std::vector<uint64_t> codes;    // ids.size() * code_words() words
+    std::shared_ptr<const VectorProjection> projection;    // Set when vectors are reduced copies
+
+    size_t size() const { return ids.size(); }
+    const float* row(size_t i) const { return vectors.data() + i * dim; }
+    const float* centroid(size_t d) const { return centroids.data() + d * dim; }
+    size_t code_words() const { return (static_cast<size_t>(dim) + 63) / 64; }
+    const uint64_t* code(size_t i) const { return codes.data() + i * code_words(); }
+};
+
+// Coarse-to-fine retrieval: when set above 0, searches first rank documents by
+// centroid and only score the paragraphs of the best n, as long as there are
+// more than n documents. Larger values trade speed for recall.
+void set_coarse_documents(size_t n);
+size_t coarse_documents();
+
+// Binary prefilter: when set above 0, searches rank the rows by the Hamming
+// distance between their codes and the query's and only score the closest n
+// exactly, as long as there are more than n rows. It takes the place of the
+// coarse-to-fine step. Larger values trade speed for recall.
+void set_binary_candidates(size_t n);
+size_t binary_candidates();
+
+// Sign bits of a vector, packed as in VectorIndex::codes
+std::vector<uint64_t> binary_code(const std::vector<float>& vector);
+
+// Indexes of the n rows with the smallest Hamming distances (each at most
+// dim), in row order; ties at the cutoff go to the earlier rows
+std::vector<size_t> closest_rows(const std::vector<uint32_t>& distances, int dim, size_t n);
+
+// Load every row of the embeddings table, or of reduced_embeddings when a
+// projection is given. Rows whose dimension differs from the first row are
+// skipped with a warning.
+bool load_vector_index(sqlite3* db, VectorIndex& index, std::shared_ptr<const VectorProjection> projection = nullptr);
+
+// Group the rows of an index filled elsewhere (e.g. from a snapshot) by
+// document and compute the document centroids and row codes; load_vector_index
+// does this itself
+void index_documents(VectorIndex& index);
+
+// Return the top_k most similar rows, sorted by descending similarity
+std::vector<SimilarityResult> search_vector_index(const VectorIndex& index, const std::vector<float>& query, size_t top_k);
+
+// Search several queries in one pass over the matrix. Rows are visited in
+// cache-sized blocks and scored against every query before moving on, so the
+// corpus streams through memory once per batch instead of once per query.
+std::vector<std::vector<SimilarityResult>> search_vector_index_batch(const VectorIndex& index,
+    const std::vector<std::vector<float>>& queries, size_t top_k);
+
+// Scatter-gather over one index segment per shard: the segments are searched
+// in parallel and their results merged into one top_k list per query. With
+// coarse_documents set, the best documents are chosen across all segments first.
+// The binary prefilter is the default from set_binary_candidates unless the
+// call gives its own candidates (0 = off), which are shared out among the
+// segments by size.
+std::vector<std::vector<SimilarityResult>> search_vector_segments_batch(const std::vector<VectorIndex>& segments,
+    const std::vector<std::vector<float>>& queries, size_t top_k);
+std::vector<std::vector<SimilarityResult>> search_vector_segments_batch(const std::vector<VectorIndex>& segments,
+    const std::vector<std::vector<float>>& queries, size_t top_k, size_t candidates);
+std::vector<SimilarityResult> search_vector_segments(const std::vector<VectorIndex>& segments,
+    const std::vector<float>& query, size_t top_k);
+
+#endif // VECTOR_INDEX_H
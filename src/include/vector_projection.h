@@ -0,0 +1,61 @@
+#pragma once
+// vector_projection.h
+
+#ifndef VECTOR_PROJECTION_H
+#define VECTOR_PROJECTION_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "sqlite3.h"
+#include "vector_index.h"
+
+// Optional first-stage dimension reduction. Each embedding gets a short,
+// normalized copy in reduced_embeddings (same shard, same id); searches scan
+// those and re-rank the best candidates against the full stored embeddings.
+struct VectorProjection {
+    std::string method;             // "pca" or "truncate"
+    int input_dim = 0;
+    int output_dim = 0;
+    std::vector<float> mean;        // input_dim floats (pca)
+    std::vector<float> components;  // output_dim rows of input_dim floats (pca)
+    int version = 0;                // Bumped every time the projection is replaced
+};
+
+// First-stage candidates re-ranked at full dimension per query
+const size_t rerank_candidates = 100;
+
+// The projection recorded in the primary database, or null when embeddings
+// are searched at full dimension
+std::shared_ptr<const VectorProjection> load_projection(sqlite3* primary);
+
+// Same, loaded once per process; used on the insert path
+std::shared_ptr<const VectorProjection> active_projection(sqlite3* primary);
+
+// Project and normalize one full-dimension vector. Returns an empty vector
+// when the dimension does not match the projection.
+std::vector<float> project_vector(const VectorProjection& projection, const std::vector<float>& vector);
+
+// Train a projection to output_dim ("pca": principal components of a sample
+// of stored embeddings; "truncate": Matryoshka-style prefix) without recording
+// it. Returns null, after reporting why, when that is not possible.
+std::shared_ptr<const VectorProjection> train_projection(sqlite3* primary, int output_dim, const std::string& method);
+
+// Train a projection to output_dim (as train_projection), record it and
+// rebuild reduced_embeddings in every shard. output_dim 0 turns reduction off.
+bool reduce_embeddings(sqlite3* primary, int output_dim, const std::string& method);
+
+// Re-score candidates with the stored full-dimension embeddings and keep the best top_k
+std::vector<SimilarityResult> rerank_full_dimension(sqlite3* primary, const std::vector<float>& query,
+    const std::vector<SimilarityResult>& candidates, size_t top_k);
+
+// Top_k hits per query over the resident segments. When the segments hold
+// reduced vectors, the queries are projected for the scan and the first
+// rerank_candidates hits re-ranked at full dimension. Binary_candidates, when
+// given, picks the binary prefilter as for search_vector_segments_batch.
+std::vector<std::vector<SimilarityResult>> search_segments_reranked(sqlite3* primary, const std::vector<VectorIndex>& segments,
+    const std::vector<std::vector<float>>& queries, size_t top_k);
+std::vector<std::vector<SimilarityResult>> search_segments_reranked(sqlite3* primary, const std::vector<VectorIndex>& segments,
+    const std::vector<std::vector<float>>& queries, size_t top_k, size_t binary_candidates);
+
+#endif // VECTOR_PROJECTION_H
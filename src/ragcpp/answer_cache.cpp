@@ -0,0 +1,146 @@
+// answer_cache.cpp
+
+#include "answer_cache.h"
+#include "encoding_utils.h"
+#include "utils.h"
+#include "metrics.h"
+#include "shards.h"
+#include <iostream>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+
+static std::atomic<bool> g_answer_cache_enabled{ true };
+static std::atomic<float> g_answer_cache_threshold{ 0.95f };
+static std::atomic<size_t> g_answer_cache_max_entries{ 10000 };
+
+void configure_answer_cache(bool enabled, float threshold, size_t max_entries) {
+    g_answer_cache_enabled = enabled;
+    g_answer_cache_threshold = threshold;
+    g_answer_cache_max_entries = max_entries;
+}
+
+// Ordered, comma-separated ids of the chunks the context is built from
+static std::string chunk_key(const std::vector<SimilarityResult>& hits) {
+    std::string key;
+    for (size_t i = 0; i < hits.size(); ++i) {
+        if (i > 0) key += ',';
+        key += std::to_string(hits[i].id);
+    }
+    return key;
+}
+
+bool lookup_cached_answer(sqlite3* db, const std::vector<float>& query_embedding, const std::vector<SimilarityResult>& hits,
+    std::wstring& answer, std::wstring& citations) {
+    if (!g_answer_cache_enabled || hits.empty()) {
+        return false;
+    }
+
+    const char* select_sql = "SELECT query_embedding, answer, citations FROM answer_cache WHERE chunk_ids = ?;";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, select_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+
+    std::string key = chunk_key(hits);
+    sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+
+    // Same context: take the closest cached query above the threshold
+    float best_similarity = g_answer_cache_threshold;
+    bool found = false;
+    std::vector<float> cached_embedding;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        int num_floats = sqlite3_column_bytes(stmt, 0) / static_cast<int>(sizeof(float));
+        if (num_floats != static_cast<int>(query_embedding.size())) continue;
+
+        cached_embedding.resize(num_floats);
+        memcpy(cached_embedding.data(), sqlite3_column_blob(stmt, 0), num_floats * sizeof(float));
+
+        float similarity = cosine_similarity(query_embedding, cached_embedding);
+        if (similarity >= best_similarity) {
+            best_similarity = similarity;
+            found = true;
+            answer = utf8_to_wstring(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
+            citations = utf8_to_wstring(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)));
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    add_counter(found ? Counter::AnswerCacheHits : Counter::AnswerCacheMisses);
+    return found;
+}
+
+void store_cached_answer(sqlite3* db, const std::wstring& user_query, const std::vector<float>& query_embedding,
+    const std::vector<SimilarityResult>& hits, const std::wstring& answer, const std::wstring& citations) {
+    if (!g_answer_cache_enabled || hits.empty() || answer.empty()) {
+        return;
+    }
+
+    // Server workers share one connection; the transaction and
+    // sqlite3_last_insert_rowid below must not interleave between them
+    auto lock = lock_connection(db);
+    sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+
+    const char* insert_sql = "INSERT INTO answer_cache (query, query_embedding, chunk_ids, answer, citations) VALUES (?, ?, ?, ?, ?);";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, insert_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return;
+    }
+
+    std::string utf8_query = wstring_to_utf8(user_query);
+    std::string key = chunk_key(hits);
+    std::string utf8_answer = wstring_to_utf8(answer);
+    std::string utf8_citations = wstring_to_utf8(citations);
+
+    sqlite3_bind_text(stmt, 1, utf8_query.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_blob(stmt, 2, query_embedding.data(), static_cast<int>(query_embedding.size() * sizeof(float)), SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, key.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 4, utf8_answer.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 5, utf8_citations.c_str(), -1, SQLITE_TRANSIENT);
+
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        std::cerr << "Failed to cache answer: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return;
+    }
+    sqlite3_int64 cache_id = sqlite3_last_insert_rowid(db);
+
+    // One row per cited chunk so the invalidation triggers can find the entry
+    const char* link_sql = "INSERT INTO answer_cache_chunks (cache_id, chunk_id) VALUES (?, ?);";
+    rc = sqlite3_prepare_v2(db, link_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return;
+    }
+
+    for (size_t i = 0; i < hits.size(); ++i) {
+        sqlite3_bind_int64(stmt, 1, cache_id);
+        sqlite3_bind_int(stmt, 2, hits[i].id);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    // Keep the newest max_entries answers; the entry_deleted trigger drops
+    // the chunk rows of the pruned ones
+    const char* prune_sql = "DELETE FROM answer_cache WHERE id IN (SELECT id FROM answer_cache ORDER BY id DESC LIMIT -1 OFFSET ?);";
+    rc = sqlite3_prepare_v2(db, prune_sql, -1, &stmt, nullptr);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(g_answer_cache_max_entries.load()));
+        rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+    if (rc != SQLITE_DONE) {
+        std::cerr << "Failed to prune the answer cache: " << sqlite3_errmsg(db) << std::endl;
+    }
+
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+}
@@ -12,6 +12,59 @@
 #include <algorithm>
 #include <cstdlib>
 
+// Helper function to parse a TCP port number or exit with an error
+static int parse_port(const std::wstring& port_str) {
+    try {
+        int port = std::stoi(port_str);
+        if (port > 0 && port < 65536) {
+            return port;
+        }
+    }
+    catch (const std::exception&) {
+    }
+    std::wcerr << L"Invalid port: " << port_str << std::endl;
+    exit(1);
+}
+
+static float parse_threshold(const std::wstring& threshold_str, const wchar_t* what) {
+    try {
+        float threshold = std::stof(threshold_str);
+        if (threshold >= 0.0f && threshold <= 1.0f) {
+            return threshold;
+        }
+    }
+    catch (const std::exception&) {
+    }
+    std::wcerr << L"Invalid " << what << L": " << threshold_str << std::endl;
+    exit(1);
+}
+
+static int parse_positive_int(const std::wstring& value_str, const wchar_t* what) {
+    try {
+        int value = std::stoi(value_str);
+        if (value > 0) {
+            return value;
+        }
+    }
+    catch (const std::exception&) {
+    }
+    std::wcerr << L"Invalid " << what << L": " << value_str << std::endl;
+    exit(1);
+}
+
+static int parse_non_negative_int(const std::wstring& value_str, const wchar_t* what) {
+    try {
+        int value = std::stoi(value_str);
+        if (value >= 0) {
+            return value;
+        }
+    }
+    catch (const std::exception&) {
+    }
+    std::wcerr << L"Invalid " << what << L": " << value_str << std::endl;
+    exit(1);
+}
+
 ProgramOptions parse_arguments(int argc, wchar_t* argv[]) {
     ProgramOptions options;
 
@@ -25,10 +78,32 @@ ProgramOptions parse_arguments(int argc, wchar_t* argv[]) {
             std::wcout << L"Usage: RAGSystem [options]\n"
                 L"Options:\n"
                 L"  -e, --embed FILE_OR_DIR [FILE_OR_DIR...]  Embed files or directories\n"
+                L"  -w, --watch FILE_OR_DIR [FILE_OR_DIR...]  Embed files or directories and keep them in sync as they change\n"
                 L"  -d, --delete ID [ID...]                   Delete documents\n"
                 L"  -q, --query QUERY                         Query and generate an answer\n"
                 L"  -l, --list                                List existing documents\n"
                 L"  -m, --monitor                             Monitor embedding progress\n"
+                L"  -s, --serve [PORT]                        Keep the index loaded and answer queries over HTTP\n"
+                L"  -r, --resume                              Embed the paragraphs earlier runs left queued\n"
+                L"      --reduce DIM                          Search DIM-dimensional copies of the embeddings, re-ranking at full dimension (0 = off)\n"
+                L"      --export-snapshot FILE                Write the documents, vectors and texts to a checksummed snapshot file\n"
+                L"      --import-snapshot FILE                Restore a snapshot into an empty database\n"
+                L"  -p, --port PORT                           Server port for --serve and --query (default 8765)\n"
+                L"      --no-server                           Answer --query in-process without contacting a server\n"
+                L"      --cache-threshold T                   Reuse a cached answer for queries this similar (0-1, default 0.95)\n"
+                L"      --no-cache                            Neither reuse nor store cached answers\n"
+                L"      --cache-entries N                     Most cached answers kept, oldest dropped first (default 10000)\n"
+                L"      --max-concurrency N                   Most API requests in flight per endpoint (default 16)\n"
+                L"      --embedding-format base64|float       Encoding requested for embeddings (default base64)\n"
+                L"      --context-tokens N                    Token budget for retrieved paragraphs (default 3000)\n"
+                L"      --profile                             Print a per-stage timing breakdown at exit (implies --no-server)\n"
+                L"      --shards N                            Split a new database into N shard files\n"
+                L"      --shard-dir DIR                       Directory for new shard files; repeat to spread them over disks\n"
+                L"      --reduce-method pca|truncate          How --reduce shortens vectors (default pca)\n"
+                L"      --snapshot FILE                       Start --serve from a snapshot for the shards it still matches\n"
+                L"      --dedup-threshold J                   Link paragraphs at least this similar to an embedded one instead of embedding them (0-1, e.g. 0.8; default 0 = off)\n"
+                L"      --coarse-docs N                       Rank documents by centroid first and search the paragraphs of the best N (0 = all)\n"
+                L"      --binary-candidates N                 Rank paragraphs by sign-code Hamming distance first and score the closest N exactly (0 = off)\n"
                 L"  -h, --help                                Display this help message\n";
             exit(0);
         }
@@ -43,6 +118,16 @@ ProgramOptions parse_arguments(int argc, wchar_t* argv[]) {
                 exit(1);
             }
         }
+        else if (arg == L"-w" || arg == L"--watch") {
+            options.watch = true;
+            while (i + 1 < args.size() && args[i + 1][0] != L'-') {
+                options.file_paths.push_back(args[++i]);
+            }
+            if (options.file_paths.empty()) {
+                std::wcerr << L"Error: --watch option requires at least one file or directory." << std::endl;
+                exit(1);
+            }
+        }
         else if (arg == L"-d" || arg == L"--delete") {
             options.delete_docs = true;
             // Collect all subsequent arguments that are not options
@@ -78,6 +163,162 @@ ProgramOptions parse_arguments(int argc, wchar_t* argv[]) {
         else if (arg == L"-m" || arg == L"--monitor") {
             options.monitor_progress = true;
         }
+        else if (arg == L"-s" || arg == L"--serve") {
+            options.serve = true;
+            // Optional port directly after the option
+            if (i + 1 < args.size() && args[i + 1][0] != L'-') {
+                options.server_port = parse_port(args[++i]);
+            }
+        }
+        else if (arg == L"-p" || arg == L"--port") {
+            if (i + 1 < args.size() && args[i + 1][0] != L'-') {
+                options.server_port = parse_port(args[++i]);
+            }
+            else {
+                std::wcerr << L"Error: --port option requires a port number." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--no-server") {
+            options.no_server = true;
+        }
+        else if (arg == L"--cache-threshold") {
+            if (i + 1 < args.size()) {
+                options.cache_threshold = parse_threshold(args[++i], L"cache threshold");
+            }
+            else {
+                std::wcerr << L"Error: --cache-threshold option requires a value." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--cache-entries") {
+            if (i + 1 < args.size()) {
+                options.cache_entries = parse_non_negative_int(args[++i], L"cache entry count");
+            }
+            else {
+                std::wcerr << L"Error: --cache-entries option requires a value." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--dedup-threshold") {
+            if (i + 1 < args.size()) {
+                options.dedup_threshold = parse_threshold(args[++i], L"near-duplicate threshold");
+            }
+            else {
+                std::wcerr << L"Error: --dedup-threshold option requires a value." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--coarse-docs") {
+            if (i + 1 < args.size()) {
+                options.coarse_documents = parse_non_negative_int(args[++i], L"document count");
+            }
+            else {
+                std::wcerr << L"Error: --coarse-docs option requires a value." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--binary-candidates") {
+            if (i + 1 < args.size()) {
+                options.binary_candidates = parse_non_negative_int(args[++i], L"candidate count");
+            }
+            else {
+                std::wcerr << L"Error: --binary-candidates option requires a value." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--no-cache") {
+            options.answer_cache = false;
+        }
+        else if (arg == L"--profile") {
+            options.profile = true;
+        }
+        else if (arg == L"--shards") {
+            if (i + 1 < args.size()) {
+                options.shard_count = parse_positive_int(args[++i], L"shard count");
+            }
+            else {
+                std::wcerr << L"Error: --shards option requires a number." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--shard-dir") {
+            if (i + 1 < args.size()) {
+                options.shard_dirs.push_back(args[++i]);
+            }
+            else {
+                std::wcerr << L"Error: --shard-dir option requires a directory." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"-r" || arg == L"--resume") {
+            options.resume = true;
+        }
+        else if (arg == L"--max-concurrency") {
+            if (i + 1 < args.size()) {
+                options.max_concurrency = parse_positive_int(args[++i], L"request concurrency");
+            }
+            else {
+                std::wcerr << L"Error: --max-concurrency option requires a number." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--embedding-format") {
+            if (i + 1 < args.size() && (args[i + 1] == L"base64" || args[i + 1] == L"float")) {
+                options.embedding_base64 = args[++i] == L"base64";
+            }
+            else {
+                std::wcerr << L"Error: --embedding-format option requires base64 or float." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--reduce") {
+            options.reduce = true;
+            if (i + 1 < args.size()) {
+                options.reduce_dim = parse_non_negative_int(args[++i], L"reduced dimension");
+            }
+            else {
+                std::wcerr << L"Error: --reduce option requires a dimension." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--export-snapshot" || arg == L"--import-snapshot") {
+            if (i + 1 < args.size()) {
+                (arg == L"--export-snapshot" ? options.export_snapshot : options.import_snapshot) = true;
+                options.snapshot_path = args[++i];
+            }
+            else {
+                std::wcerr << L"Error: " << arg << L" option requires a file." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--snapshot") {
+            if (i + 1 < args.size()) {
+                options.snapshot_path = args[++i];
+            }
+            else {
+                std::wcerr << L"Error: --snapshot option requires a file." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--reduce-method") {
+            if (i + 1 < args.size() && (args[i + 1] == L"pca" || args[i + 1] == L"truncate")) {
+                options.reduce_method = args[++i];
+            }
+            else {
+                std::wcerr << L"Error: --reduce-method option requires pca or truncate." << std::endl;
+                exit(1);
+            }
+        }
+        else if (arg == L"--context-tokens") {
+            if (i + 1 < args.size()) {
+                options.context_tokens = parse_positive_int(args[++i], L"context token budget");
+            }
+            else {
+                std::wcerr << L"Error: --context-tokens option requires a number." << std::endl;
+                exit(1);
+            }
+        }
         else {
             std::wcerr << L"Unknown option or argument: " << arg << std::endl;
             exit(1);
@@ -85,14 +326,15 @@ ProgramOptions parse_arguments(int argc, wchar_t* argv[]) {
     }
 
     // Validate that only one primary option is selected
-    int command_count = options.embed + options.delete_docs + options.query + options.list_docs + options.monitor_progress;
+    int command_count = options.embed + options.delete_docs + options.query + options.list_docs + options.monitor_progress + options.serve + options.reduce + options.resume
+        + options.export_snapshot + options.import_snapshot + options.watch;
     if (command_count > 1) {
-        std::wcerr << L"Options --embed, --delete, --query, --list, and --monitor cannot be used together." << std::endl;
+        std::wcerr << L"Options --embed, --delete, --query, --list, --monitor, --serve, --reduce, --resume, --export-snapshot, --import-snapshot, and --watch cannot be used together." << std::endl;
         exit(1);
     }
 
     if (command_count == 0) {
-        std::wcerr << L"You must specify one of the options: --embed, --delete, --query, --list, or --monitor." << std::endl;
+        std::wcerr << L"You must specify one of the options: --embed, --delete, --query, --list, --monitor, --serve, --reduce, --resume, --export-snapshot, --import-snapshot, or --watch." << std::endl;
         exit(1);
     }
 
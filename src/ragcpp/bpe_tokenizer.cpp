@@ -0,0 +1,553 @@
+// bpe_tokenizer.cpp
+
+#include "bpe_tokenizer.h"
+#include "encoding_utils.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstring>
+#include <functional>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BPE_USE_SSE2 1
+#endif
+
+const char* const BPE_VOCAB_PATH = "./dict/cl100k_base.tiktoken";
+
+// Pieces longer than this merge through a heap instead of linear scans
+const size_t long_piece_bytes = 128;
+
+namespace {
+
+// Character classes of the cl100k pre-tokenization pattern:
+//   's|'t|'re|'ve|'m|'ll|'d | [^\r\n\p{L}\p{N}]?\p{L}+ | \p{N}{1,3}
+//   | ?[^\s\p{L}\p{N}]+[\r\n]* | \s*[\r\n]+ | \s+(?!\S) | \s+
+enum CharClass : unsigned char {
+    CLASS_LETTER,
+    CLASS_NUMBER,
+    CLASS_SPACE,
+    CLASS_NEWLINE,      // \r and \n; also whitespace
+    CLASS_OTHER
+};
+
+struct CodepointRange {
+    uint32_t first;
+    uint32_t last;
+};
+
+// \p{L} outside ASCII, coarsely: the scripts our documents use are exact,
+// rarer scripts are approximated by their blocks
+const CodepointRange letter_ranges[] = {
+    { 0x00AA, 0x00AA }, { 0x00B5, 0x00B5 }, { 0x00BA, 0x00BA }, { 0x00C0, 0x00D6 }, { 0x00D8, 0x00F6 },
+    { 0x00F8, 0x02C1 }, { 0x02C6, 0x02D1 }, { 0x02E0, 0x02E4 }, { 0x0370, 0x0373 }, { 0x0376, 0x0377 },
+    { 0x037B, 0x037D }, { 0x0386, 0x0386 }, { 0x0388, 0x03F5 }, { 0x03F7, 0x0481 }, { 0x048A, 0x052F },
+    { 0x0531, 0x0556 }, { 0x0561, 0x0587 }, { 0x05D0, 0x05EA }, { 0x0620, 0x064A }, { 0x0671, 0x06D3 },
+    { 0x0904, 0x0939 }, { 0x0E01, 0x0E30 }, { 0x10A0, 0x10FF }, { 0x1100, 0x11FF }, { 0x1E00, 0x1FBC },
+    { 0x3005, 0x3006 }, { 0x3041, 0x3096 }, { 0x309D, 0x309F }, { 0x30A1, 0x30FA }, { 0x30FC, 0x30FF },
+    { 0x3105, 0x312F }, { 0x3131, 0x318E }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xA000, 0xA48C },
+    { 0xAC00, 0xD7A3 }, { 0xF900, 0xFAFF }, { 0xFF21, 0xFF3A }, { 0xFF41, 0xFF5A }, { 0xFF66, 0xFFDC },
+    { 0x20000, 0x2FA1F },
+};
+
+const CodepointRange number_ranges[] = {
+    { 0x00B2, 0x00B3 }, { 0x00B9, 0x00B9 }, { 0x00BC, 0x00BE }, { 0x0660, 0x0669 }, { 0x06F0, 0x06F9 },
+    { 0x0966, 0x096F }, { 0x2070, 0x2070 }, { 0x2074, 0x2079 }, { 0x2080, 0x2089 }, { 0x2150, 0x2189 },
+    { 0x2460, 0x249B }, { 0x3007, 0x3007 }, { 0x3021, 0x3029 }, { 0xFF10, 0xFF19 },
+};
+
+const CodepointRange space_ranges[] = {
+    { 0x0085, 0x0085 }, { 0x00A0, 0x00A0 }, { 0x1680, 0x1680 }, { 0x2000, 0x200A }, { 0x2028, 0x2029 },
+    { 0x202F, 0x202F }, { 0x205F, 0x205F }, { 0x3000, 0x3000 },
+};
+
+template <size_t N>
+bool in_ranges(const CodepointRange (&ranges)[N], uint32_t cp) {
+    auto it = std::upper_bound(std::begin(ranges), std::end(ranges), cp,
+        [](uint32_t value, const CodepointRange& range) { return value < range.first; });
+    return it != std::begin(ranges) && cp <= (it - 1)->last;
+}
+
+struct AsciiClassTable {
+    unsigned char classes[128];
+
+    AsciiClassTable() {
+        for (int c = 0; c < 128; ++c) {
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) classes[c] = CLASS_LETTER;
+            else if (c >= '0' && c <= '9') classes[c] = CLASS_NUMBER;
+            else if (c == '\r' || c == '\n') classes[c] = CLASS_NEWLINE;
+            else if (c == ' ' || c == '\t' || c == '\v' || c == '\f') classes[c] = CLASS_SPACE;
+            else classes[c] = CLASS_OTHER;
+        }
+    }
+};
+
+const AsciiClassTable ascii_class_table;
+
+struct Codepoint {
+    uint32_t value;
+    size_t length;
+};
+
+// Invalid sequences decode as one byte of class OTHER
+Codepoint decode_utf8(const unsigned char* s, size_t remaining) {
+    unsigned char b = s[0];
+    if (b < 0x80) return { b, 1 };
+    if ((b & 0xE0) == 0xC0 && remaining >= 2 && (s[1] & 0xC0) == 0x80) {
+        return { (uint32_t(b & 0x1F) << 6) | (s[1] & 0x3F), 2 };
+    }
+    if ((b & 0xF0) == 0xE0 && remaining >= 3 && (s[1] & 0xC0) == 0x80 && (s[2] & 0xC0) == 0x80) {
+        return { (uint32_t(b & 0x0F) << 12) | (uint32_t(s[1] & 0x3F) << 6) | (s[2] & 0x3F), 3 };
+    }
+    if ((b & 0xF8) == 0xF0 && remaining >= 4 && (s[1] & 0xC0) == 0x80 && (s[2] & 0xC0) == 0x80 && (s[3] & 0xC0) == 0x80) {
+        return { (uint32_t(b & 0x07) << 18) | (uint32_t(s[1] & 0x3F) << 12) | (uint32_t(s[2] & 0x3F) << 6) | (s[3] & 0x3F), 4 };
+    }
+    return { 0xFFFFFFFF, 1 };
+}
+
+CharClass classify(uint32_t cp) {
+    if (cp < 128) return static_cast<CharClass>(ascii_class_table.classes[cp]);
+    if (in_ranges(letter_ranges, cp)) return CLASS_LETTER;
+    if (in_ranges(number_ranges, cp)) return CLASS_NUMBER;
+    if (in_ranges(space_ranges, cp)) return CLASS_SPACE;
+    return CLASS_OTHER;
+}
+
+// Number of leading ASCII letters, sixteen bytes at a time where possible
+size_t ascii_letter_run(const unsigned char* s, size_t remaining) {
+    size_t run = 0;
+#ifdef BPE_USE_SSE2
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i before_a = _mm_set1_epi8('a' - 1);
+    const __m128i after_z = _mm_set1_epi8('z' + 1);
+    while (remaining - run >= 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + run));
+        __m128i folded = _mm_or_si128(bytes, case_bit);
+        // Bytes >= 0x80 are negative here and fail the first comparison
+        __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(folded, before_a), _mm_cmplt_epi8(folded, after_z));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(letters));
+        if (mask != 0xFFFF) {
+            return run + std::countr_one(mask);
+        }
+        run += 16;
+    }
+#endif
+    while (run < remaining && s[run] < 0x80 && ascii_class_table.classes[s[run]] == CLASS_LETTER) {
+        run++;
+    }
+    return run;
+}
+
+class PreTokenizer {
+public:
+    PreTokenizer(const unsigned char* text, size_t size) : s_(text), n_(size) {}
+
+    // End of the piece starting at i
+    size_t next_piece(size_t i) const {
+        size_t length;
+        CharClass k = class_at(i, length);
+        unsigned char b = s_[i];
+
+        // 's 't 're 've 'm 'll 'd, case-insensitively
+        if (b == '\'' && i + 1 < n_) {
+            unsigned char b1 = lower(s_[i + 1]);
+            if (b1 == 's' || b1 == 't' || b1 == 'm' || b1 == 'd') return i + 2;
+            if (i + 2 < n_) {
+                unsigned char b2 = lower(s_[i + 2]);
+                if ((b1 == 'r' && b2 == 'e') || (b1 == 'v' && b2 == 'e') || (b1 == 'l' && b2 == 'l')) return i + 3;
+            }
+        }
+
+        // [^\r\n\p{L}\p{N}]?\p{L}+
+        if (k == CLASS_LETTER) {
+            return scan_letters(i + length);
+        }
+        size_t next_length;
+        if ((k == CLASS_SPACE || k == CLASS_OTHER) && i + length < n_ && class_at(i + length, next_length) == CLASS_LETTER) {
+            return scan_letters(i + length + next_length);
+        }
+
+        // \p{N}{1,3}
+        if (k == CLASS_NUMBER) {
+            size_t j = i + length;
+            for (int digits = 1; digits < 3 && j < n_; ++digits) {
+                if (class_at(j, next_length) != CLASS_NUMBER) break;
+                j += next_length;
+            }
+            return j;
+        }
+
+        //  ?[^\s\p{L}\p{N}]+[\r\n]*
+        size_t j = (b == ' ') ? i + 1 : i;
+        if (j < n_ && class_at(j, next_length) == CLASS_OTHER) {
+            j += next_length;
+            while (j < n_ && class_at(j, next_length) == CLASS_OTHER) {
+                j += next_length;
+            }
+            while (j < n_ && (s_[j] == '\r' || s_[j] == '\n')) {
+                j++;
+            }
+            return j;
+        }
+
+        // Whitespace: \s*[\r\n]+ | \s+(?!\S) | \s+
+        size_t end = i;
+        size_t last_start = i;
+        size_t after_newline = 0;
+        while (end < n_) {
+            CharClass next_class = class_at(end, next_length);
+            if (next_class != CLASS_SPACE && next_class != CLASS_NEWLINE) break;
+            last_start = end;
+            end += next_length;
+            if (next_class == CLASS_NEWLINE) after_newline = end;
+        }
+        if (after_newline > 0) return after_newline;
+        if (end == n_ || last_start == i) return end;
+        return last_start; // Leave the last space to prefix the next word
+    }
+
+private:
+    static unsigned char lower(unsigned char b) {
+        return (b >= 'A' && b <= 'Z') ? static_cast<unsigned char>(b | 0x20) : b;
+    }
+
+    // Class and encoded length of the character at i; ASCII skips decoding
+    CharClass class_at(size_t i, size_t& length) const {
+        if (s_[i] < 0x80) {
+            length = 1;
+            return static_cast<CharClass>(ascii_class_table.classes[s_[i]]);
+        }
+        Codepoint c = decode_utf8(s_ + i, n_ - i);
+        length = c.length;
+        return c.value == 0xFFFFFFFF ? CLASS_OTHER : classify(c.value);
+    }
+
+    size_t scan_letters(size_t j) const {
+        size_t length;
+        while (j < n_) {
+            if (s_[j] < 0x80) {
+                j += ascii_letter_run(s_ + j, n_ - j);
+                if (j >= n_ || s_[j] < 0x80) break;
+                continue;
+            }
+            if (class_at(j, length) != CLASS_LETTER) break;
+            j += length;
+        }
+        return j;
+    }
+
+    const unsigned char* s_;
+    size_t n_;
+};
+
+// First eight bytes of a token, zero padded; short tokens avoid a
+// variable-length memcpy call
+uint64_t load_prefix(const char* p, size_t n) {
+    uint64_t prefix = 0;
+    if (n >= 8) {
+        memcpy(&prefix, p, 8);
+        return prefix;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        prefix |= uint64_t(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    return prefix;
+}
+
+// Multiplicative hash; the table indexes by its top bits, which mix every
+// input bit
+uint64_t hash_bytes(uint64_t prefix, const char* p, size_t n) {
+    uint64_t h = (prefix ^ (0x9E3779B97F4A7C15ULL * n)) * 0xFF51AFD7ED558CCDULL;
+    for (size_t i = 8; i < n; i += 8) {
+        h = (h ^ (h >> 29) ^ load_prefix(p + i, n - i)) * 0xC4CEB9FE1A85EC53ULL;
+    }
+    return h;
+}
+
+bool decode_base64(const std::string& input, std::string& output) {
+    static const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    output.clear();
+    uint32_t buffer = 0;
+    int bits = 0;
+    for (char ch : input) {
+        if (ch == '=') break;
+        size_t value = alphabet.find(ch);
+        if (value == std::string::npos) return false;
+        buffer = (buffer << 6) | static_cast<uint32_t>(value);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            output += static_cast<char>((buffer >> bits) & 0xFF);
+        }
+    }
+    return true;
+}
+
+// Rough count for when no vocabulary is available: about four ASCII bytes
+// per token, one token per other character
+size_t estimate_tokens(std::string_view text) {
+    size_t ascii = 0;
+    size_t other = 0;
+    for (unsigned char b : text) {
+        if (b < 0x80) ascii++;
+        else if ((b & 0xC0) != 0x80) other++;
+    }
+    return (ascii + 3) / 4 + other;
+}
+
+} // namespace
+
+bool BpeTokenizer::load(const std::string& vocab_path) {
+    std::ifstream file(vocab_path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    std::vector<std::pair<std::string, int>> entries;
+    std::string line;
+    std::string bytes;
+    while (std::getline(file, line)) {
+        size_t space = line.find(' ');
+        if (space == std::string::npos) continue;
+        if (!decode_base64(line.substr(0, space), bytes) || bytes.empty()) {
+            std::cerr << "Invalid entry in BPE vocabulary " << vocab_path << ": " << line << std::endl;
+            return false;
+        }
+        entries.emplace_back(bytes, std::atoi(line.c_str() + space + 1));
+    }
+    if (entries.empty()) {
+        std::cerr << "BPE vocabulary " << vocab_path << " is empty." << std::endl;
+        return false;
+    }
+
+    // Keep the table at most half full so probes stay short
+    size_t capacity = std::bit_ceil(entries.size() * 2);
+    arena_.clear();
+    slots_.assign(capacity, Slot());
+    mask_ = capacity - 1;
+    shift_ = 64 - std::countr_zero(capacity);
+    for (const auto& [entry_bytes, rank] : entries) {
+        insert(entry_bytes, rank);
+    }
+    return true;
+}
+
+void BpeTokenizer::insert(const std::string& bytes, int rank) {
+    uint64_t prefix = load_prefix(bytes.data(), bytes.size());
+    uint64_t index = hash_bytes(prefix, bytes.data(), bytes.size()) >> shift_;
+    while (slots_[index].length != 0) {
+        index = (index + 1) & mask_;
+    }
+    slots_[index].prefix = prefix;
+    slots_[index].offset = static_cast<uint32_t>(arena_.size());
+    slots_[index].length = static_cast<uint32_t>(bytes.size());
+    slots_[index].rank = rank;
+    arena_ += bytes;
+}
+
+int BpeTokenizer::rank_of(const char* bytes, size_t length) const {
+    uint64_t prefix = load_prefix(bytes, length);
+    uint64_t index = hash_bytes(prefix, bytes, length) >> shift_;
+    while (true) {
+        const Slot& slot = slots_[index];
+        if (slot.length == 0) return -1;
+        if (slot.length == length && slot.prefix == prefix
+            && (length <= 8 || memcmp(arena_.data() + slot.offset + 8, bytes + 8, length - 8) == 0)) {
+            return slot.rank;
+        }
+        index = (index + 1) & mask_;
+    }
+}
+
+size_t BpeTokenizer::merge_piece(const char* piece, size_t length, std::vector<int>* tokens) const {
+    // Most pieces are whole vocabulary entries
+    int whole = rank_of(piece, length);
+    if (whole >= 0) {
+        if (tokens) tokens->push_back(whole);
+        return 1;
+    }
+
+    if (length > long_piece_bytes) {
+        return merge_long_piece(piece, length, tokens);
+    }
+
+    // Repeatedly merge the adjacent pair with the lowest rank. parts[i] is the
+    // start of part i and the rank of part i joined with part i + 1.
+    thread_local std::vector<std::pair<size_t, int>> parts;
+    parts.clear();
+
+    auto pair_rank = [&](size_t i) {
+        if (i + 3 >= parts.size()) return INT_MAX;
+        int rank = rank_of(piece + parts[i].first, parts[i + 3].first - parts[i].first);
+        return rank < 0 ? INT_MAX : rank;
+    };
+
+    for (size_t i = 0; i + 1 < length; ++i) {
+        int rank = rank_of(piece + i, 2);
+        parts.push_back({ i, rank < 0 ? INT_MAX : rank });
+    }
+    parts.push_back({ length - 1, INT_MAX });
+    parts.push_back({ length, INT_MAX });
+
+    while (parts.size() > 2) {
+        size_t best = 0;
+        int best_rank = INT_MAX;
+        for (size_t i = 0; i + 1 < parts.size(); ++i) {
+            if (parts[i].second < best_rank) {
+                best_rank = parts[i].second;
+                best = i;
+            }
+        }
+        if (best_rank == INT_MAX) break;
+
+        parts[best].second = pair_rank(best);
+        if (best > 0) {
+            parts[best - 1].second = pair_rank(best - 1);
+        }
+        parts.erase(parts.begin() + best + 1);
+    }
+
+    if (tokens) {
+        for (size_t i = 0; i + 1 < parts.size(); ++i) {
+            tokens->push_back(rank_of(piece + parts[i].first, parts[i + 1].first - parts[i].first));
+        }
+    }
+    return parts.size() - 1;
+}
+
+size_t BpeTokenizer::merge_long_piece(const char* piece, size_t length, std::vector<int>* tokens) const {
+    // Same merge order as merge_piece, but parts form a linked list and the
+    // candidate pairs sit in a heap, so long CJK runs merge in O(n log n).
+    // A heap entry is stale once the version of its left part has moved on.
+    struct Candidate {
+        int rank;
+        uint32_t left;
+        uint32_t version;
+
+        bool operator>(const Candidate& other) const {
+            return rank != other.rank ? rank > other.rank : left > other.left;
+        }
+    };
+    const uint32_t removed = UINT32_MAX;
+    const uint32_t end = static_cast<uint32_t>(length);
+
+    thread_local std::vector<uint32_t> next;
+    thread_local std::vector<uint32_t> prev;
+    thread_local std::vector<uint32_t> version;
+    thread_local std::vector<Candidate> heap;
+    next.resize(length);
+    prev.resize(length);
+    version.assign(length, 0);
+    heap.clear();
+
+    auto pair_rank = [&](uint32_t left) {
+        uint32_t right = next[left];
+        if (right >= end) return INT_MAX;
+        uint32_t stop = (next[right] >= end) ? end : next[right];
+        int rank = rank_of(piece + left, stop - left);
+        return rank < 0 ? INT_MAX : rank;
+    };
+
+    for (uint32_t i = 0; i < end; ++i) {
+        next[i] = i + 1;
+        prev[i] = (i == 0) ? removed : i - 1;
+    }
+    for (uint32_t i = 0; i + 1 < end; ++i) {
+        int rank = pair_rank(i);
+        if (rank != INT_MAX) heap.push_back({ rank, i, 0 });
+    }
+    std::make_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+
+    size_t parts = length;
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+        Candidate candidate = heap.back();
+        heap.pop_back();
+        uint32_t left = candidate.left;
+        if (version[left] != candidate.version) continue;
+
+        // Fold the right part into the left one
+        uint32_t right = next[left];
+        next[left] = next[right];
+        if (next[right] < end) prev[next[right]] = left;
+        version[right] = removed;
+        parts--;
+
+        version[left]++;
+        int rank = pair_rank(left);
+        if (rank != INT_MAX) {
+            heap.push_back({ rank, left, version[left] });
+            std::push_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+        }
+        if (prev[left] != removed) {
+            uint32_t before = prev[left];
+            version[before]++;
+            rank = pair_rank(before);
+            if (rank != INT_MAX) {
+                heap.push_back({ rank, before, version[before] });
+                std::push_heap(heap.begin(), heap.end(), std::greater<Candidate>());
+            }
+        }
+    }
+
+    if (tokens) {
+        for (uint32_t i = 0; i < end; i = next[i]) {
+            uint32_t stop = (next[i] >= end) ? end : next[i];
+            tokens->push_back(rank_of(piece + i, stop - i));
+        }
+    }
+    return parts;
+}
+
+size_t BpeTokenizer::count_tokens(std::string_view text) const {
+    if (!loaded()) {
+        return estimate_tokens(text);
+    }
+
+    PreTokenizer pre_tokenizer(reinterpret_cast<const unsigned char*>(text.data()), text.size());
+    size_t count = 0;
+    for (size_t start = 0; start < text.size();) {
+        size_t end = pre_tokenizer.next_piece(start);
+        count += merge_piece(text.data() + start, end - start, nullptr);
+        start = end;
+    }
+    return count;
+}
+
+void BpeTokenizer::encode(std::string_view text, std::vector<int>& tokens) const {
+    tokens.clear();
+    if (!loaded()) return;
+
+    PreTokenizer pre_tokenizer(reinterpret_cast<const unsigned char*>(text.data()), text.size());
+    for (size_t start = 0; start < text.size();) {
+        size_t end = pre_tokenizer.next_piece(start);
+        merge_piece(text.data() + start, end - start, &tokens);
+        start = end;
+    }
+}
+
+// Load the vocabulary on first use, so commands that never count tokens skip it
+static const BpeTokenizer& bpe_tokenizer() {
+    static const BpeTokenizer instance = [] {
+        BpeTokenizer tokenizer;
+        if (!tokenizer.load(BPE_VOCAB_PATH)) {
+            std::cerr << "BPE vocabulary " << BPE_VOCAB_PATH << " not found, estimating token counts." << std::endl;
+        }
+        return tokenizer;
+    }();
+    return instance;
+}
+
+size_t count_tokens(std::string_view utf8_text) {
+    return bpe_tokenizer().count_tokens(utf8_text);
+}
+
+size_t count_tokens(const std::wstring& text) {
+    return bpe_tokenizer().count_tokens(wstring_to_utf8(text));
+}
+
+bool bpe_vocabulary_loaded() {
+    return bpe_tokenizer().loaded();
+}
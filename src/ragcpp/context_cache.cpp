@@ -0,0 +1,142 @@
+// context_cache.cpp
+
+#include "context_cache.h"
+#include "database.h"
+#include "lru_cache.h"
+#include "bpe_tokenizer.h"
+#include "metrics.h"
+#include "shards.h"
+#include <mutex>
+#include <algorithm>
+
+namespace {
+
+const size_t paragraph_cache_capacity = 8192;
+const size_t document_cache_capacity = 1024;
+
+using CachedText = std::shared_ptr<const std::wstring>;
+
+// Token counts are cached with the text so packing a prompt never re-tokenizes
+struct CachedParagraph {
+    CachedText text;
+    size_t token_count = 0;
+};
+
+struct ContextCacheState {
+    std::mutex mutex;
+    LruCache<int, CachedParagraph> paragraphs{ paragraph_cache_capacity };
+    LruCache<int, CachedText> documents{ document_cache_capacity };
+
+    // What the cached rows were read from
+    sqlite3* db = nullptr;
+    int data_version = -1;
+    int content_generation = -1;
+};
+
+ContextCacheState& cache_state() {
+    static ContextCacheState state;
+    return state;
+}
+
+// data_version moves when another connection commits to any shard and the
+// content generation when this process writes; either means cached rows may be stale
+void validate_cache(ContextCacheState& state, sqlite3* db) {
+    int data_version = shards_data_version(db);
+    int content_generation = get_content_generation();
+    if (db != state.db || data_version != state.data_version || content_generation != state.content_generation) {
+        state.paragraphs.clear();
+        state.documents.clear();
+        state.db = db;
+        state.data_version = data_version;
+        state.content_generation = content_generation;
+    }
+}
+
+CachedText empty_text() {
+    static const CachedText empty = std::make_shared<const std::wstring>();
+    return empty;
+}
+
+} // namespace
+
+void fetch_context_entries(sqlite3* db, const std::vector<SimilarityResult>& hits, std::vector<ContextEntry>& entries) {
+    StageTimer timer(Stage::ContextFetch);
+    ContextCacheState& state = cache_state();
+    entries.assign(hits.size(), ContextEntry());
+
+    std::vector<int> missing_ids;
+    std::vector<int> missing_doc_ids;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        validate_cache(state, db);
+        CachedParagraph paragraph;
+        for (size_t i = 0; i < hits.size(); ++i) {
+            if (state.paragraphs.get(hits[i].id, paragraph)) {
+                entries[i].text = paragraph.text;
+                entries[i].token_count = paragraph.token_count;
+            }
+            else {
+                missing_ids.push_back(hits[i].id);
+            }
+            if (!state.documents.get(hits[i].doc_id, entries[i].file_name)) {
+                missing_doc_ids.push_back(hits[i].doc_id);
+            }
+        }
+    }
+
+    add_counter(Counter::ContextCacheHits, hits.size() - missing_ids.size());
+    add_counter(Counter::ContextCacheMisses, missing_ids.size());
+    if (missing_ids.empty() && missing_doc_ids.empty()) {
+        return;
+    }
+
+    // Several hits usually share a document
+    std::sort(missing_doc_ids.begin(), missing_doc_ids.end());
+    missing_doc_ids.erase(std::unique(missing_doc_ids.begin(), missing_doc_ids.end()), missing_doc_ids.end());
+
+    // Fetch the misses outside the lock, one query per table
+    std::unordered_map<int, std::wstring> texts;
+    std::unordered_map<int, std::wstring> file_names;
+    if (!missing_ids.empty()) {
+        texts = get_texts_by_ids(db, missing_ids);
+    }
+    if (!missing_doc_ids.empty()) {
+        file_names = get_document_infos(db, missing_doc_ids);
+    }
+
+    std::unordered_map<int, CachedParagraph> fetched_texts;
+    std::unordered_map<int, CachedText> fetched_file_names;
+    for (auto& [id, text] : texts) {
+        size_t token_count = count_tokens(text);
+        fetched_texts[id] = { std::make_shared<const std::wstring>(std::move(text)), token_count };
+    }
+    for (auto& [doc_id, file_name] : file_names) {
+        fetched_file_names[doc_id] = std::make_shared<const std::wstring>(std::move(file_name));
+    }
+
+    for (size_t i = 0; i < hits.size(); ++i) {
+        if (!entries[i].text) {
+            auto it = fetched_texts.find(hits[i].id);
+            if (it != fetched_texts.end()) {
+                entries[i].text = it->second.text;
+                entries[i].token_count = it->second.token_count;
+            }
+            else {
+                entries[i].text = empty_text();
+            }
+        }
+        if (!entries[i].file_name) {
+            auto it = fetched_file_names.find(hits[i].doc_id);
+            entries[i].file_name = (it != fetched_file_names.end()) ? it->second : empty_text();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.db != db) return; // Another database took over the cache meanwhile
+    for (const auto& [id, text] : fetched_texts) {
+        state.paragraphs.put(id, text);
+    }
+    for (const auto& [doc_id, file_name] : fetched_file_names) {
+        state.documents.put(doc_id, file_name);
+    }
+}
@@ -2,31 +2,285 @@
 
 #include "database.h"
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <filesystem>
 #include "encoding_utils.h"
+#include "metrics.h"
+#include "shards.h"
+#include "vector_projection.h"
+#include "near_duplicates.h"
+#include "document_centroids.h"
+#include "text_store.h"
+#include <nlohmann/json.hpp>
 
-void initialize_database(sqlite3*& db) {
-    int rc = sqlite3_open("embeddings.db", &db);
+// Bumped by every write to documents or embeddings made through this process
+static std::atomic<int> g_content_generation{ 0 };
+
+// Layout of the tables below, recorded in schema_version. Version 1 kept each
+// paragraph's text in its embeddings row; version 2 moved it to paragraphs;
+// version 3 can pack it into compressed text blocks.
+const int current_schema_version = 3;
+
+// The recorded version; databases from before schema_version existed are
+// version 1 if they have embeddings with text, new (0) otherwise
+static int read_schema_version(sqlite3* db) {
+    int version = 0;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "SELECT version FROM schema_version WHERE id = 1;", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        return version;
+    }
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM pragma_table_info('embeddings') WHERE name = 'text';", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = 1;
+        }
+        sqlite3_finalize(stmt);
+    }
+    return version;
+}
+
+// Version 1 -> 2, first half: set the old embeddings table aside, without the
+// triggers and indexes whose names the new one takes over
+static bool set_aside_v1_embeddings(sqlite3* db) {
+    if (sqlite3_exec(db, "ALTER TABLE embeddings RENAME TO embeddings_v1;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    std::vector<std::string> drops;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "SELECT type, name FROM sqlite_master WHERE tbl_name = 'embeddings_v1' AND type IN ('trigger', 'index') "
+        "AND sql IS NOT NULL;", -1, &stmt, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        std::string type = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        std::string name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        drops.push_back((type == "trigger" ? "DROP TRIGGER \"" : "DROP INDEX \"") + name + "\";");
+    }
+    sqlite3_finalize(stmt);
+    for (const auto& drop : drops) {
+        if (sqlite3_exec(db, drop.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Version 2 -> 3: paragraphs gain their place in a text block. Packing only
+// sets text to NULL, which must not drop cached answers citing the paragraph.
+static bool add_text_block_columns(sqlite3* db) {
+    const char* alter_sql =
+        "ALTER TABLE paragraphs ADD COLUMN block_id INTEGER;"
+        "ALTER TABLE paragraphs ADD COLUMN block_offset INTEGER;"
+        "ALTER TABLE paragraphs ADD COLUMN block_length INTEGER;"
+        "DROP TRIGGER IF EXISTS answer_cache_paragraph_updated;";
+    return sqlite3_exec(db, alter_sql, nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+// Version 1 -> 2, second half, once the new tables exist: split the rows between them,
+// keeping ids and the AUTOINCREMENT high-water mark that shard ids are drawn from
+static bool copy_v1_embeddings(sqlite3* db) {
+    const char* copy_sql =
+        "INSERT INTO embeddings (id, doc_id, embedding) SELECT id, doc_id, embedding FROM embeddings_v1 ORDER BY id;"
+        "INSERT INTO paragraphs (id, doc_id, text) SELECT id, doc_id, text FROM embeddings_v1 ORDER BY id;"
+        "UPDATE sqlite_sequence SET seq = (SELECT seq FROM sqlite_sequence WHERE name = 'embeddings_v1') WHERE name = 'embeddings';"
+        "INSERT INTO sqlite_sequence (name, seq) SELECT 'embeddings', seq FROM sqlite_sequence WHERE name = 'embeddings_v1' "
+        "AND NOT EXISTS (SELECT 1 FROM sqlite_sequence WHERE name = 'embeddings');"
+        "DROP TABLE embeddings_v1;";
+    return sqlite3_exec(db, copy_sql, nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+void initialize_database(sqlite3*& db, const char* db_path) {
+    int rc = sqlite3_open(db_path, &db);
     if (rc) {
         std::cerr << "Cannot open database: " << sqlite3_errmsg(db) << std::endl;
         db = nullptr;
         return;
     }
+    register_vector_functions(db);
+    register_text_functions(db);
+    sqlite3_exec(db, "PRAGMA foreign_keys = ON;", nullptr, nullptr, nullptr);
 
-    const char* sql = "CREATE TABLE IF NOT EXISTS documents ("
+    int version = read_schema_version(db);
+    if (version > current_schema_version) {
+        std::cerr << "Database " << db_path << " has schema version " << version << "; this build only reads up to "
+            << current_schema_version << "." << std::endl;
+        sqlite3_close(db);
+        db = nullptr;
+        return;
+    }
+    // Migrations run in one transaction: an interrupted one leaves the old layout
+    bool migrate = version > 0 && version < current_schema_version;
+    if (migrate) {
+        std::cout << "Migrating " << db_path << " to schema version " << current_schema_version << "..." << std::endl;
+        sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr);
+        if (version == 1 ? !set_aside_v1_embeddings(db) : !add_text_block_columns(db)) {
+            std::cerr << "Migration failed: " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+            sqlite3_close(db);
+            db = nullptr;
+            return;
+        }
+    }
+
+    const char* sql = "CREATE TABLE IF NOT EXISTS schema_version ("
+        "id INTEGER PRIMARY KEY CHECK (id = 1), "
+        "version INTEGER);"
+        "CREATE TABLE IF NOT EXISTS documents ("
         "doc_id INTEGER PRIMARY KEY AUTOINCREMENT, "
-        "file_name TEXT);"
+        "file_name TEXT, "
+        "file_path TEXT, "
+        "file_size INTEGER, "
+        "modified INTEGER);"
+        // Vectors and paragraph text are kept apart, so scans over the vectors
+        // read only vector pages. Documents live in the primary and embeddings
+        // in any shard, so deleting a document deletes its embeddings
+        // explicitly; the rest follows them through foreign keys and triggers.
         "CREATE TABLE IF NOT EXISTS embeddings ("
         "id INTEGER PRIMARY KEY AUTOINCREMENT, "
         "doc_id INTEGER, "
+        "embedding BLOB);"
+        "CREATE TABLE IF NOT EXISTS paragraphs ("
+        "id INTEGER PRIMARY KEY REFERENCES embeddings(id) ON DELETE CASCADE, "
+        "doc_id INTEGER, "
         "text TEXT, "
-        "embedding BLOB, "
-        "FOREIGN KEY(doc_id) REFERENCES documents(doc_id));"
+        "block_id INTEGER, "
+        "block_offset INTEGER, "
+        "block_length INTEGER);"
+        "CREATE INDEX IF NOT EXISTS idx_paragraphs_doc_id ON paragraphs(doc_id);"
+        // Compressed paragraph text (see text_store.h): a packed paragraph has
+        // no text of its own but a byte range in one of its shard's blocks
+        "CREATE TABLE IF NOT EXISTS text_dictionaries ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "data BLOB);"
+        "CREATE TABLE IF NOT EXISTS text_blocks ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "dictionary_id INTEGER, "
+        "raw_size INTEGER, "
+        "data BLOB);"
+        "CREATE INDEX IF NOT EXISTS idx_paragraphs_block_id ON paragraphs(block_id);"
+        "CREATE TRIGGER IF NOT EXISTS text_block_paragraph_deleted AFTER DELETE ON paragraphs WHEN OLD.block_id IS NOT NULL BEGIN "
+        "DELETE FROM text_blocks WHERE id = OLD.block_id AND NOT EXISTS (SELECT 1 FROM paragraphs WHERE block_id = OLD.block_id); "
+        "END;"
+        "CREATE VIEW IF NOT EXISTS paragraph_texts AS "
+        "SELECT id, doc_id, IFNULL(text, block_text(block_id, block_offset, block_length)) AS text FROM paragraphs;"
         "CREATE TABLE IF NOT EXISTS progress("
         "doc_id INTEGER PRIMARY KEY,"
         "total_paragraphs INTEGER,"
         "paragraphs_processed INTEGER,"
         "status TEXT,"
-        "last_updated TIMESTAMP DEFAULT CURRENT_TIMESTAMP);";
+        "last_updated TIMESTAMP DEFAULT CURRENT_TIMESTAMP);"
+        // Shard files of a split database, recorded in the primary (shard 0, empty path)
+        "CREATE TABLE IF NOT EXISTS shards ("
+        "shard INTEGER PRIMARY KEY, "
+        "path TEXT);"
+        // Semantic answer cache: one row per generated answer, keyed by the
+        // ordered ids of the chunks its context was built from
+        "CREATE TABLE IF NOT EXISTS answer_cache ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "query TEXT, "
+        "query_embedding BLOB, "
+        "chunk_ids TEXT, "
+        "answer TEXT, "
+        "citations TEXT, "
+        "created TIMESTAMP DEFAULT CURRENT_TIMESTAMP);"
+        "CREATE INDEX IF NOT EXISTS idx_answer_cache_chunk_ids ON answer_cache(chunk_ids);"
+        "CREATE TABLE IF NOT EXISTS answer_cache_chunks ("
+        "cache_id INTEGER, "
+        "chunk_id INTEGER);"
+        "CREATE INDEX IF NOT EXISTS idx_answer_cache_chunks_chunk_id ON answer_cache_chunks(chunk_id);"
+        // Cached answers die with any chunk they cite, whichever process
+        // deletes or rewrites it
+        "CREATE TRIGGER IF NOT EXISTS answer_cache_embedding_deleted AFTER DELETE ON embeddings BEGIN "
+        "DELETE FROM answer_cache WHERE id IN (SELECT cache_id FROM answer_cache_chunks WHERE chunk_id = OLD.id); "
+        "END;"
+        "CREATE TRIGGER IF NOT EXISTS answer_cache_embedding_updated AFTER UPDATE OF embedding ON embeddings BEGIN "
+        "DELETE FROM answer_cache WHERE id IN (SELECT cache_id FROM answer_cache_chunks WHERE chunk_id = OLD.id); "
+        "END;"
+        "CREATE TRIGGER IF NOT EXISTS answer_cache_paragraph_updated AFTER UPDATE OF text ON paragraphs WHEN NEW.text IS NOT NULL BEGIN "
+        "DELETE FROM answer_cache WHERE id IN (SELECT cache_id FROM answer_cache_chunks WHERE chunk_id = OLD.id); "
+        "END;"
+        "CREATE TRIGGER IF NOT EXISTS answer_cache_entry_deleted AFTER DELETE ON answer_cache BEGIN "
+        "DELETE FROM answer_cache_chunks WHERE cache_id = OLD.id; "
+        "END;"
+        // Optional dimension reduction (see vector_projection.h): the projection
+        // lives in the primary, each shard keeps the reduced copies of its own
+        // embeddings under the same ids
+        "CREATE TABLE IF NOT EXISTS projection ("
+        "id INTEGER PRIMARY KEY CHECK (id = 1), "
+        "method TEXT, "
+        "input_dim INTEGER, "
+        "output_dim INTEGER, "
+        "mean BLOB, "
+        "components BLOB, "
+        "version INTEGER);"
+        "CREATE TABLE IF NOT EXISTS reduced_embeddings ("
+        "id INTEGER PRIMARY KEY, "
+        "doc_id INTEGER, "
+        "embedding BLOB);"
+        "CREATE TRIGGER IF NOT EXISTS reduced_embedding_deleted AFTER DELETE ON embeddings BEGIN "
+        "DELETE FROM reduced_embeddings WHERE id = OLD.id; "
+        "END;"
+        // Paragraphs waiting for an embedding. A file's paragraphs are queued
+        // before any request is sent and removed once stored, so whatever an
+        // interrupted or rate-limited run left behind is picked up by the next
+        "CREATE TABLE IF NOT EXISTS embedding_queue ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "doc_id INTEGER, "
+        "seq INTEGER, "
+        "text TEXT, "
+        "attempts INTEGER DEFAULT 0, "
+        "last_error TEXT);"
+        "CREATE INDEX IF NOT EXISTS idx_embedding_queue_doc_id ON embedding_queue(doc_id, seq);"
+        "CREATE TRIGGER IF NOT EXISTS embedding_queue_document_deleted AFTER DELETE ON documents BEGIN "
+        "DELETE FROM embedding_queue WHERE doc_id = OLD.doc_id; "
+        "END;"
+        // Near-duplicate detection (see near_duplicates.h): each shard keeps the
+        // MinHash signatures of its embeddings and their LSH band keys; the
+        // primary records paragraphs stored as links to an embedded copy
+        "CREATE TABLE IF NOT EXISTS minhash_signatures ("
+        "id INTEGER PRIMARY KEY, "
+        "doc_id INTEGER, "
+        "signature BLOB);"
+        "CREATE TABLE IF NOT EXISTS minhash_bands ("
+        "band_key INTEGER, "
+        "id INTEGER);"
+        "CREATE INDEX IF NOT EXISTS idx_minhash_bands_band_key ON minhash_bands(band_key);"
+        "CREATE INDEX IF NOT EXISTS idx_minhash_bands_id ON minhash_bands(id);"
+        "CREATE TRIGGER IF NOT EXISTS minhash_embedding_deleted AFTER DELETE ON embeddings BEGIN "
+        "DELETE FROM minhash_signatures WHERE id = OLD.id; "
+        "DELETE FROM minhash_bands WHERE id = OLD.id; "
+        "END;"
+        "CREATE TABLE IF NOT EXISTS near_duplicates ("
+        "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+        "doc_id INTEGER, "
+        "text TEXT, "
+        "canonical_id INTEGER, "
+        "canonical_doc_id INTEGER, "
+        "similarity REAL);"
+        "CREATE INDEX IF NOT EXISTS idx_near_duplicates_doc_id ON near_duplicates(doc_id);"
+        "CREATE INDEX IF NOT EXISTS idx_near_duplicates_canonical_id ON near_duplicates(canonical_id);"
+        "CREATE INDEX IF NOT EXISTS idx_near_duplicates_canonical_doc_id ON near_duplicates(canonical_doc_id);"
+        "CREATE TRIGGER IF NOT EXISTS near_duplicates_document_deleted AFTER DELETE ON documents BEGIN "
+        "DELETE FROM near_duplicates WHERE doc_id = OLD.doc_id; "
+        "END;"
+        // Coarse-to-fine retrieval (see document_centroids.h): each shard keeps
+        // a running sum of the normalized embeddings of its documents, and
+        // scans the embeddings of the chosen documents through the doc_id indexes
+        "CREATE TABLE IF NOT EXISTS document_centroids ("
+        "doc_id INTEGER PRIMARY KEY, "
+        "paragraphs INTEGER, "
+        "embedding_sum BLOB);"
+        "CREATE INDEX IF NOT EXISTS idx_embeddings_doc_id ON embeddings(doc_id);"
+        "CREATE INDEX IF NOT EXISTS idx_reduced_embeddings_doc_id ON reduced_embeddings(doc_id);"
+        "CREATE TRIGGER IF NOT EXISTS document_centroid_embedding_deleted AFTER DELETE ON embeddings BEGIN "
+        "DELETE FROM document_centroids WHERE doc_id = OLD.doc_id; "
+        "END;";
 
     char* err_msg = nullptr;
     rc = sqlite3_exec(db, sql, nullptr, nullptr, &err_msg);
@@ -34,11 +288,53 @@ void initialize_database(sqlite3*& db) {
         std::cerr << "SQL error: " << err_msg << std::endl;
         sqlite3_free(err_msg);
     }
+
+    // Databases created before documents recorded their source file
+    bool has_file_path = false;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM pragma_table_info('documents') WHERE name = 'file_path';", -1, &stmt, nullptr) == SQLITE_OK) {
+        has_file_path = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    const char* migrate_sql = has_file_path ? "" :
+        "ALTER TABLE documents ADD COLUMN file_path TEXT;"
+        "ALTER TABLE documents ADD COLUMN file_size INTEGER;"
+        "ALTER TABLE documents ADD COLUMN modified INTEGER;";
+    std::string index_sql = std::string(migrate_sql) + "CREATE INDEX IF NOT EXISTS idx_documents_file_path ON documents(file_path);";
+    rc = sqlite3_exec(db, index_sql.c_str(), nullptr, nullptr, &err_msg);
+    if (rc != SQLITE_OK) {
+        std::cerr << "SQL error: " << err_msg << std::endl;
+        sqlite3_free(err_msg);
+    }
+
+    if (version == current_schema_version) {
+        return;
+    }
+    bool ok = version != 1 || copy_v1_embeddings(db);
+    if (ok) {
+        std::string version_sql = "INSERT OR REPLACE INTO schema_version (id, version) VALUES (1, " + std::to_string(current_schema_version) + ");";
+        ok = sqlite3_exec(db, version_sql.c_str(), nullptr, nullptr, nullptr) == SQLITE_OK;
+    }
+    if (!migrate) {
+        return;
+    }
+    if (!ok) {
+        std::cerr << "Migration failed: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+        sqlite3_close(db);
+        db = nullptr;
+        return;
+    }
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    std::cout << "Migrated " << db_path << " to schema version " << current_schema_version << "." << std::endl;
 }
 
-int insert_document(sqlite3* db, const std::wstring& file_name) {
+int insert_document(sqlite3* db, const std::wstring& file_name, const std::wstring& file_path, const FileVersion& version) {
+    auto lock = lock_connection(db);
     sqlite3_stmt* stmt;
-    const char* insert_sql = "INSERT INTO documents (file_name) VALUES (?);";
+    // RETURNING rather than sqlite3_last_insert_rowid: files are embedded in
+    // parallel, and other threads insert through the same connection
+    const char* insert_sql = "INSERT INTO documents (file_name, file_path, file_size, modified) VALUES (?, ?, ?, ?) RETURNING doc_id;";
     int rc = sqlite3_prepare_v2(db, insert_sql, -1, &stmt, nullptr);
     if (rc != SQLITE_OK) {
         std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
@@ -47,97 +343,296 @@ int insert_document(sqlite3* db, const std::wstring& file_name) {
 
     std::string utf8_file_name = wstring_to_utf8(file_name);
     sqlite3_bind_text(stmt, 1, utf8_file_name.c_str(), -1, SQLITE_TRANSIENT);
+    std::string utf8_file_path = wstring_to_utf8(file_path);
+    if (!file_path.empty()) {
+        sqlite3_bind_text(stmt, 2, utf8_file_path.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(stmt, 3, version.size);
+        sqlite3_bind_int64(stmt, 4, version.modified);
+    }
 
     rc = sqlite3_step(stmt);
-    if (rc != SQLITE_DONE) {
+    if (rc != SQLITE_ROW) {
         std::cerr << "Failed to execute SQL statement: " << sqlite3_errmsg(db) << std::endl;
         sqlite3_finalize(stmt);
         return -1;
     }
 
-    int doc_id = static_cast<int>(sqlite3_last_insert_rowid(db));
+    int doc_id = sqlite3_column_int(stmt, 0);
     sqlite3_finalize(stmt);
+    g_content_generation++;
 
     return doc_id;
 }
 
-void insert_embedding(sqlite3* db, int doc_id, const std::wstring& text, const std::vector<float>& embedding) {
+// Keep reduced_embeddings in step with embeddings while a projection is active;
+// false only when the row could not be written
+static bool insert_reduced_embedding(sqlite3* shard, const VectorProjection& projection, int id, int doc_id, const std::vector<float>& embedding) {
+    std::vector<float> reduced = project_vector(projection, embedding);
+    if (reduced.empty()) {
+        std::cerr << "Embedding " << id << " has " << embedding.size() << " dimensions, the projection expects "
+            << projection.input_dim << "; it will only be found by full-dimension scans." << std::endl;
+        return true;
+    }
+
     sqlite3_stmt* stmt;
-    const char* insert_sql = "INSERT INTO embeddings (doc_id, text, embedding) VALUES (?, ?, ?);";
-    int rc = sqlite3_prepare_v2(db, insert_sql, -1, &stmt, nullptr);
+    const char* insert_sql = "INSERT INTO reduced_embeddings (id, doc_id, embedding) VALUES (?, ?, ?);";
+    int rc = sqlite3_prepare_v2(shard, insert_sql, -1, &stmt, nullptr);
     if (rc != SQLITE_OK) {
-        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
-        return;
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(shard) << std::endl;
+        return false;
+    }
+    sqlite3_bind_int(stmt, 1, id);
+    sqlite3_bind_int(stmt, 2, doc_id);
+    sqlite3_bind_blob(stmt, 3, reduced.data(), static_cast<int>(reduced.size() * sizeof(float)), SQLITE_TRANSIENT);
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        std::cerr << "Failed to execute SQL statement: " << sqlite3_errmsg(shard) << std::endl;
+    }
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE;
+}
+
+int insert_embedding(sqlite3* db, int doc_id, const std::wstring& text, const std::vector<float>& embedding) {
+    StageTimer timer(Stage::DbInsert);
+
+    size_t shards = shard_count(db);
+    sqlite3* shard = shard_for_id(db, doc_id);
+
+    // With several shards, take the next id above any ever used in this shard
+    // (the AUTOINCREMENT high-water mark) that is congruent to the shard number
+    sqlite3_stmt* stmt;
+    const char* insert_sql = (shards == 1)
+        ? "INSERT INTO embeddings (doc_id, embedding) VALUES (?1, ?2) RETURNING id;"
+        : "INSERT INTO embeddings (id, doc_id, embedding) VALUES ("
+          "(SELECT s + 1 + ((?3 - s - 1) % ?4 + ?4) % ?4 FROM "
+          "(SELECT IFNULL((SELECT seq FROM sqlite_sequence WHERE name = 'embeddings'), 0) AS s)), "
+          "?1, ?2) RETURNING id;";
+    int rc = sqlite3_prepare_v2(shard, insert_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(shard) << std::endl;
+        return -1;
     }
 
     std::string utf8_text = wstring_to_utf8(text);
 
     sqlite3_bind_int(stmt, 1, doc_id);
-    sqlite3_bind_text(stmt, 2, utf8_text.c_str(), -1, SQLITE_TRANSIENT);
 
     const void* blob_data = static_cast<const void*>(embedding.data());
     int blob_size = static_cast<int>(embedding.size() * sizeof(float));
 
-    sqlite3_bind_blob(stmt, 3, blob_data, blob_size, SQLITE_TRANSIENT);
+    sqlite3_bind_blob(stmt, 2, blob_data, blob_size, SQLITE_TRANSIENT);
+    if (shards > 1) {
+        sqlite3_bind_int(stmt, 3, static_cast<int>(shard_index(db, doc_id)));
+        sqlite3_bind_int(stmt, 4, static_cast<int>(shards));
+    }
 
+    // The vector, its text and its reduced copy are stored together, or not at
+    // all. A savepoint rather than BEGIN, so callers may batch inserts in their
+    // own transaction; on its own it commits like one.
+    auto lock = lock_connection(shard);
+    auto roll_back = [shard]() {
+        sqlite3_exec(shard, "ROLLBACK TO insert_embedding; RELEASE insert_embedding;", nullptr, nullptr, nullptr);
+    };
+    if (sqlite3_exec(shard, "SAVEPOINT insert_embedding;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        std::cerr << "Cannot begin transaction: " << sqlite3_errmsg(shard) << std::endl;
+        sqlite3_finalize(stmt);
+        return -1;
+    }
     rc = sqlite3_step(stmt);
+    if (rc != SQLITE_ROW) {
+        std::cerr << "Failed to execute SQL statement: " << sqlite3_errmsg(shard) << std::endl;
+        sqlite3_finalize(stmt);
+        roll_back();
+        return -1;
+    }
+    int id = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    const char* paragraph_sql = "INSERT INTO paragraphs (id, doc_id, text) VALUES (?, ?, ?);";
+    rc = sqlite3_prepare_v2(shard, paragraph_sql, -1, &stmt, nullptr);
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, id);
+        sqlite3_bind_int(stmt, 2, doc_id);
+        sqlite3_bind_text(stmt, 3, utf8_text.c_str(), static_cast<int>(utf8_text.size()), SQLITE_STATIC);
+        rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
     if (rc != SQLITE_DONE) {
-        std::cerr << "Failed to execute SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        // A vector without its text could never be cited
+        std::cerr << "Failed to store paragraph text: " << sqlite3_errmsg(shard) << std::endl;
+        roll_back();
+        return -1;
+    }
+
+    std::shared_ptr<const VectorProjection> projection = active_projection(db);
+    if (projection && !insert_reduced_embedding(shard, *projection, id, doc_id, embedding)) {
+        roll_back();
+        return -1;
+    }
+    if (sqlite3_exec(shard, "RELEASE insert_embedding;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+        std::cerr << "Failed to commit embedding: " << sqlite3_errmsg(shard) << std::endl;
+        roll_back();
+        return -1;
+    }
+    add_counter(Counter::Chunks);
+    g_content_generation++;
+    return id;
+}
+
+// The answer cache triggers only see embeddings in the primary; answers citing
+// a document stored in another shard are dropped here before its rows go
+static void drop_cached_answers_for_document(sqlite3* primary, sqlite3* shard, int doc_id) {
+    std::vector<int> chunk_ids;
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(shard, "SELECT id FROM embeddings WHERE doc_id = ?;", -1, &stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(shard) << std::endl;
+        return;
     }
+    sqlite3_bind_int(stmt, 1, doc_id);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        chunk_ids.push_back(sqlite3_column_int(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
 
+    const char* delete_sql = "DELETE FROM answer_cache WHERE id IN (SELECT cache_id FROM answer_cache_chunks WHERE chunk_id = ?);";
+    if (sqlite3_prepare_v2(primary, delete_sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(primary) << std::endl;
+        return;
+    }
+    auto lock = lock_connection(primary);
+    sqlite3_exec(primary, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    for (int chunk_id : chunk_ids) {
+        sqlite3_bind_int(stmt, 1, chunk_id);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_exec(primary, "COMMIT;", nullptr, nullptr, nullptr);
     sqlite3_finalize(stmt);
 }
 
 void delete_documents(const std::vector<int>& doc_ids, sqlite3* db) {
     sqlite3_stmt* stmt;
+    int rc;
 
-    // Delete from embeddings
-    const char* delete_embeddings_sql = "DELETE FROM embeddings WHERE doc_id = ?;";
-    int rc = sqlite3_prepare_v2(db, delete_embeddings_sql, -1, &stmt, nullptr);
-    if (rc != SQLITE_OK) {
-        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
-        return;
+    // Copies linked to paragraphs of these documents go back to being embedded on their own
+    size_t requeued = requeue_near_duplicates_of(db, doc_ids);
+    if (requeued > 0) {
+        std::cout << "Queued " << requeued << " near-duplicate paragraphs of other documents for embedding; run --resume to embed them." << std::endl;
     }
 
+    // Delete from embeddings, in whichever shard holds each document. Each shard's
+    // rows go in one transaction, under its lock so no writer thread is mid-insert.
+    std::map<sqlite3*, std::vector<int>> docs_by_shard;
     for (int doc_id : doc_ids) {
-        sqlite3_bind_int(stmt, 1, doc_id);
+        sqlite3* shard = shard_for_id(db, doc_id);
+        if (shard != db) {
+            drop_cached_answers_for_document(db, shard, doc_id);
+        }
+        docs_by_shard[shard].push_back(doc_id);
+    }
 
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_DONE) {
-            std::cerr << "Failed to delete embeddings: " << sqlite3_errmsg(db) << std::endl;
+    const char* delete_embeddings_sql = "DELETE FROM embeddings WHERE doc_id = ?;";
+    for (const auto& [shard, shard_doc_ids] : docs_by_shard) {
+        auto lock = lock_connection(shard);
+        rc = sqlite3_prepare_v2(shard, delete_embeddings_sql, -1, &stmt, nullptr);
+        if (rc != SQLITE_OK) {
+            std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(shard) << std::endl;
+            return;
+        }
+
+        bool ok = sqlite3_exec(shard, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr) == SQLITE_OK;
+        for (size_t i = 0; ok && i < shard_doc_ids.size(); ++i) {
+            sqlite3_bind_int(stmt, 1, shard_doc_ids[i]);
+            ok = sqlite3_step(stmt) == SQLITE_DONE;
+            sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+        ok = ok && sqlite3_exec(shard, "COMMIT;", nullptr, nullptr, nullptr) == SQLITE_OK;
+        if (!ok) {
+            // The documents stay listed, so the delete can be run again
+            std::cerr << "Failed to delete embeddings: " << sqlite3_errmsg(shard) << std::endl;
+            sqlite3_exec(shard, "ROLLBACK;", nullptr, nullptr, nullptr);
+            return;
         }
-        else {
+        for (int doc_id : shard_doc_ids) {
             std::cout << "Deleted embeddings for document ID " << doc_id << "." << std::endl;
         }
-
-        sqlite3_reset(stmt);
     }
 
-    sqlite3_finalize(stmt);
-
     // Delete from documents
     const char* delete_documents_sql = "DELETE FROM documents WHERE doc_id = ?;";
+    auto lock = lock_connection(db);
     rc = sqlite3_prepare_v2(db, delete_documents_sql, -1, &stmt, nullptr);
     if (rc != SQLITE_OK) {
         std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
         return;
     }
 
-    for (int doc_id : doc_ids) {
-        sqlite3_bind_int(stmt, 1, doc_id);
-
-        rc = sqlite3_step(stmt);
-        if (rc != SQLITE_DONE) {
-            std::cerr << "Failed to delete document: " << sqlite3_errmsg(db) << std::endl;
-        }
-        else {
+    bool ok = sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr) == SQLITE_OK;
+    for (size_t i = 0; ok && i < doc_ids.size(); ++i) {
+        sqlite3_bind_int(stmt, 1, doc_ids[i]);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    ok = ok && sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) == SQLITE_OK;
+    if (!ok) {
+        std::cerr << "Failed to delete document: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    }
+    else {
+        for (int doc_id : doc_ids) {
             std::cout << "Deleted document ID " << doc_id << "." << std::endl;
         }
+    }
+    g_content_generation++;
+}
 
-        sqlite3_reset(stmt);
+std::vector<StoredFile> get_stored_files(sqlite3* db) {
+    std::vector<StoredFile> files;
+    const char* select_sql = "SELECT doc_id, file_path, file_size, modified FROM documents WHERE file_path IS NOT NULL;";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, select_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return files;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        StoredFile file;
+        file.doc_id = sqlite3_column_int(stmt, 0);
+        const char* path = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        file.file_path = utf8_to_wstring(std::string(path ? path : "", sqlite3_column_bytes(stmt, 1)));
+        file.version.size = sqlite3_column_int64(stmt, 2);
+        file.version.modified = sqlite3_column_int64(stmt, 3);
+        files.push_back(file);
+    }
+    sqlite3_finalize(stmt);
+    return files;
+}
+
+bool move_document(sqlite3* db, int doc_id, const std::wstring& file_path) {
+    auto lock = lock_connection(db);
+    const char* update_sql = "UPDATE documents SET file_path = ?, file_name = ? WHERE doc_id = ?;";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, update_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return false;
     }
 
+    std::string utf8_file_path = wstring_to_utf8(file_path);
+    std::string utf8_file_name = wstring_to_utf8(std::filesystem::path(file_path).filename().wstring());
+    sqlite3_bind_text(stmt, 1, utf8_file_path.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, utf8_file_name.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 3, doc_id);
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!ok) {
+        std::cerr << "Failed to execute SQL statement: " << sqlite3_errmsg(db) << std::endl;
+    }
     sqlite3_finalize(stmt);
+    g_content_generation++;
+    return ok;
 }
 
 void list_documents(sqlite3* db) {
@@ -165,8 +660,9 @@ void list_documents(sqlite3* db) {
     sqlite3_finalize(stmt);
 }
 
-std::wstring get_text_by_id(sqlite3* db, int id) {
-    const char* select_sql = "SELECT text FROM embeddings WHERE id = ?;";
+std::wstring get_text_by_id(sqlite3* primary, int id) {
+    sqlite3* db = shard_for_id(primary, id);
+    const char* select_sql = "SELECT text FROM paragraph_texts WHERE id = ?;";
     sqlite3_stmt* stmt;
     int rc = sqlite3_prepare_v2(db, select_sql, -1, &stmt, nullptr);
     if (rc != SQLITE_OK) {
@@ -217,7 +713,115 @@ std::wstring get_document_info(sqlite3* db, int doc_id) {
     return file_name;
 }
 
+// Visit the rows of "select_prefix IN (?, ?, ...)" for many keys, chunked to
+// stay under SQLite's host parameter limit
+static void for_each_row_by_keys(sqlite3* db, const char* select_prefix, const std::vector<int>& keys,
+    const std::function<void(sqlite3_stmt*)>& visit) {
+    const size_t max_params = 500;
+
+    for (size_t start = 0; start < keys.size(); start += max_params) {
+        size_t count = std::min(max_params, keys.size() - start);
+
+        std::string select_sql = select_prefix;
+        select_sql += " IN (";
+        for (size_t i = 0; i < count; ++i) {
+            select_sql += (i == 0) ? "?" : ", ?";
+        }
+        select_sql += ");";
+
+        sqlite3_stmt* stmt;
+        int rc = sqlite3_prepare_v2(db, select_sql.c_str(), -1, &stmt, nullptr);
+        if (rc != SQLITE_OK) {
+            std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+            return;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            sqlite3_bind_int(stmt, static_cast<int>(i) + 1, keys[start + i]);
+        }
+
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            visit(stmt);
+        }
+
+        sqlite3_finalize(stmt);
+    }
+}
+
+// Same, over embedding ids spread across shards: each shard is asked only for its own ids
+static void for_each_embedding_row(sqlite3* db, const char* select_prefix, const std::vector<int>& ids,
+    const std::function<void(sqlite3_stmt*)>& visit) {
+    std::vector<sqlite3*> shards = shard_connections(db);
+    if (shards.size() == 1) {
+        for_each_row_by_keys(db, select_prefix, ids, visit);
+        return;
+    }
+
+    std::vector<std::vector<int>> ids_by_shard(shards.size());
+    for (int id : ids) {
+        ids_by_shard[static_cast<size_t>(id) % shards.size()].push_back(id);
+    }
+    for (size_t k = 0; k < shards.size(); ++k) {
+        if (ids_by_shard[k].empty()) continue;
+        for_each_row_by_keys(shards[k], select_prefix, ids_by_shard[k], visit);
+    }
+}
+
+static std::unordered_map<int, std::wstring> select_text_by_keys(sqlite3* db, const char* select_prefix, const std::vector<int>& keys,
+    bool embedding_ids) {
+    std::unordered_map<int, std::wstring> values;
+    values.reserve(keys.size());
+    auto visit = [&values](sqlite3_stmt* stmt) {
+        int key = sqlite3_column_int(stmt, 0);
+        const char* text_data = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        values[key] = utf8_to_wstring(std::string(text_data ? text_data : "", sqlite3_column_bytes(stmt, 1)));
+    };
+    if (embedding_ids) {
+        for_each_embedding_row(db, select_prefix, keys, visit);
+    }
+    else {
+        for_each_row_by_keys(db, select_prefix, keys, visit);
+    }
+    return values;
+}
+
+std::unordered_map<int, std::wstring> get_texts_by_ids(sqlite3* db, const std::vector<int>& ids) {
+    return select_text_by_keys(db, "SELECT id, text FROM paragraph_texts WHERE id", ids, true);
+}
+
+std::unordered_map<int, std::vector<float>> get_embeddings_by_ids(sqlite3* db, const std::vector<int>& ids) {
+    std::unordered_map<int, std::vector<float>> embeddings;
+    embeddings.reserve(ids.size());
+    for_each_embedding_row(db, "SELECT id, embedding FROM embeddings WHERE id", ids, [&embeddings](sqlite3_stmt* stmt) {
+        const float* data = static_cast<const float*>(sqlite3_column_blob(stmt, 1));
+        int num_floats = sqlite3_column_bytes(stmt, 1) / static_cast<int>(sizeof(float));
+        embeddings[sqlite3_column_int(stmt, 0)].assign(data, data + num_floats);
+    });
+    return embeddings;
+}
+
+std::unordered_map<int, std::wstring> get_document_infos(sqlite3* db, const std::vector<int>& doc_ids) {
+    return select_text_by_keys(db, "SELECT doc_id, file_name FROM documents WHERE doc_id", doc_ids, false);
+}
+
+int get_data_version(sqlite3* db) {
+    sqlite3_stmt* stmt;
+    int version = -1;
+    if (sqlite3_prepare_v2(db, "PRAGMA data_version;", -1, &stmt, nullptr) == SQLITE_OK) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return version;
+}
+
+int get_content_generation() {
+    return g_content_generation.load();
+}
+
 void insert_progress(sqlite3* db, int doc_id, int total_paragraphs, int paragraphs_processed, const std::string& status) {
+    auto lock = lock_connection(db);
     const char* insert_sql = "INSERT INTO progress (doc_id, total_paragraphs, paragraphs_processed, status) VALUES (?, ?, ?, ?);";
     sqlite3_stmt* stmt;
     int rc = sqlite3_prepare_v2(db, insert_sql, -1, &stmt, nullptr);
@@ -240,6 +844,7 @@ void insert_progress(sqlite3* db, int doc_id, int total_paragraphs, int paragrap
 }
 
 void update_progress(sqlite3* db, int doc_id, int paragraphs_processed) {
+    auto lock = lock_connection(db);
     const char* update_sql = "UPDATE progress SET paragraphs_processed = ?, last_updated = CURRENT_TIMESTAMP WHERE doc_id = ?;";
     sqlite3_stmt* stmt;
     int rc = sqlite3_prepare_v2(db, update_sql, -1, &stmt, nullptr);
@@ -260,6 +865,7 @@ void update_progress(sqlite3* db, int doc_id, int paragraphs_processed) {
 }
 
 void update_progress_status(sqlite3* db, int doc_id, const std::string& status) {
+    auto lock = lock_connection(db);
     const char* update_sql = "UPDATE progress SET status = ?, last_updated = CURRENT_TIMESTAMP WHERE doc_id = ?;";
     sqlite3_stmt* stmt;
     int rc = sqlite3_prepare_v2(db, update_sql, -1, &stmt, nullptr);
@@ -278,3 +884,150 @@ void update_progress_status(sqlite3* db, int doc_id, const std::string& status)
 
     sqlite3_finalize(stmt);
 }
+
+std::vector<QueuedParagraph> enqueue_paragraphs(sqlite3* db, int doc_id, const std::vector<std::wstring>& paragraphs) {
+    std::vector<QueuedParagraph> queued;
+    if (paragraphs.empty()) {
+        return queued;
+    }
+
+    // One statement for the whole file, so the queue is written with a single
+    // commit even while other files share the connection
+    nlohmann::json texts = nlohmann::json::array();
+    for (const auto& paragraph : paragraphs) {
+        texts.push_back(wstring_to_utf8(paragraph));
+    }
+    const char* insert_sql = "INSERT INTO embedding_queue (doc_id, seq, text) "
+        "SELECT ?, key, value FROM json_each(?) RETURNING id, seq;";
+    auto lock = lock_connection(db);
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, insert_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return queued;
+    }
+
+    std::string texts_json = texts.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+    sqlite3_bind_int(stmt, 1, doc_id);
+    sqlite3_bind_text(stmt, 2, texts_json.c_str(), static_cast<int>(texts_json.size()), SQLITE_TRANSIENT);
+
+    queued.resize(paragraphs.size());
+    size_t returned = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        size_t seq = static_cast<size_t>(sqlite3_column_int(stmt, 1));
+        if (seq < queued.size()) {
+            queued[seq] = { sqlite3_column_int(stmt, 0), doc_id, paragraphs[seq], 0 };
+            returned++;
+        }
+    }
+    if (rc != SQLITE_DONE || returned != paragraphs.size()) {
+        std::cerr << "Failed to queue paragraphs: " << sqlite3_errmsg(db) << std::endl;
+        queued.clear();
+    }
+
+    sqlite3_finalize(stmt);
+    return queued;
+}
+
+std::vector<QueuedParagraph> get_queued_paragraphs(sqlite3* db) {
+    std::vector<QueuedParagraph> queued;
+    const char* select_sql = "SELECT id, doc_id, text, attempts FROM embedding_queue ORDER BY doc_id, seq;";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, select_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return queued;
+    }
+
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* text_data = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+        queued.push_back({
+            sqlite3_column_int(stmt, 0),
+            sqlite3_column_int(stmt, 1),
+            utf8_to_wstring(std::string(text_data ? text_data : "", sqlite3_column_bytes(stmt, 2))),
+            sqlite3_column_int(stmt, 3)
+        });
+    }
+
+    sqlite3_finalize(stmt);
+    return queued;
+}
+
+int count_queued_paragraphs(sqlite3* db, int doc_id) {
+    const char* select_sql = "SELECT COUNT(*) FROM embedding_queue WHERE doc_id = ?;";
+    sqlite3_stmt* stmt;
+    int count = 0;
+    if (sqlite3_prepare_v2(db, select_sql, -1, &stmt, nullptr) == SQLITE_OK) {
+        sqlite3_bind_int(stmt, 1, doc_id);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            count = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    return count;
+}
+
+void dequeue_paragraphs(sqlite3* db, const std::vector<int>& queue_ids) {
+    auto lock = lock_connection(db);
+    // A DELETE yields no rows; the helper only supplies the chunked IN list
+    for_each_row_by_keys(db, "DELETE FROM embedding_queue WHERE id", queue_ids, [](sqlite3_stmt*) {});
+}
+
+void record_paragraph_failure(sqlite3* db, int queue_id, const std::string& error) {
+    auto lock = lock_connection(db);
+    const char* update_sql = "UPDATE embedding_queue SET attempts = attempts + 1, last_error = ? WHERE id = ?;";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, update_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return;
+    }
+
+    sqlite3_bind_text(stmt, 1, error.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 2, queue_id);
+
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        std::cerr << "Failed to update the embedding queue: " << sqlite3_errmsg(db) << std::endl;
+    }
+
+    sqlite3_finalize(stmt);
+}
+
+bool has_embedding(sqlite3* db, int doc_id, const std::wstring& text) {
+    std::string utf8_text = wstring_to_utf8(text);
+    auto has_row = [doc_id, &utf8_text](sqlite3* connection, const char* select_sql) {
+        sqlite3_stmt* stmt;
+        bool found = false;
+        if (sqlite3_prepare_v2(connection, select_sql, -1, &stmt, nullptr) == SQLITE_OK) {
+            sqlite3_bind_int(stmt, 1, doc_id);
+            sqlite3_bind_text(stmt, 2, utf8_text.c_str(), -1, SQLITE_TRANSIENT);
+            found = sqlite3_step(stmt) == SQLITE_ROW;
+            sqlite3_finalize(stmt);
+        }
+        return found;
+    };
+    return has_row(shard_for_id(db, doc_id), "SELECT 1 FROM paragraph_texts WHERE doc_id = ? AND text = ? LIMIT 1;")
+        || has_row(db, "SELECT 1 FROM near_duplicates WHERE doc_id = ? AND text = ? LIMIT 1;");
+}
+
+void advance_progress(sqlite3* db, int doc_id, int paragraphs) {
+    auto lock = lock_connection(db);
+    const char* update_sql = "UPDATE progress SET paragraphs_processed = paragraphs_processed + ?, last_updated = CURRENT_TIMESTAMP WHERE doc_id = ?;";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, update_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return;
+    }
+
+    sqlite3_bind_int(stmt, 1, paragraphs);
+    sqlite3_bind_int(stmt, 2, doc_id);
+
+    rc = sqlite3_step(stmt);
+    if (rc != SQLITE_DONE) {
+        std::cerr << "Failed to update progress: " << sqlite3_errmsg(db) << std::endl;
+    }
+
+    sqlite3_finalize(stmt);
+}
@@ -0,0 +1,193 @@
+// document_centroids.cpp
+
+#include "document_centroids.h"
+#include "shards.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+bool prepare(sqlite3* db, const char* sql, sqlite3_stmt** stmt) {
+    if (sqlite3_prepare_v2(db, sql, -1, stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// A sum with a different dimension than the stored one is dropped: the
+// centroid stays that of the first dimension seen, as load_vector_index does
+void vector_sum(sqlite3_context* context, int, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+        sqlite3_result_value(context, argv[1]);
+        return;
+    }
+    int bytes = sqlite3_value_bytes(argv[0]);
+    if (sqlite3_value_bytes(argv[1]) != bytes || bytes % sizeof(float) != 0) {
+        sqlite3_result_value(context, argv[0]);
+        return;
+    }
+
+    size_t count = bytes / sizeof(float);
+    std::vector<float> a(count);
+    std::vector<float> b(count);
+    memcpy(a.data(), sqlite3_value_blob(argv[0]), bytes);
+    memcpy(b.data(), sqlite3_value_blob(argv[1]), bytes);
+    for (size_t i = 0; i < count; ++i) {
+        a[i] += b[i];
+    }
+    sqlite3_result_blob(context, a.data(), bytes, SQLITE_TRANSIENT);
+}
+
+void add_normalized(std::vector<float>& sum, const float* embedding, size_t dim) {
+    float norm = 0.0f;
+    for (size_t d = 0; d < dim; ++d) {
+        norm += embedding[d] * embedding[d];
+    }
+    float scale = 1.0f / (std::sqrt(norm) + 1e-8f);
+    for (size_t d = 0; d < dim; ++d) {
+        sum[d] += embedding[d] * scale;
+    }
+}
+
+bool insert_centroid(sqlite3* shard, int doc_id, const std::vector<float>& sum, int paragraphs) {
+    const char* upsert_sql = "INSERT INTO document_centroids (doc_id, paragraphs, embedding_sum) VALUES (?1, ?2, ?3) "
+        "ON CONFLICT(doc_id) DO UPDATE SET paragraphs = paragraphs + excluded.paragraphs, "
+        "embedding_sum = vector_sum(embedding_sum, excluded.embedding_sum);";
+    auto lock = lock_connection(shard);
+    sqlite3_stmt* stmt;
+    if (!prepare(shard, upsert_sql, &stmt)) {
+        return false;
+    }
+    sqlite3_bind_int(stmt, 1, doc_id);
+    sqlite3_bind_int(stmt, 2, paragraphs);
+    sqlite3_bind_blob(stmt, 3, sum.data(), static_cast<int>(sum.size() * sizeof(float)), SQLITE_TRANSIENT);
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!ok) {
+        std::cerr << "Failed to update document centroid: " << sqlite3_errmsg(shard) << std::endl;
+    }
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+// Sum one document's stored embeddings into a new centroid row
+bool build_centroid(sqlite3* shard, sqlite3_stmt* select_stmt, int doc_id) {
+    std::vector<float> sum;
+    int paragraphs = 0;
+    sqlite3_bind_int(select_stmt, 1, doc_id);
+    while (sqlite3_step(select_stmt) == SQLITE_ROW) {
+        size_t dim = sqlite3_column_bytes(select_stmt, 0) / sizeof(float);
+        if (dim == 0) continue;
+        if (sum.empty()) {
+            sum.assign(dim, 0.0f);
+        }
+        else if (dim != sum.size()) {
+            continue;
+        }
+        add_normalized(sum, static_cast<const float*>(sqlite3_column_blob(select_stmt, 0)), dim);
+        paragraphs++;
+    }
+    sqlite3_reset(select_stmt);
+    return paragraphs > 0 && insert_centroid(shard, doc_id, sum, paragraphs);
+}
+
+} // namespace
+
+void register_vector_functions(sqlite3* db) {
+    sqlite3_create_function(db, "vector_sum", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, vector_sum, nullptr, nullptr);
+}
+
+void add_to_document_centroid(sqlite3* primary, int doc_id, const std::vector<float>& sum, int paragraphs) {
+    if (paragraphs == 0 || sum.empty()) {
+        return;
+    }
+    insert_centroid(shard_for_id(primary, doc_id), doc_id, sum, paragraphs);
+}
+
+size_t build_missing_document_centroids(sqlite3* primary) {
+    std::vector<sqlite3*> shards = shard_connections(primary);
+    std::vector<size_t> built(shards.size(), 0);
+    run_on_shards(shards.size(), [&](size_t k) {
+        sqlite3* shard = shards[k];
+        sqlite3_stmt* stmt;
+        if (!prepare(shard, "SELECT DISTINCT doc_id FROM embeddings WHERE doc_id NOT IN (SELECT doc_id FROM document_centroids);", &stmt)) {
+            return;
+        }
+        std::vector<int> doc_ids;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            doc_ids.push_back(sqlite3_column_int(stmt, 0));
+        }
+        sqlite3_finalize(stmt);
+        if (doc_ids.empty() || !prepare(shard, "SELECT embedding FROM embeddings WHERE doc_id = ? ORDER BY id;", &stmt)) {
+            return;
+        }
+
+        auto lock = lock_connection(shard);
+        sqlite3_exec(shard, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+        for (int doc_id : doc_ids) {
+            if (build_centroid(shard, stmt, doc_id)) {
+                built[k]++;
+            }
+        }
+        sqlite3_exec(shard, "COMMIT;", nullptr, nullptr, nullptr);
+        sqlite3_finalize(stmt);
+    });
+
+    size_t total = 0;
+    for (size_t n : built) {
+        total += n;
+    }
+    return total;
+}
+
+std::vector<int> rank_stored_documents(sqlite3* primary, const std::vector<float>& query, size_t n) {
+    struct DocumentScore {
+        int doc_id;
+        float similarity;
+    };
+
+    float query_norm = 0.0f;
+    for (float value : query) {
+        query_norm += value * value;
+    }
+    query_norm = std::sqrt(query_norm);
+
+    std::vector<sqlite3*> shards = shard_connections(primary);
+    std::vector<std::vector<DocumentScore>> shard_scores(shards.size());
+    run_on_shards(shards.size(), [&](size_t k) {
+        sqlite3_stmt* stmt;
+        if (!prepare(shards[k], "SELECT doc_id, embedding_sum FROM document_centroids;", &stmt)) {
+            return;
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            if (sqlite3_column_bytes(stmt, 1) != static_cast<int>(query.size() * sizeof(float))) continue;
+            const float* sum = static_cast<const float*>(sqlite3_column_blob(stmt, 1));
+            float dot_product = 0.0f;
+            float norm = 0.0f;
+            for (size_t d = 0; d < query.size(); ++d) {
+                dot_product += sum[d] * query[d];
+                norm += sum[d] * sum[d];
+            }
+            shard_scores[k].push_back({ sqlite3_column_int(stmt, 0), dot_product / (std::sqrt(norm) * query_norm + 1e-8f) });
+        }
+        sqlite3_finalize(stmt);
+    });
+
+    std::vector<DocumentScore> scores;
+    for (const auto& per_shard : shard_scores) {
+        scores.insert(scores.end(), per_shard.begin(), per_shard.end());
+    }
+    std::vector<int> doc_ids;
+    if (scores.size() <= n) {
+        return doc_ids;
+    }
+    std::partial_sort(scores.begin(), scores.begin() + n, scores.end(), [](const DocumentScore& a, const DocumentScore& b) {
+        return a.similarity > b.similarity;
+    });
+    for (size_t i = 0; i < n; ++i) {
+        doc_ids.push_back(scores[i].doc_id);
+    }
+    return doc_ids;
+}
@@ -7,33 +7,56 @@
 #include "file_handler.h"
 #include "utils.h"
 #include "encoding_utils.h"
+#include "context_cache.h"
+#include "answer_cache.h"
+#include "bpe_tokenizer.h"
+#include "metrics.h"
+#include "shards.h"
+#include "thread_pool.h"
+#include "vector_projection.h"
+#include "request_scheduler.h"
+#include "near_duplicates.h"
+#include "document_centroids.h"
+#include "text_store.h"
+#include "file_watcher.h"
+#include "file_reader.h"
 #include <iostream>
 #include <filesystem>
 #include <algorithm>
 #include <cstring>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <unordered_set>
+#include <cmath>
+#include <nlohmann/json.hpp>
 
-// Define SimilarityResult struct and retrieve_similar_embeddings function
-struct SimilarityResult {
-    int id;
-    int doc_id;
-    float similarity;
-};
-
-std::vector<SimilarityResult> retrieve_similar_embeddings(
-    const std::vector<float>& query_embedding,
-    sqlite3* db) {
-
+// Score every embedding stored in one shard, unsorted; reduced copies when a
+// projection is active. With documents (a JSON array of doc_ids), only those
+// documents and the ones without a centroid yet are scanned.
+static std::vector<SimilarityResult> scan_shard_embeddings(const std::vector<float>& query_embedding, sqlite3* db, bool reduced,
+    const std::string& documents) {
     std::vector<SimilarityResult> results;
 
-    const char* select_sql = "SELECT id, doc_id, embedding FROM embeddings;";
+    std::string select_sql = reduced
+        ? "SELECT id, doc_id, embedding FROM reduced_embeddings"
+        : "SELECT id, doc_id, embedding FROM embeddings";
+    if (!documents.empty()) {
+        select_sql += " WHERE doc_id IN (SELECT value FROM json_each(?1)) OR doc_id NOT IN (SELECT doc_id FROM document_centroids)";
+    }
     sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(db, select_sql, -1, &stmt, nullptr);
+    int rc = sqlite3_prepare_v2(db, select_sql.c_str(), -1, &stmt, nullptr);
     if (rc != SQLITE_OK) {
         std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
         return results;
     }
+    if (!documents.empty()) {
+        sqlite3_bind_text(stmt, 1, documents.c_str(), static_cast<int>(documents.size()), SQLITE_STATIC);
+    }
 
     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
         int id = sqlite3_column_int(stmt, 0);
@@ -50,11 +73,54 @@ std::vector<SimilarityResult> retrieve_similar_embeddings(
     }
 
     sqlite3_finalize(stmt);
+    return results;
+}
 
-    std::sort(results.begin(), results.end(), [](const SimilarityResult& a, const SimilarityResult& b) {
+std::vector<SimilarityResult> retrieve_similar_embeddings(
+    const std::vector<float>& query_embedding,
+    sqlite3* db) {
+    StageTimer timer(Stage::VectorSearch);
+
+    // With a projection, scan the short vectors first and re-rank the best at full dimension
+    std::shared_ptr<const VectorProjection> projection = load_projection(db);
+    std::vector<float> scan_query = projection ? project_vector(*projection, query_embedding) : query_embedding;
+    bool reduced = projection && !scan_query.empty();
+    if (!reduced) {
+        scan_query = query_embedding;
+    }
+
+    // Rank the documents first when coarse-to-fine retrieval is on and would prune any
+    std::string documents;
+    if (coarse_documents() > 0) {
+        std::vector<int> doc_ids = rank_stored_documents(db, query_embedding, coarse_documents());
+        if (!doc_ids.empty()) {
+            documents = nlohmann::json(doc_ids).dump();
+        }
+    }
+
+    // Scan the shards in parallel, then merge
+    std::vector<sqlite3*> shards = shard_connections(db);
+    std::vector<std::vector<SimilarityResult>> shard_results(shards.size());
+    run_on_shards(shards.size(), [&](size_t k) {
+        shard_results[k] = scan_shard_embeddings(scan_query, shards[k], reduced, documents);
+    });
+
+    std::vector<SimilarityResult> results = std::move(shard_results[0]);
+    for (size_t k = 1; k < shard_results.size(); ++k) {
+        results.insert(results.end(), shard_results[k].begin(), shard_results[k].end());
+    }
+
+    auto by_similarity = [](const SimilarityResult& a, const SimilarityResult& b) {
         return a.similarity > b.similarity;
-        });
+    };
+    if (reduced) {
+        size_t keep = std::min(rerank_candidates, results.size());
+        std::partial_sort(results.begin(), results.begin() + keep, results.end(), by_similarity);
+        results.resize(keep);
+        return rerank_full_dimension(db, query_embedding, results, keep);
+    }
 
+    std::sort(results.begin(), results.end(), by_similarity);
     return results;
 }
 
@@ -105,55 +171,516 @@ void monitor_progress(sqlite3* db) {
 
 // Helper function to check if the extension is supported
 bool is_supported_extension(const std::wstring& extension) {
-    static const std::vector<std::wstring> supported_extensions = { L".txt", L".pdf", L".png", L".jpg", L".jpeg", L".bmp" };
-    return std::find(supported_extensions.begin(), supported_extensions.end(), extension) != supported_extensions.end();
+    static const std::unordered_set<std::wstring> supported_extensions = { L".txt", L".pdf", L".png", L".jpg", L".jpeg", L".bmp" };
+    return supported_extensions.count(extension) > 0;
+}
+
+// Workers issuing embedding requests for all files being embedded; the
+// request scheduler decides how many of them may have a request in flight
+static ThreadPool& embedding_request_pool() {
+    static ThreadPool pool(max_concurrent_requests());
+    return pool;
+}
+
+// Successfully stored paragraphs are dequeued in batches of this many
+const size_t dequeue_batch_size = 32;
+
+// A paragraph the first pass found to be a copy of an embedded one
+struct PlannedLink {
+    size_t paragraph;
+    size_t original;            // Earlier paragraph of the batch, when match.id is -1
+    NearDuplicateMatch match;
+};
+
+// Embed queued paragraphs of one document with several requests in flight,
+// storing each as soon as its embedding arrives so one paragraph waiting out
+// a retry does not hold up the rest. Paragraphs whose requests fail for good
+// stay queued with their attempt count raised. With skip_stored, a paragraph
+// an interrupted run already stored is only dequeued. Near-duplicates of a
+// stored paragraph, or of an earlier one in the batch, are linked to it
+// instead of embedded; linked counts those.
+static size_t embed_queued_paragraphs(sqlite3* db, const std::string& api_key, const std::vector<QueuedParagraph>& queued, bool skip_stored,
+    size_t& linked) {
+    linked = 0;
+    if (queued.empty()) {
+        return 0;
+    }
+    const int doc_id = queued[0].doc_id;
+    const double threshold = near_duplicate_threshold();
+
+    // Dequeues, signatures and the document centroid are written in batches;
+    // a signature only has to be in place before the next file is checked
+    // against it, and searches scan a document without a centroid in full
+    size_t embedded = 0;
+    std::vector<int> done_ids;
+    std::vector<StoredSignature> new_signatures;
+    std::vector<float> centroid_sum;
+    int centroid_paragraphs = 0;
+    auto flush = [&]() {
+        dequeue_paragraphs(db, done_ids);
+        done_ids.clear();
+        if (!new_signatures.empty()) {
+            insert_minhash_signatures(db, new_signatures);
+            new_signatures.clear();
+        }
+        if (centroid_paragraphs > 0) {
+            add_to_document_centroid(db, doc_id, centroid_sum, centroid_paragraphs);
+            centroid_sum.clear();
+            centroid_paragraphs = 0;
+        }
+    };
+    auto add_to_centroid = [&](const std::vector<float>& embedding) {
+        if (centroid_sum.empty()) {
+            centroid_sum.assign(embedding.size(), 0.0f);
+        }
+        else if (centroid_sum.size() != embedding.size()) {
+            return;
+        }
+        float norm = 0.0f;
+        for (float value : embedding) {
+            norm += value * value;
+        }
+        float scale = 1.0f / (std::sqrt(norm) + 1e-8f);
+        for (size_t d = 0; d < embedding.size(); ++d) {
+            centroid_sum[d] += embedding[d] * scale;
+        }
+        centroid_paragraphs++;
+    };
+    auto mark_done = [&](size_t i) {
+        done_ids.push_back(queued[i].id);
+        if (done_ids.size() >= dequeue_batch_size) {
+            flush();
+        }
+    };
+
+    // Whether paragraph i needs an embedding request; the others are already
+    // stored (skip_stored) or near-duplicates, linked once the loop is done
+    std::vector<MinHashSignature> signatures(threshold > 0.0 ? queued.size() : 0);
+    std::vector<PlannedLink> links;
+    MinHashIndex batch;
+    auto needs_request = [&](size_t i) {
+        if (skip_stored && has_embedding(db, doc_id, queued[i].text)) {
+            embedded++;
+            mark_done(i);
+            return false;
+        }
+        if (threshold <= 0.0) {
+            return true;
+        }
+
+        PlannedLink link{ i, 0, NearDuplicateMatch() };
+        bool stored_copy;
+        {
+            StageTimer timer(Stage::NearDuplicateCheck);
+            signatures[i] = minhash_signature(queued[i].text);
+            stored_copy = find_stored_near_duplicate(db, signatures[i], threshold, link.match);
+        }
+        if (stored_copy) {
+            links.push_back(link);
+            return false;
+        }
+        int original = batch.find(signatures[i], threshold, &link.match.similarity);
+        if (original >= 0) {
+            link.original = static_cast<size_t>(original);
+            links.push_back(link);
+            return false;
+        }
+        batch.add(static_cast<int>(i), signatures[i]);
+        return true;
+    };
+
+    std::vector<int> stored_ids(queued.size(), -1);
+    std::vector<std::vector<float>> embeddings(queued.size());
+    std::deque<size_t> finished;
+    std::mutex mutex;
+    std::condition_variable paragraph_finished;
+
+    auto submit = [&](size_t i) {
+        embedding_request_pool().submit([&, i]() {
+            std::vector<float> embedding;
+            try {
+                embedding = get_embedding(tokenize_text(queued[i].text), api_key);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Embedding request failed: " << e.what() << std::endl;
+            }
+            // Notify under the lock: the writer owns these locals and may return as soon as it sees the last one
+            std::lock_guard<std::mutex> lock(mutex);
+            embeddings[i] = std::move(embedding);
+            finished.push_back(i);
+            paragraph_finished.notify_all();
+        });
+    };
+
+    // Keep a bounded number of this file's requests outstanding. Paragraphs
+    // are checked just before their turn, while earlier requests are in flight.
+    const size_t lookahead = 2 * max_concurrent_requests();
+    size_t next = 0;
+    size_t outstanding = 0;
+    auto top_up = [&]() {
+        while (outstanding < lookahead && next < queued.size()) {
+            size_t i = next++;
+            if (needs_request(i)) {
+                submit(i);
+                outstanding++;
+            }
+        }
+    };
+
+    for (top_up(); outstanding > 0; top_up()) {
+        size_t i;
+        std::vector<float> embedding;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            paragraph_finished.wait(lock, [&] { return !finished.empty(); });
+            i = finished.front();
+            finished.pop_front();
+            embedding = std::move(embeddings[i]);
+        }
+        outstanding--;
+
+        if (embedding.empty()) {
+            std::cerr << "Failed to generate embedding, leaving the paragraph queued for the next run." << std::endl;
+            record_paragraph_failure(db, queued[i].id, "embedding request failed");
+            continue;
+        }
+        stored_ids[i] = insert_embedding(db, doc_id, queued[i].text, embedding);
+        if (stored_ids[i] >= 0) {
+            add_to_centroid(embedding);
+            if (threshold > 0.0) {
+                new_signatures.push_back({ stored_ids[i], doc_id, signatures[i] });
+            }
+        }
+        advance_progress(db, doc_id, 1);
+        embedded++;
+        mark_done(i);
+    }
+
+    // Copies of a paragraph in this batch wait for it to be stored; if it
+    // failed, they stay queued and are looked at again on the next run
+    for (PlannedLink& link : links) {
+        if (link.match.id < 0) {
+            link.match.id = stored_ids[link.original];
+            link.match.doc_id = doc_id;
+        }
+        if (link.match.id < 0 || !link_near_duplicate(db, doc_id, queued[link.paragraph].text, link.match)) {
+            continue;
+        }
+        advance_progress(db, doc_id, 1);
+        embedded++;
+        linked++;
+        mark_done(link.paragraph);
+    }
+    flush();
+    return embedded;
+}
+
+// Record how far a document got, and compress the text of the paragraphs stored for it
+static void finish_document(sqlite3* db, int doc_id) {
+    int remaining = count_queued_paragraphs(db, doc_id);
+    update_progress_status(db, doc_id, remaining == 0 ? "Completed" : "Retry Pending");
+    pack_document_texts(db, doc_id);
+}
+
+// Directories listed at once while crawling
+const size_t crawl_threads = 8;
+
+// Files read ahead of the writers that embed them, and at most as many more
+// numbered and waiting for their writer; all of them within the reader's
+// byte budget, since a file's buffer is released only once it is embedded
+const size_t read_ahead_files = 64;
+
+static bool is_embeddable_file(const std::wstring& path) {
+    std::wstring extension = std::filesystem::path(path).extension().wstring();
+    if (is_supported_extension(extension)) {
+        return true;
+    }
+    std::wcerr << L"Unsupported file format: " << extension << L" Skipping file: " << path << std::endl;
+    return false;
+}
+
+static int begin_document(const FileContents& file, sqlite3* db);
+static void embed_document(const FileContents& file, int doc_id, const std::string& api_key, sqlite3* db);
+
+// Embed files on one writer per shard: files are numbered here, in order, and
+// document d goes to the writer of shard d % shard_count, the only thread that
+// writes to that shard. Shards have separate write locks, so their writers
+// proceed in parallel; a single shard keeps the serial order. Text and PDF
+// files are read ahead, many at once, while the writers wait on the embedding API.
+static void embed_files(const std::vector<std::wstring>& files, const std::string& api_key, sqlite3* db) {
+    std::vector<std::wstring> readable;
+    std::vector<std::wstring> others;
+    for (const auto& file_path : files) {
+        std::wstring extension = get_file_extension(file_path);
+        if (extension == L".txt" || extension == L".pdf") {
+            readable.push_back(file_path);
+        }
+        else {
+            others.push_back(file_path);
+        }
+    }
+
+    // The reader and the count of waiting files outlive the writers, which
+    // drain before they are destroyed
+    FileReader reader(read_ahead_files);
+    reader.start(std::move(readable));
+    std::mutex mutex;
+    std::condition_variable file_embedded;
+    size_t waiting = 0;
+    std::vector<std::unique_ptr<ThreadPool>> writers;
+    for (size_t k = 0; k < shard_count(db); ++k) {
+        writers.push_back(std::make_unique<ThreadPool>(1));
+    }
+
+    auto dispatch = [&](FileContents& file) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            file_embedded.wait(lock, [&] { return waiting < read_ahead_files; });
+            waiting++;
+        }
+        int doc_id = begin_document(file, db);
+        if (doc_id == -1) {
+            reader.release(std::move(file.data));
+            std::lock_guard<std::mutex> lock(mutex);
+            waiting--;
+            return;
+        }
+        writers[shard_index(db, doc_id)]->submit([&, doc_id, file = std::move(file)]() mutable {
+            embed_document(file, doc_id, api_key, db);
+            reader.release(std::move(file.data));
+            // Notify under the lock: the dispatcher owns these locals
+            std::lock_guard<std::mutex> lock(mutex);
+            waiting--;
+            file_embedded.notify_one();
+        });
+    };
+
+    FileContents file;
+    while (reader.next(file)) {
+        dispatch(file);
+    }
+    for (const auto& file_path : others) {
+        FileContents unread;
+        unread.path = file_path;
+        dispatch(unread);
+    }
 }
 
 void process_paths(const std::vector<std::wstring>& paths, const std::string& api_key, sqlite3* db) {
+    // Finish what earlier runs left queued before starting on new files
+    resume_embedding_queue(db, api_key);
+
+    std::vector<std::wstring> roots;
     for (const auto& path : paths) {
-        if (std::filesystem::exists(path)) {
-            if (std::filesystem::is_regular_file(path)) {
-                // Process a single file
-                embed_file(path, api_key, db);
+        std::error_code error;
+        if (!std::filesystem::exists(path, error)) {
+            std::wcerr << L"Path does not exist: " << path << std::endl;
+        }
+        else if (!std::filesystem::is_regular_file(path, error) && !std::filesystem::is_directory(path, error)) {
+            std::wcerr << L"Unsupported path type (not a file or directory): " << path << std::endl;
+        }
+        else {
+            roots.push_back(path);
+        }
+    }
+
+    // Files named directly are embedded whatever their extension says, as before
+    std::vector<std::wstring> files = crawl_files(roots, [&roots](const std::wstring& path) {
+        return std::find(roots.begin(), roots.end(), path) != roots.end() || is_embeddable_file(path);
+    }, crawl_threads);
+    embed_files(files, api_key, db);
+}
+
+// Changes to a path are acted on once it has been quiet this long, so the
+// bursts of writes and renames an editor makes while saving embed the file once
+const std::chrono::milliseconds watch_debounce(1000);
+
+// Without change notifications, the watched paths are rescanned this often
+const std::chrono::seconds watch_poll_interval(10);
+
+static bool get_file_version(const std::wstring& path, FileVersion& version) {
+    std::error_code error;
+    version.size = static_cast<long long>(std::filesystem::file_size(path, error));
+    if (error) return false;
+    version.modified = static_cast<long long>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+    return !error;
+}
+
+// Bring the documents embedded from the given paths in line with the file
+// system: new files are embedded, changed ones replaced, and documents whose
+// file is gone deleted, unless a new file with the same size and modification
+// time shows it was renamed. Paths may be files or directories, existing or not.
+static void sync_watched_paths(const std::vector<std::wstring>& paths, const std::string& api_key, sqlite3* db) {
+    std::vector<StoredFile> stored = get_stored_files(db);
+    std::unordered_map<std::wstring, size_t> stored_by_path;
+    for (size_t i = 0; i < stored.size(); ++i) {
+        stored_by_path[stored[i].file_path] = i;
+    }
+
+    // Quietly: editors leave swap and backup files next to the ones they save
+    std::vector<std::wstring> present = crawl_files(paths, [](const std::wstring& path) {
+        return is_supported_extension(std::filesystem::path(path).extension().wstring());
+    }, crawl_threads);
+    std::unordered_set<std::wstring> present_set(present.begin(), present.end());
+
+    // Documents under the paths whose file no longer exists
+    std::vector<size_t> vanished;
+    for (size_t i = 0; i < stored.size(); ++i) {
+        if (present_set.count(stored[i].file_path)) continue;
+        for (const auto& path : paths) {
+            if (path_is_within(stored[i].file_path, path)) {
+                vanished.push_back(i);
+                break;
             }
-            else if (std::filesystem::is_directory(path)) {
-                // Recursively process directory
-                for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
-                    if (entry.is_regular_file()) {
-                        // Check if the file has a supported extension
-                        std::wstring extension = entry.path().extension().wstring();
-                        if (is_supported_extension(extension)) {
-                            embed_file(entry.path().wstring(), api_key, db);
-                        }
-                        else {
-                            std::wcerr << L"Unsupported file format: " << extension << L" Skipping file: " << entry.path().wstring() << std::endl;
-                        }
-                    }
-                }
+        }
+    }
+
+    std::vector<std::wstring> to_embed;
+    std::vector<int> to_delete;
+    std::vector<char> renamed(stored.size(), 0);
+    for (const auto& path : present) {
+        FileVersion version;
+        if (!get_file_version(path, version)) continue;
+
+        auto it = stored_by_path.find(path);
+        if (it != stored_by_path.end()) {
+            if (stored[it->second].version != version) {
+                to_delete.push_back(stored[it->second].doc_id);
+                to_embed.push_back(path);
+            }
+            continue;
+        }
+
+        auto moved = std::find_if(vanished.begin(), vanished.end(), [&](size_t i) {
+            return !renamed[i] && stored[i].version == version
+                && get_file_extension(stored[i].file_path) == get_file_extension(path);
+        });
+        if (moved != vanished.end() && move_document(db, stored[*moved].doc_id, path)) {
+            renamed[*moved] = 1;
+            std::wcout << L"Renamed document (ID: " << stored[*moved].doc_id << L"): " << stored[*moved].file_path
+                << L" -> " << path << std::endl;
+            continue;
+        }
+        to_embed.push_back(path);
+    }
+    for (size_t i : vanished) {
+        if (!renamed[i]) {
+            to_delete.push_back(stored[i].doc_id);
+        }
+    }
+
+    // Replaced documents go first, so a search never sees both versions
+    if (!to_delete.empty()) {
+        delete_documents(to_delete, db);
+    }
+    embed_files(to_embed, api_key, db);
+    // Copies of deleted paragraphs in other documents were queued again
+    if (!to_delete.empty()) {
+        resume_embedding_queue(db, api_key);
+    }
+}
+
+void watch_paths(const std::vector<std::wstring>& paths, const std::string& api_key, sqlite3* db) {
+    resume_embedding_queue(db, api_key);
+
+    std::vector<std::wstring> roots;
+    for (const auto& path : paths) {
+        roots.push_back(normalize_path(path));
+    }
+
+    // Subscribe before the initial crawl, so nothing changed during it is missed
+    FileWatcher watcher;
+    bool notifications = watcher.start(roots);
+    sync_watched_paths(roots, api_key, db);
+    if (notifications) {
+        std::wcout << L"Watching " << roots.size() << L" paths for changes; press Ctrl+C to stop." << std::endl;
+    }
+    else {
+        std::wcout << L"Change notifications are unavailable; rescanning every " << watch_poll_interval.count() << L" s." << std::endl;
+    }
+
+    using clock = std::chrono::steady_clock;
+    std::unordered_map<std::wstring, clock::time_point> dirty;     // Path -> time of its latest change
+    while (true) {
+        if (!notifications) {
+            std::this_thread::sleep_for(watch_poll_interval);
+            sync_watched_paths(roots, api_key, db);
+            continue;
+        }
+
+        std::vector<std::wstring> changed;
+        bool complete = watcher.wait(std::chrono::milliseconds(200), changed);
+        auto now = clock::now();
+        for (const auto& path : changed) {
+            dirty[path] = now;
+        }
+        if (!complete) {
+            std::wcerr << L"Change notifications were lost; rescanning the watched paths." << std::endl;
+            dirty.clear();
+            sync_watched_paths(roots, api_key, db);
+            continue;
+        }
+
+        std::vector<std::wstring> settled;
+        for (auto it = dirty.begin(); it != dirty.end();) {
+            if (now - it->second >= watch_debounce) {
+                settled.push_back(it->first);
+                it = dirty.erase(it);
             }
             else {
-                std::wcerr << L"Unsupported path type (not a file or directory): " << path << std::endl;
+                ++it;
             }
         }
-        else {
-            std::wcerr << L"Path does not exist: " << path << std::endl;
+        if (!settled.empty()) {
+            sync_watched_paths(settled, api_key, db);
         }
     }
 }
 
+// Input limit of text-embedding-ada-002
+const size_t max_embedding_tokens = 8191;
+
 void embed_file(const std::wstring& file_path, const std::string& api_key, sqlite3* db) {
+    FileContents file;
+    file.path = file_path;
+    int doc_id = begin_document(file, db);
+    if (doc_id != -1) {
+        embed_document(file, doc_id, api_key, db);
+    }
+}
+
+// Record a file as a new document; returns its doc_id, or -1
+static int begin_document(const FileContents& file, sqlite3* db) {
+    const std::wstring& file_path = file.path;
+
     // Get file name
     std::wstring file_name = std::filesystem::path(file_path).filename().wstring();
 
-    // Insert document info, get doc_id
-    int doc_id = insert_document(db, file_name);
+    // Insert document info, get doc_id. The version is taken before reading,
+    // so a write during embedding shows up as a change to --watch.
+    FileVersion version;
+    if (file.read) {
+        version.size = file.size;
+        version.modified = file.modified;
+    }
+    else {
+        get_file_version(file_path, version);
+    }
+    int doc_id = insert_document(db, file_name, normalize_path(file_path), version);
 
     if (doc_id == -1) {
         std::cerr << "Document insertion failed, skipping embedding." << std::endl;
-        return;
+        return -1;
     }
 
     std::wcout << L"Embedding document (ID: " << doc_id << L"): " << file_name << std::endl;
+    return doc_id;
+}
+
+// Embed a file read ahead by a FileReader, or read it here when it was not
+static void embed_document(const FileContents& file, int doc_id, const std::string& api_key, sqlite3* db) {
+    const std::wstring& file_path = file.path;
+    std::wstring file_name = std::filesystem::path(file_path).filename().wstring();
 
     // Detect file extension
     std::wstring extension = get_file_extension(file_path);
@@ -162,11 +689,13 @@ void embed_file(const std::wstring& file_path, const std::string& api_key, sqlit
 
     if (extension == L".txt") {
         // Handle text files
-        file_content = read_text_file(file_path);
+        StageTimer timer(Stage::FileRead);
+        file_content = file.read ? utf8_to_wstring(file.data) : read_text_file(file_path);
     }
     else if (extension == L".pdf") {
         // Handle PDF files
-        file_content = extract_text_from_pdf(file_path);
+        StageTimer timer(Stage::PdfExtract);
+        file_content = file.read ? extract_text_from_pdf_data(file.data, file_path) : extract_text_from_pdf(file_path);
     }
     /*
     else if (extension == L".png" || extension == L".jpg" || extension == L".jpeg" || extension == L".bmp") {
@@ -184,41 +713,241 @@ void embed_file(const std::wstring& file_path, const std::string& api_key, sqlit
         return;
     }
 
+    if (file.read) {
+        add_counter(Counter::BytesRead, file.data.size());
+    }
+    else {
+        std::error_code size_error;
+        uintmax_t file_size = std::filesystem::file_size(file_path, size_error);
+        add_counter(Counter::BytesRead, size_error ? 0 : static_cast<uint64_t>(file_size));
+    }
+
     // Split into paragraphs
-    std::vector<std::wstring> paragraphs = split_paragraphs(file_content);
+    std::vector<std::wstring> paragraphs;
+    {
+        StageTimer timer(Stage::Chunking);
+        paragraphs = split_paragraphs(file_content);
+    }
 
     int total_paragraphs = static_cast<int>(paragraphs.size());
-    int paragraphs_processed = 0;
     // Insert initial progress record
-    insert_progress(db, doc_id, total_paragraphs, paragraphs_processed, "In Progress");
+    insert_progress(db, doc_id, total_paragraphs, 0, "In Progress");
 
-    // Generate embeddings for each paragraph and store in the database
-    for (const auto& paragraph : paragraphs) {
+    std::vector<std::wstring> to_embed;
+    for (auto& paragraph : paragraphs) {
         if (paragraph.empty()) continue;
 
-        // Tokenize the paragraph
-        std::wstring tokenized_paragraph = tokenize_text(paragraph);
+        // The embeddings endpoint rejects inputs over its token limit
+        if (bpe_vocabulary_loaded() && count_tokens(paragraph) > max_embedding_tokens) {
+            std::cerr << "Paragraph exceeds " << max_embedding_tokens << " tokens, skipping it." << std::endl;
+            continue;
+        }
+        to_embed.push_back(std::move(paragraph));
+    }
 
-        // Generate embedding using the tokenized text
-        auto embedding = get_embedding(tokenized_paragraph, api_key);
-        if (!embedding.empty()) {
-            insert_embedding(db, doc_id, paragraph, embedding);
-            paragraphs_processed++;
+    // Queue everything first so an interrupted run can be resumed
+    std::vector<QueuedParagraph> queued = enqueue_paragraphs(db, doc_id, to_embed);
+    if (queued.empty() && !to_embed.empty()) {
+        update_progress_status(db, doc_id, "Failed");
+        return;
+    }
+
+    size_t linked = 0;
+    size_t paragraphs_processed = embed_queued_paragraphs(db, api_key, queued, false, linked);
+    finish_document(db, doc_id);
 
-            // Update progress after each paragraph
-            update_progress(db, doc_id, paragraphs_processed);
+    std::wcout << L"Embedded " << paragraphs_processed << L" of " << total_paragraphs << L" paragraphs from " << file_name;
+    if (linked > 0) {
+        std::wcout << L" (" << linked << L" linked to near-duplicates)";
+    }
+    std::wcout << std::endl;
+}
 
-            std::wcout << L"Embedded paragraph: " << paragraph.substr(0, 30) << L"..." << std::endl;
+void resume_embedding_queue(sqlite3* db, const std::string& api_key) {
+    // Paragraphs stored while near-duplicate detection was off, or imported,
+    // need signatures before new ones can be matched against them
+    if (near_duplicate_threshold() > 0.0) {
+        size_t signed_rows = sign_stored_paragraphs(db);
+        if (signed_rows > 0) {
+            std::wcout << L"Indexed " << signed_rows << L" stored paragraphs for near-duplicate detection." << std::endl;
         }
-        else {
-            std::cerr << "Failed to generate embedding, skipping this paragraph." << std::endl;
+    }
+    // Likewise documents without a centroid, which every coarse-to-fine search scans in full
+    size_t summarized = build_missing_document_centroids(db);
+    if (summarized > 0) {
+        std::wcout << L"Computed centroids for " << summarized << L" documents." << std::endl;
+    }
+    // And paragraphs whose text is not compressed yet
+    size_t packed = pack_stored_paragraphs(db);
+    if (packed > 0) {
+        std::wcout << L"Compressed the text of " << packed << L" stored paragraphs." << std::endl;
+    }
+
+    std::vector<QueuedParagraph> queued = get_queued_paragraphs(db);
+    if (queued.empty()) {
+        return;
+    }
+    std::wcout << L"Resuming " << queued.size() << L" queued paragraphs from earlier runs." << std::endl;
+
+    // One document at a time, in document order
+    size_t embedded = 0;
+    size_t linked = 0;
+    size_t start = 0;
+    while (start < queued.size()) {
+        size_t end = start;
+        while (end < queued.size() && queued[end].doc_id == queued[start].doc_id) {
+            end++;
         }
+        std::vector<QueuedParagraph> document(queued.begin() + start, queued.begin() + end);
+        size_t document_linked = 0;
+        embedded += embed_queued_paragraphs(db, api_key, document, true, document_linked);
+        linked += document_linked;
+        finish_document(db, queued[start].doc_id);
+        start = end;
+    }
+
+    std::wcout << L"Embedded " << embedded << L" of " << queued.size() << L" queued paragraphs";
+    if (linked > 0) {
+        std::wcout << L" (" << linked << L" linked to near-duplicates)";
     }
-    // After processing all paragraphs
-    update_progress_status(db, doc_id, "Completed");
+    if (embedded < queued.size()) {
+        std::wcout << L"; the rest stay queued for the next run";
+    }
+    std::wcout << L"." << std::endl;
 }
 
-void generate_answer(const std::wstring& user_query, const std::string& api_key, sqlite3* db) {
+static std::atomic<size_t> g_context_token_budget{ 3000 };
+
+void set_context_token_budget(size_t tokens) {
+    g_context_token_budget = tokens;
+}
+
+size_t context_token_budget() {
+    return g_context_token_budget;
+}
+
+std::vector<SimilarityResult> build_context(const std::vector<SimilarityResult>& results, sqlite3* db, int max_chunks,
+    size_t token_budget, std::wstring& context, std::wstring& citations) {
+    const size_t label_tokens = 4; // "[n] " and the trailing newline
+
+    context.clear();
+    citations.clear();
+
+    size_t count = std::min(static_cast<size_t>(std::max(max_chunks, 0)), results.size());
+    std::vector<SimilarityResult> candidates(results.begin(), results.begin() + count);
+    std::vector<ContextEntry> entries;
+    fetch_context_entries(db, candidates, entries);
+
+    // A hit repeating a better one's passage (stored before near-duplicate
+    // detection, or by runs embedding copies at the same time) is left out;
+    // its document is cited alongside the one kept
+    std::vector<int> copy_of(count, -1);
+    const double threshold = near_duplicate_threshold();
+    if (threshold > 0.0 && count > 1) {
+        std::vector<int> ids;
+        for (const auto& candidate : candidates) {
+            ids.push_back(candidate.id);
+        }
+        std::unordered_map<int, MinHashSignature> stored = get_minhash_signatures(db, ids);
+        MinHashIndex kept;
+        for (size_t i = 0; i < count; ++i) {
+            auto it = stored.find(candidates[i].id);
+            MinHashSignature signature = it != stored.end() ? it->second : minhash_signature(*entries[i].text);
+            copy_of[i] = kept.find(signature, threshold);
+            if (copy_of[i] < 0) {
+                kept.add(static_cast<int>(i), signature);
+            }
+        }
+    }
+
+    // Greedily take paragraphs in rank order while they fit the budget
+    std::vector<SimilarityResult> packed;
+    std::vector<size_t> packed_entries;
+    size_t used_tokens = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (copy_of[i] >= 0) continue;
+        size_t tokens = entries[i].token_count + label_tokens;
+        if (used_tokens + tokens > token_budget) continue;
+        used_tokens += tokens;
+        packed.push_back(candidates[i]);
+        packed_entries.push_back(i);
+    }
+
+    // Other documents holding the same passage: linked copies and left-out hits
+    std::vector<std::wstring> also_in(packed_entries.size());
+    if (threshold > 0.0 && !packed.empty()) {
+        std::vector<int> packed_ids;
+        for (const auto& hit : packed) {
+            packed_ids.push_back(hit.id);
+        }
+        std::unordered_map<int, std::vector<int>> copies = get_near_duplicate_documents(db, packed_ids);
+        std::vector<std::vector<int>> other_doc_ids(packed_entries.size());
+        std::vector<int> all_doc_ids;
+        for (size_t n = 0; n < packed_entries.size(); ++n) {
+            size_t i = packed_entries[n];
+            std::vector<int>& others = other_doc_ids[n];
+            auto it = copies.find(candidates[i].id);
+            if (it != copies.end()) {
+                others = it->second;
+            }
+            for (size_t j = i + 1; j < count; ++j) {
+                if (copy_of[j] == static_cast<int>(i)) others.push_back(candidates[j].doc_id);
+            }
+            std::sort(others.begin(), others.end());
+            others.erase(std::unique(others.begin(), others.end()), others.end());
+            others.erase(std::remove(others.begin(), others.end(), candidates[i].doc_id), others.end());
+            all_doc_ids.insert(all_doc_ids.end(), others.begin(), others.end());
+        }
+        if (!all_doc_ids.empty()) {
+            std::unordered_map<int, std::wstring> names = get_document_infos(db, all_doc_ids);
+            for (size_t n = 0; n < packed_entries.size(); ++n) {
+                for (int other : other_doc_ids[n]) {
+                    auto it = names.find(other);
+                    if (it == names.end()) continue;
+                    also_in[n] += also_in[n].empty() ? L" (also in: " : L", ";
+                    also_in[n] += it->second;
+                }
+                if (!also_in[n].empty()) also_in[n] += L')';
+            }
+        }
+    }
+
+    // Size both buffers up front so the appends below never reallocate
+    const std::wstring citation_prefix = L" From document: ";
+    size_t context_size = 0;
+    size_t citations_size = 0;
+    for (size_t n = 0; n < packed_entries.size(); ++n) {
+        const ContextEntry& entry = entries[packed_entries[n]];
+        size_t label_size = std::to_wstring(n + 1).size() + 2;
+        context_size += label_size + 1 + entry.text->size() + 1;
+        citations_size += label_size + citation_prefix.size() + entry.file_name->size() + also_in[n].size() + 1;
+    }
+    context.reserve(context_size);
+    citations.reserve(citations_size);
+
+    for (size_t n = 0; n < packed_entries.size(); ++n) {
+        const ContextEntry& entry = entries[packed_entries[n]];
+        std::wstring number = std::to_wstring(n + 1);
+
+        context += L'[';
+        context += number;
+        context += L"] ";
+        context += *entry.text;
+        context += L'\n';
+
+        citations += L'[';
+        citations += number;
+        citations += L']';
+        citations += citation_prefix;
+        citations += *entry.file_name;
+        citations += also_in[n];
+        citations += L'\n';
+    }
+    return packed;
+}
+
+bool answer_query(const std::wstring& user_query, const std::string& api_key, sqlite3* db, const std::vector<VectorIndex>* segments,
+    const std::function<void(const std::wstring&)>& on_token, std::wstring& citations) {
     // Tokenize user query
     std::wstring tokenized_query = tokenize_text(user_query);
 
@@ -226,37 +955,70 @@ void generate_answer(const std::wstring& user_query, const std::string& api_key,
     auto query_embedding = get_embedding(tokenized_query, api_key);
     if (query_embedding.empty()) {
         std::cerr << "Failed to generate query embedding." << std::endl;
-        return;
+        return false;
     }
 
-    // Retrieve most similar embeddings
-    auto similar_results = retrieve_similar_embeddings(query_embedding, db);
+    // Get top relevant paragraphs and document info
+    int top_k = 20; // Candidates for packing into the context budget
+
+    // Retrieve most similar embeddings, from the resident segments when there are some
+    auto similar_results = segments ? search_segments_reranked(db, *segments, { query_embedding }, top_k)[0]
+        : retrieve_similar_embeddings(query_embedding, db);
 
     if (similar_results.empty()) {
         std::cerr << "No relevant embeddings found." << std::endl;
-        return;
+        return false;
     }
 
-    // Get top relevant paragraphs and document info
-    int top_k = 5; // Adjust as needed
     std::wstring context;
-    std::wstring citations;
-    for (int i = 0; i < top_k && i < similar_results.size(); ++i) {
-        int id = similar_results[i].id;
-        int doc_id = similar_results[i].doc_id;
-        std::wstring text = get_text_by_id(db, id);
-        std::wstring file_name = get_document_info(db, doc_id);
+    auto packed = build_context(similar_results, db, top_k, context_token_budget(), context, citations);
 
-        context += L"[" + std::to_wstring(i + 1) + L"] " + text + L"\n";
-        citations += L"[" + std::to_wstring(i + 1) + L"] From document: " + file_name + L"\n";
+    // A close enough earlier question over the same context already has an answer
+    std::wstring cached_answer;
+    if (lookup_cached_answer(db, query_embedding, packed, cached_answer, citations)) {
+        on_token(cached_answer);
+        return true;
     }
 
-    // Generate answer
-    std::wstring answer = generate_answer_from_context(context, user_query, api_key);
-
-    // Output result with citations
-    std::wcout << L"Answer:\n" << answer << std::endl;
-    std::wcout << L"Citations:\n" << citations << std::endl;
+    // Generate answer, handing tokens over as they stream in
+    std::wstring answer = generate_answer_from_context_stream(context, user_query, api_key, on_token);
+    if (answer.empty()) {
+        std::cerr << "Failed to generate an answer." << std::endl;
+    }
+    else {
+        store_cached_answer(db, user_query, query_embedding, packed, answer, citations);
+    }
+    return true;
 }
 
+void generate_answer(const std::wstring& user_query, const std::string& api_key, sqlite3* db) {
+    // The binary prefilter works on the codes of vectors held in memory, so a
+    // query that asks for it loads them here, one segment per shard as --serve does
+    std::vector<VectorIndex> segments;
+    if (binary_candidates() > 0) {
+        std::shared_ptr<const VectorProjection> projection = load_projection(db);
+        std::vector<sqlite3*> shards = shard_connections(db);
+        segments.resize(shards.size());
+        std::vector<char> loaded(shards.size(), 0);
+        run_on_shards(shards.size(), [&](size_t k) {
+            loaded[k] = load_vector_index(shards[k], segments[k], projection);
+        });
+        if (std::find(loaded.begin(), loaded.end(), 0) != loaded.end()) {
+            std::cerr << "Cannot load the vectors for the binary prefilter; scanning the database without it." << std::endl;
+            segments.clear();
+        }
+    }
+
+    std::wcout << L"Answer:\n" << std::flush;
 
+    std::wstring citations;
+    bool answered = answer_query(user_query, api_key, db, segments.empty() ? nullptr : &segments, [](const std::wstring& token) {
+        std::wcout << token << std::flush;
+    }, citations);
+
+    // Citations follow the streamed answer
+    std::wcout << std::endl;
+    if (answered) {
+        std::wcout << L"Citations:\n" << citations << std::endl;
+    }
+}
@@ -0,0 +1,421 @@
+// embedding_parser.cpp
+
+#include "embedding_parser.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
+
+namespace {
+
+// Bytes of the body kept for error messages
+const size_t excerpt_limit = 512;
+
+// Length of the last embedding parsed, so rows are allocated once at their
+// final size instead of growing
+std::atomic<size_t> g_dimension_hint{ 0 };
+
+const uint8_t base64_invalid = 0xFF;
+
+constexpr std::array<uint8_t, 256> make_base64_table() {
+    std::array<uint8_t, 256> table{};
+    for (auto& value : table) value = base64_invalid;
+    const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (uint8_t i = 0; i < 64; ++i) {
+        table[static_cast<unsigned char>(alphabet[i])] = i;
+    }
+    return table;
+}
+
+constexpr std::array<uint8_t, 256> base64_table = make_base64_table();
+
+inline bool is_number_char(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+inline bool is_whitespace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+} // namespace
+
+EmbeddingResponseParser::EmbeddingResponseParser(std::vector<float>* outputs, size_t count)
+    : outputs_(outputs), count_(count) {
+    excerpt_.reserve(excerpt_limit);
+}
+
+size_t EmbeddingResponseParser::write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t total_size = size * nmemb;
+    static_cast<EmbeddingResponseParser*>(userp)->feed(static_cast<const char*>(contents), total_size);
+    return total_size;
+}
+
+void EmbeddingResponseParser::feed(const char* data, size_t size) {
+    if (excerpt_.size() < excerpt_limit) {
+        excerpt_.append(data, std::min(size, excerpt_limit - excerpt_.size()));
+    }
+
+    const char* p = data;
+    const char* end = data + size;
+    while (p < end && !failed_) {
+        switch (state_) {
+        case State::String:
+            if (string_is_row_ && !escape_) {
+                p = decode_row_base64(p, end);
+            }
+            while (p < end) {
+                char c = *p++;
+                if (escape_) {
+                    escape_ = false;
+                    string_char(c);
+                }
+                else if (c == '\\') {
+                    escape_ = true;
+                }
+                else if (c == '"') {
+                    string_end();
+                    state_ = State::Value;
+                    break;
+                }
+                else {
+                    string_char(c);
+                }
+            }
+            break;
+
+        case State::Number:
+            while (p < end && is_number_char(*p)) {
+                if (number_length_ == max_number_length) {
+                    fail();
+                    return;
+                }
+                number_[number_length_++] = *p++;
+            }
+            if (p < end) {
+                number_value(number_, number_ + number_length_);
+                number_length_ = 0;
+                state_ = State::Value;
+            }
+            break;
+
+        case State::Literal:
+            while (p < end && *p >= 'a' && *p <= 'z') ++p;
+            if (p < end) state_ = State::Value;
+            break;
+
+        case State::Value: {
+            if (depth_ > 0 && frames_[depth_ - 1].role == Role::EmbeddingArray) {
+                p = parse_row_numbers(p, end);
+                if (p == end) break;
+            }
+            char c = *p;
+            if (is_whitespace(c) || c == ':') {
+                ++p;
+            }
+            else if (c == ',') {
+                if (depth_ > 0 && frames_[depth_ - 1].is_object) {
+                    frames_[depth_ - 1].expect_key = true;
+                }
+                ++p;
+            }
+            else if (c == '-' || (c >= '0' && c <= '9')) {
+                p += parse_number(p, end);
+            }
+            else if (c == '"') {
+                Frame* top = depth_ > 0 ? &frames_[depth_ - 1] : nullptr;
+                string_is_key_ = top && top->is_object && top->expect_key;
+                string_is_row_ = !string_is_key_ && top && top->role == Role::Item && top->key == Key::Embedding;
+                key_length_ = 0;
+                if (string_is_row_) begin_row();
+                state_ = State::String;
+                ++p;
+            }
+            else if (c == '{' || c == '[') {
+                open_container(c == '{');
+                ++p;
+            }
+            else if (c == '}' || c == ']') {
+                close_container(c == '}');
+                ++p;
+            }
+            else if (c == 't' || c == 'f' || c == 'n') {
+                state_ = State::Literal;
+                ++p;
+            }
+            else {
+                fail();
+            }
+            break;
+        }
+        }
+    }
+}
+
+// Fast path through the body of an embedding array: numbers that end inside
+// this slice go straight into the row. Stops at anything else, which the
+// general loop handles, including a number cut off in its exponent, which
+// from_chars would otherwise accept without it.
+const char* EmbeddingResponseParser::parse_row_numbers(const char* p, const char* end) {
+    while (p < end) {
+        char c = *p;
+        if (c == ',' || is_whitespace(c)) {
+            ++p;
+            continue;
+        }
+        if (c != '-' && (c < '0' || c > '9')) break;
+        float value;
+        auto result = std::from_chars(p, end, value);
+        if (result.ec != std::errc() || result.ptr == end || is_number_char(*result.ptr)) break;
+        row_->push_back(value);
+        p = result.ptr;
+    }
+    return p;
+}
+
+// Fast path through a base64 row: whole 16-character groups (three floats)
+// are decoded at once, the rest a character at a time. Stops at the closing
+// quote, an escape or padding.
+const char* EmbeddingResponseParser::decode_row_base64(const char* p, const char* end) {
+    if (bit_count_ == 0 && float_byte_count_ == 0) {
+        while (end - p >= 16) {
+            uint32_t words[3];
+            uint8_t invalid = 0;
+            for (int w = 0; w < 4; ++w) {
+                uint8_t a = base64_table[static_cast<unsigned char>(p[4 * w])];
+                uint8_t b = base64_table[static_cast<unsigned char>(p[4 * w + 1])];
+                uint8_t c = base64_table[static_cast<unsigned char>(p[4 * w + 2])];
+                uint8_t d = base64_table[static_cast<unsigned char>(p[4 * w + 3])];
+                invalid |= a | b | c | d;
+                uint32_t triple = (uint32_t(a) << 18) | (uint32_t(b) << 12) | (uint32_t(c) << 6) | d;
+                // Bytes 3w..3w+2 of the twelve, little-endian within each float
+                for (int k = 0; k < 3; ++k) {
+                    int byte = 3 * w + k;
+                    uint32_t value = (triple >> (16 - 8 * k)) & 0xFF;
+                    if (byte % 4 == 0) words[byte / 4] = value;
+                    else words[byte / 4] |= value << (8 * (byte % 4));
+                }
+            }
+            if (invalid & 0x80) break;
+            for (uint32_t word : words) {
+                float value;
+                std::memcpy(&value, &word, sizeof(value));
+                row_->push_back(value);
+            }
+            p += 16;
+        }
+    }
+    while (p < end) {
+        char c = *p;
+        if (base64_table[static_cast<unsigned char>(c)] == base64_invalid) break;
+        string_char(c);
+        ++p;
+    }
+    return p;
+}
+
+// Parse a number in place when it ends inside this slice; otherwise keep its
+// start for the next one. Returns the bytes consumed.
+size_t EmbeddingResponseParser::parse_number(const char* p, const char* end) {
+    const char* q = p;
+    while (q < end && is_number_char(*q)) ++q;
+    if (q < end) {
+        number_value(p, q);
+        return q - p;
+    }
+    if (static_cast<size_t>(q - p) > max_number_length) {
+        fail();
+        return q - p;
+    }
+    std::memcpy(number_, p, q - p);
+    number_length_ = q - p;
+    state_ = State::Number;
+    return q - p;
+}
+
+void EmbeddingResponseParser::number_value(const char* first, const char* last) {
+    if (depth_ == 0) return;
+    const Frame& top = frames_[depth_ - 1];
+    if (top.role == Role::EmbeddingArray) {
+        float value = 0.0f;
+        auto result = std::from_chars(first, last, value);
+        if (result.ec == std::errc::result_out_of_range) {
+            // Denormals and overflow: let strtof pick the nearest float
+            std::string text(first, last);
+            value = std::strtof(text.c_str(), nullptr);
+        }
+        else if (result.ec != std::errc() || result.ptr != last) {
+            fail();
+            return;
+        }
+        row_->push_back(value);
+    }
+    else if (top.role == Role::Item && top.key == Key::Index) {
+        long long index = -1;
+        auto result = std::from_chars(first, last, index);
+        if (result.ec != std::errc() || result.ptr != last || index < 0) {
+            fail();
+            return;
+        }
+        item_index_ = index;
+    }
+}
+
+void EmbeddingResponseParser::string_char(char c) {
+    if (string_is_row_) {
+        uint8_t value = base64_table[static_cast<unsigned char>(c)];
+        if (value == base64_invalid) {
+            if (c != '=') fail();
+            return;
+        }
+        bits_ = (bits_ << 6) | value;
+        bit_count_ += 6;
+        if (bit_count_ >= 8) {
+            bit_count_ -= 8;
+            // Assemble the little-endian float32 independently of host byte order
+            float_bytes_ |= ((bits_ >> bit_count_) & 0xFF) << (8 * float_byte_count_);
+            if (++float_byte_count_ == 4) {
+                float value;
+                std::memcpy(&value, &float_bytes_, sizeof(value));
+                row_->push_back(value);
+                float_bytes_ = 0;
+                float_byte_count_ = 0;
+            }
+        }
+    }
+    else if (string_is_key_) {
+        if (key_length_ < sizeof(key_)) key_[key_length_] = c;
+        key_length_++;
+    }
+}
+
+void EmbeddingResponseParser::string_end() {
+    if (string_is_key_) {
+        Frame& top = frames_[depth_ - 1];
+        std::string_view key(key_, std::min(key_length_, sizeof(key_)));
+        top.key = key_length_ > sizeof(key_) ? Key::Other
+            : key == "data" ? Key::Data
+            : key == "index" ? Key::Index
+            : key == "embedding" ? Key::Embedding
+            : Key::Other;
+        top.expect_key = false;
+    }
+    else if (string_is_row_ && float_byte_count_ != 0) {
+        // The base64 payload was not a whole number of float32s
+        fail();
+    }
+    string_is_key_ = false;
+    string_is_row_ = false;
+}
+
+bool EmbeddingResponseParser::open_container(bool is_object) {
+    if (depth_ == max_tracked_depth) {
+        fail();
+        return false;
+    }
+
+    Role role = Role::Other;
+    if (depth_ == 0) {
+        role = is_object ? Role::Root : Role::Other;
+    }
+    else {
+        const Frame& parent = frames_[depth_ - 1];
+        if (parent.is_object && parent.expect_key) {
+            // A container where a key belongs
+            fail();
+            return false;
+        }
+        if (parent.role == Role::Root && parent.key == Key::Data && !is_object) {
+            role = Role::DataArray;
+            saw_data_ = true;
+        }
+        else if (parent.role == Role::DataArray && is_object) {
+            role = Role::Item;
+            item_index_ = -1;
+            row_ = nullptr;
+        }
+        else if (parent.role == Role::Item && parent.key == Key::Embedding && !is_object) {
+            role = Role::EmbeddingArray;
+            begin_row();
+        }
+    }
+    frames_[depth_++] = { role, is_object, is_object, Key::Other };
+    return true;
+}
+
+bool EmbeddingResponseParser::close_container(bool is_object) {
+    if (depth_ == 0 || frames_[depth_ - 1].is_object != is_object) {
+        fail();
+        return false;
+    }
+    Role role = frames_[--depth_].role;
+    if (role == Role::Item) {
+        end_item();
+    }
+    return true;
+}
+
+// Rows go straight to their output when the item's index is already known
+void EmbeddingResponseParser::begin_row() {
+    if (item_index_ >= 0 && static_cast<size_t>(item_index_) < count_) {
+        row_ = &outputs_[item_index_];
+    }
+    else {
+        row_ = &pending_;
+    }
+    row_->clear();
+    row_->reserve(g_dimension_hint.load(std::memory_order_relaxed));
+    bits_ = 0;
+    bit_count_ = 0;
+    float_bytes_ = 0;
+    float_byte_count_ = 0;
+}
+
+void EmbeddingResponseParser::end_item() {
+    // Items without an index are taken in array order
+    size_t index = item_index_ >= 0 ? static_cast<size_t>(item_index_) : item_ordinal_;
+    if (row_ && index < count_) {
+        if (row_ == &pending_) {
+            outputs_[index].swap(pending_);
+        }
+        if (!outputs_[index].empty()) {
+            g_dimension_hint.store(outputs_[index].size(), std::memory_order_relaxed);
+        }
+    }
+    pending_.clear();
+    row_ = nullptr;
+    item_index_ = -1;
+    item_ordinal_++;
+}
+
+bool EmbeddingResponseParser::finish() {
+    bool complete = !failed_ && depth_ == 0 && saw_data_ && state_ != State::String;
+    if (!complete) {
+        for (size_t i = 0; i < count_; ++i) {
+            outputs_[i].clear();
+        }
+    }
+    return complete;
+}
+
+void EmbeddingResponseParser::reset() {
+    for (size_t i = 0; i < count_; ++i) {
+        outputs_[i].clear();
+    }
+    state_ = State::Value;
+    depth_ = 0;
+    escape_ = false;
+    string_is_key_ = false;
+    string_is_row_ = false;
+    key_length_ = 0;
+    number_length_ = 0;
+    item_index_ = -1;
+    item_ordinal_ = 0;
+    row_ = nullptr;
+    pending_.clear();
+    saw_data_ = false;
+    failed_ = false;
+    excerpt_.clear();
+}
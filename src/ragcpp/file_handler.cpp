@@ -28,27 +28,10 @@ std::wstring read_text_file(const std::wstring& file_path) {
     return utf8_to_wstring(content);
 }
 
-std::wstring extract_text_from_pdf(const std::wstring& pdf_path) {
-    std::wstring extracted_text;
-
 #ifdef _WIN32
-    // Windows: Use MuPDF
-    std::string pdf_path_utf8 = wstring_to_utf8(pdf_path);
-
-    fz_context* ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
-    if (!ctx) {
-        std::cerr << "Cannot create MuPDF context." << std::endl;
-        return L"";
-    }
-
-    fz_register_document_handlers(ctx);
-
-    fz_document* doc = fz_open_document(ctx, pdf_path_utf8.c_str());
-    if (!doc) {
-        std::cerr << "Cannot open PDF file: " << pdf_path_utf8 << std::endl;
-        fz_drop_context(ctx);
-        return L"";
-    }
+// Text of every page of an open document
+static std::wstring extract_document_text(fz_context* ctx, fz_document* doc) {
+    std::wstring extracted_text;
 
     int page_count = fz_count_pages(ctx, doc);
 
@@ -87,6 +70,68 @@ std::wstring extract_text_from_pdf(const std::wstring& pdf_path) {
         fz_drop_page(ctx, page);
     }
 
+    return extracted_text;
+}
+#endif
+
+std::wstring extract_text_from_pdf(const std::wstring& pdf_path) {
+    std::wstring extracted_text;
+
+#ifdef _WIN32
+    // Windows: Use MuPDF
+    std::string pdf_path_utf8 = wstring_to_utf8(pdf_path);
+
+    fz_context* ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+    if (!ctx) {
+        std::cerr << "Cannot create MuPDF context." << std::endl;
+        return L"";
+    }
+
+    fz_register_document_handlers(ctx);
+
+    fz_document* doc = fz_open_document(ctx, pdf_path_utf8.c_str());
+    if (!doc) {
+        std::cerr << "Cannot open PDF file: " << pdf_path_utf8 << std::endl;
+        fz_drop_context(ctx);
+        return L"";
+    }
+
+    extracted_text = extract_document_text(ctx, doc);
+
+    fz_drop_document(ctx, doc);
+    fz_drop_context(ctx);
+
+#endif
+
+    return extracted_text;
+}
+
+std::wstring extract_text_from_pdf_data(const std::string& data, const std::wstring& pdf_path) {
+    std::wstring extracted_text;
+
+#ifdef _WIN32
+    fz_context* ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+    if (!ctx) {
+        std::cerr << "Cannot create MuPDF context." << std::endl;
+        return L"";
+    }
+
+    fz_register_document_handlers(ctx);
+
+    // The stream reads the buffer in place; the document keeps its own reference
+    fz_stream* stream = fz_open_memory(ctx, reinterpret_cast<const unsigned char*>(data.data()), data.size());
+    fz_document* doc = stream ? fz_open_document_with_stream(ctx, "application/pdf", stream) : NULL;
+    if (stream) {
+        fz_drop_stream(ctx, stream);
+    }
+    if (!doc) {
+        std::wcerr << L"Cannot open PDF file: " << pdf_path << std::endl;
+        fz_drop_context(ctx);
+        return L"";
+    }
+
+    extracted_text = extract_document_text(ctx, doc);
+
     fz_drop_document(ctx, doc);
     fz_drop_context(ctx);
 
@@ -143,3 +188,17 @@ std::wstring extract_text_from_image(const std::wstring& image_path) {
 std::wstring get_file_extension(const std::wstring& file_path) {
     return std::filesystem::path(file_path).extension().wstring();
 }
+
+std::wstring normalize_path(const std::wstring& path) {
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(path, error);
+    if (error) {
+        absolute = path;
+    }
+    std::filesystem::path normalized = absolute.lexically_normal();
+    // "dir/" and "dir" name the same directory
+    if (!normalized.has_filename() && normalized.has_relative_path()) {
+        normalized = normalized.parent_path();
+    }
+    return normalized.wstring();
+}
@@ -0,0 +1,515 @@
+// file_reader.cpp
+
+#include "file_reader.h"
+#include "thread_pool.h"
+#include "encoding_utils.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#define FILE_READER_IO_URING 1
+#endif
+
+namespace {
+
+// Buffers above this capacity are freed rather than pooled
+const size_t max_pooled_buffer_bytes = 4 * 1024 * 1024;
+
+// Read a whole file with blocking calls
+void read_whole_file(FileContents& file) {
+    std::error_code error;
+    std::filesystem::path path(file.path);
+    uintmax_t size = std::filesystem::file_size(path, error);
+    if (error || size > max_read_ahead_bytes) return;
+    auto modified = std::filesystem::last_write_time(path, error);
+    if (error) return;
+
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream) return;
+    file.data.resize(static_cast<size_t>(size));
+    stream.read(file.data.data(), static_cast<std::streamsize>(size));
+    file.data.resize(static_cast<size_t>(stream.gcount()));
+    file.size = static_cast<long long>(size);
+    file.modified = static_cast<long long>(modified.time_since_epoch().count());
+    file.read = true;
+}
+
+} // namespace
+
+#ifdef FILE_READER_IO_URING
+
+// A submission and a completion ring mapped from the kernel, driven with the
+// raw system calls. Each file takes an openat and a statx submitted together,
+// then reads until it is complete, one slot per file in flight.
+struct FileReader::Ring {
+    // Operations a completion can belong to, kept in the low bits of its user_data
+    enum Operation : uint64_t { Open = 0, Stat = 1, Read = 2 };
+
+    struct Slot {
+        size_t index = 0;
+        std::string path;       // Kept alive while the kernel may read it
+        int fd = -1;
+        struct statx status;
+        int waiting = 0;        // Completions still due before the next step
+        bool failed = false;
+        size_t offset = 0;
+        size_t reserved = 0;    // Its share of the budget
+        FileContents file;
+    };
+
+    int fd = -1;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    std::vector<Slot> slots;
+    std::vector<size_t> free_slots;
+    std::vector<size_t> parked;     // Stat'ed and waiting for the budget to read
+    unsigned unsubmitted = 0;
+    size_t in_flight = 0;       // Submitted or queued operations without a completion yet
+
+    ~Ring() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        if (fd >= 0) close(fd);
+    }
+
+    // Set up a ring for entries submissions at a time. False when the kernel
+    // lacks io_uring, a sandbox forbids it, or it cannot open, stat and read.
+    bool setup(unsigned entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) return false;
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ring == MAP_FAILED) return false;
+        cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_ring
+            : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) return false;
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) return false;
+
+        char* sq = static_cast<char*>(sq_ring);
+        char* cq = static_cast<char*>(cq_ring);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // openat, statx and read arrived in 5.6; older kernels fail them one by one
+        const size_t probe_ops = 256;
+        std::vector<char> probe_buffer(sizeof(io_uring_probe) + probe_ops * sizeof(io_uring_probe_op), 0);
+        auto* probe = reinterpret_cast<io_uring_probe*>(probe_buffer.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, probe_ops) < 0) return false;
+        for (int op : { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ }) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+        }
+        return true;
+    }
+
+    // Queue an operation; slots hold at most two at a time, so the ring never fills
+    io_uring_sqe* prepare(uint8_t opcode, Operation operation, size_t slot, int file_fd, const void* address, unsigned length, uint64_t offset) {
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = file_fd;
+        sqe->addr = reinterpret_cast<uint64_t>(address);
+        sqe->len = length;
+        sqe->off = offset;
+        sqe->user_data = slot << 2 | operation;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted++;
+        in_flight++;
+        return sqe;
+    }
+
+    void prepare_read(size_t s) {
+        Slot& slot = slots[s];
+        size_t remaining = slot.file.data.size() - slot.offset;
+        unsigned length = static_cast<unsigned>(std::min<size_t>(remaining, 1u << 30));
+        prepare(IORING_OP_READ, Read, s, slot.fd, slot.file.data.data() + slot.offset, length, slot.offset);
+    }
+
+    // Submit what is queued and, with operations in flight, wait for one to complete
+    bool enter() {
+        unsigned wait = in_flight > 0 ? 1 : 0;
+        int submitted = static_cast<int>(syscall(__NR_io_uring_enter, fd, unsubmitted, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0));
+        if (submitted < 0) {
+            return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+        }
+        unsubmitted -= static_cast<unsigned>(submitted);
+        return true;
+    }
+};
+
+void FileReader::ring_loop() {
+    Ring& ring = *ring_;
+
+    auto finish = [&](size_t s) {
+        Ring::Slot& slot = ring.slots[s];
+        if (slot.fd >= 0) {
+            close(slot.fd);
+            slot.fd = -1;
+        }
+        if (slot.failed) {
+            recycle(std::move(slot.file.data));
+            slot.file.data.clear();
+            slot.file.read = false;
+        }
+        deliver(slot.index, std::move(slot.file), slot.reserved);
+        slot.reserved = 0;
+        ring.free_slots.push_back(s);
+    };
+
+    // Read a file once its share of the budget is reserved
+    auto begin_read = [&](size_t s) {
+        Ring::Slot& slot = ring.slots[s];
+        slot.file.data = acquire_buffer();
+        slot.file.data.resize(slot.reserved);
+        if (slot.reserved == 0) {
+            finish(s);
+            return;
+        }
+        ring.prepare_read(s);
+    };
+
+    // One step of a file: opened and stat'ed, then read until complete
+    auto complete = [&](size_t s, Ring::Operation operation, int result) {
+        Ring::Slot& slot = ring.slots[s];
+        if (operation == Ring::Read) {
+            if (result < 0) {
+                slot.failed = true;
+                finish(s);
+                return;
+            }
+            slot.offset += static_cast<size_t>(result);
+            if (result == 0 || slot.offset == slot.file.data.size()) {
+                slot.file.data.resize(slot.offset);
+                finish(s);
+                return;
+            }
+            ring.prepare_read(s);
+            return;
+        }
+
+        if (result < 0) {
+            slot.failed = true;
+        }
+        else if (operation == Ring::Open) {
+            slot.fd = result;
+        }
+        if (--slot.waiting > 0) return;
+
+        uint64_t size = slot.status.stx_size;
+        if (slot.failed || size > max_read_ahead_bytes) {
+            slot.failed = true;
+            finish(s);
+            return;
+        }
+        auto since_epoch = std::chrono::seconds(slot.status.stx_mtime.tv_sec) + std::chrono::nanoseconds(slot.status.stx_mtime.tv_nsec);
+        auto modified = std::chrono::file_clock::from_sys(std::chrono::sys_time<std::chrono::nanoseconds>(since_epoch));
+        slot.file.size = static_cast<long long>(size);
+        slot.file.modified = static_cast<long long>(
+            std::chrono::time_point_cast<std::filesystem::file_time_type::duration>(modified).time_since_epoch().count());
+        slot.file.read = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!fits_budget(slot.index, static_cast<size_t>(size))) {
+                ring.parked.push_back(s);
+                return;
+            }
+            held_bytes_ += static_cast<size_t>(size);
+        }
+        slot.reserved = static_cast<size_t>(size);
+        begin_read(s);
+    };
+
+    while (true) {
+        std::vector<size_t> admitted;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto can_issue = [this] { return issued_ < paths_.size() && issued_ - taken_ < depth_; };
+            auto can_admit = [&] {
+                return std::any_of(ring.parked.begin(), ring.parked.end(), [&](size_t s) {
+                    return fits_budget(ring.slots[s].index, static_cast<size_t>(ring.slots[s].status.stx_size));
+                });
+            };
+            auto done = [&] { return stopping_ || (issued_ == paths_.size() && ring.parked.empty()); };
+            if (ring.in_flight == 0) {
+                file_taken_.wait(lock, [&] { return done() || can_issue() || can_admit(); });
+                if (done()) {
+                    break;
+                }
+            }
+            for (auto it = ring.parked.begin(); it != ring.parked.end();) {
+                Ring::Slot& slot = ring.slots[*it];
+                size_t size = static_cast<size_t>(slot.status.stx_size);
+                if (!fits_budget(slot.index, size)) {
+                    ++it;
+                    continue;
+                }
+                held_bytes_ += size;
+                slot.reserved = size;
+                admitted.push_back(*it);
+                it = ring.parked.erase(it);
+            }
+            while (!stopping_ && can_issue() && !ring.free_slots.empty()) {
+                size_t s = ring.free_slots.back();
+                ring.free_slots.pop_back();
+                Ring::Slot& slot = ring.slots[s];
+                slot.index = issued_++;
+                unread_.insert(slot.index);
+                slot.path = wstring_to_utf8(paths_[slot.index]);
+                slot.fd = -1;
+                slot.failed = false;
+                slot.offset = 0;
+                slot.waiting = 2;
+                slot.file = FileContents();
+                slot.file.path = paths_[slot.index];
+
+                io_uring_sqe* open_sqe = ring.prepare(IORING_OP_OPENAT, Ring::Open, s, AT_FDCWD, slot.path.c_str(), 0, 0);
+                open_sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                io_uring_sqe* statx_sqe = ring.prepare(IORING_OP_STATX, Ring::Stat, s, AT_FDCWD, slot.path.c_str(), STATX_SIZE | STATX_MTIME,
+                    reinterpret_cast<uint64_t>(&slot.status));
+                statx_sqe->statx_flags = 0;
+            }
+        }
+        for (size_t s : admitted) {
+            begin_read(s);
+        }
+
+        if (!ring.enter()) {
+            std::cerr << "io_uring_enter failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+            uint64_t user_data = cqe->user_data;
+            int result = cqe->res;
+            head++;
+            __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+            ring.in_flight--;
+            complete(static_cast<size_t>(user_data >> 2), static_cast<Ring::Operation>(user_data & 3), result);
+        }
+    }
+
+    // After a failure, files not read through the ring are handed out unread,
+    // for the caller to read itself
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (; issued_ < paths_.size(); ++issued_) {
+        FileContents file;
+        file.path = paths_[issued_];
+        ready_[issued_] = std::move(file);
+    }
+    for (size_t s = 0; s < ring.slots.size(); ++s) {
+        Ring::Slot& slot = ring.slots[s];
+        if (std::find(ring.free_slots.begin(), ring.free_slots.end(), s) != ring.free_slots.end()) continue;
+        if (slot.fd >= 0) {
+            close(slot.fd);
+        }
+        FileContents file;
+        file.path = slot.file.path;
+        ready_[slot.index] = std::move(file);
+    }
+    unread_.clear();
+    file_ready_.notify_all();
+}
+
+#elif defined(__linux__)
+
+struct FileReader::Ring {};
+
+void FileReader::ring_loop() {}
+
+#endif
+
+FileReader::FileReader(size_t depth, size_t budget_bytes)
+    : depth_(depth > 0 ? depth : 1), budget_bytes_(budget_bytes) {
+}
+
+FileReader::~FileReader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    file_taken_.notify_all();
+#ifdef __linux__
+    if (ring_thread_.joinable()) {
+        ring_thread_.join();
+    }
+#endif
+    // Queued blocking reads see stopping_ and return at once
+    pool_.reset();
+#ifdef __linux__
+    ring_.reset();
+#endif
+}
+
+void FileReader::start(std::vector<std::wstring> paths) {
+    paths_ = std::move(paths);
+    if (paths_.empty()) {
+        return;
+    }
+
+#ifdef FILE_READER_IO_URING
+    auto ring = std::make_unique<Ring>();
+    if (ring->setup(static_cast<unsigned>(2 * depth_))) {
+        ring->slots.resize(depth_);
+        for (size_t s = depth_; s > 0; --s) {
+            ring->free_slots.push_back(s - 1);
+        }
+        ring_ = std::move(ring);
+        ring_thread_ = std::thread(&FileReader::ring_loop, this);
+        return;
+    }
+#endif
+
+    pool_ = std::make_unique<ThreadPool>(depth_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    issue_blocking_reads();
+}
+
+bool FileReader::next(FileContents& file) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (claimed_ >= paths_.size()) {
+        return false;
+    }
+    size_t index = claimed_++;
+    file_ready_.wait(lock, [&] { return ready_.count(index) > 0; });
+    file = std::move(ready_[index]);
+    ready_.erase(index);
+    ready_bytes_ -= std::min(ready_bytes_, file.data.size());
+    taken_++;
+
+    if (pool_) {
+        issue_blocking_reads();
+    }
+    else {
+        file_taken_.notify_all();
+    }
+    return true;
+}
+
+void FileReader::release(std::string&& buffer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        held_bytes_ -= std::min(held_bytes_, buffer.size());
+    }
+    file_taken_.notify_all();
+    recycle(std::move(buffer));
+}
+
+// Keep a buffer for a later read, without touching the budget
+void FileReader::recycle(std::string&& buffer) {
+    if (buffer.capacity() == 0 || buffer.capacity() > max_pooled_buffer_bytes) {
+        return;
+    }
+    buffer.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_buffers_.size() < depth_) {
+        free_buffers_.push_back(std::move(buffer));
+    }
+}
+
+std::string FileReader::acquire_buffer() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_buffers_.empty()) {
+        return std::string();
+    }
+    std::string buffer = std::move(free_buffers_.back());
+    free_buffers_.pop_back();
+    return buffer;
+}
+
+// With mutex_ held: whether a read of size more bytes may start now. The
+// next file due leaves out the files read after it: they cannot be taken
+// before it, so waiting for them to be released would never end.
+bool FileReader::fits_budget(size_t index, size_t size) const {
+    size_t counted = held_bytes_;
+    if (!unread_.empty() && index == *unread_.begin()) {
+        counted -= std::min(counted, ready_bytes_);
+    }
+    return size == 0 || counted == 0 || counted + size <= budget_bytes_;
+}
+
+// Hand a file to next(); its share of the budget becomes what it holds
+void FileReader::deliver(size_t index, FileContents&& file, size_t reserved) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        unread_.erase(index);
+        held_bytes_ = held_bytes_ - std::min(held_bytes_, reserved) + file.data.size();
+        ready_bytes_ += file.data.size();
+        ready_[index] = std::move(file);
+        file_ready_.notify_all();
+    }
+    // Another file may now be the next one due, or fit
+    file_taken_.notify_all();
+}
+
+// With mutex_ held: start blocking reads until depth_ files are read or being read ahead of next()
+void FileReader::issue_blocking_reads() {
+    while (issued_ < paths_.size() && issued_ - taken_ < depth_) {
+        size_t index = issued_++;
+        unread_.insert(index);
+        pool_->submit([this, index]() { read_blocking(index); });
+    }
+}
+
+void FileReader::read_blocking(size_t index) {
+    FileContents file;
+    file.path = paths_[index];
+    // A file too large to read ahead, or gone, needs no share of the budget
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(std::filesystem::path(file.path), error);
+    size_t reserved = (error || size > max_read_ahead_bytes) ? 0 : static_cast<size_t>(size);
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        file_taken_.wait(lock, [&] { return stopping_ || fits_budget(index, reserved); });
+        if (stopping_) return;
+        held_bytes_ += reserved;
+    }
+    file.data = acquire_buffer();
+    read_whole_file(file);
+    if (!file.read) {
+        recycle(std::move(file.data));
+        file.data.clear();
+    }
+    deliver(index, std::move(file), reserved);
+}
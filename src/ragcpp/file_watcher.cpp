@@ -0,0 +1,327 @@
+// file_watcher.cpp
+
+#include "file_watcher.h"
+#include "file_handler.h"
+#include "encoding_utils.h"
+#include <iostream>
+#include <filesystem>
+#include <deque>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+std::vector<std::wstring> crawl_files(const std::vector<std::wstring>& roots,
+    const std::function<bool(const std::wstring&)>& accept, size_t threads) {
+    std::vector<std::wstring> files;
+    std::deque<std::filesystem::path> directories;
+    for (const auto& root : roots) {
+        std::error_code error;
+        if (std::filesystem::is_regular_file(root, error)) {
+            if (accept(root)) {
+                files.push_back(root);
+            }
+        }
+        else if (std::filesystem::is_directory(root, error)) {
+            directories.push_back(root);
+        }
+    }
+
+    // Workers take one directory at a time and queue its subdirectories, so
+    // wide and deep trees both spread over all of them
+    std::mutex mutex;
+    std::condition_variable work_available;
+    size_t busy = 0;
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            work_available.wait(lock, [&] { return !directories.empty() || busy == 0; });
+            if (directories.empty()) {
+                return;
+            }
+            std::filesystem::path directory = std::move(directories.front());
+            directories.pop_front();
+            busy++;
+            lock.unlock();
+
+            std::vector<std::wstring> found_files;
+            std::vector<std::filesystem::path> found_directories;
+            std::error_code error;
+            for (std::filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+                std::error_code type_error;
+                if (it->is_directory(type_error) && !it->is_symlink(type_error)) {
+                    found_directories.push_back(it->path());
+                }
+                else if (it->is_regular_file(type_error) && accept(it->path().wstring())) {
+                    found_files.push_back(it->path().wstring());
+                }
+            }
+            if (error) {
+                std::cerr << "Cannot list directory " << wstring_to_utf8(directory.wstring()) << ": " << error.message() << std::endl;
+            }
+
+            lock.lock();
+            files.insert(files.end(), found_files.begin(), found_files.end());
+            directories.insert(directories.end(), found_directories.begin(), found_directories.end());
+            busy--;
+            work_available.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::max<size_t>(threads, 1); ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    // Listing order depends on thread timing; embed in a stable order, and
+    // once when roots overlap
+    std::sort(files.begin(), files.end());
+    files.erase(std::unique(files.begin(), files.end()), files.end());
+    return files;
+}
+
+FileWatcher::~FileWatcher() {
+    stop();
+}
+
+bool path_is_within(const std::wstring& path, const std::wstring& root) {
+    if (path.size() < root.size() || path.compare(0, root.size(), root) != 0) {
+        return false;
+    }
+    // "/a/bc" is not inside "/a/b"
+    return path.size() == root.size() || std::filesystem::path(path.substr(root.size())).has_root_directory()
+        || !std::filesystem::path(root).has_filename();
+}
+
+bool FileWatcher::accepted(const std::wstring& path) const {
+    if (std::find(root_files_.begin(), root_files_.end(), path) != root_files_.end()) {
+        return true;
+    }
+    for (const auto& root : roots_) {
+        if (path != root && path_is_within(path, root)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef _WIN32
+
+bool FileWatcher::start(const std::vector<std::wstring>& roots) {
+    for (const auto& root : roots) {
+        std::wstring path = normalize_path(root);
+        std::error_code error;
+        bool is_file = std::filesystem::is_regular_file(path, error);
+        std::wstring directory = path;
+        if (is_file) {
+            root_files_.push_back(path);
+            directory = std::filesystem::path(path).parent_path().wstring();
+        }
+        else if (!std::filesystem::is_directory(path, error)) {
+            continue;
+        }
+        else {
+            roots_.push_back(path);
+        }
+
+        HANDLE handle = CreateFileW(directory.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) {
+            std::cerr << "Cannot watch directory " << wstring_to_utf8(directory) << ": error " << GetLastError() << std::endl;
+            continue;
+        }
+        directories_.push_back(handle);
+        directory_paths_.push_back(directory);
+    }
+    if (directories_.empty()) {
+        return false;
+    }
+    for (size_t k = 0; k < directories_.size(); ++k) {
+        readers_.emplace_back(&FileWatcher::reader_loop, this, k);
+    }
+    return true;
+}
+
+void FileWatcher::reader_loop(size_t directory) {
+    HANDLE handle = directories_[directory];
+    const std::wstring& base = directory_paths_[directory];
+    // File roots are watched through their directory, which is not watched recursively
+    bool subtree = std::find(roots_.begin(), roots_.end(), base) != roots_.end();
+    std::vector<DWORD> buffer(16384);
+    const DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+
+    while (true) {
+        DWORD bytes = 0;
+        if (!ReadDirectoryChangesW(handle, buffer.data(), static_cast<DWORD>(buffer.size() * sizeof(DWORD)), subtree ? TRUE : FALSE,
+            filter, &bytes, nullptr, nullptr)) {
+            return;     // Cancelled by stop(), or the directory went away
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (bytes == 0) {
+            overflowed_ = true;     // The system buffer overflowed; changes were lost
+        }
+        else {
+            const uint8_t* entry = reinterpret_cast<const uint8_t*>(buffer.data());
+            while (true) {
+                const FILE_NOTIFY_INFORMATION* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(entry);
+                std::wstring name(info->FileName, info->FileNameLength / sizeof(wchar_t));
+                std::wstring path = (std::filesystem::path(base) / name).lexically_normal().wstring();
+                if (accepted(path)) {
+                    pending_.push_back(path);
+                }
+                if (info->NextEntryOffset == 0) break;
+                entry += info->NextEntryOffset;
+            }
+        }
+        changed_.notify_all();
+    }
+}
+
+void FileWatcher::stop() {
+    for (void* handle : directories_) {
+        CancelIoEx(handle, nullptr);
+    }
+    for (auto& reader : readers_) {
+        reader.join();
+    }
+    readers_.clear();
+    for (void* handle : directories_) {
+        CloseHandle(handle);
+    }
+    directories_.clear();
+    directory_paths_.clear();
+}
+
+bool FileWatcher::wait(std::chrono::milliseconds timeout, std::vector<std::wstring>& changed) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait_for(lock, timeout, [this] { return !pending_.empty() || overflowed_; });
+    changed.insert(changed.end(), pending_.begin(), pending_.end());
+    pending_.clear();
+    bool complete = !overflowed_;
+    overflowed_ = false;
+    return complete;
+}
+
+#else
+
+void FileWatcher::add_watches(const std::wstring& directory, bool recursive) {
+    const uint32_t mask = IN_CREATE | IN_CLOSE_WRITE | IN_MODIFY | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW;
+    std::vector<std::filesystem::path> pending{ directory };
+    while (!pending.empty()) {
+        std::filesystem::path path = std::move(pending.back());
+        pending.pop_back();
+        int wd = inotify_add_watch(fd_, path.string().c_str(), mask);
+        if (wd < 0) {
+            if (errno == ENOSPC) {
+                std::cerr << "Out of inotify watches at " << path.string() << "; raise fs.inotify.max_user_watches." << std::endl;
+            }
+            continue;
+        }
+        watches_[wd] = path.wstring();
+        if (!recursive) continue;
+
+        std::error_code error;
+        for (std::filesystem::directory_iterator it(path, error), end; !error && it != end; it.increment(error)) {
+            std::error_code type_error;
+            if (it->is_directory(type_error) && !it->is_symlink(type_error)) {
+                pending.push_back(it->path());
+            }
+        }
+    }
+}
+
+bool FileWatcher::start(const std::vector<std::wstring>& roots) {
+    fd_ = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd_ < 0) {
+        std::cerr << "inotify is unavailable." << std::endl;
+        return false;
+    }
+    for (const auto& root : roots) {
+        std::wstring path = normalize_path(root);
+        std::error_code error;
+        if (std::filesystem::is_regular_file(path, error)) {
+            root_files_.push_back(path);
+            add_watches(std::filesystem::path(path).parent_path().wstring(), false);
+        }
+        else if (std::filesystem::is_directory(path, error)) {
+            roots_.push_back(path);
+            add_watches(path, true);
+        }
+    }
+    return !watches_.empty();
+}
+
+void FileWatcher::stop() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    watches_.clear();
+}
+
+bool FileWatcher::wait(std::chrono::milliseconds timeout, std::vector<std::wstring>& changed) {
+    pollfd descriptor{ fd_, POLLIN, 0 };
+    if (poll(&descriptor, 1, static_cast<int>(timeout.count())) <= 0) {
+        return true;
+    }
+
+    bool complete = true;
+    alignas(inotify_event) char buffer[64 * 1024];
+    ssize_t length;
+    while ((length = read(fd_, buffer, sizeof(buffer))) > 0) {
+        for (char* entry = buffer; entry < buffer + length;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(entry);
+            entry += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                complete = false;
+                continue;
+            }
+            auto watch = watches_.find(event->wd);
+            if (watch == watches_.end()) continue;
+            if (event->mask & IN_IGNORED) {
+                watches_.erase(watch);
+                continue;
+            }
+            if (event->len == 0) continue;
+
+            std::wstring path = (std::filesystem::path(watch->second) / event->name).wstring();
+            if (event->mask & IN_ISDIR) {
+                // A directory moved away keeps its watches, which would report
+                // the old paths; drop them, and watch whatever arrives instead
+                if (event->mask & IN_MOVED_FROM) {
+                    std::wstring prefix = path + L"/";
+                    for (auto it = watches_.begin(); it != watches_.end();) {
+                        if (it->second == path || it->second.compare(0, prefix.size(), prefix) == 0) {
+                            inotify_rm_watch(fd_, it->first);
+                            it = watches_.erase(it);
+                        }
+                        else {
+                            ++it;
+                        }
+                    }
+                }
+                else if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && accepted(path)) {
+                    add_watches(path, true);
+                }
+            }
+            if (accepted(path)) {
+                changed.push_back(path);
+            }
+        }
+    }
+    return complete;
+}
+
+#endif
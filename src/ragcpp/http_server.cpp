@@ -0,0 +1,295 @@
+// http_server.cpp
+
+#include "http_server.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <charconv>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET socket_t;
+#define CLOSE_SOCKET closesocket
+#define SEND_FLAGS 0
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define CLOSE_SOCKET close
+#define SEND_FLAGS MSG_NOSIGNAL // Report a closed peer as an error instead of raising SIGPIPE
+#endif
+
+namespace {
+
+// Limits on what one client can hold: request size, how long the server
+// waits on a silent or stalled peer, and connections served at once
+const size_t max_header_bytes = 64 * 1024;
+const size_t max_body_bytes = 1024 * 1024;
+const int socket_timeout_seconds = 30;
+const int max_connections = 256;
+
+const char* status_text(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+    }
+}
+
+bool send_all(socket_t s, const char* data, size_t size) {
+    while (size > 0) {
+        int sent = send(s, data, static_cast<int>(size), SEND_FLAGS);
+        if (sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// Give up on a peer that sends or reads nothing for socket_timeout_seconds
+void set_socket_timeouts(socket_t s) {
+#ifdef _WIN32
+    DWORD timeout = socket_timeout_seconds * 1000;
+#else
+    timeval timeout{};
+    timeout.tv_sec = socket_timeout_seconds;
+#endif
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+}
+
+void send_response(socket_t s, const HttpResponse& response) {
+    std::string header = "HTTP/1.1 " + std::to_string(response.status) + " " + status_text(response.status) + "\r\n"
+        "Content-Type: " + response.content_type + "\r\n";
+    for (const auto& [name, value] : response.headers) {
+        header += name + ": " + value + "\r\n";
+    }
+    header += "Content-Length: " + std::to_string(response.body.size()) + "\r\n"
+        "Connection: close\r\n\r\n";
+    if (send_all(s, header.data(), header.size())) {
+        send_all(s, response.body.data(), response.body.size());
+    }
+}
+
+HttpResponse error_response(int status, const std::string& message) {
+    HttpResponse response;
+    response.status = status;
+    response.body = "{\"error\":\"" + message + "\"}";
+    return response;
+}
+
+// Read one request (headers plus Content-Length body) from the socket. On
+// failure, error_status is the status to answer with, or 0 when the peer
+// went away or timed out and there is no one to answer.
+bool read_request(socket_t s, HttpRequest& request, int& error_status) {
+    std::string buffer;
+    char chunk[8192];
+    size_t header_end = std::string::npos;
+    error_status = 0;
+
+    while (header_end == std::string::npos) {
+        int received = recv(s, chunk, sizeof(chunk), 0);
+        if (received <= 0) return false;
+        buffer.append(chunk, received);
+        header_end = buffer.find("\r\n\r\n");
+        if (std::min(header_end, buffer.size()) > max_header_bytes) {
+            error_status = 431;
+            return false;
+        }
+    }
+
+    std::istringstream header_stream(buffer.substr(0, header_end));
+    std::string line;
+    std::getline(header_stream, line);
+    std::istringstream request_line(line);
+    request_line >> request.method >> request.path;
+
+    while (std::getline(header_stream, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) continue;
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        size_t value_start = line.find_first_not_of(' ', colon + 1);
+        request.headers[name] = value_start == std::string::npos ? "" : line.substr(value_start);
+    }
+
+    size_t content_length = 0;
+    auto it = request.headers.find("content-length");
+    if (it != request.headers.end()) {
+        const std::string& value = it->second;
+        auto result = std::from_chars(value.data(), value.data() + value.size(), content_length);
+        if (value.empty() || result.ec != std::errc() || result.ptr != value.data() + value.size()) {
+            error_status = 400;
+            return false;
+        }
+    }
+    if (content_length > max_body_bytes) {
+        error_status = 413;
+        return false;
+    }
+
+    request.body = buffer.substr(header_end + 4);
+    if (request.body.size() > content_length) {
+        request.body.resize(content_length);
+    }
+    while (request.body.size() < content_length) {
+        int received = recv(s, chunk, sizeof(chunk), 0);
+        if (received <= 0) return false;
+        request.body.append(chunk, received);
+    }
+    return true;
+}
+
+} // namespace
+
+HttpServer::~HttpServer() {
+    stop();
+}
+
+bool HttpServer::start(int port, HttpHandler handler) {
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+        std::cerr << "WSAStartup failed." << std::endl;
+        return false;
+    }
+#endif
+
+    socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET) {
+        std::cerr << "Cannot create server socket." << std::endl;
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<unsigned short>(port));
+
+    if (bind(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(s, SOMAXCONN) != 0) {
+        std::cerr << "Cannot bind server socket to port " << port << "." << std::endl;
+        CLOSE_SOCKET(s);
+        return false;
+    }
+
+    socklen_t addr_len = sizeof(addr);
+    getsockname(s, reinterpret_cast<sockaddr*>(&addr), &addr_len);
+    port_ = ntohs(addr.sin_port);
+
+    handler_ = std::move(handler);
+    listen_socket_ = static_cast<std::intptr_t>(s);
+    running_ = true;
+    accept_thread_ = std::thread(&HttpServer::accept_loop, this);
+    return true;
+}
+
+void HttpServer::stop() {
+    if (!running_.exchange(false)) return;
+
+    socket_t s = static_cast<socket_t>(listen_socket_);
+#ifdef _WIN32
+    closesocket(s);
+#else
+    shutdown(s, SHUT_RDWR);
+    close(s);
+#endif
+    listen_socket_ = -1;
+
+    if (accept_thread_.joinable()) {
+        accept_thread_.join();
+    }
+
+    // Let in-flight connections finish before the handler goes away
+    while (active_connections_ > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void HttpServer::accept_loop() {
+    while (running_) {
+        socket_t client = accept(static_cast<socket_t>(listen_socket_), nullptr, nullptr);
+        if (client == INVALID_SOCKET) {
+            continue;
+        }
+        set_socket_timeouts(client);
+        if (active_connections_ >= max_connections) {
+            send_response(client, error_response(503, "too many connections"));
+            CLOSE_SOCKET(client);
+            continue;
+        }
+        active_connections_++;
+        std::thread(&HttpServer::handle_connection, this, static_cast<std::intptr_t>(client)).detach();
+    }
+}
+
+void HttpServer::handle_connection(std::intptr_t client) {
+    socket_t s = static_cast<socket_t>(client);
+
+    // Nothing a client sends or a handler throws may escape this detached thread
+    bool headers_sent = false;
+    try {
+        HttpRequest request;
+        int error_status = 0;
+        if (!read_request(s, request, error_status)) {
+            if (error_status != 0) {
+                send_response(s, error_response(error_status, status_text(error_status)));
+            }
+        }
+        else {
+            HttpResponse response = handler_(request);
+            if (response.stream) {
+                std::string header = "HTTP/1.1 " + std::to_string(response.status) + " " + status_text(response.status) + "\r\n"
+                    "Content-Type: " + response.content_type + "\r\n";
+                for (const auto& [name, value] : response.headers) {
+                    header += name + ": " + value + "\r\n";
+                }
+                header += "Cache-Control: no-cache\r\n"
+                    "Connection: close\r\n\r\n";
+                headers_sent = true;
+                if (send_all(s, header.data(), header.size())) {
+                    response.stream([s](const std::string& data) { return send_all(s, data.data(), data.size()); });
+                }
+            }
+            else {
+                headers_sent = true;
+                send_response(s, response);
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "HTTP handler failed: " << e.what() << std::endl;
+        if (!headers_sent) {
+            send_response(s, error_response(500, "internal server error"));
+        }
+    }
+    catch (...) {
+        std::cerr << "HTTP handler failed." << std::endl;
+        if (!headers_sent) {
+            send_response(s, error_response(500, "internal server error"));
+        }
+    }
+
+    CLOSE_SOCKET(s);
+    active_connections_--;
+}
@@ -5,6 +5,17 @@
 #include "args.h"
 #include "database.h"
 #include "document_manager.h"
+#include "query_server.h"
+#include "answer_cache.h"
+#include "metrics.h"
+#include "shards.h"
+#include "vector_projection.h"
+#include "encoding_utils.h"
+#include "request_scheduler.h"
+#include "openai_api.h"
+#include "snapshot.h"
+#include "near_duplicates.h"
+#include "vector_index.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -27,14 +38,36 @@ int wmain(int argc, wchar_t* argv[]) {
 
     // Parse command-line arguments
     ProgramOptions options = parse_arguments(argc, argv);
+    configure_answer_cache(options.answer_cache, options.cache_threshold, options.cache_entries);
+    set_context_token_budget(options.context_tokens);
+    set_max_concurrent_requests(options.max_concurrency);
+    set_embedding_encoding(options.embedding_base64);
+    set_near_duplicate_threshold(options.dedup_threshold);
+    set_coarse_documents(options.coarse_documents);
+    if (options.binary_candidates >= 0) {
+        set_binary_candidates(options.binary_candidates);
+    }
+
+    // Let a running --serve instance answer; it already has everything loaded.
+    // Profiling needs the work to happen in this process.
+    if (options.query && !options.no_server && !options.profile && query_via_server(options.user_query, options.server_port, options.binary_candidates)) {
+        return 0;
+    }
 
     // Initialize the database
     sqlite3* db = nullptr;
     initialize_database(db);
+    if (!db || !open_shards(db, options.shard_count, options.shard_dirs)) {
+        sqlite3_close(db);
+        return -1;
+    }
 
     if (options.embed) {
         process_paths(options.file_paths, api_key, db);
     }
+    else if (options.watch) {
+        watch_paths(options.file_paths, api_key, db);
+    }
     else if (options.delete_docs) {
         delete_documents(options.doc_ids_to_delete, db);
     }
@@ -47,9 +80,29 @@ int wmain(int argc, wchar_t* argv[]) {
     else if (options.monitor_progress) {
         monitor_progress(db);
     }
+    else if (options.serve) {
+        run_query_server(db, api_key, options.server_port, options.snapshot_path);
+    }
+    else if (options.resume) {
+        resume_embedding_queue(db, api_key);
+    }
+    else if (options.reduce) {
+        reduce_embeddings(db, options.reduce_dim, wstring_to_utf8(options.reduce_method));
+    }
+    else if (options.export_snapshot) {
+        export_snapshot(db, options.snapshot_path);
+    }
+    else if (options.import_snapshot) {
+        import_snapshot(db, options.snapshot_path);
+    }
 
     // Close the database
+    close_shards(db);
     sqlite3_close(db);
 
+    if (options.profile) {
+        print_profile();
+    }
+
     return 0;
 }
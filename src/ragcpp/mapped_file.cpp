@@ -0,0 +1,94 @@
+// mapped_file.cpp
+
+#include "mapped_file.h"
+#include "encoding_utils.h"
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::wstring& path) {
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "Cannot open file: " << wstring_to_utf8(path) << std::endl;
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        std::cerr << "Cannot read the size of " << wstring_to_utf8(path) << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+    file_ = file;
+    size_ = static_cast<size_t>(size.QuadPart);
+    if (size_ == 0) {
+        return true;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        std::cerr << "Cannot map file: " << wstring_to_utf8(path) << std::endl;
+        if (mapping) CloseHandle(mapping);
+        close();
+        return false;
+    }
+    mapping_ = mapping;
+    data_ = static_cast<const uint8_t*>(view);
+#else
+    std::string utf8_path = wstring_to_utf8(path);
+    int fd = ::open(utf8_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open file: " << wstring_to_utf8(path) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        std::cerr << "Cannot read the size of " << wstring_to_utf8(path) << std::endl;
+        ::close(fd);
+        return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+        void* view = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view == MAP_FAILED) {
+            std::cerr << "Cannot map file: " << wstring_to_utf8(path) << std::endl;
+            ::close(fd);
+            size_ = 0;
+            return false;
+        }
+        // The whole file is about to be read; start reading it in
+        madvise(view, size_, MADV_WILLNEED);
+        data_ = static_cast<const uint8_t*>(view);
+    }
+    // The mapping keeps the file referenced
+    ::close(fd);
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_) CloseHandle(file_);
+    mapping_ = nullptr;
+    file_ = nullptr;
+#else
+    if (data_) munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+}
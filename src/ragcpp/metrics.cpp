@@ -0,0 +1,211 @@
+// metrics.cpp
+
+#include "metrics.h"
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+
+namespace {
+
+// Bucket b counts samples of at most 2^b microseconds (1 us up to about
+// 67 s); the last bucket catches everything slower
+const size_t bucket_count = 28;
+
+struct alignas(64) StageHistogram {
+    std::atomic<uint64_t> buckets[bucket_count];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_ns;
+    std::atomic<uint64_t> max_ns;
+};
+
+StageHistogram g_stages[static_cast<size_t>(Stage::Count)];
+std::atomic<uint64_t> g_counters[static_cast<size_t>(Counter::Count)];
+
+const char* const stage_names[] = {
+    "file_read",
+    "pdf_extract",
+    "chunking",
+    "tokenize",
+    "embedding_http",
+    "db_insert",
+    "near_duplicate_check",
+    "vector_search",
+    "context_fetch",
+    "llm_call",
+};
+static_assert(std::size(stage_names) == static_cast<size_t>(Stage::Count), "one name per stage");
+
+const char* const counter_names[] = {
+    "bytes_read",
+    "http_bytes_received",
+    "chunks",
+    "embedding_requests",
+    "chat_requests",
+    "http_errors",
+    "retries",
+    "answer_cache_hits",
+    "answer_cache_misses",
+    "context_cache_hits",
+    "context_cache_misses",
+    "near_duplicates",
+};
+static_assert(std::size(counter_names) == static_cast<size_t>(Counter::Count), "one name per counter");
+
+double bucket_upper_seconds(size_t bucket) {
+    return static_cast<double>(uint64_t(1) << bucket) * 1e-6;
+}
+
+struct StageSnapshot {
+    uint64_t buckets[bucket_count];
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+};
+
+StageSnapshot snapshot(size_t stage) {
+    StageSnapshot snap;
+    const StageHistogram& histogram = g_stages[stage];
+    for (size_t b = 0; b < bucket_count; ++b) {
+        snap.buckets[b] = histogram.buckets[b].load(std::memory_order_relaxed);
+    }
+    snap.count = histogram.count.load(std::memory_order_relaxed);
+    snap.sum_ns = histogram.sum_ns.load(std::memory_order_relaxed);
+    snap.max_ns = histogram.max_ns.load(std::memory_order_relaxed);
+    return snap;
+}
+
+// Upper bound of the bucket holding quantile q, capped at the observed max
+double quantile_seconds(const StageSnapshot& snap, double q) {
+    uint64_t total = 0;
+    for (uint64_t value : snap.buckets) total += value;
+    if (total == 0) return 0.0;
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * total)));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < bucket_count; ++b) {
+        seen += snap.buckets[b];
+        if (seen >= rank) {
+            return std::min(bucket_upper_seconds(b), snap.max_ns * 1e-9);
+        }
+    }
+    return snap.max_ns * 1e-9;
+}
+
+std::string format_number(double value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.9g", value);
+    return buffer;
+}
+
+} // namespace
+
+void record_stage(Stage stage, uint64_t nanoseconds) {
+    StageHistogram& histogram = g_stages[static_cast<size_t>(stage)];
+
+    uint64_t microseconds = nanoseconds / 1000;
+    size_t bucket = microseconds == 0 ? 0 : static_cast<size_t>(std::bit_width(microseconds - 1));
+    if (bucket >= bucket_count) bucket = bucket_count - 1;
+
+    histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.sum_ns.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t current_max = histogram.max_ns.load(std::memory_order_relaxed);
+    while (nanoseconds > current_max
+        && !histogram.max_ns.compare_exchange_weak(current_max, nanoseconds, std::memory_order_relaxed)) {
+    }
+}
+
+void add_counter(Counter counter, uint64_t delta) {
+    g_counters[static_cast<size_t>(counter)].fetch_add(delta, std::memory_order_relaxed);
+}
+
+std::string metrics_prometheus() {
+    std::string out;
+    out += "# HELP ragcpp_stage_seconds Time spent in each pipeline stage.\n";
+    out += "# TYPE ragcpp_stage_seconds histogram\n";
+    for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+        StageSnapshot snap = snapshot(s);
+        std::string label = std::string("stage=\"") + stage_names[s] + "\"";
+
+        uint64_t cumulative = 0;
+        for (size_t b = 0; b + 1 < bucket_count; ++b) {
+            cumulative += snap.buckets[b];
+            out += "ragcpp_stage_seconds_bucket{" + label + ",le=\"" + format_number(bucket_upper_seconds(b)) + "\"} "
+                + std::to_string(cumulative) + "\n";
+        }
+        cumulative += snap.buckets[bucket_count - 1];
+        out += "ragcpp_stage_seconds_bucket{" + label + ",le=\"+Inf\"} " + std::to_string(cumulative) + "\n";
+        out += "ragcpp_stage_seconds_sum{" + label + "} " + format_number(snap.sum_ns * 1e-9) + "\n";
+        out += "ragcpp_stage_seconds_count{" + label + "} " + std::to_string(cumulative) + "\n";
+    }
+
+    for (size_t c = 0; c < static_cast<size_t>(Counter::Count); ++c) {
+        std::string name = std::string("ragcpp_") + counter_names[c] + "_total";
+        out += "# TYPE " + name + " counter\n";
+        out += name + " " + std::to_string(g_counters[c].load(std::memory_order_relaxed)) + "\n";
+    }
+    return out;
+}
+
+std::string metrics_json() {
+    nlohmann::json report;
+    nlohmann::json stages = nlohmann::json::object();
+    for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+        StageSnapshot snap = snapshot(s);
+        stages[stage_names[s]] = {
+            {"count", snap.count},
+            {"sum_seconds", snap.sum_ns * 1e-9},
+            {"max_seconds", snap.max_ns * 1e-9},
+            {"p50_seconds", quantile_seconds(snap, 0.50)},
+            {"p99_seconds", quantile_seconds(snap, 0.99)}
+        };
+    }
+    report["stages"] = stages;
+
+    nlohmann::json counters = nlohmann::json::object();
+    for (size_t c = 0; c < static_cast<size_t>(Counter::Count); ++c) {
+        counters[counter_names[c]] = g_counters[c].load(std::memory_order_relaxed);
+    }
+    report["counters"] = counters;
+    return report.dump(2);
+}
+
+// Wide output like the rest of the CLI; mixing narrow writes into a
+// wide-oriented stdout loses them on some C runtimes
+void print_profile() {
+    std::wcout << L"\nProfile\n";
+    std::wcout << std::left << std::setw(22) << L"Stage"
+        << std::right << std::setw(10) << L"count"
+        << std::setw(14) << L"total ms"
+        << std::setw(12) << L"mean ms"
+        << std::setw(12) << L"p50 ms"
+        << std::setw(12) << L"p99 ms"
+        << std::setw(12) << L"max ms" << L"\n";
+    std::wcout << std::wstring(90, L'-') << L"\n";
+    std::wcout << std::fixed << std::setprecision(3);
+    for (size_t s = 0; s < static_cast<size_t>(Stage::Count); ++s) {
+        StageSnapshot snap = snapshot(s);
+        if (snap.count == 0) continue;
+        std::wcout << std::left << std::setw(22) << stage_names[s]
+            << std::right << std::setw(10) << snap.count
+            << std::setw(14) << snap.sum_ns * 1e-6
+            << std::setw(12) << snap.sum_ns * 1e-6 / snap.count
+            << std::setw(12) << quantile_seconds(snap, 0.50) * 1e3
+            << std::setw(12) << quantile_seconds(snap, 0.99) * 1e3
+            << std::setw(12) << snap.max_ns * 1e-6 << L"\n";
+    }
+    std::wcout << std::defaultfloat;
+
+    for (size_t c = 0; c < static_cast<size_t>(Counter::Count); ++c) {
+        uint64_t value = g_counters[c].load(std::memory_order_relaxed);
+        if (value == 0) continue;
+        std::wcout << std::left << std::setw(24) << counter_names[c] << std::right << value << L"\n";
+    }
+    std::wcout << std::flush;
+}
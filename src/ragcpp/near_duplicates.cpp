@@ -0,0 +1,443 @@
+// near_duplicates.cpp
+
+#include "near_duplicates.h"
+#include "database.h"
+#include "text_processing.h"
+#include "encoding_utils.h"
+#include "metrics.h"
+#include "shards.h"
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <map>
+
+namespace {
+
+// Words per shingle. Paragraphs shorter than this form a single shingle.
+const size_t shingle_words = 3;
+
+const size_t band_rows = minhash_size / minhash_bands;
+
+// Rows per statement when signing stored paragraphs
+const size_t signature_batch_size = 512;
+static_assert(minhash_size % minhash_bands == 0, "bands must split the signature evenly");
+
+std::atomic<double> g_near_duplicate_threshold{ 0.0 };
+
+uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// The minhash_size hash functions h(x) = (a * x + b) >> 32. Signatures are
+// stored, so the constants are fixed rather than drawn at startup.
+struct Permutations {
+    uint64_t a[minhash_size];
+    uint64_t b[minhash_size];
+};
+
+const Permutations& permutations() {
+    static const Permutations p = [] {
+        Permutations p{};
+        uint64_t state = 0x52414743505044ULL;
+        for (size_t j = 0; j < minhash_size; ++j) {
+            state += 0x9E3779B97F4A7C15ULL;
+            p.a[j] = mix64(state) | 1;
+            state += 0x9E3779B97F4A7C15ULL;
+            p.b[j] = mix64(state);
+        }
+        return p;
+    }();
+    return p;
+}
+
+// Spaces and ASCII punctuation carry no content; ASCII letters are compared
+// case-insensitively. Returns 0 for a word to skip.
+uint64_t word_hash(const std::string& word) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    bool content = false;
+    for (unsigned char c : word) {
+        if (c < 0x80 && (std::isspace(c) || std::ispunct(c))) continue;
+        content = true;
+        h = (h ^ static_cast<unsigned char>(std::tolower(c))) * 0x100000001B3ULL;
+    }
+    return content ? mix64(h) | 1 : 0;
+}
+
+int64_t band_key(const MinHashSignature& signature, size_t band) {
+    uint64_t h = mix64(band + 1);
+    for (size_t r = 0; r < band_rows; ++r) {
+        h = mix64(h ^ signature[band * band_rows + r]);
+    }
+    return static_cast<int64_t>(h);
+}
+
+std::string band_keys_json(const MinHashSignature& signature) {
+    std::string json = "[";
+    for (size_t band = 0; band < minhash_bands; ++band) {
+        if (band > 0) json += ',';
+        json += std::to_string(band_key(signature, band));
+    }
+    json += ']';
+    return json;
+}
+
+bool prepare(sqlite3* db, const char* sql, sqlite3_stmt** stmt) {
+    if (sqlite3_prepare_v2(db, sql, -1, stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Rows for insert_minhash_signatures: the band keys as JSON for json_each,
+// and the signature as a VALUES row with a blob literal. Both are built from
+// numbers only, and blob literals work with SQLite versions before unhex().
+void append_signature_rows(std::string& bands_json, std::string& values, const StoredSignature& row) {
+    static const char digits[] = "0123456789abcdef";
+    bands_json += bands_json.size() > 1 ? ",{\"id\":" : "{\"id\":";
+    bands_json += std::to_string(row.id);
+    bands_json += ",\"bands\":";
+    bands_json += band_keys_json(row.signature);
+    bands_json += '}';
+
+    values += values.empty() ? "(" : ",(";
+    values += std::to_string(row.id);
+    values += ',';
+    values += std::to_string(row.doc_id);
+    values += ",X'";
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(row.signature.data());
+    for (size_t i = 0; i < sizeof(row.signature); ++i) {
+        values += digits[bytes[i] >> 4];
+        values += digits[bytes[i] & 15];
+    }
+    values += "')";
+}
+
+bool read_signature(sqlite3_stmt* stmt, int column, MinHashSignature& signature) {
+    if (sqlite3_column_bytes(stmt, column) != static_cast<int>(sizeof(signature))) {
+        return false;
+    }
+    std::memcpy(signature.data(), sqlite3_column_blob(stmt, column), sizeof(signature));
+    return true;
+}
+
+std::string ids_json(const std::vector<int>& ids) {
+    std::string json = "[";
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (i > 0) json += ',';
+        json += std::to_string(ids[i]);
+    }
+    json += ']';
+    return json;
+}
+
+} // namespace
+
+MinHashSignature minhash_signature(const std::wstring& text) {
+    std::vector<uint64_t> words;
+    for (const auto& word : split_words(text)) {
+        uint64_t h = word_hash(word);
+        if (h != 0) words.push_back(h);
+    }
+
+    std::vector<uint64_t> shingles;
+    if (words.size() <= shingle_words) {
+        uint64_t h = 0;
+        for (uint64_t word : words) {
+            h = mix64(h + word);
+        }
+        shingles.push_back(h);
+    }
+    else {
+        shingles.reserve(words.size() - shingle_words + 1);
+        for (size_t i = 0; i + shingle_words <= words.size(); ++i) {
+            uint64_t h = 0;
+            for (size_t w = 0; w < shingle_words; ++w) {
+                h = mix64(h + words[i + w]);
+            }
+            shingles.push_back(h);
+        }
+    }
+    std::sort(shingles.begin(), shingles.end());
+    shingles.erase(std::unique(shingles.begin(), shingles.end()), shingles.end());
+
+    const Permutations& p = permutations();
+    MinHashSignature signature;
+    signature.fill(UINT32_MAX);
+    for (uint64_t shingle : shingles) {
+        for (size_t j = 0; j < minhash_size; ++j) {
+            uint32_t value = static_cast<uint32_t>((p.a[j] * shingle + p.b[j]) >> 32);
+            signature[j] = std::min(signature[j], value);
+        }
+    }
+    return signature;
+}
+
+double minhash_similarity(const MinHashSignature& a, const MinHashSignature& b) {
+    size_t equal = 0;
+    for (size_t j = 0; j < minhash_size; ++j) {
+        equal += a[j] == b[j];
+    }
+    return static_cast<double>(equal) / minhash_size;
+}
+
+void set_near_duplicate_threshold(double threshold) {
+    g_near_duplicate_threshold = std::clamp(threshold, 0.0, 1.0);
+}
+
+double near_duplicate_threshold() {
+    return g_near_duplicate_threshold;
+}
+
+void MinHashIndex::add(int key, const MinHashSignature& signature) {
+    size_t position = entries_.size();
+    entries_.emplace_back(key, signature);
+    for (size_t band = 0; band < minhash_bands; ++band) {
+        bands_.emplace(band_key(signature, band), position);
+    }
+}
+
+int MinHashIndex::find(const MinHashSignature& signature, double threshold, double* similarity) const {
+    std::vector<size_t> candidates;
+    for (size_t band = 0; band < minhash_bands; ++band) {
+        auto range = bands_.equal_range(band_key(signature, band));
+        for (auto it = range.first; it != range.second; ++it) {
+            candidates.push_back(it->second);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    int best_key = -1;
+    double best = threshold;
+    for (size_t position : candidates) {
+        double s = minhash_similarity(signature, entries_[position].second);
+        if (s >= best && (best_key < 0 || s > best)) {
+            best = s;
+            best_key = entries_[position].first;
+        }
+    }
+    if (best_key >= 0 && similarity) {
+        *similarity = best;
+    }
+    return best_key;
+}
+
+void insert_minhash_signatures(sqlite3* primary, const std::vector<StoredSignature>& rows) {
+    std::vector<sqlite3*> shards = shard_connections(primary);
+    std::vector<std::string> bands_by_shard(shards.size(), "[");
+    std::vector<std::string> values_by_shard(shards.size());
+    for (const auto& row : rows) {
+        size_t k = shard_index(primary, row.id);
+        append_signature_rows(bands_by_shard[k], values_by_shard[k], row);
+    }
+
+    // Bands first: a signature whose bands are missing would never be matched,
+    // while one missing its signature row is signed again by sign_stored_paragraphs
+    for (size_t k = 0; k < shards.size(); ++k) {
+        if (values_by_shard[k].empty()) continue;
+        auto lock = lock_connection(shards[k]);
+        bands_by_shard[k] += ']';
+        std::string insert_sql[] = {
+            "INSERT INTO minhash_bands (band_key, id) SELECT b.value, json_extract(r.value, '$.id') FROM json_each(?1) r, json_each(r.value, '$.bands') b;",
+            "INSERT INTO minhash_signatures (id, doc_id, signature) VALUES " + values_by_shard[k] + ";"
+        };
+        for (const std::string& sql : insert_sql) {
+            sqlite3_stmt* stmt;
+            if (!prepare(shards[k], sql.c_str(), &stmt)) {
+                break;
+            }
+            sqlite3_bind_text(stmt, 1, bands_by_shard[k].c_str(), static_cast<int>(bands_by_shard[k].size()), SQLITE_STATIC);
+            bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+            if (!ok) {
+                std::cerr << "Failed to store near-duplicate signatures: " << sqlite3_errmsg(shards[k]) << std::endl;
+            }
+            sqlite3_finalize(stmt);
+            if (!ok) break;
+        }
+    }
+}
+
+bool find_stored_near_duplicate(sqlite3* primary, const MinHashSignature& signature, double threshold, NearDuplicateMatch& match) {
+    const char* select_sql = "SELECT id, doc_id, signature FROM minhash_signatures WHERE id IN "
+        "(SELECT id FROM minhash_bands WHERE band_key IN (SELECT value FROM json_each(?1)));";
+    std::string keys = band_keys_json(signature);
+
+    match = NearDuplicateMatch();
+    match.similarity = threshold;
+    for (sqlite3* shard : shard_connections(primary)) {
+        sqlite3_stmt* stmt;
+        if (!prepare(shard, select_sql, &stmt)) {
+            continue;
+        }
+        sqlite3_bind_text(stmt, 1, keys.c_str(), static_cast<int>(keys.size()), SQLITE_STATIC);
+        MinHashSignature stored;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            if (!read_signature(stmt, 2, stored)) continue;
+            // The earliest of equally similar rows, so copies keep pointing at one original
+            int id = sqlite3_column_int(stmt, 0);
+            double s = minhash_similarity(signature, stored);
+            if (s > match.similarity || (s == match.similarity && (match.id < 0 || id < match.id))) {
+                match.id = id;
+                match.doc_id = sqlite3_column_int(stmt, 1);
+                match.similarity = s;
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+    return match.id >= 0;
+}
+
+size_t sign_stored_paragraphs(sqlite3* primary) {
+    std::vector<sqlite3*> shards = shard_connections(primary);
+    std::vector<size_t> signed_rows(shards.size(), 0);
+    run_on_shards(shards.size(), [&](size_t k) {
+        sqlite3* shard = shards[k];
+        sqlite3_stmt* stmt;
+        if (!prepare(shard, "SELECT id, doc_id, text FROM paragraph_texts WHERE id NOT IN (SELECT id FROM minhash_signatures);", &stmt)) {
+            return;
+        }
+
+        // Read everything first: the inserts go to the table being filtered on
+        std::vector<StoredSignature> rows;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+            std::wstring paragraph = utf8_to_wstring(std::string(text ? text : "", sqlite3_column_bytes(stmt, 2)));
+            rows.push_back({ sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), minhash_signature(paragraph) });
+        }
+        sqlite3_finalize(stmt);
+
+        for (size_t start = 0; start < rows.size(); start += signature_batch_size) {
+            size_t end = std::min(rows.size(), start + signature_batch_size);
+            insert_minhash_signatures(primary, std::vector<StoredSignature>(rows.begin() + start, rows.begin() + end));
+        }
+        signed_rows[k] = rows.size();
+    });
+
+    size_t total = 0;
+    for (size_t n : signed_rows) {
+        total += n;
+    }
+    return total;
+}
+
+bool link_near_duplicate(sqlite3* primary, int doc_id, const std::wstring& text, const NearDuplicateMatch& match) {
+    auto lock = lock_connection(primary);
+    sqlite3_stmt* stmt;
+    const char* insert_sql = "INSERT INTO near_duplicates (doc_id, text, canonical_id, canonical_doc_id, similarity) VALUES (?, ?, ?, ?, ?);";
+    if (!prepare(primary, insert_sql, &stmt)) {
+        return false;
+    }
+
+    std::string utf8_text = wstring_to_utf8(text);
+    sqlite3_bind_int(stmt, 1, doc_id);
+    sqlite3_bind_text(stmt, 2, utf8_text.c_str(), static_cast<int>(utf8_text.size()), SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 3, match.id);
+    sqlite3_bind_int(stmt, 4, match.doc_id);
+    sqlite3_bind_double(stmt, 5, match.similarity);
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!ok) {
+        std::cerr << "Failed to link a near-duplicate paragraph: " << sqlite3_errmsg(primary) << std::endl;
+    }
+    sqlite3_finalize(stmt);
+    if (ok) {
+        add_counter(Counter::NearDuplicates);
+    }
+    return ok;
+}
+
+size_t requeue_near_duplicates_of(sqlite3* primary, const std::vector<int>& doc_ids) {
+    if (doc_ids.empty()) {
+        return 0;
+    }
+
+    sqlite3_stmt* stmt;
+    const char* delete_sql = "DELETE FROM near_duplicates WHERE canonical_doc_id IN (SELECT value FROM json_each(?1)) "
+        "AND doc_id NOT IN (SELECT value FROM json_each(?1)) RETURNING doc_id, text;";
+    if (!prepare(primary, delete_sql, &stmt)) {
+        return 0;
+    }
+
+    auto lock = lock_connection(primary);
+    sqlite3_exec(primary, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    std::string deleted = ids_json(doc_ids);
+    sqlite3_bind_text(stmt, 1, deleted.c_str(), static_cast<int>(deleted.size()), SQLITE_STATIC);
+    std::map<int, std::vector<std::wstring>> orphans;
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        orphans[sqlite3_column_int(stmt, 0)].push_back(utf8_to_wstring(std::string(text ? text : "", sqlite3_column_bytes(stmt, 1))));
+    }
+    sqlite3_finalize(stmt);
+
+    bool ok = rc == SQLITE_DONE;
+    size_t requeued = 0;
+    for (const auto& [doc_id, texts] : orphans) {
+        if (!ok) break;
+        ok = enqueue_paragraphs(primary, doc_id, texts).size() == texts.size();
+        advance_progress(primary, doc_id, -static_cast<int>(texts.size()));
+        update_progress_status(primary, doc_id, "Retry Pending");
+        requeued += texts.size();
+    }
+    if (!ok) {
+        std::cerr << "Failed to re-queue near-duplicate paragraphs: " << sqlite3_errmsg(primary) << std::endl;
+    }
+    sqlite3_exec(primary, ok ? "COMMIT;" : "ROLLBACK;", nullptr, nullptr, nullptr);
+    return ok ? requeued : 0;
+}
+
+std::unordered_map<int, std::vector<int>> get_near_duplicate_documents(sqlite3* primary, const std::vector<int>& ids) {
+    std::unordered_map<int, std::vector<int>> documents;
+    if (ids.empty()) {
+        return documents;
+    }
+
+    sqlite3_stmt* stmt;
+    const char* select_sql = "SELECT DISTINCT canonical_id, doc_id FROM near_duplicates "
+        "WHERE canonical_id IN (SELECT value FROM json_each(?1)) ORDER BY canonical_id, doc_id;";
+    if (!prepare(primary, select_sql, &stmt)) {
+        return documents;
+    }
+    std::string keys = ids_json(ids);
+    sqlite3_bind_text(stmt, 1, keys.c_str(), static_cast<int>(keys.size()), SQLITE_STATIC);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        documents[sqlite3_column_int(stmt, 0)].push_back(sqlite3_column_int(stmt, 1));
+    }
+    sqlite3_finalize(stmt);
+    return documents;
+}
+
+std::unordered_map<int, MinHashSignature> get_minhash_signatures(sqlite3* primary, const std::vector<int>& ids) {
+    std::unordered_map<int, MinHashSignature> signatures;
+    std::vector<sqlite3*> shards = shard_connections(primary);
+    std::vector<std::vector<int>> ids_by_shard(shards.size());
+    for (int id : ids) {
+        ids_by_shard[shard_index(primary, id)].push_back(id);
+    }
+
+    const char* select_sql = "SELECT id, signature FROM minhash_signatures WHERE id IN (SELECT value FROM json_each(?1));";
+    for (size_t k = 0; k < shards.size(); ++k) {
+        if (ids_by_shard[k].empty()) continue;
+        sqlite3_stmt* stmt;
+        if (!prepare(shards[k], select_sql, &stmt)) {
+            continue;
+        }
+        std::string keys = ids_json(ids_by_shard[k]);
+        sqlite3_bind_text(stmt, 1, keys.c_str(), static_cast<int>(keys.size()), SQLITE_STATIC);
+        MinHashSignature signature;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            if (read_signature(stmt, 1, signature)) {
+                signatures[sqlite3_column_int(stmt, 0)] = signature;
+            }
+        }
+        sqlite3_finalize(stmt);
+    }
+    return signatures;
+}
@@ -6,17 +6,249 @@
 #include <iostream>
 #include "utils.h"
 #include "encoding_utils.h"
+#include "sse_parser.h"
+#include "metrics.h"
+#include "request_scheduler.h"
+#include "embedding_parser.h"
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
 
-std::vector<float> get_embedding(const std::wstring& wtext, const std::string& api_key) {
-    std::string text = wstring_to_utf8(wtext);
+// Base URL of the OpenAI-compatible endpoint. OPENAI_API_BASE overrides the
+// default so the tool can be pointed at a proxy or a local stand-in server.
+static std::string& api_base_url() {
+    static std::string base_url = [] {
+        const char* env = std::getenv("OPENAI_API_BASE");
+        return std::string(env ? env : "https://api.openai.com");
+    }();
+    return base_url;
+}
+
+void set_api_base_url(const std::string& base_url) {
+    api_base_url() = base_url;
+}
+
+// Finished easy handles are pooled rather than cleaned up. curl keeps its
+// connection cache on the handle, so later requests (from any thread) reuse
+// the open TCP/TLS connection to the API instead of handshaking again.
+static std::mutex curl_pool_mutex;
+static std::vector<CURL*> curl_pool;
+
+static CURL* acquire_curl_handle() {
+    {
+        std::lock_guard<std::mutex> lock(curl_pool_mutex);
+        if (!curl_pool.empty()) {
+            CURL* curl = curl_pool.back();
+            curl_pool.pop_back();
+            curl_easy_reset(curl);
+            return curl;
+        }
+    }
+    return curl_easy_init();
+}
+
+static void release_curl_handle(CURL* curl) {
+    std::lock_guard<std::mutex> lock(curl_pool_mutex);
+    curl_pool.push_back(curl);
+}
+
+// Bytes received and failures (transport errors and HTTP error statuses) of a finished request
+static void record_http_result(CURL* curl, CURLcode res) {
+    curl_off_t downloaded = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded) == CURLE_OK && downloaded > 0) {
+        add_counter(Counter::HttpBytesReceived, static_cast<uint64_t>(downloaded));
+    }
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    if (res != CURLE_OK || status >= 400) {
+        add_counter(Counter::HttpErrors);
+    }
+}
+
+static size_t header_callback(char* buffer, size_t size, size_t nitems, void* userdata) {
+    static_cast<RateLimitHeaders*>(userdata)->parse_header_line(buffer, size * nitems);
+    return size * nitems;
+}
+
+// Transport failures, timeouts, rate limiting and server errors are worth another try
+static bool is_retryable(CURLcode res, long status) {
+    if (res != CURLE_OK) {
+        return res != CURLE_WRITE_ERROR && res != CURLE_ABORTED_BY_CALLBACK;
+    }
+    return status == 408 || status == 429 || status >= 500;
+}
+
+// Perform a prepared request through the endpoint's scheduler, retrying
+// retryable failures with backoff. reset_for_retry clears what the failed
+// attempt received and returns false when the request must not be repeated.
+// Returns the curl result and HTTP status of the last attempt.
+static CURLcode perform_api_request(CURL* curl, ApiEndpoint endpoint, const std::function<bool()>& reset_for_retry, long& status) {
+    Stage stage = endpoint == ApiEndpoint::Embeddings ? Stage::EmbeddingHttp : Stage::LlmCall;
+    Counter requests = endpoint == ApiEndpoint::Embeddings ? Counter::EmbeddingRequests : Counter::ChatRequests;
+    RequestScheduler& scheduler = api_request_scheduler(endpoint);
+
+    CURLcode res = CURLE_OK;
+    for (int attempt = 1; ; ++attempt) {
+        RateLimitHeaders headers;
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+
+        scheduler.acquire();
+        {
+            StageTimer timer(stage);
+            res = curl_easy_perform(curl);
+        }
+        status = 0;
+        if (res == CURLE_OK) {
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        }
+        add_counter(requests);
+        record_http_result(curl, res);
+        scheduler.release(status, headers);
+
+        if (res == CURLE_OK && status < 400) break;
+        if (attempt >= max_request_attempts || !is_retryable(res, status) || !reset_for_retry()) break;
+
+        auto delay = retry_delay(attempt, headers.retry_after_seconds);
+        std::string reason = res != CURLE_OK ? curl_easy_strerror(res) : "HTTP " + std::to_string(status);
+        std::cerr << "API request failed (" << reason << "), retrying in " << delay.count() << " ms (attempt "
+            << attempt + 1 << " of " << max_request_attempts << ")." << std::endl;
+        add_counter(Counter::Retries);
+        std::this_thread::sleep_for(delay);
+    }
+    return res;
+}
+
+// Request base64 embeddings unless turned off: a quarter of the bytes of
+// decimal text and no number parsing at all
+static std::atomic<bool> g_embedding_base64{ true };
+
+void set_embedding_encoding(bool base64) {
+    g_embedding_base64 = base64;
+}
+
+std::vector<float> parse_embedding_response(const std::string& response_body) {
+    std::vector<float> embedding;
+    EmbeddingResponseParser parser(&embedding, 1);
+    parser.feed(response_body.data(), response_body.size());
+    if (!parser.finish() || embedding.empty()) {
+        std::cerr << "Failed to get embedding: " << parser.excerpt() << std::endl;
+    }
+    return embedding;
+}
+
+std::vector<std::vector<float>> parse_embeddings_response(const std::string& response_body, size_t count) {
+    std::vector<std::vector<float>> embeddings(count);
+    EmbeddingResponseParser parser(embeddings.data(), count);
+    parser.feed(response_body.data(), response_body.size());
+    if (!parser.finish()) {
+        std::cerr << "Failed to get embeddings: " << parser.excerpt() << std::endl;
+    }
+    return embeddings;
+}
+
+// POST an /v1/embeddings request for input (a string or an array of strings)
+// and stream the response into outputs[0..count)
+static void request_embeddings(const nlohmann::json& input, std::vector<float>* outputs, size_t count, const std::string& api_key) {
+    CURL* curl = acquire_curl_handle();
+    if (!curl) {
+        return;
+    }
+
+    std::string url = api_base_url() + "/v1/embeddings";
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
+
+    struct curl_slist* headers = nullptr;
+    std::string auth_header = "Authorization: Bearer " + api_key;
+    headers = curl_slist_append(headers, auth_header.c_str());
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+    nlohmann::json json_data;
+    json_data["input"] = input;
+    json_data["model"] = "text-embedding-ada-002";
+    if (g_embedding_base64) {
+        json_data["encoding_format"] = "base64";
+    }
+
+    std::string post_fields = json_data.dump();
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_fields.c_str());
 
-    CURL* curl = curl_easy_init();
+    // The body is parsed as it arrives rather than buffered
+    EmbeddingResponseParser parser(outputs, count);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, EmbeddingResponseParser::write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &parser);
+
+    long status = 0;
+    CURLcode res = perform_api_request(curl, ApiEndpoint::Embeddings, [&parser]() {
+        parser.reset();
+        return true;
+    }, status);
+    if (res != CURLE_OK) {
+        std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
+        parser.reset();
+    }
+    else if (!parser.finish() || status >= 400) {
+        std::cerr << "Failed to get embeddings: " << parser.excerpt() << std::endl;
+        parser.reset();
+    }
+
+    curl_slist_free_all(headers);
+    release_curl_handle(curl);
+}
+
+std::vector<float> get_embedding(const std::wstring& wtext, const std::string& api_key) {
     std::vector<float> embedding;
+    request_embeddings(wstring_to_utf8(wtext), &embedding, 1, api_key);
+    return embedding;
+}
+
+std::vector<std::vector<float>> get_embeddings(const std::vector<std::wstring>& wtexts, const std::string& api_key) {
+    std::vector<std::vector<float>> embeddings(wtexts.size());
+    if (wtexts.empty()) {
+        return embeddings;
+    }
+
+    nlohmann::json inputs = nlohmann::json::array();
+    for (const auto& wtext : wtexts) {
+        inputs.push_back(wstring_to_utf8(wtext));
+    }
+    request_embeddings(inputs, embeddings.data(), embeddings.size(), api_key);
+    return embeddings;
+}
+
+static std::string build_chat_request(const std::string& context, const std::string& question, bool stream) {
+    std::string system_prompt = "You are an assistant that provides answers with proper citations from the provided context.";
+    nlohmann::json json_data;
+    json_data["model"] = "gpt-4";
+    json_data["messages"] = {
+        {{"role", "system"}, {"content", system_prompt}},
+        {{"role", "user"}, {"content", "Context:\n" + context + "\n\nQuestion: " + question}}
+    };
+    json_data["temperature"] = 0.7;
+    if (stream) {
+        json_data["stream"] = true;
+    }
+    return json_data.dump();
+}
+
+std::wstring generate_answer_from_context(const std::wstring& wcontext, const std::wstring& wquestion, const std::string& api_key) {
+    std::string context = wstring_to_utf8(wcontext);
+    std::string question = wstring_to_utf8(wquestion);
+
+    CURL* curl = acquire_curl_handle();
+    std::wstring answer;
 
     if (curl) {
         std::string read_buffer;
 
-        curl_easy_setopt(curl, CURLOPT_URL, "https://api.openai.com/v1/embeddings");
+        std::string url = api_base_url() + "/v1/chat/completions";
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
         curl_easy_setopt(curl, CURLOPT_POST, 1L);
         curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
         curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
@@ -27,48 +259,107 @@ std::vector<float> get_embedding(const std::wstring& wtext, const std::string& a
         headers = curl_slist_append(headers, "Content-Type: application/json");
         curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
-        nlohmann::json json_data;
-        json_data["input"] = text;
-        json_data["model"] = "text-embedding-ada-002";
-
-        std::string post_fields = json_data.dump();
+        std::string post_fields = build_chat_request(context, question, false);
         curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_fields.c_str());
 
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, &read_buffer);
 
-        CURLcode res = curl_easy_perform(curl);
+        long status = 0;
+        CURLcode res = perform_api_request(curl, ApiEndpoint::Chat, [&read_buffer]() {
+            read_buffer.clear();
+            return true;
+        }, status);
         if (res != CURLE_OK) {
             std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
         }
         else {
-            auto response_json = nlohmann::json::parse(read_buffer);
-            if (response_json.contains("data")) {
-                embedding = response_json["data"][0]["embedding"].get<std::vector<float>>();
+            auto response_json = nlohmann::json::parse(read_buffer, nullptr, false);
+            try {
+                if (!response_json.is_discarded() && response_json.contains("choices")) {
+                    std::string utf8_answer = response_json["choices"][0]["message"]["content"].get<std::string>();
+                    answer = utf8_to_wstring(utf8_answer);
+                }
+                else {
+                    std::cerr << "Failed to get answer: " << read_buffer.substr(0, 512) << std::endl;
+                }
             }
-            else {
-                std::cerr << "Failed to get embedding: " << response_json.dump() << std::endl;
+            catch (const nlohmann::json::exception& e) {
+                std::cerr << "Malformed chat response: " << e.what() << std::endl;
             }
         }
 
         curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
+        release_curl_handle(curl);
     }
 
-    return embedding;
+    return answer;
 }
 
-std::wstring generate_answer_from_context(const std::wstring& wcontext, const std::wstring& wquestion, const std::string& api_key) {
+// State shared with the curl write callback while streaming a completion
+struct StreamState {
+    SseParser parser;
+    std::string raw_body;   // Kept for error reporting when the body is not an event stream
+    std::string answer;
+    bool done = false;
+    const std::function<void(const std::wstring&)>* on_token;
+
+    StreamState(const std::function<void(const std::wstring&)>* callback)
+        : parser([this](const std::string& data) { handle_event(data); }), on_token(callback) {
+    }
+
+    // Forget a failed attempt's body before the request is retried
+    void reset() {
+        parser = SseParser([this](const std::string& data) { handle_event(data); });
+        raw_body.clear();
+        answer.clear();
+        done = false;
+    }
+
+    void handle_event(const std::string& data) {
+        if (data == "[DONE]") {
+            done = true;
+            return;
+        }
+        auto chunk = nlohmann::json::parse(data, nullptr, false);
+        if (chunk.is_discarded() || !chunk.contains("choices") || chunk["choices"].empty()) {
+            return;
+        }
+        const auto& delta = chunk["choices"][0]["delta"];
+        if (delta.contains("content") && delta["content"].is_string()) {
+            std::string token = delta["content"].get<std::string>();
+            answer += token;
+            if (*on_token) {
+                (*on_token)(utf8_to_wstring(token));
+            }
+        }
+    }
+};
+
+static size_t stream_write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t total_size = size * nmemb;
+    StreamState* state = static_cast<StreamState*>(userp);
+    const char* data = static_cast<const char*>(contents);
+    if (state->raw_body.size() < 4096) {
+        state->raw_body.append(data, std::min<size_t>(total_size, 4096 - state->raw_body.size()));
+    }
+    state->parser.feed(data, total_size);
+    return total_size;
+}
+
+std::wstring generate_answer_from_context_stream(const std::wstring& wcontext, const std::wstring& wquestion, const std::string& api_key,
+    const std::function<void(const std::wstring&)>& on_token) {
     std::string context = wstring_to_utf8(wcontext);
     std::string question = wstring_to_utf8(wquestion);
 
-    CURL* curl = curl_easy_init();
+    CURL* curl = acquire_curl_handle();
     std::wstring answer;
 
     if (curl) {
-        std::string read_buffer;
+        StreamState state(&on_token);
 
-        curl_easy_setopt(curl, CURLOPT_URL, "https://api.openai.com/v1/chat/completions");
+        std::string url = api_base_url() + "/v1/chat/completions";
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
         curl_easy_setopt(curl, CURLOPT_POST, 1L);
         curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0);
         curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
@@ -77,40 +368,37 @@ std::wstring generate_answer_from_context(const std::wstring& wcontext, const st
         std::string auth_header = "Authorization: Bearer " + api_key;
         headers = curl_slist_append(headers, auth_header.c_str());
         headers = curl_slist_append(headers, "Content-Type: application/json");
+        headers = curl_slist_append(headers, "Accept: text/event-stream");
         curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
-        std::string system_prompt = "You are an assistant that provides answers with proper citations from the provided context.";
-        nlohmann::json json_data;
-        json_data["model"] = "gpt-4";
-        json_data["messages"] = {
-            {{"role", "system"}, {"content", system_prompt}},
-            {{"role", "user"}, {"content", "Context:\n" + context + "\n\nQuestion: " + question}}
-        };
-        json_data["temperature"] = 0.7;
-
-        std::string post_fields = json_data.dump();
+        std::string post_fields = build_chat_request(context, question, true);
         curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_fields.c_str());
 
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &read_buffer);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream_write_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &state);
 
-        CURLcode res = curl_easy_perform(curl);
+        // A stream that has already delivered tokens cannot be taken back
+        long status = 0;
+        CURLcode res = perform_api_request(curl, ApiEndpoint::Chat, [&state]() {
+            if (state.parser.event_count() > 0) {
+                return false;
+            }
+            state.reset();
+            return true;
+        }, status);
         if (res != CURLE_OK) {
             std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << std::endl;
         }
         else {
-            auto response_json = nlohmann::json::parse(read_buffer);
-            if (response_json.contains("choices")) {
-                std::string utf8_answer = response_json["choices"][0]["message"]["content"].get<std::string>();
-                answer = utf8_to_wstring(utf8_answer);
-            }
-            else {
-                std::cerr << "Failed to get answer: " << response_json.dump() << std::endl;
+            state.parser.finish();
+            if (state.parser.event_count() == 0) {
+                std::cerr << "Failed to get answer: " << state.raw_body << std::endl;
             }
         }
+        answer = utf8_to_wstring(state.answer);
 
         curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
+        release_curl_handle(curl);
     }
 
     return answer;
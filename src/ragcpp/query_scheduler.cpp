@@ -0,0 +1,205 @@
+// query_scheduler.cpp
+
+#include "query_scheduler.h"
+#include "document_manager.h"
+#include "text_processing.h"
+#include "openai_api.h"
+#include "answer_cache.h"
+#include "vector_projection.h"
+#include <iostream>
+#include <algorithm>
+
+bool QueryExecution::follow(const std::function<void(const std::wstring&)>& on_token, std::wstring& citations) {
+    size_t next = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        changed_.wait(lock, [&] { return done_ || next < tokens_.size(); });
+
+        // Deliver outside the lock so a slow client does not stall the producer
+        while (next < tokens_.size()) {
+            std::wstring token = tokens_[next++];
+            lock.unlock();
+            on_token(token);
+            lock.lock();
+        }
+
+        if (done_ && next == tokens_.size()) {
+            citations = citations_;
+            return success_;
+        }
+    }
+}
+
+void QueryExecution::append_token(const std::wstring& token) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tokens_.push_back(token);
+    }
+    changed_.notify_all();
+}
+
+void QueryExecution::finish(bool success, const std::wstring& citations) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        success_ = success;
+        citations_ = citations;
+        done_ = true;
+    }
+    changed_.notify_all();
+}
+
+QueryScheduler::QueryScheduler(sqlite3* db, const std::string& api_key, const std::vector<VectorIndex>& segments,
+    std::shared_mutex& index_mutex, const QuerySchedulerOptions& options)
+    : db_(db), api_key_(api_key), segments_(segments), index_mutex_(index_mutex), options_(options),
+    answer_pool_(options.answer_threads), scan_pool_(options.scan_threads) {
+    batch_thread_ = std::thread(&QueryScheduler::batch_loop, this);
+}
+
+QueryScheduler::~QueryScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    pending_changed_.notify_all();
+    batch_thread_.join();
+}
+
+std::shared_ptr<QueryExecution> QueryScheduler::submit(const std::wstring& query, size_t binary_candidates) {
+    std::shared_ptr<QueryExecution> execution;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        // Same question, searched the same way, already being answered: share its execution
+        auto it = in_flight_.find({ query, binary_candidates });
+        if (it != in_flight_.end()) {
+            return it->second;
+        }
+
+        execution = std::make_shared<QueryExecution>();
+        in_flight_[{ query, binary_candidates }] = execution;
+
+        if (pending_.empty()) {
+            first_pending_time_ = std::chrono::steady_clock::now();
+        }
+        pending_.push_back({ query, binary_candidates, execution });
+    }
+    pending_changed_.notify_all();
+    return execution;
+}
+
+void QueryScheduler::batch_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        pending_changed_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+        if (pending_.empty()) {
+            return; // Stopping with nothing left to flush
+        }
+
+        // Give other queries the rest of the window to join this batch
+        auto deadline = first_pending_time_ + std::chrono::milliseconds(options_.batch_window_ms);
+        pending_changed_.wait_until(lock, deadline, [this] {
+            return stopping_ || pending_.size() >= options_.max_batch_size;
+        });
+
+        size_t take = std::min(pending_.size(), options_.max_batch_size);
+        std::vector<PendingQuery> batch(pending_.begin(), pending_.begin() + take);
+        pending_.erase(pending_.begin(), pending_.begin() + take);
+        if (!pending_.empty()) {
+            first_pending_time_ = std::chrono::steady_clock::now();
+        }
+
+        lock.unlock();
+        scan_pool_.submit([this, batch]() { run_batch(batch); });
+        lock.lock();
+    }
+}
+
+void QueryScheduler::run_batch(std::vector<PendingQuery> batch) {
+    std::vector<std::wstring> tokenized;
+    tokenized.reserve(batch.size());
+    for (const auto& pending : batch) {
+        tokenized.push_back(tokenize_text(pending.query));
+    }
+
+    // One embedding request for the whole batch
+    std::vector<std::vector<float>> embeddings = get_embeddings(tokenized, api_key_);
+
+    // One blocked pass over every segment for all queries of the batch with
+    // the same prefilter, re-ranked at full dimension when the segments hold
+    // reduced vectors
+    std::map<size_t, std::vector<size_t>> by_prefilter;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        by_prefilter[batch[i].binary_candidates].push_back(i);
+    }
+    std::vector<std::vector<SimilarityResult>> results(batch.size());
+    {
+        std::shared_lock<std::shared_mutex> lock(index_mutex_);
+        for (const auto& [candidates, members] : by_prefilter) {
+            std::vector<std::vector<float>> queries;
+            queries.reserve(members.size());
+            for (size_t i : members) {
+                queries.push_back(embeddings[i]);
+            }
+            auto group_results = search_segments_reranked(db_, segments_, queries, options_.top_k, candidates);
+            for (size_t j = 0; j < members.size(); ++j) {
+                results[members[j]] = std::move(group_results[j]);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (embeddings[i].empty()) {
+            std::cerr << "Failed to generate query embedding." << std::endl;
+            complete(batch[i], false, L"");
+        }
+        else if (results[i].empty()) {
+            std::cerr << "No relevant embeddings found." << std::endl;
+            complete(batch[i], false, L"");
+        }
+        else {
+            PendingQuery pending = batch[i];
+            std::vector<float> embedding = std::move(embeddings[i]);
+            std::vector<SimilarityResult> query_results = std::move(results[i]);
+            answer_pool_.submit([this, pending, embedding, query_results]() { run_answer(pending, embedding, query_results); });
+        }
+    }
+}
+
+void QueryScheduler::run_answer(const PendingQuery& pending, const std::vector<float>& embedding,
+    const std::vector<SimilarityResult>& results) {
+    std::wstring context;
+    std::wstring citations;
+    auto packed = build_context(results, db_, options_.top_k, context_token_budget(), context, citations);
+
+    std::wstring cached_answer;
+    if (lookup_cached_answer(db_, embedding, packed, cached_answer, citations)) {
+        pending.execution->append_token(cached_answer);
+        complete(pending, true, citations);
+        return;
+    }
+
+    QueryExecution* execution = pending.execution.get();
+    std::wstring answer = generate_answer_from_context_stream(context, pending.query, api_key_, [execution](const std::wstring& token) {
+        execution->append_token(token);
+    });
+    if (answer.empty()) {
+        // The server then sends its error event rather than citations without an answer
+        std::cerr << "Failed to generate an answer." << std::endl;
+        complete(pending, false, L"");
+        return;
+    }
+
+    store_cached_answer(db_, pending.query, embedding, packed, answer, citations);
+    complete(pending, true, citations);
+}
+
+void QueryScheduler::complete(const PendingQuery& pending, bool success, const std::wstring& citations) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = in_flight_.find({ pending.query, pending.binary_candidates });
+        if (it != in_flight_.end() && it->second == pending.execution) {
+            in_flight_.erase(it);
+        }
+    }
+    pending.execution->finish(success, citations);
+}
@@ -0,0 +1,276 @@
+// query_server.cpp
+
+#include "query_server.h"
+#include "http_server.h"
+#include "sse_parser.h"
+#include "vector_index.h"
+#include "document_manager.h"
+#include "database.h"
+#include "query_scheduler.h"
+#include "shards.h"
+#include "vector_projection.h"
+#include "snapshot.h"
+#include "encoding_utils.h"
+#include "metrics.h"
+#include <curl/curl.h>
+#include <nlohmann/json.hpp>
+#include <iostream>
+#include <shared_mutex>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <chrono>
+
+namespace {
+
+struct ServerState {
+    sqlite3* db = nullptr;
+    std::string api_key;
+    std::shared_mutex index_mutex;
+    std::vector<sqlite3*> shards;
+    std::vector<VectorIndex> segments;      // One per shard
+    std::vector<int> data_versions;
+    std::shared_ptr<const VectorProjection> projection;    // Segments hold reduced vectors when set
+    std::unique_ptr<QueryScheduler> scheduler;
+};
+
+size_t vector_count(const ServerState& state) {
+    size_t count = 0;
+    for (const auto& segment : state.segments) {
+        count += segment.size();
+    }
+    return count;
+}
+
+int projection_version(const std::shared_ptr<const VectorProjection>& projection) {
+    return projection ? projection->version : 0;
+}
+
+// Reload the segments of shards another connection has committed to, and
+// every segment when a --reduce run has replaced the projection
+void refresh_index_if_changed(ServerState& state) {
+    std::vector<int> versions(state.shards.size());
+    for (size_t k = 0; k < state.shards.size(); ++k) {
+        versions[k] = get_data_version(state.shards[k]);
+    }
+    {
+        std::shared_lock<std::shared_mutex> lock(state.index_mutex);
+        if (versions == state.data_versions) return;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(state.index_mutex);
+    if (versions == state.data_versions) return;
+
+    auto start = std::chrono::steady_clock::now();
+    bool projection_changed = false;
+    if (versions[0] != state.data_versions[0]) {
+        std::shared_ptr<const VectorProjection> projection = load_projection(state.db);
+        projection_changed = projection_version(projection) != projection_version(state.projection);
+        state.projection = projection;
+    }
+    run_on_shards(state.shards.size(), [&state, &versions, projection_changed](size_t k) {
+        if (projection_changed || versions[k] != state.data_versions[k]) {
+            load_vector_index(state.shards[k], state.segments[k], state.projection);
+        }
+    });
+    state.data_versions = versions;
+
+    int dim = 0;
+    for (const auto& segment : state.segments) {
+        if (dim == 0) dim = segment.dim;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded " << vector_count(state) << (state.projection ? " reduced" : "") << " vectors (dim " << dim << ") from "
+        << state.shards.size() << (state.shards.size() == 1 ? " shard" : " shards") << " in " << ms << " ms." << std::endl;
+}
+
+std::string sse_event(const nlohmann::json& payload) {
+    return "data: " + payload.dump() + "\n\n";
+}
+
+HttpResponse handle_query(ServerState& state, const HttpRequest& request) {
+    HttpResponse response;
+    auto request_json = nlohmann::json::parse(request.body, nullptr, false);
+    if (request_json.is_discarded() || !request_json.contains("query") || !request_json["query"].is_string()) {
+        response.status = 400;
+        response.body = "{\"error\":\"expected {\\\"query\\\": \\\"...\\\"}\"}";
+        return response;
+    }
+
+    std::wstring user_query = utf8_to_wstring(request_json["query"].get<std::string>());
+
+    size_t candidates = binary_candidates();
+    if (request_json.contains("binary_candidates")) {
+        if (!request_json["binary_candidates"].is_number_unsigned()) {
+            response.status = 400;
+            response.body = "{\"error\":\"binary_candidates must be a non-negative integer\"}";
+            return response;
+        }
+        candidates = request_json["binary_candidates"].get<size_t>();
+    }
+
+    response.content_type = "text/event-stream";
+    response.stream = [&state, user_query, candidates](const HttpChunkWriter& write) {
+        refresh_index_if_changed(state);
+
+        std::wstring citations;
+        auto execution = state.scheduler->submit(user_query, candidates);
+        bool answered = execution->follow([&write](const std::wstring& token) {
+            write(sse_event({ {"token", wstring_to_utf8(token)} }));
+        }, citations);
+
+        if (answered) {
+            write(sse_event({ {"citations", wstring_to_utf8(citations)} }));
+        }
+        else {
+            write(sse_event({ {"error", "No answer could be generated for this query."} }));
+        }
+        write("data: [DONE]\n\n");
+    };
+    return response;
+}
+
+size_t client_write_callback(void* contents, size_t size, size_t nmemb, void* userp) {
+    size_t total_size = size * nmemb;
+    static_cast<SseParser*>(userp)->feed(static_cast<const char*>(contents), total_size);
+    return total_size;
+}
+
+} // namespace
+
+int run_query_server(sqlite3* db, const std::string& api_key, int port, const std::wstring& snapshot_path) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    ServerState state;
+    state.db = db;
+    state.api_key = api_key;
+    state.shards = shard_connections(db);
+    state.segments.resize(state.shards.size());
+    state.data_versions.assign(state.shards.size(), -1);
+    if (!snapshot_path.empty()) {
+        // Versions first: a commit landing while the snapshot loads still triggers a reload
+        std::vector<int> versions(state.shards.size());
+        for (size_t k = 0; k < state.shards.size(); ++k) {
+            versions[k] = get_data_version(state.shards[k]);
+        }
+        state.projection = load_projection(db);
+        std::vector<bool> loaded = load_segments_from_snapshot(db, snapshot_path, state.projection, state.segments);
+        for (size_t k = 0; k < state.shards.size(); ++k) {
+            if (loaded[k]) state.data_versions[k] = versions[k];
+        }
+    }
+    refresh_index_if_changed(state);
+    state.scheduler = std::make_unique<QueryScheduler>(db, api_key, state.segments, state.index_mutex, QuerySchedulerOptions());
+
+    HttpServer server;
+    bool started = server.start(port, [&state](const HttpRequest& request) {
+        if (request.method == "POST" && request.path == "/query") {
+            return handle_query(state, request);
+        }
+
+        HttpResponse response;
+        if (request.method == "GET" && request.path == "/health") {
+            std::shared_lock<std::shared_mutex> lock(state.index_mutex);
+            response.body = nlohmann::json({ {"status", "ok"}, {"vectors", vector_count(state)}, {"shards", state.shards.size()} }).dump();
+            return response;
+        }
+        if (request.method == "GET" && request.path == "/metrics") {
+            response.content_type = "text/plain; version=0.0.4";
+            response.body = metrics_prometheus();
+            return response;
+        }
+        if (request.method == "GET" && request.path == "/metrics.json") {
+            response.body = metrics_json();
+            return response;
+        }
+
+        response.status = 404;
+        response.body = "{\"error\":\"not found\"}";
+        return response;
+    });
+
+    if (!started) {
+        return -1;
+    }
+
+    std::cout << "Serving queries on http://127.0.0.1:" << server.port() << std::endl;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::hours(1));
+    }
+}
+
+bool query_via_server(const std::wstring& user_query, int port, int binary_candidates) {
+    CURL* curl = curl_easy_init();
+    if (!curl) return false;
+
+    bool printed_answer = false;
+    std::string error;
+    std::string citations;
+    SseParser parser([&](const std::string& data) {
+        if (data == "[DONE]") return;
+        auto event = nlohmann::json::parse(data, nullptr, false);
+        if (event.is_discarded()) return;
+
+        if (event.contains("token")) {
+            if (!printed_answer) {
+                std::wcout << L"Answer:\n";
+                printed_answer = true;
+            }
+            std::wcout << utf8_to_wstring(event["token"].get<std::string>()) << std::flush;
+        }
+        else if (event.contains("citations")) {
+            citations = event["citations"].get<std::string>();
+        }
+        else if (event.contains("error")) {
+            error = event["error"].get<std::string>();
+        }
+    });
+
+    std::string url = "http://127.0.0.1:" + std::to_string(port) + "/query";
+    nlohmann::json request_json = { {"query", wstring_to_utf8(user_query)} };
+    if (binary_candidates >= 0) {
+        request_json["binary_candidates"] = binary_candidates;
+    }
+    std::string post_fields = request_json.dump();
+
+    struct curl_slist* headers = nullptr;
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_fields.c_str());
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, 500L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, client_write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &parser);
+
+    CURLcode res = curl_easy_perform(curl);
+    parser.finish();
+
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+
+    // Nothing reached the console: let the caller answer in-process instead
+    if (parser.event_count() == 0) {
+        if (res == CURLE_OK && status != 200) {
+            std::cerr << "Query server on port " << port << " returned HTTP " << status << ", answering locally." << std::endl;
+        }
+        return false;
+    }
+
+    if (res != CURLE_OK) {
+        std::cerr << "\nConnection to query server lost: " << curl_easy_strerror(res) << std::endl;
+    }
+
+    std::wcout << std::endl;
+    if (!error.empty()) {
+        std::cerr << error << std::endl;
+    }
+    if (!citations.empty()) {
+        std::wcout << L"Citations:\n" << utf8_to_wstring(citations) << std::endl;
+    }
+    return true;
+}
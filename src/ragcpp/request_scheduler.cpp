@@ -0,0 +1,192 @@
+// request_scheduler.cpp
+
+#include "request_scheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+
+namespace {
+
+// Requests in flight per endpoint before the first response has been seen
+const double initial_request_window = 4.0;
+
+// Congestion signals closer together than this count as one event, so a
+// burst of 429s from requests sent in the same window halves it only once
+const std::chrono::milliseconds decrease_interval(1000);
+
+// Pause after a 429 that names no reset time
+const double default_rate_limit_pause_seconds = 1.0;
+
+const int retry_base_delay_ms = 500;
+const int retry_max_delay_ms = 30000;
+
+std::atomic<size_t> g_max_concurrent_requests{ 16 };
+
+// OpenAI reset durations look like "20ms", "1s", "6m0s" or "1.5s"
+double parse_duration_seconds(const std::string& value) {
+    double seconds = 0.0;
+    size_t i = 0;
+    bool parsed = false;
+    while (i < value.size()) {
+        char* end = nullptr;
+        double number = std::strtod(value.c_str() + i, &end);
+        if (end == value.c_str() + i) break;
+        i = end - value.c_str();
+
+        std::string unit;
+        while (i < value.size() && std::isalpha(static_cast<unsigned char>(value[i]))) {
+            unit += value[i++];
+        }
+        if (unit == "ms") seconds += number / 1000.0;
+        else if (unit == "s" || unit.empty()) seconds += number;
+        else if (unit == "m") seconds += number * 60.0;
+        else if (unit == "h") seconds += number * 3600.0;
+        else return -1.0;
+        parsed = true;
+    }
+    return parsed ? seconds : -1.0;
+}
+
+long parse_count(const std::string& value) {
+    char* end = nullptr;
+    long count = std::strtol(value.c_str(), &end, 10);
+    return end == value.c_str() ? -1 : count;
+}
+
+} // namespace
+
+void RateLimitHeaders::parse_header_line(const char* line, size_t length) {
+    std::string header(line, length);
+    size_t colon = header.find(':');
+    if (colon == std::string::npos) return;
+
+    std::string name = header.substr(0, colon);
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    size_t value_start = header.find_first_not_of(" \t", colon + 1);
+    size_t value_end = header.find_last_not_of(" \t\r\n");
+    if (value_start == std::string::npos || value_end < value_start) return;
+    std::string value = header.substr(value_start, value_end - value_start + 1);
+
+    if (name == "x-ratelimit-remaining-requests") {
+        remaining_requests = parse_count(value);
+    }
+    else if (name == "x-ratelimit-remaining-tokens") {
+        remaining_tokens = parse_count(value);
+    }
+    else if (name == "x-ratelimit-reset-requests") {
+        reset_requests_seconds = parse_duration_seconds(value);
+    }
+    else if (name == "x-ratelimit-reset-tokens") {
+        reset_tokens_seconds = parse_duration_seconds(value);
+    }
+    else if (name == "retry-after-ms") {
+        long ms = parse_count(value);
+        if (ms >= 0) retry_after_seconds = ms / 1000.0;
+    }
+    else if (name == "retry-after" && retry_after_seconds < 0.0) {
+        // Only the delay-seconds form; an HTTP date leaves the default pause
+        retry_after_seconds = parse_duration_seconds(value);
+    }
+}
+
+RequestScheduler::RequestScheduler(double initial_window, size_t max_window)
+    : window_(std::min(initial_window, static_cast<double>(max_window))), max_window_(max_window) {
+}
+
+void RequestScheduler::acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        auto now = std::chrono::steady_clock::now();
+        if (now < paused_until_) {
+            changed_.wait_until(lock, paused_until_);
+            continue;
+        }
+        if (in_flight_ < static_cast<size_t>(std::max(1.0, std::floor(window_)))) {
+            in_flight_++;
+            return;
+        }
+        changed_.wait(lock);
+    }
+}
+
+void RequestScheduler::release(long status, const RateLimitHeaders& headers) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    in_flight_--;
+    auto now = std::chrono::steady_clock::now();
+
+    auto pause_for = [this, now](double seconds) {
+        auto until = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+        paused_until_ = std::max(paused_until_, until);
+    };
+
+    if (status == 429 || status == 503) {
+        // Multiplicative decrease, once per congestion event. Other failures
+        // (a 500, a dropped connection) say nothing about load and are only retried.
+        if (now - last_decrease_ >= decrease_interval) {
+            window_ = std::max(1.0, window_ / 2.0);
+            last_decrease_ = now;
+        }
+        if (status == 429) {
+            double pause = headers.retry_after_seconds > 0.0 ? headers.retry_after_seconds
+                : headers.reset_requests_seconds > 0.0 ? headers.reset_requests_seconds
+                : default_rate_limit_pause_seconds;
+            pause_for(pause);
+        }
+    }
+    else if (status < 400) {
+        // Additive increase: about one more slot per window of successes
+        window_ = std::min(static_cast<double>(max_window_), window_ + 1.0 / window_);
+    }
+
+    // Stop before the provider has to refuse: an exhausted quota pauses everyone until it resets
+    if (headers.remaining_requests == 0 && headers.reset_requests_seconds > 0.0) {
+        pause_for(headers.reset_requests_seconds);
+    }
+    if (headers.remaining_tokens == 0 && headers.reset_tokens_seconds > 0.0) {
+        pause_for(headers.reset_tokens_seconds);
+    }
+
+    changed_.notify_all();
+}
+
+void RequestScheduler::set_max_window(size_t max_window) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_window_ = std::max<size_t>(1, max_window);
+    window_ = std::min(window_, static_cast<double>(max_window_));
+    changed_.notify_all();
+}
+
+double RequestScheduler::window() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return window_;
+}
+
+RequestScheduler& api_request_scheduler(ApiEndpoint endpoint) {
+    static RequestScheduler embeddings(initial_request_window, g_max_concurrent_requests);
+    static RequestScheduler chat(initial_request_window, g_max_concurrent_requests);
+    return endpoint == ApiEndpoint::Embeddings ? embeddings : chat;
+}
+
+void set_max_concurrent_requests(size_t max_requests) {
+    g_max_concurrent_requests = std::max<size_t>(1, max_requests);
+    api_request_scheduler(ApiEndpoint::Embeddings).set_max_window(g_max_concurrent_requests);
+    api_request_scheduler(ApiEndpoint::Chat).set_max_window(g_max_concurrent_requests);
+}
+
+size_t max_concurrent_requests() {
+    return g_max_concurrent_requests;
+}
+
+std::chrono::milliseconds retry_delay(int attempt, double retry_after_seconds) {
+    thread_local std::mt19937 rng(std::random_device{}());
+    if (retry_after_seconds > 0.0) {
+        // Honour the server, plus a little spread so waiting clients do not return in lockstep
+        long base = static_cast<long>(retry_after_seconds * 1000.0);
+        return std::chrono::milliseconds(base + std::uniform_int_distribution<long>(0, 250)(rng));
+    }
+    long ceiling = std::min<long>(retry_max_delay_ms, static_cast<long>(retry_base_delay_ms) << std::min(attempt - 1, 16));
+    return std::chrono::milliseconds(std::uniform_int_distribution<long>(ceiling / 4, ceiling)(rng));
+}
@@ -0,0 +1,257 @@
+// shards.cpp
+
+#include "shards.h"
+#include "database.h"
+#include "thread_pool.h"
+#include "encoding_utils.h"
+#include <iostream>
+#include <filesystem>
+#include <unordered_map>
+#include <memory>
+#include <shared_mutex>
+#include <mutex>
+#include <condition_variable>
+
+namespace {
+
+// Open shard sets by primary connection, each with the primary first
+std::shared_mutex g_shards_mutex;
+std::unordered_map<sqlite3*, std::vector<sqlite3*>> g_shards;
+
+// Write locks by connection; entries outlive their connection, which is harmless
+std::mutex g_connection_locks_mutex;
+std::unordered_map<sqlite3*, std::unique_ptr<std::recursive_mutex>> g_connection_locks;
+
+ThreadPool& shard_pool() {
+    static ThreadPool pool(0);
+    return pool;
+}
+
+// Shard file paths by shard number; the primary's entry is empty
+bool read_layout(sqlite3* primary, std::vector<std::string>& paths) {
+    const char* select_sql = "SELECT shard, path FROM shards ORDER BY shard;";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(primary, select_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(primary) << std::endl;
+        return false;
+    }
+
+    bool valid = true;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        if (sqlite3_column_int(stmt, 0) != static_cast<int>(paths.size())) {
+            valid = false;
+        }
+        const char* path = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        paths.push_back(path ? path : "");
+    }
+    sqlite3_finalize(stmt);
+
+    if (!valid) {
+        std::cerr << "The shard layout in the database is not numbered 0.." << paths.size() - 1 << "." << std::endl;
+    }
+    return valid;
+}
+
+bool has_embeddings(sqlite3* primary) {
+    sqlite3_stmt* stmt;
+    bool found = false;
+    if (sqlite3_prepare_v2(primary, "SELECT 1 FROM embeddings LIMIT 1;", -1, &stmt, nullptr) == SQLITE_OK) {
+        found = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+    }
+    return found;
+}
+
+std::vector<std::string> plan_layout(sqlite3* primary, int shard_count, const std::vector<std::wstring>& shard_dirs) {
+    std::filesystem::path primary_dir;
+    const char* primary_file = sqlite3_db_filename(primary, "main");
+    if (primary_file && *primary_file) {
+        primary_dir = std::filesystem::path(utf8_to_wstring(primary_file)).parent_path();
+    }
+
+    std::vector<std::string> paths{ "" };
+    for (int k = 1; k < shard_count; ++k) {
+        std::filesystem::path dir = shard_dirs.empty() ? primary_dir : std::filesystem::path(shard_dirs[(k - 1) % shard_dirs.size()]);
+        std::filesystem::path file = dir / (L"embeddings.shard" + std::to_wstring(k) + L".db");
+        paths.push_back(wstring_to_utf8(file.wstring()));
+    }
+    return paths;
+}
+
+bool write_layout(sqlite3* primary, const std::vector<std::string>& paths) {
+    sqlite3_exec(primary, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+
+    const char* insert_sql = "INSERT INTO shards (shard, path) VALUES (?, ?);";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(primary, insert_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(primary) << std::endl;
+        sqlite3_exec(primary, "ROLLBACK;", nullptr, nullptr, nullptr);
+        return false;
+    }
+
+    for (size_t k = 0; k < paths.size(); ++k) {
+        sqlite3_bind_int(stmt, 1, static_cast<int>(k));
+        sqlite3_bind_text(stmt, 2, paths[k].c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            std::cerr << "Failed to record shard layout: " << sqlite3_errmsg(primary) << std::endl;
+            sqlite3_finalize(stmt);
+            sqlite3_exec(primary, "ROLLBACK;", nullptr, nullptr, nullptr);
+            return false;
+        }
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+
+    sqlite3_exec(primary, "COMMIT;", nullptr, nullptr, nullptr);
+    return true;
+}
+
+} // namespace
+
+bool open_shards(sqlite3* primary, int shard_count, const std::vector<std::wstring>& shard_dirs) {
+    std::vector<std::string> paths;
+    if (!read_layout(primary, paths)) {
+        return false;
+    }
+
+    if (paths.empty()) {
+        if (shard_count <= 1) {
+            return true;
+        }
+        // Existing rows were numbered for a single file and would sit in the wrong shard
+        if (has_embeddings(primary)) {
+            std::cerr << "Shards can only be set up on a database without embeddings." << std::endl;
+            return false;
+        }
+        paths = plan_layout(primary, shard_count, shard_dirs);
+        for (size_t k = 1; k < paths.size(); ++k) {
+            std::error_code ec;
+            std::filesystem::create_directories(std::filesystem::path(utf8_to_wstring(paths[k])).parent_path(), ec);
+        }
+        if (!write_layout(primary, paths)) {
+            return false;
+        }
+        std::cout << "Split the database into " << shard_count << " shards." << std::endl;
+    }
+    else if (shard_count > 0 && static_cast<size_t>(shard_count) != paths.size()) {
+        std::cerr << "The database is split into " << paths.size() << " shards, not " << shard_count << "." << std::endl;
+        return false;
+    }
+
+    if (paths.size() <= 1) {
+        return true;
+    }
+
+    std::vector<sqlite3*> connections{ primary };
+    for (size_t k = 1; k < paths.size(); ++k) {
+        sqlite3* shard = nullptr;
+        initialize_database(shard, paths[k].c_str());
+        if (!shard) {
+            std::cerr << "Cannot open shard " << k << ": " << paths[k] << std::endl;
+            for (size_t i = 1; i < connections.size(); ++i) {
+                sqlite3_close(connections[i]);
+            }
+            return false;
+        }
+        connections.push_back(shard);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(g_shards_mutex);
+    g_shards[primary] = std::move(connections);
+    return true;
+}
+
+void close_shards(sqlite3* primary) {
+    std::vector<sqlite3*> connections;
+    {
+        std::unique_lock<std::shared_mutex> lock(g_shards_mutex);
+        auto it = g_shards.find(primary);
+        if (it == g_shards.end()) return;
+        connections = std::move(it->second);
+        g_shards.erase(it);
+    }
+    for (size_t k = 1; k < connections.size(); ++k) {
+        sqlite3_close(connections[k]);
+    }
+}
+
+size_t shard_count(sqlite3* primary) {
+    std::shared_lock<std::shared_mutex> lock(g_shards_mutex);
+    auto it = g_shards.find(primary);
+    return it == g_shards.end() ? 1 : it->second.size();
+}
+
+std::vector<sqlite3*> shard_connections(sqlite3* primary) {
+    std::shared_lock<std::shared_mutex> lock(g_shards_mutex);
+    auto it = g_shards.find(primary);
+    if (it == g_shards.end()) {
+        return { primary };
+    }
+    return it->second;
+}
+
+size_t shard_index(sqlite3* primary, int id) {
+    size_t count = shard_count(primary);
+    return count == 1 ? 0 : static_cast<size_t>(id) % count;
+}
+
+sqlite3* shard_for_id(sqlite3* primary, int id) {
+    std::shared_lock<std::shared_mutex> lock(g_shards_mutex);
+    auto it = g_shards.find(primary);
+    if (it == g_shards.end()) {
+        return primary;
+    }
+    return it->second[static_cast<size_t>(id) % it->second.size()];
+}
+
+std::unique_lock<std::recursive_mutex> lock_connection(sqlite3* db) {
+    std::recursive_mutex* connection_lock;
+    {
+        std::lock_guard<std::mutex> lock(g_connection_locks_mutex);
+        std::unique_ptr<std::recursive_mutex>& entry = g_connection_locks[db];
+        if (!entry) {
+            entry = std::make_unique<std::recursive_mutex>();
+        }
+        connection_lock = entry.get();
+    }
+    return std::unique_lock<std::recursive_mutex>(*connection_lock);
+}
+
+int shards_data_version(sqlite3* primary) {
+    int version = 0;
+    for (sqlite3* shard : shard_connections(primary)) {
+        version += get_data_version(shard);
+    }
+    return version;
+}
+
+void run_on_shards(size_t count, const std::function<void(size_t)>& task) {
+    if (count == 0) return;
+    if (count == 1) {
+        task(0);
+        return;
+    }
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t remaining = count;
+    for (size_t k = 0; k < count; ++k) {
+        shard_pool().submit([&, k]() {
+            try {
+                task(k);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Shard task failed: " << e.what() << std::endl;
+            }
+            // Notify under the lock: the waiter owns these locals and may return as soon as it sees zero
+            std::lock_guard<std::mutex> lock(mutex);
+            remaining--;
+            finished.notify_all();
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return remaining == 0; });
+}
@@ -0,0 +1,1071 @@
+// snapshot.cpp
+
+#include "snapshot.h"
+#include "mapped_file.h"
+#include "shards.h"
+#include "vector_projection.h"
+#include "encoding_utils.h"
+#include "document_centroids.h"
+#include "text_store.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <unordered_map>
+#include <string_view>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// File layout, all integers and floats little-endian as in memory:
+//   SnapshotHeader, SectionEntry[max_sections], then the sections, each
+//   starting on a 64-byte boundary.
+// Documents:  u64 n; i32 doc_id[n]; i32 total_paragraphs[n] (-1 = no progress
+//             row); i32 paragraphs_processed[n]; strings file_name; strings status
+// Embeddings and ReducedEmbeddings (matrix):
+//             u32 dim; u32 shards; u64 rows; ShardRange[shards]; i32 id[rows];
+//             i32 doc_id[rows]; f32 vectors[rows * dim] (64-byte aligned); f32 norm[rows]
+// Texts:      strings, one per Embeddings row
+// Projection: strings method (one entry); i32 input_dim; i32 output_dim;
+//             i32 version; f32 mean[input_dim]; f32 components[output_dim * input_dim]
+// NearDuplicates: u64 n; i32 doc_id[n]; i32 canonical_id[n]; i32 canonical_doc_id[n];
+//             f32 similarity[n]; strings text
+// A strings column is u64 n; u64 offset[n + 1]; bytes, padded to 8.
+
+namespace {
+
+const char snapshot_magic[8] = { 'R', 'A', 'G', 'S', 'N', 'A', 'P', '\0' };
+const uint32_t snapshot_format_version = 1;
+const size_t section_alignment = 64;
+const size_t max_sections = 16;
+
+enum SectionType : uint32_t {
+    SectionDocuments = 1,
+    SectionEmbeddings = 2,
+    SectionTexts = 3,
+    SectionProjection = 4,
+    SectionReducedEmbeddings = 5,
+    SectionNearDuplicates = 6
+};
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t section_count;
+    uint64_t table_checksum;    // Of the section table that follows
+    uint64_t reserved;
+};
+
+struct SectionEntry {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t checksum;
+};
+
+// Rows of one shard within a matrix section, and what that shard's embeddings
+// table looked like when they were written. Ids only grow, so any insert or
+// delete since then changes (row_count, max_id).
+struct ShardRange {
+    uint64_t begin;
+    uint64_t end;
+    uint64_t row_count;
+    int64_t max_id;
+};
+
+// Word-at-a-time 64-bit hash: catches torn and corrupted files, not tampering
+class Checksum {
+public:
+    void update(const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total_ += size;
+        if (tail_length_ > 0) {
+            size_t take = std::min(size, sizeof(tail_) - tail_length_);
+            std::memcpy(tail_ + tail_length_, p, take);
+            tail_length_ += take;
+            p += take;
+            size -= take;
+            if (tail_length_ < sizeof(tail_)) return;
+            uint64_t word;
+            std::memcpy(&word, tail_, sizeof(word));
+            state_ = mix(state_, word);
+            tail_length_ = 0;
+        }
+        for (; size >= 8; p += 8, size -= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            state_ = mix(state_, word);
+        }
+        std::memcpy(tail_, p, size);
+        tail_length_ = size;
+    }
+
+    uint64_t value() const {
+        uint64_t h = state_;
+        if (tail_length_ > 0) {
+            uint64_t word = 0;
+            std::memcpy(&word, tail_, tail_length_);
+            h = mix(h, word);
+        }
+        return mix(h, total_);
+    }
+
+private:
+    static uint64_t mix(uint64_t h, uint64_t word) {
+        h = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+        return h ^ (h >> 29);
+    }
+
+    uint64_t state_ = 0xCBF29CE484222325ULL;
+    uint64_t total_ = 0;
+    uint8_t tail_[8];
+    size_t tail_length_ = 0;
+};
+
+uint64_t checksum_of(const void* data, size_t size) {
+    Checksum checksum;
+    checksum.update(data, size);
+    return checksum.value();
+}
+
+// Streams sections to the file, hashing them on the way; the header and
+// section table at the front are filled in by finish()
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::filesystem::path& path) : out_(path, std::ios::binary | std::ios::trunc) {
+        std::vector<char> reserved(sizeof(SnapshotHeader) + max_sections * sizeof(SectionEntry), 0);
+        out_.write(reserved.data(), static_cast<std::streamsize>(reserved.size()));
+        offset_ = reserved.size();
+    }
+
+    bool ok() const { return static_cast<bool>(out_); }
+    uint64_t size() const { return offset_; }
+
+    void begin_section(uint32_t type) {
+        pad(section_alignment, false);
+        current_ = { type, 0, offset_, 0, 0 };
+        checksum_ = Checksum();
+    }
+
+    void end_section() {
+        current_.length = offset_ - current_.offset;
+        current_.checksum = checksum_.value();
+        sections_.push_back(current_);
+    }
+
+    void write(const void* data, size_t size) {
+        out_.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        checksum_.update(data, size);
+        offset_ += size;
+    }
+
+    template <typename T>
+    void write_value(const T& value) {
+        write(&value, sizeof(T));
+    }
+
+    template <typename T>
+    void write_array(const std::vector<T>& values) {
+        write(values.data(), values.size() * sizeof(T));
+    }
+
+    // Zero bytes up to the next multiple of alignment (sections start aligned,
+    // so this aligns within the section as well)
+    void align(size_t alignment) {
+        pad(alignment, true);
+    }
+
+    void write_strings(const std::vector<std::string>& values) {
+        std::vector<uint64_t> offsets{ 0 };
+        for (const auto& value : values) {
+            offsets.push_back(offsets.back() + value.size());
+        }
+        write_value<uint64_t>(values.size());
+        write_array(offsets);
+        for (const auto& value : values) {
+            write(value.data(), value.size());
+        }
+        align(8);
+    }
+
+    bool finish() {
+        if (sections_.size() > max_sections) {
+            std::cerr << "Too many snapshot sections." << std::endl;
+            return false;
+        }
+        std::vector<SectionEntry> table(max_sections);
+        std::fill(table.begin(), table.end(), SectionEntry{});
+        std::copy(sections_.begin(), sections_.end(), table.begin());
+
+        SnapshotHeader header{};
+        std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+        header.format_version = snapshot_format_version;
+        header.section_count = static_cast<uint32_t>(sections_.size());
+        header.table_checksum = checksum_of(table.data(), table.size() * sizeof(SectionEntry));
+
+        out_.seekp(0);
+        out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out_.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(SectionEntry)));
+        out_.flush();
+        bool written = static_cast<bool>(out_);
+        out_.close();
+        return written;
+    }
+
+private:
+    void pad(size_t alignment, bool hashed) {
+        static const char zeros[section_alignment] = {};
+        size_t padding = (alignment - offset_ % alignment) % alignment;
+        while (padding > 0) {
+            size_t n = std::min(padding, sizeof(zeros));
+            if (hashed) {
+                write(zeros, n);
+            }
+            else {
+                out_.write(zeros, static_cast<std::streamsize>(n));
+                offset_ += n;
+            }
+            padding -= n;
+        }
+    }
+
+    std::ofstream out_;
+    uint64_t offset_ = 0;
+    std::vector<SectionEntry> sections_;
+    SectionEntry current_{};
+    Checksum checksum_;
+};
+
+// Bounds-checked walk over one mapped section
+class SectionReader {
+public:
+    SectionReader(const uint8_t* data, size_t length) : begin_(data), p_(data), end_(data + length) {}
+
+    bool ok() const { return ok_; }
+
+    template <typename T>
+    const T* take(size_t count) {
+        if (!ok_ || count > static_cast<size_t>(end_ - p_) / sizeof(T)) {
+            ok_ = false;
+            return nullptr;
+        }
+        const T* values = reinterpret_cast<const T*>(p_);
+        p_ += count * sizeof(T);
+        return values;
+    }
+
+    template <typename T>
+    T read() {
+        const T* value = take<T>(1);
+        return value ? *value : T{};
+    }
+
+    void align(size_t alignment) {
+        size_t padding = (alignment - static_cast<size_t>(p_ - begin_) % alignment) % alignment;
+        take<uint8_t>(padding);
+    }
+
+private:
+    const uint8_t* begin_;
+    const uint8_t* p_;
+    const uint8_t* end_;
+    bool ok_ = true;
+};
+
+struct StringColumn {
+    size_t count = 0;
+    const uint64_t* offsets = nullptr;
+    const char* bytes = nullptr;
+
+    std::string_view at(size_t i) const {
+        return std::string_view(bytes + offsets[i], static_cast<size_t>(offsets[i + 1] - offsets[i]));
+    }
+};
+
+bool read_strings(SectionReader& reader, StringColumn& column) {
+    column.count = static_cast<size_t>(reader.read<uint64_t>());
+    if (!reader.ok() || column.count == SIZE_MAX) return false;
+    column.offsets = reader.take<uint64_t>(column.count + 1);
+    if (!column.offsets || column.offsets[0] != 0) return false;
+    for (size_t i = 0; i < column.count; ++i) {
+        if (column.offsets[i + 1] < column.offsets[i]) return false;
+    }
+    column.bytes = reader.take<char>(static_cast<size_t>(column.offsets[column.count]));
+    reader.align(8);
+    return column.bytes != nullptr || column.offsets[column.count] == 0;
+}
+
+struct MatrixSection {
+    bool present = false;
+    uint32_t dim = 0;
+    uint32_t shard_count = 0;
+    size_t rows = 0;
+    const ShardRange* ranges = nullptr;
+    const int32_t* ids = nullptr;
+    const int32_t* doc_ids = nullptr;
+    const float* vectors = nullptr;
+    const float* norms = nullptr;
+};
+
+bool read_matrix(SectionReader& reader, MatrixSection& matrix) {
+    matrix.dim = reader.read<uint32_t>();
+    matrix.shard_count = reader.read<uint32_t>();
+    matrix.rows = static_cast<size_t>(reader.read<uint64_t>());
+    if (!reader.ok() || matrix.shard_count == 0 || (matrix.dim > 0 && matrix.rows > SIZE_MAX / matrix.dim)) return false;
+
+    matrix.ranges = reader.take<ShardRange>(matrix.shard_count);
+    matrix.ids = reader.take<int32_t>(matrix.rows);
+    reader.align(8);
+    matrix.doc_ids = reader.take<int32_t>(matrix.rows);
+    reader.align(section_alignment);
+    matrix.vectors = reader.take<float>(matrix.rows * matrix.dim);
+    matrix.norms = reader.take<float>(matrix.rows);
+    if (!reader.ok()) return false;
+
+    uint64_t expected_begin = 0;
+    for (uint32_t k = 0; k < matrix.shard_count; ++k) {
+        if (matrix.ranges[k].begin != expected_begin || matrix.ranges[k].end < matrix.ranges[k].begin) return false;
+        expected_begin = matrix.ranges[k].end;
+    }
+    matrix.present = expected_begin == matrix.rows;
+    return matrix.present;
+}
+
+// A mapped, verified snapshot; the views point into the mapping
+struct Snapshot {
+    MappedFile file;
+    size_t document_count = 0;
+    const int32_t* doc_ids = nullptr;
+    const int32_t* total_paragraphs = nullptr;
+    const int32_t* paragraphs_processed = nullptr;
+    StringColumn file_names;
+    StringColumn statuses;
+    MatrixSection embeddings;
+    StringColumn texts;
+    std::shared_ptr<VectorProjection> projection;
+    MatrixSection reduced;
+    size_t link_count = 0;
+    const int32_t* link_doc_ids = nullptr;
+    const int32_t* link_canonical_ids = nullptr;
+    const int32_t* link_canonical_doc_ids = nullptr;
+    const float* link_similarities = nullptr;
+    StringColumn link_texts;
+};
+
+bool read_documents(SectionReader& reader, Snapshot& snapshot) {
+    snapshot.document_count = static_cast<size_t>(reader.read<uint64_t>());
+    snapshot.doc_ids = reader.take<int32_t>(snapshot.document_count);
+    snapshot.total_paragraphs = reader.take<int32_t>(snapshot.document_count);
+    snapshot.paragraphs_processed = reader.take<int32_t>(snapshot.document_count);
+    reader.align(8);
+    return reader.ok() && read_strings(reader, snapshot.file_names) && read_strings(reader, snapshot.statuses)
+        && snapshot.file_names.count == snapshot.document_count && snapshot.statuses.count == snapshot.document_count;
+}
+
+bool read_near_duplicates(SectionReader& reader, Snapshot& snapshot) {
+    snapshot.link_count = static_cast<size_t>(reader.read<uint64_t>());
+    snapshot.link_doc_ids = reader.take<int32_t>(snapshot.link_count);
+    snapshot.link_canonical_ids = reader.take<int32_t>(snapshot.link_count);
+    snapshot.link_canonical_doc_ids = reader.take<int32_t>(snapshot.link_count);
+    snapshot.link_similarities = reader.take<float>(snapshot.link_count);
+    reader.align(8);
+    return reader.ok() && read_strings(reader, snapshot.link_texts) && snapshot.link_texts.count == snapshot.link_count;
+}
+
+bool read_projection(SectionReader& reader, Snapshot& snapshot) {
+    StringColumn method;
+    if (!read_strings(reader, method) || method.count != 1) return false;
+    auto projection = std::make_shared<VectorProjection>();
+    projection->method = std::string(method.at(0));
+    projection->input_dim = reader.read<int32_t>();
+    projection->output_dim = reader.read<int32_t>();
+    projection->version = reader.read<int32_t>();
+    if (!reader.ok() || projection->input_dim <= 0 || projection->output_dim <= 0) return false;
+    reader.align(8);
+    if (projection->method == "pca") {
+        const float* mean = reader.take<float>(projection->input_dim);
+        const float* components = reader.take<float>(static_cast<size_t>(projection->output_dim) * projection->input_dim);
+        if (!reader.ok()) return false;
+        projection->mean.assign(mean, mean + projection->input_dim);
+        projection->components.assign(components, components + static_cast<size_t>(projection->output_dim) * projection->input_dim);
+    }
+    snapshot.projection = projection;
+    return true;
+}
+
+uint32_t section_bit(uint32_t type) {
+    return 1u << type;
+}
+
+const uint32_t all_sections = ~0u;
+
+// Map the file and check the header; then verify the checksum of each section
+// in wanted and parse it. Other sections are never touched, so a server
+// loading reduced vectors does not read the full-dimension matrix.
+bool open_snapshot(const std::wstring& path, Snapshot& snapshot, uint32_t wanted) {
+    if (!snapshot.file.open(path)) {
+        return false;
+    }
+    const uint8_t* data = snapshot.file.data();
+    size_t size = snapshot.file.size();
+    size_t table_end = sizeof(SnapshotHeader) + max_sections * sizeof(SectionEntry);
+
+    SnapshotHeader header{};
+    if (size >= table_end) {
+        std::memcpy(&header, data, sizeof(header));
+    }
+    if (size < table_end || std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0) {
+        std::cerr << "Not a snapshot file: " << wstring_to_utf8(path) << std::endl;
+        return false;
+    }
+    if (header.format_version != snapshot_format_version) {
+        std::cerr << "Snapshot format version " << header.format_version << " is not supported (expected "
+            << snapshot_format_version << "): " << wstring_to_utf8(path) << std::endl;
+        return false;
+    }
+    const SectionEntry* table = reinterpret_cast<const SectionEntry*>(data + sizeof(SnapshotHeader));
+    if (header.section_count > max_sections || checksum_of(table, max_sections * sizeof(SectionEntry)) != header.table_checksum) {
+        std::cerr << "The snapshot header is corrupt: " << wstring_to_utf8(path) << std::endl;
+        return false;
+    }
+
+    bool has_documents = false;
+    bool has_texts = false;
+    for (uint32_t i = 0; i < header.section_count; ++i) {
+        const SectionEntry& entry = table[i];
+        if (entry.offset < table_end || entry.offset > size || entry.length > size - entry.offset) {
+            std::cerr << "The snapshot is truncated: " << wstring_to_utf8(path) << std::endl;
+            return false;
+        }
+        // Sections added by later versions of the format are skipped as well
+        if (entry.type >= 32 || !(wanted & section_bit(entry.type))) {
+            continue;
+        }
+        if (checksum_of(data + entry.offset, static_cast<size_t>(entry.length)) != entry.checksum) {
+            std::cerr << "Checksum mismatch in snapshot section " << entry.type << ": " << wstring_to_utf8(path) << std::endl;
+            return false;
+        }
+
+        SectionReader reader(data + entry.offset, static_cast<size_t>(entry.length));
+        bool parsed = true;
+        switch (entry.type) {
+        case SectionDocuments:
+            parsed = has_documents = read_documents(reader, snapshot);
+            break;
+        case SectionEmbeddings:
+            parsed = read_matrix(reader, snapshot.embeddings);
+            break;
+        case SectionTexts:
+            parsed = has_texts = read_strings(reader, snapshot.texts);
+            break;
+        case SectionProjection:
+            parsed = read_projection(reader, snapshot);
+            break;
+        case SectionReducedEmbeddings:
+            parsed = read_matrix(reader, snapshot.reduced);
+            break;
+        case SectionNearDuplicates:
+            parsed = read_near_duplicates(reader, snapshot);
+            break;
+        default:
+            break;
+        }
+        if (!parsed) {
+            std::cerr << "Malformed snapshot section " << entry.type << ": " << wstring_to_utf8(path) << std::endl;
+            return false;
+        }
+    }
+
+    bool complete = (!(wanted & section_bit(SectionDocuments)) || has_documents)
+        && (!(wanted & section_bit(SectionEmbeddings)) || snapshot.embeddings.present)
+        && (!(wanted & section_bit(SectionTexts)) || (has_texts && snapshot.texts.count == snapshot.embeddings.rows))
+        && (!snapshot.reduced.present || (snapshot.projection && snapshot.reduced.dim == static_cast<uint32_t>(snapshot.projection->output_dim)));
+    if (!complete) {
+        std::cerr << "The snapshot is incomplete: " << wstring_to_utf8(path) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool prepare(sqlite3* db, const char* sql, sqlite3_stmt** stmt) {
+    if (sqlite3_prepare_v2(db, sql, -1, stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// What a shard's embeddings table looks like now, to compare with ShardRange
+bool shard_fingerprint(sqlite3* shard, uint64_t& row_count, int64_t& max_id) {
+    sqlite3_stmt* stmt;
+    if (!prepare(shard, "SELECT COUNT(*), IFNULL(MAX(id), 0) FROM embeddings;", &stmt)) {
+        return false;
+    }
+    bool found = sqlite3_step(stmt) == SQLITE_ROW;
+    if (found) {
+        row_count = static_cast<uint64_t>(sqlite3_column_int64(stmt, 0));
+        max_id = sqlite3_column_int64(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// Dimension of the first stored embedding in shard order; rows of any other
+// dimension are left out, as load_vector_index does
+int first_embedding_dim(const std::vector<sqlite3*>& shards) {
+    for (sqlite3* shard : shards) {
+        sqlite3_stmt* stmt;
+        if (!prepare(shard, "SELECT length(embedding) FROM embeddings WHERE length(embedding) > 0 ORDER BY id LIMIT 1;", &stmt)) {
+            return 0;
+        }
+        int bytes = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+        sqlite3_finalize(stmt);
+        if (bytes > 0) {
+            return bytes / static_cast<int>(sizeof(float));
+        }
+    }
+    return 0;
+}
+
+bool write_documents_section(SnapshotWriter& writer, sqlite3* primary, size_t& document_count) {
+    sqlite3_stmt* stmt;
+    const char* select_sql = "SELECT d.doc_id, d.file_name, IFNULL(p.total_paragraphs, -1), IFNULL(p.paragraphs_processed, 0), "
+        "IFNULL(p.status, '') FROM documents d LEFT JOIN progress p ON p.doc_id = d.doc_id ORDER BY d.doc_id;";
+    if (!prepare(primary, select_sql, &stmt)) {
+        return false;
+    }
+
+    std::vector<int32_t> doc_ids;
+    std::vector<int32_t> totals;
+    std::vector<int32_t> processed;
+    std::vector<std::string> file_names;
+    std::vector<std::string> statuses;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        doc_ids.push_back(sqlite3_column_int(stmt, 0));
+        const char* file_name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        file_names.push_back(file_name ? file_name : "");
+        totals.push_back(sqlite3_column_int(stmt, 2));
+        processed.push_back(sqlite3_column_int(stmt, 3));
+        const char* status = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
+        statuses.push_back(status ? status : "");
+    }
+    sqlite3_finalize(stmt);
+
+    writer.begin_section(SectionDocuments);
+    writer.write_value<uint64_t>(doc_ids.size());
+    writer.write_array(doc_ids);
+    writer.write_array(totals);
+    writer.write_array(processed);
+    writer.align(8);
+    writer.write_strings(file_names);
+    writer.write_strings(statuses);
+    writer.end_section();
+    document_count = doc_ids.size();
+    return true;
+}
+
+bool write_near_duplicates_section(SnapshotWriter& writer, sqlite3* primary) {
+    sqlite3_stmt* stmt;
+    if (!prepare(primary, "SELECT doc_id, canonical_id, canonical_doc_id, similarity, text FROM near_duplicates ORDER BY id;", &stmt)) {
+        return false;
+    }
+
+    std::vector<int32_t> doc_ids;
+    std::vector<int32_t> canonical_ids;
+    std::vector<int32_t> canonical_doc_ids;
+    std::vector<float> similarities;
+    std::vector<std::string> texts;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        doc_ids.push_back(sqlite3_column_int(stmt, 0));
+        canonical_ids.push_back(sqlite3_column_int(stmt, 1));
+        canonical_doc_ids.push_back(sqlite3_column_int(stmt, 2));
+        similarities.push_back(static_cast<float>(sqlite3_column_double(stmt, 3)));
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 4));
+        texts.push_back(text ? text : "");
+    }
+    sqlite3_finalize(stmt);
+
+    writer.begin_section(SectionNearDuplicates);
+    writer.write_value<uint64_t>(doc_ids.size());
+    writer.write_array(doc_ids);
+    writer.write_array(canonical_ids);
+    writer.write_array(canonical_doc_ids);
+    writer.write_array(similarities);
+    writer.align(8);
+    writer.write_strings(texts);
+    writer.end_section();
+    return true;
+}
+
+// One matrix section over the same table of every shard. Ids are gathered
+// first; the vectors are then streamed from SQLite to the file without being
+// held in memory.
+bool write_matrix_section(SnapshotWriter& writer, uint32_t type, const std::vector<sqlite3*>& shards, const std::string& table,
+    int dim, const std::vector<ShardRange>& fingerprints, size_t& rows_written) {
+    std::string ids_sql = "SELECT id, doc_id FROM " + table + " WHERE length(embedding) = ?1 ORDER BY id;";
+    std::string vectors_sql = "SELECT embedding FROM " + table + " WHERE length(embedding) = ?1 ORDER BY id;";
+    int blob_bytes = dim * static_cast<int>(sizeof(float));
+
+    std::vector<ShardRange> ranges(shards.size());
+    std::vector<int32_t> ids;
+    std::vector<int32_t> doc_ids;
+    for (size_t k = 0; k < shards.size(); ++k) {
+        sqlite3_stmt* stmt;
+        if (!prepare(shards[k], ids_sql.c_str(), &stmt)) {
+            return false;
+        }
+        sqlite3_bind_int(stmt, 1, blob_bytes);
+        ranges[k] = fingerprints[k];
+        ranges[k].begin = ids.size();
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            ids.push_back(sqlite3_column_int(stmt, 0));
+            doc_ids.push_back(sqlite3_column_int(stmt, 1));
+        }
+        ranges[k].end = ids.size();
+        sqlite3_finalize(stmt);
+    }
+
+    writer.begin_section(type);
+    writer.write_value<uint32_t>(static_cast<uint32_t>(dim));
+    writer.write_value<uint32_t>(static_cast<uint32_t>(shards.size()));
+    writer.write_value<uint64_t>(ids.size());
+    writer.write_array(ranges);
+    writer.write_array(ids);
+    writer.align(8);
+    writer.write_array(doc_ids);
+    writer.align(section_alignment);
+
+    std::vector<float> norms;
+    norms.reserve(ids.size());
+    for (size_t k = 0; k < shards.size(); ++k) {
+        sqlite3_stmt* stmt;
+        if (!prepare(shards[k], vectors_sql.c_str(), &stmt)) {
+            return false;
+        }
+        sqlite3_bind_int(stmt, 1, blob_bytes);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const float* row = static_cast<const float*>(sqlite3_column_blob(stmt, 0));
+            writer.write(row, blob_bytes);
+            float norm = 0.0f;
+            for (int d = 0; d < dim; ++d) {
+                norm += row[d] * row[d];
+            }
+            norms.push_back(std::sqrt(norm));
+        }
+        sqlite3_finalize(stmt);
+        if (norms.size() != ranges[k].end) {
+            std::cerr << "Shard " << k << " changed while its snapshot was written." << std::endl;
+            return false;
+        }
+    }
+    writer.write_array(norms);
+    writer.end_section();
+    rows_written = ids.size();
+    return true;
+}
+
+bool write_texts_section(SnapshotWriter& writer, const std::vector<sqlite3*>& shards, int dim) {
+    std::vector<std::string> texts;
+    for (sqlite3* shard : shards) {
+        sqlite3_stmt* stmt;
+        if (!prepare(shard, "SELECT p.text FROM embeddings e LEFT JOIN paragraph_texts p ON p.id = e.id "
+            "WHERE length(e.embedding) = ?1 ORDER BY e.id;", &stmt)) {
+            return false;
+        }
+        sqlite3_bind_int(stmt, 1, dim * static_cast<int>(sizeof(float)));
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+            texts.push_back(text ? text : "");
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    writer.begin_section(SectionTexts);
+    writer.write_strings(texts);
+    writer.end_section();
+    return true;
+}
+
+void write_projection_section(SnapshotWriter& writer, const VectorProjection& projection) {
+    writer.begin_section(SectionProjection);
+    writer.write_strings({ projection.method });
+    writer.write_value<int32_t>(projection.input_dim);
+    writer.write_value<int32_t>(projection.output_dim);
+    writer.write_value<int32_t>(projection.version);
+    writer.align(8);
+    if (projection.method == "pca") {
+        writer.write_array(projection.mean);
+        writer.write_array(projection.components);
+    }
+    writer.end_section();
+}
+
+bool database_is_empty(sqlite3* primary, const std::vector<sqlite3*>& shards) {
+    auto has_rows = [](sqlite3* db, const char* sql) {
+        sqlite3_stmt* stmt;
+        bool found = true;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+            found = sqlite3_step(stmt) == SQLITE_ROW;
+            sqlite3_finalize(stmt);
+        }
+        return found;
+    };
+    if (has_rows(primary, "SELECT 1 FROM documents LIMIT 1;")) {
+        return false;
+    }
+    for (sqlite3* shard : shards) {
+        if (has_rows(shard, "SELECT 1 FROM embeddings LIMIT 1;")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool import_documents(sqlite3* primary, const Snapshot& snapshot) {
+    sqlite3_stmt* document_stmt;
+    sqlite3_stmt* progress_stmt;
+    if (!prepare(primary, "INSERT INTO documents (doc_id, file_name) VALUES (?, ?);", &document_stmt)) {
+        return false;
+    }
+    if (!prepare(primary, "INSERT INTO progress (doc_id, total_paragraphs, paragraphs_processed, status) VALUES (?, ?, ?, ?);", &progress_stmt)) {
+        sqlite3_finalize(document_stmt);
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < snapshot.document_count && ok; ++i) {
+        std::string_view file_name = snapshot.file_names.at(i);
+        sqlite3_bind_int(document_stmt, 1, snapshot.doc_ids[i]);
+        sqlite3_bind_text(document_stmt, 2, file_name.data(), static_cast<int>(file_name.size()), SQLITE_STATIC);
+        ok = sqlite3_step(document_stmt) == SQLITE_DONE;
+        sqlite3_reset(document_stmt);
+
+        if (ok && snapshot.total_paragraphs[i] >= 0) {
+            std::string_view status = snapshot.statuses.at(i);
+            sqlite3_bind_int(progress_stmt, 1, snapshot.doc_ids[i]);
+            sqlite3_bind_int(progress_stmt, 2, snapshot.total_paragraphs[i]);
+            sqlite3_bind_int(progress_stmt, 3, snapshot.paragraphs_processed[i]);
+            sqlite3_bind_text(progress_stmt, 4, status.data(), static_cast<int>(status.size()), SQLITE_STATIC);
+            ok = sqlite3_step(progress_stmt) == SQLITE_DONE;
+            sqlite3_reset(progress_stmt);
+        }
+    }
+    if (!ok) {
+        std::cerr << "Failed to import documents: " << sqlite3_errmsg(primary) << std::endl;
+    }
+    sqlite3_finalize(document_stmt);
+    sqlite3_finalize(progress_stmt);
+    return ok;
+}
+
+// Links keep pointing at their embedded paragraph through renumbering;
+// renumbered is empty when ids are kept
+bool import_near_duplicates(sqlite3* primary, const Snapshot& snapshot, const std::unordered_map<int, int>& renumbered) {
+    sqlite3_stmt* stmt;
+    const char* insert_sql = "INSERT INTO near_duplicates (doc_id, text, canonical_id, canonical_doc_id, similarity) VALUES (?, ?, ?, ?, ?);";
+    if (!prepare(primary, insert_sql, &stmt)) {
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < snapshot.link_count && ok; ++i) {
+        int canonical_id = snapshot.link_canonical_ids[i];
+        if (!renumbered.empty()) {
+            auto it = renumbered.find(canonical_id);
+            if (it == renumbered.end()) continue;
+            canonical_id = it->second;
+        }
+        std::string_view text = snapshot.link_texts.at(i);
+        sqlite3_bind_int(stmt, 1, snapshot.link_doc_ids[i]);
+        sqlite3_bind_text(stmt, 2, text.data(), static_cast<int>(text.size()), SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 3, canonical_id);
+        sqlite3_bind_int(stmt, 4, snapshot.link_canonical_doc_ids[i]);
+        sqlite3_bind_double(stmt, 5, snapshot.link_similarities[i]);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+    }
+    if (!ok) {
+        std::cerr << "Failed to import near-duplicate links: " << sqlite3_errmsg(primary) << std::endl;
+    }
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+bool import_projection(sqlite3* primary, const VectorProjection& projection) {
+    sqlite3_stmt* stmt;
+    const char* insert_sql = "INSERT OR REPLACE INTO projection (id, method, input_dim, output_dim, mean, components, version) "
+        "VALUES (1, ?, ?, ?, ?, ?, ?);";
+    if (!prepare(primary, insert_sql, &stmt)) {
+        return false;
+    }
+    sqlite3_bind_text(stmt, 1, projection.method.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 2, projection.input_dim);
+    sqlite3_bind_int(stmt, 3, projection.output_dim);
+    sqlite3_bind_blob(stmt, 4, projection.mean.data(), static_cast<int>(projection.mean.size() * sizeof(float)), SQLITE_STATIC);
+    sqlite3_bind_blob(stmt, 5, projection.components.data(), static_cast<int>(projection.components.size() * sizeof(float)), SQLITE_STATIC);
+    sqlite3_bind_int(stmt, 6, projection.version);
+    bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+    if (!ok) {
+        std::cerr << "Failed to import the projection: " << sqlite3_errmsg(primary) << std::endl;
+    }
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+// Insert the rows of a matrix that belong in shard; target_ids gives each
+// row's id in this database (-1 = skip). With texts, each row's paragraph
+// text goes into paragraphs under the same id.
+bool import_matrix_rows(sqlite3* shard, size_t shard_number, size_t shard_total, const MatrixSection& matrix,
+    const std::vector<int>& target_ids, const StringColumn* texts, const char* insert_sql) {
+    sqlite3_stmt* stmt;
+    if (!prepare(shard, insert_sql, &stmt)) {
+        return false;
+    }
+    sqlite3_stmt* text_stmt = nullptr;
+    if (texts && !prepare(shard, "INSERT INTO paragraphs (id, doc_id, text) VALUES (?, ?, ?);", &text_stmt)) {
+        sqlite3_finalize(stmt);
+        return false;
+    }
+
+    bool ok = true;
+    int blob_bytes = static_cast<int>(matrix.dim * sizeof(float));
+    for (size_t i = 0; i < matrix.rows && ok; ++i) {
+        int id = target_ids[i];
+        if (id < 0 || static_cast<size_t>(id) % shard_total != shard_number) continue;
+
+        sqlite3_bind_int(stmt, 1, id);
+        sqlite3_bind_int(stmt, 2, matrix.doc_ids[i]);
+        sqlite3_bind_blob(stmt, 3, matrix.vectors + i * matrix.dim, blob_bytes, SQLITE_STATIC);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_reset(stmt);
+        if (ok && text_stmt) {
+            std::string_view text = texts->at(i);
+            sqlite3_bind_int(text_stmt, 1, id);
+            sqlite3_bind_int(text_stmt, 2, matrix.doc_ids[i]);
+            sqlite3_bind_text(text_stmt, 3, text.data(), static_cast<int>(text.size()), SQLITE_STATIC);
+            ok = sqlite3_step(text_stmt) == SQLITE_DONE;
+            sqlite3_reset(text_stmt);
+        }
+    }
+    if (!ok) {
+        std::cerr << "Failed to import embeddings: " << sqlite3_errmsg(shard) << std::endl;
+    }
+    sqlite3_finalize(text_stmt);
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+} // namespace
+
+bool export_snapshot(sqlite3* primary, const std::wstring& path) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<sqlite3*> shards = shard_connections(primary);
+
+    // One read transaction per shard keeps every query below on the same rows
+    for (sqlite3* shard : shards) {
+        sqlite3_exec(shard, "BEGIN;", nullptr, nullptr, nullptr);
+    }
+
+    std::filesystem::path final_path(path);
+    std::filesystem::path temp_path = final_path;
+    temp_path += ".tmp";
+
+    bool ok = true;
+    size_t document_count = 0;
+    size_t rows = 0;
+    size_t reduced_rows = 0;
+    uint64_t file_size = 0;
+    int dim = first_embedding_dim(shards);
+    std::shared_ptr<const VectorProjection> projection = load_projection(primary);
+    {
+        SnapshotWriter writer(temp_path);
+        std::vector<ShardRange> fingerprints(shards.size(), ShardRange{});
+        for (size_t k = 0; k < shards.size() && ok; ++k) {
+            ok = shard_fingerprint(shards[k], fingerprints[k].row_count, fingerprints[k].max_id);
+        }
+
+        ok = ok && writer.ok()
+            && write_documents_section(writer, primary, document_count)
+            && write_matrix_section(writer, SectionEmbeddings, shards, "embeddings", dim, fingerprints, rows)
+            && write_texts_section(writer, shards, dim)
+            && write_near_duplicates_section(writer, primary);
+        if (ok && projection) {
+            write_projection_section(writer, *projection);
+            ok = write_matrix_section(writer, SectionReducedEmbeddings, shards, "reduced_embeddings", projection->output_dim,
+                fingerprints, reduced_rows);
+        }
+        file_size = writer.size();
+        ok = ok && writer.finish();
+    }
+
+    for (sqlite3* shard : shards) {
+        sqlite3_exec(shard, "COMMIT;", nullptr, nullptr, nullptr);
+    }
+
+    std::error_code ec;
+    if (ok) {
+        std::filesystem::rename(temp_path, final_path, ec);
+    }
+    if (!ok || ec) {
+        std::cerr << "Failed to write snapshot: " << wstring_to_utf8(path) << std::endl;
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Exported " << document_count << " documents and " << rows << " embeddings (dim " << dim << ")";
+    if (projection) {
+        std::cout << " with " << reduced_rows << " reduced vectors";
+    }
+    std::cout << " to " << wstring_to_utf8(path) << " (" << file_size / (1024.0 * 1024.0) << " MB) in " << seconds << " s." << std::endl;
+    return true;
+}
+
+bool import_snapshot(sqlite3* primary, const std::wstring& path) {
+    auto start = std::chrono::steady_clock::now();
+    Snapshot snapshot;
+    if (!open_snapshot(path, snapshot, all_sections)) {
+        return false;
+    }
+
+    std::vector<sqlite3*> shards = shard_connections(primary);
+    if (!database_is_empty(primary, shards)) {
+        std::cerr << "Snapshots can only be imported into an empty database." << std::endl;
+        return false;
+    }
+
+    // Ids route rows to shards (id % shard count matches doc_id % shard count),
+    // so they are only kept when this database is split the same way
+    size_t shard_total = shards.size();
+    bool keep_ids = shard_total == 1 || shard_total == snapshot.embeddings.shard_count;
+    std::vector<int> ids(snapshot.embeddings.rows);
+    std::unordered_map<int, int> renumbered;
+    std::vector<long long> next_id(shard_total);
+    for (size_t k = 0; k < shard_total; ++k) {
+        next_id[k] = k == 0 ? static_cast<long long>(shard_total) : static_cast<long long>(k);
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (keep_ids) {
+            ids[i] = snapshot.embeddings.ids[i];
+            continue;
+        }
+        size_t k = static_cast<size_t>(snapshot.embeddings.doc_ids[i]) % shard_total;
+        ids[i] = static_cast<int>(next_id[k]);
+        next_id[k] += shard_total;
+        renumbered[snapshot.embeddings.ids[i]] = ids[i];
+    }
+    std::vector<int> reduced_ids(snapshot.reduced.rows);
+    for (size_t i = 0; i < reduced_ids.size(); ++i) {
+        if (keep_ids) {
+            reduced_ids[i] = snapshot.reduced.ids[i];
+            continue;
+        }
+        auto it = renumbered.find(snapshot.reduced.ids[i]);
+        reduced_ids[i] = it == renumbered.end() ? -1 : it->second;
+    }
+
+    sqlite3_exec(primary, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    bool ok = import_documents(primary, snapshot) && import_near_duplicates(primary, snapshot, renumbered);
+    if (ok && snapshot.projection) {
+        ok = import_projection(primary, *snapshot.projection);
+    }
+    sqlite3_exec(primary, ok ? "COMMIT;" : "ROLLBACK;", nullptr, nullptr, nullptr);
+    if (!ok) {
+        return false;
+    }
+
+    std::vector<char> shard_ok(shard_total, 0);
+    run_on_shards(shard_total, [&](size_t k) {
+        sqlite3* shard = shards[k];
+        sqlite3_exec(shard, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+        bool written = import_matrix_rows(shard, k, shard_total, snapshot.embeddings, ids, &snapshot.texts,
+            "INSERT INTO embeddings (id, doc_id, embedding) VALUES (?, ?, ?);");
+        if (written && snapshot.reduced.present) {
+            written = import_matrix_rows(shard, k, shard_total, snapshot.reduced, reduced_ids, nullptr,
+                "INSERT INTO reduced_embeddings (id, doc_id, embedding) VALUES (?, ?, ?);");
+        }
+        sqlite3_exec(shard, written ? "COMMIT;" : "ROLLBACK;", nullptr, nullptr, nullptr);
+        shard_ok[k] = written;
+    });
+    if (std::find(shard_ok.begin(), shard_ok.end(), 0) != shard_ok.end()) {
+        std::cerr << "The snapshot was only partly imported." << std::endl;
+        return false;
+    }
+    build_missing_document_centroids(primary);
+    pack_stored_paragraphs(primary);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Imported " << snapshot.document_count << " documents and " << snapshot.embeddings.rows << " embeddings";
+    if (snapshot.reduced.present) {
+        std::cout << " with " << snapshot.reduced.rows << " reduced vectors";
+    }
+    std::cout << " from " << wstring_to_utf8(path) << " in " << seconds << " s." << std::endl;
+    return true;
+}
+
+std::vector<bool> load_segments_from_snapshot(sqlite3* primary, const std::wstring& path,
+    const std::shared_ptr<const VectorProjection>& projection, std::vector<VectorIndex>& segments) {
+    std::vector<bool> loaded(segments.size(), false);
+    auto start = std::chrono::steady_clock::now();
+    Snapshot snapshot;
+    uint32_t wanted = projection ? section_bit(SectionProjection) | section_bit(SectionReducedEmbeddings) : section_bit(SectionEmbeddings);
+    if (!open_snapshot(path, snapshot, wanted)) {
+        return loaded;
+    }
+    if (projection && (!snapshot.reduced.present || snapshot.projection->version != projection->version
+        || snapshot.projection->output_dim != projection->output_dim)) {
+        std::cerr << "The snapshot does not hold the current reduced vectors; loading from the database instead." << std::endl;
+        return loaded;
+    }
+    const MatrixSection& matrix = projection ? snapshot.reduced : snapshot.embeddings;
+
+    std::vector<sqlite3*> shards = shard_connections(primary);
+    if (matrix.shard_count != shards.size() || segments.size() != shards.size()) {
+        std::cerr << "The snapshot was written from " << matrix.shard_count << " shards, the database has "
+            << shards.size() << "; loading from the database instead." << std::endl;
+        return loaded;
+    }
+
+    std::vector<char> filled(shards.size(), 0);
+    run_on_shards(shards.size(), [&](size_t k) {
+        uint64_t row_count = 0;
+        int64_t max_id = 0;
+        const ShardRange& range = matrix.ranges[k];
+        if (!shard_fingerprint(shards[k], row_count, max_id) || row_count != range.row_count || max_id != range.max_id) {
+            return;
+        }
+
+        size_t begin = static_cast<size_t>(range.begin);
+        size_t end = static_cast<size_t>(range.end);
+        VectorIndex& segment = segments[k];
+        segment = VectorIndex();
+        segment.projection = projection;
+        segment.dim = end > begin ? static_cast<int>(matrix.dim) : 0;
+        segment.ids.assign(matrix.ids + begin, matrix.ids + end);
+        segment.doc_ids.assign(matrix.doc_ids + begin, matrix.doc_ids + end);
+        segment.norms.assign(matrix.norms + begin, matrix.norms + end);
+        segment.vectors.assign(matrix.vectors + begin * matrix.dim, matrix.vectors + end * matrix.dim);
+        index_documents(segment);
+        filled[k] = 1;
+    });
+
+    size_t shard_hits = 0;
+    size_t vectors = 0;
+    for (size_t k = 0; k < shards.size(); ++k) {
+        loaded[k] = filled[k] != 0;
+        if (loaded[k]) {
+            shard_hits++;
+            vectors += segments[k].size();
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded " << vectors << (projection ? " reduced" : "") << " vectors for " << shard_hits << " of "
+        << shards.size() << (shards.size() == 1 ? " shard" : " shards") << " from snapshot " << wstring_to_utf8(path) << " in " << ms << " ms";
+    if (shard_hits < shards.size()) {
+        std::cout << "; shards changed since the snapshot are read from the database";
+    }
+    std::cout << "." << std::endl;
+    return loaded;
+}
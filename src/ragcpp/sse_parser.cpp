@@ -0,0 +1,73 @@
+// sse_parser.cpp
+
+#include "sse_parser.h"
+
+SseParser::SseParser(EventCallback on_event) : on_event_(std::move(on_event)) {
+}
+
+void SseParser::feed(const char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        char c = data[i];
+        if (c == '\n') {
+            if (!line_buffer_.empty() && line_buffer_.back() == '\r') {
+                line_buffer_.pop_back();
+            }
+            process_line(line_buffer_);
+            line_buffer_.clear();
+        }
+        else {
+            line_buffer_ += c;
+        }
+    }
+}
+
+void SseParser::finish() {
+    if (!line_buffer_.empty()) {
+        process_line(line_buffer_);
+        line_buffer_.clear();
+    }
+    dispatch();
+}
+
+void SseParser::process_line(const std::string& line) {
+    // A blank line terminates the current event
+    if (line.empty()) {
+        dispatch();
+        return;
+    }
+
+    // Lines starting with ':' are comments (often used as keep-alives)
+    if (line[0] == ':') {
+        return;
+    }
+
+    size_t colon = line.find(':');
+    std::string field = line.substr(0, colon);
+    std::string value;
+    if (colon != std::string::npos) {
+        size_t value_start = colon + 1;
+        if (value_start < line.size() && line[value_start] == ' ') {
+            value_start++;
+        }
+        value = line.substr(value_start);
+    }
+
+    // Only the data field matters for the OpenAI stream; event, id and retry are ignored
+    if (field == "data") {
+        if (has_data_) {
+            data_buffer_ += '\n';
+        }
+        data_buffer_ += value;
+        has_data_ = true;
+    }
+}
+
+void SseParser::dispatch() {
+    if (!has_data_) {
+        return;
+    }
+    event_count_++;
+    on_event_(data_buffer_);
+    data_buffer_.clear();
+    has_data_ = false;
+}
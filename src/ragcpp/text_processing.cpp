@@ -4,6 +4,7 @@
 #include "cppjieba/Jieba.hpp"
 #include <sstream>
 #include "encoding_utils.h"
+#include "metrics.h"
 
 const char* const DICT_PATH = "./dict/jieba.dict.utf8";
 const char* const HMM_PATH = "./dict/hmm_model.utf8";
@@ -11,15 +12,21 @@ const char* const USER_DICT_PATH = "./dict/user.dict.utf8";
 const char* const IDF_PATH = "./dict/idf.utf8";
 const char* const STOP_WORD_PATH = "./dict/stop_words.utf8";
 
-// Initialize Jieba tokenizer
-cppjieba::Jieba jieba(DICT_PATH, HMM_PATH, USER_DICT_PATH, IDF_PATH, STOP_WORD_PATH);
+// Initialize Jieba tokenizer on first use, so commands that never tokenize
+// (such as a thin client forwarding to --serve) skip loading the dictionaries
+static cppjieba::Jieba& jieba() {
+    static cppjieba::Jieba instance(DICT_PATH, HMM_PATH, USER_DICT_PATH, IDF_PATH, STOP_WORD_PATH);
+    return instance;
+}
 
 std::wstring tokenize_text(const std::wstring& wtext) {
+    StageTimer timer(Stage::Tokenize);
+
     // Convert wstring to UTF-8 string
     std::string text = wstring_to_utf8(wtext);
 
     std::vector<std::string> words;
-    jieba.Cut(text, words, true); // Use accurate mode
+    jieba().Cut(text, words, true); // Use accurate mode
 
     // Join the words with spaces
     std::string result;
@@ -31,6 +38,12 @@ std::wstring tokenize_text(const std::wstring& wtext) {
     return utf8_to_wstring(result);
 }
 
+std::vector<std::string> split_words(const std::wstring& text) {
+    std::vector<std::string> words;
+    jieba().Cut(wstring_to_utf8(text), words, true);
+    return words;
+}
+
 std::vector<std::wstring> split_paragraphs(const std::wstring& text) {
     std::vector<std::wstring> paragraphs;
     std::wstringstream ss(text);
@@ -0,0 +1,520 @@
+// text_store.cpp
+
+#include "text_store.h"
+#include "shards.h"
+#include "lru_cache.h"
+#include <zlib.h>
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Inflated blocks kept in memory, across all databases (16 MB at 4 KB each)
+const size_t text_block_cache_blocks = 4096;
+
+// Deflate only looks back 32 KB, so a larger dictionary would not be used
+const size_t dictionary_bytes = 32 * 1024;
+
+// A database file trains its dictionary once it holds this many paragraphs,
+// from a random sample of up to dictionary_sample_paragraphs of them
+const int dictionary_min_paragraphs = 64;
+const int dictionary_sample_paragraphs = 2048;
+
+// Inline paragraphs packed per transaction by pack_stored_paragraphs
+const int pack_batch_rows = 4096;
+
+// What is cached for one open connection: the generation that prefixes its
+// block keys, and its dictionaries. Forgotten when the connection closes, so
+// a connection opened later at the same address or on a recreated file never
+// reads another's text.
+struct ConnectionCache {
+    uint64_t generation = 0;
+    std::unordered_map<sqlite3_int64, std::shared_ptr<const std::string>> dictionaries;
+};
+
+// Recursive: a failed registration in connection_cache runs its destructor,
+// which takes the lock again
+std::recursive_mutex g_cache_mutex;
+LruCache<std::string, std::shared_ptr<const std::string>> g_block_cache(text_block_cache_blocks);
+std::unordered_map<sqlite3*, ConnectionCache> g_connection_caches;
+uint64_t g_last_generation = 0;
+
+// One process trains a database's dictionary once, not once per writer thread
+std::mutex g_training_mutex;
+
+bool prepare(sqlite3* db, const char* sql, sqlite3_stmt** stmt) {
+    if (sqlite3_prepare_v2(db, sql, -1, stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Destructor of the function registered below, run when its connection
+// closes; its blocks are no longer reachable and age out of the cache
+void forget_connection_cache(void* db) {
+    std::lock_guard<std::recursive_mutex> lock(g_cache_mutex);
+    g_connection_caches.erase(static_cast<sqlite3*>(db));
+}
+
+void close_marker(sqlite3_context* context, int, sqlite3_value**) {
+    sqlite3_result_null(context);
+}
+
+// Call with g_cache_mutex held. Null only when the close hook could not be
+// registered, and then nothing is cached for the connection.
+ConnectionCache* connection_cache(sqlite3* db) {
+    auto it = g_connection_caches.find(db);
+    if (it != g_connection_caches.end()) {
+        return &it->second;
+    }
+    g_connection_caches[db].generation = ++g_last_generation;
+    if (sqlite3_create_function_v2(db, "ragcpp_text_cache", 0, SQLITE_UTF8, db, close_marker, nullptr, nullptr,
+        forget_connection_cache) != SQLITE_OK) {
+        g_connection_caches.erase(db);
+        return nullptr;
+    }
+    return &g_connection_caches[db];
+}
+
+// Block ids are AUTOINCREMENT, so they are never reused within a database
+// file; the key names the connection's generation and the id
+std::string block_cache_key(const ConnectionCache& cache, sqlite3_int64 block_id) {
+    return std::to_string(cache.generation) + "#" + std::to_string(block_id);
+}
+
+void cache_dictionary(sqlite3* db, sqlite3_int64 dictionary_id, const std::shared_ptr<const std::string>& dictionary) {
+    std::lock_guard<std::recursive_mutex> lock(g_cache_mutex);
+    if (ConnectionCache* cache = connection_cache(db)) {
+        cache->dictionaries[dictionary_id] = dictionary;
+    }
+}
+
+std::shared_ptr<const std::string> load_dictionary(sqlite3* db, sqlite3_int64 dictionary_id) {
+    {
+        std::lock_guard<std::recursive_mutex> lock(g_cache_mutex);
+        if (ConnectionCache* cache = connection_cache(db)) {
+            auto it = cache->dictionaries.find(dictionary_id);
+            if (it != cache->dictionaries.end()) {
+                return it->second;
+            }
+        }
+    }
+
+    sqlite3_stmt* stmt;
+    if (!prepare(db, "SELECT data FROM text_dictionaries WHERE id = ?;", &stmt)) {
+        return nullptr;
+    }
+    sqlite3_bind_int64(stmt, 1, dictionary_id);
+    std::shared_ptr<const std::string> dictionary;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* data = static_cast<const char*>(sqlite3_column_blob(stmt, 0));
+        dictionary = std::make_shared<const std::string>(data ? data : "", sqlite3_column_bytes(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+
+    if (dictionary) {
+        cache_dictionary(db, dictionary_id, dictionary);
+    }
+    return dictionary;
+}
+
+std::shared_ptr<const std::string> load_block(sqlite3* db, sqlite3_int64 block_id) {
+    std::string key;
+    std::shared_ptr<const std::string> block;
+    {
+        std::lock_guard<std::recursive_mutex> lock(g_cache_mutex);
+        if (ConnectionCache* cache = connection_cache(db)) {
+            key = block_cache_key(*cache, block_id);
+            if (g_block_cache.get(key, block)) {
+                return block;
+            }
+        }
+    }
+
+    sqlite3_stmt* stmt;
+    if (!prepare(db, "SELECT dictionary_id, raw_size, data FROM text_blocks WHERE id = ?;", &stmt)) {
+        return nullptr;
+    }
+    sqlite3_bind_int64(stmt, 1, block_id);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        std::shared_ptr<const std::string> dictionary;
+        bool has_dictionary = sqlite3_column_type(stmt, 0) != SQLITE_NULL;
+        if (has_dictionary) {
+            dictionary = load_dictionary(db, sqlite3_column_int64(stmt, 0));
+        }
+        std::string raw;
+        if ((!has_dictionary || dictionary)
+            && decompress_text_block(sqlite3_column_blob(stmt, 2), sqlite3_column_bytes(stmt, 2),
+                static_cast<size_t>(sqlite3_column_int64(stmt, 1)), dictionary ? *dictionary : std::string(), raw)) {
+            block = std::make_shared<const std::string>(std::move(raw));
+        }
+    }
+    sqlite3_finalize(stmt);
+
+    if (block && !key.empty()) {
+        std::lock_guard<std::recursive_mutex> lock(g_cache_mutex);
+        g_block_cache.put(key, block);
+    }
+    return block;
+}
+
+void block_text(sqlite3_context* context, int, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+        sqlite3_result_null(context);
+        return;
+    }
+    sqlite3_int64 block_id = sqlite3_value_int64(argv[0]);
+    sqlite3_int64 offset = sqlite3_value_int64(argv[1]);
+    sqlite3_int64 length = sqlite3_value_int64(argv[2]);
+    std::shared_ptr<const std::string> block = load_block(sqlite3_context_db_handle(context), block_id);
+    if (!block || offset < 0 || length < 0 || static_cast<size_t>(offset + length) > block->size()) {
+        std::cerr << "Cannot read paragraph text from block " << block_id << "." << std::endl;
+        sqlite3_result_null(context);
+        return;
+    }
+    sqlite3_result_text(context, block->data() + offset, static_cast<int>(length), SQLITE_TRANSIENT);
+}
+
+// The newest dictionary of a database file, training one first when it has
+// none and enough paragraphs to learn from. Id 0 = compress without one.
+sqlite3_int64 current_dictionary(sqlite3* shard, std::shared_ptr<const std::string>& dictionary) {
+    std::lock_guard<std::mutex> training(g_training_mutex);
+    sqlite3_int64 dictionary_id = 0;
+    sqlite3_stmt* stmt;
+    if (prepare(shard, "SELECT MAX(id) FROM text_dictionaries;", &stmt)) {
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+            dictionary_id = sqlite3_column_int64(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+    }
+    if (dictionary_id > 0) {
+        dictionary = load_dictionary(shard, dictionary_id);
+        return dictionary ? dictionary_id : 0;
+    }
+
+    std::vector<std::string> samples;
+    if (!prepare(shard, "SELECT text FROM paragraph_texts WHERE id IN (SELECT id FROM paragraphs ORDER BY RANDOM() LIMIT ?);", &stmt)) {
+        return 0;
+    }
+    sqlite3_bind_int(stmt, 1, dictionary_sample_paragraphs);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        samples.emplace_back(text ? text : "", sqlite3_column_bytes(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    if (samples.size() < static_cast<size_t>(dictionary_min_paragraphs)) {
+        return 0;
+    }
+
+    std::string trained = train_text_dictionary(samples, dictionary_bytes);
+    if (trained.empty() || !prepare(shard, "INSERT INTO text_dictionaries (data) VALUES (?) RETURNING id;", &stmt)) {
+        return 0;
+    }
+    sqlite3_bind_blob(stmt, 1, trained.data(), static_cast<int>(trained.size()), SQLITE_STATIC);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        dictionary_id = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    if (dictionary_id > 0) {
+        dictionary = std::make_shared<const std::string>(std::move(trained));
+        cache_dictionary(shard, dictionary_id, dictionary);
+    }
+    return dictionary_id;
+}
+
+struct InlineParagraph {
+    sqlite3_int64 id;
+    int doc_id;
+    std::string text;
+};
+
+// Compress rows (in document order) into blocks of consecutive paragraphs of
+// one document and point the rows at them. Returns the paragraphs packed.
+size_t write_blocks(sqlite3* shard, const std::vector<InlineParagraph>& rows, sqlite3_int64 dictionary_id,
+    const std::string& dictionary) {
+    sqlite3_stmt* insert_stmt;
+    sqlite3_stmt* update_stmt;
+    if (!prepare(shard, "INSERT INTO text_blocks (dictionary_id, raw_size, data) VALUES (?, ?, ?) RETURNING id;", &insert_stmt)) {
+        return 0;
+    }
+    if (!prepare(shard, "UPDATE paragraphs SET text = NULL, block_id = ?1, block_offset = ?2, block_length = ?3 "
+        "WHERE id = ?4 AND block_id IS NULL;", &update_stmt)) {
+        sqlite3_finalize(insert_stmt);
+        return 0;
+    }
+
+    size_t packed = 0;
+    size_t start = 0;
+    while (start < rows.size()) {
+        std::string raw = rows[start].text;
+        size_t end = start + 1;
+        while (end < rows.size() && rows[end].doc_id == rows[start].doc_id && raw.size() + rows[end].text.size() <= text_block_bytes) {
+            raw += rows[end].text;
+            end++;
+        }
+
+        std::string compressed = compress_text_block(raw, dictionary);
+        sqlite3_int64 block_id = 0;
+        if (!compressed.empty()) {
+            if (dictionary_id > 0) {
+                sqlite3_bind_int64(insert_stmt, 1, dictionary_id);
+            }
+            else {
+                sqlite3_bind_null(insert_stmt, 1);
+            }
+            sqlite3_bind_int64(insert_stmt, 2, static_cast<sqlite3_int64>(raw.size()));
+            sqlite3_bind_blob(insert_stmt, 3, compressed.data(), static_cast<int>(compressed.size()), SQLITE_STATIC);
+            if (sqlite3_step(insert_stmt) == SQLITE_ROW) {
+                block_id = sqlite3_column_int64(insert_stmt, 0);
+            }
+            sqlite3_reset(insert_stmt);
+        }
+        if (block_id == 0) {
+            std::cerr << "Failed to store a text block: " << sqlite3_errmsg(shard) << std::endl;
+            break;
+        }
+
+        size_t offset = 0;
+        for (size_t i = start; i < end; ++i) {
+            sqlite3_bind_int64(update_stmt, 1, block_id);
+            sqlite3_bind_int64(update_stmt, 2, static_cast<sqlite3_int64>(offset));
+            sqlite3_bind_int64(update_stmt, 3, static_cast<sqlite3_int64>(rows[i].text.size()));
+            sqlite3_bind_int64(update_stmt, 4, rows[i].id);
+            if (sqlite3_step(update_stmt) == SQLITE_DONE) {
+                packed += sqlite3_changes(shard) > 0 ? 1 : 0;
+            }
+            sqlite3_reset(update_stmt);
+            offset += rows[i].text.size();
+        }
+        start = end;
+    }
+    sqlite3_finalize(insert_stmt);
+    sqlite3_finalize(update_stmt);
+    return packed;
+}
+
+InlineParagraph read_inline_paragraph(sqlite3_stmt* stmt) {
+    const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+    return { sqlite3_column_int64(stmt, 0), sqlite3_column_int(stmt, 1), std::string(text ? text : "", sqlite3_column_bytes(stmt, 2)) };
+}
+
+} // namespace
+
+void register_text_functions(sqlite3* db) {
+    sqlite3_create_function(db, "block_text", 3, SQLITE_UTF8, nullptr, block_text, nullptr, nullptr);
+}
+
+std::string train_text_dictionary(const std::vector<std::string>& samples, size_t capacity) {
+    // Score 128-byte segments of the samples by the 8-byte strings in them
+    // that recur across samples, then pick segments greedily; once a string
+    // is in the dictionary it no longer counts for the remaining segments
+    const size_t dmer = 8;
+    const size_t segment_bytes = 128;
+    auto dmer_at = [&samples](size_t sample, size_t i) {
+        uint64_t value;
+        memcpy(&value, samples[sample].data() + i, dmer);
+        return value;
+    };
+
+    // In how many samples each string occurs; one that only occurs in a
+    // single sample is left to that sample's own block to compress
+    std::unordered_map<uint64_t, uint32_t> frequency;
+    std::unordered_set<uint64_t> seen;
+    for (size_t s = 0; s < samples.size(); ++s) {
+        if (samples[s].size() < dmer) continue;
+        seen.clear();
+        for (size_t i = 0; i + dmer <= samples[s].size(); ++i) {
+            seen.insert(dmer_at(s, i));
+        }
+        for (uint64_t value : seen) {
+            frequency[value]++;
+        }
+    }
+
+    struct Segment {
+        size_t sample;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<Segment> segments;
+    for (size_t s = 0; s < samples.size(); ++s) {
+        for (size_t begin = 0; begin + dmer <= samples[s].size(); begin += segment_bytes) {
+            segments.push_back({ s, begin, std::min(begin + segment_bytes, samples[s].size()) });
+        }
+    }
+    auto score = [&](const Segment& segment) {
+        uint64_t total = 0;
+        seen.clear();
+        for (size_t i = segment.begin; i + dmer <= segment.end; ++i) {
+            uint64_t value = dmer_at(segment.sample, i);
+            if (!seen.insert(value).second) continue;
+            auto it = frequency.find(value);
+            if (it != frequency.end() && it->second > 1) {
+                total += it->second;
+            }
+        }
+        return total;
+    };
+
+    std::priority_queue<std::pair<uint64_t, size_t>> candidates;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        uint64_t value = score(segments[i]);
+        if (value > 0) {
+            candidates.push({ value, i });
+        }
+    }
+
+    // Scores only drop as segments are chosen, so a candidate whose fresh
+    // score still beats the next stored one is the best
+    std::vector<size_t> chosen;
+    size_t size = 0;
+    while (!candidates.empty() && size < capacity) {
+        size_t i = candidates.top().second;
+        candidates.pop();
+        uint64_t current = score(segments[i]);
+        if (current == 0) continue;
+        if (!candidates.empty() && current < candidates.top().first) {
+            candidates.push({ current, i });
+            continue;
+        }
+        chosen.push_back(i);
+        size += segments[i].end - segments[i].begin;
+        for (size_t p = segments[i].begin; p + dmer <= segments[i].end; ++p) {
+            auto it = frequency.find(dmer_at(segments[i].sample, p));
+            if (it != frequency.end()) {
+                it->second = 0;
+            }
+        }
+    }
+
+    // Deflate codes nearer matches in fewer bits: best segments go last
+    std::string dictionary;
+    for (auto it = chosen.rbegin(); it != chosen.rend(); ++it) {
+        dictionary.append(samples[segments[*it].sample], segments[*it].begin, segments[*it].end - segments[*it].begin);
+    }
+    if (dictionary.size() > capacity) {
+        dictionary.erase(0, dictionary.size() - capacity);
+    }
+    return dictionary;
+}
+
+std::string compress_text_block(const std::string& raw, const std::string& dictionary) {
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return "";
+    }
+    if (!dictionary.empty()) {
+        deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary.data()), static_cast<uInt>(dictionary.size()));
+    }
+
+    std::string compressed(deflateBound(&stream, static_cast<uLong>(raw.size())), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(raw.data()));
+    stream.avail_in = static_cast<uInt>(raw.size());
+    stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    stream.avail_out = static_cast<uInt>(compressed.size());
+    int rc = deflate(&stream, Z_FINISH);
+    compressed.resize(stream.total_out);
+    deflateEnd(&stream);
+    return rc == Z_STREAM_END ? compressed : "";
+}
+
+bool decompress_text_block(const void* data, size_t size, size_t raw_size, const std::string& dictionary, std::string& raw) {
+    z_stream stream{};
+    if (inflateInit2(&stream, -15) != Z_OK) {
+        return false;
+    }
+    if (!dictionary.empty()) {
+        inflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary.data()), static_cast<uInt>(dictionary.size()));
+    }
+
+    raw.resize(raw_size);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    stream.next_out = reinterpret_cast<Bytef*>(raw.data());
+    stream.avail_out = static_cast<uInt>(raw.size());
+    int rc = inflate(&stream, Z_FINISH);
+    bool ok = rc == Z_STREAM_END && stream.total_out == raw_size;
+    inflateEnd(&stream);
+    return ok;
+}
+
+void pack_document_texts(sqlite3* primary, int doc_id) {
+    sqlite3* shard = shard_for_id(primary, doc_id);
+    std::shared_ptr<const std::string> dictionary;
+    sqlite3_int64 dictionary_id = current_dictionary(shard, dictionary);
+
+    sqlite3_stmt* stmt;
+    if (!prepare(shard, "SELECT id, doc_id, text FROM paragraphs WHERE doc_id = ? AND block_id IS NULL AND text IS NOT NULL ORDER BY id;", &stmt)) {
+        return;
+    }
+    sqlite3_bind_int(stmt, 1, doc_id);
+    std::vector<InlineParagraph> rows;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        rows.push_back(read_inline_paragraph(stmt));
+    }
+    sqlite3_finalize(stmt);
+    if (rows.empty()) {
+        return;
+    }
+
+    auto lock = lock_connection(shard);
+    sqlite3_exec(shard, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    write_blocks(shard, rows, dictionary_id, dictionary ? *dictionary : std::string());
+    sqlite3_exec(shard, "COMMIT;", nullptr, nullptr, nullptr);
+}
+
+size_t pack_stored_paragraphs(sqlite3* primary) {
+    std::vector<sqlite3*> shards = shard_connections(primary);
+    std::vector<size_t> packed(shards.size(), 0);
+    run_on_shards(shards.size(), [&](size_t k) {
+        sqlite3* shard = shards[k];
+        std::shared_ptr<const std::string> dictionary;
+        sqlite3_int64 dictionary_id = current_dictionary(shard, dictionary);
+
+        sqlite3_stmt* stmt;
+        if (!prepare(shard, "SELECT id, doc_id, text FROM paragraphs WHERE block_id IS NULL AND text IS NOT NULL "
+            "AND (doc_id, id) > (?1, ?2) ORDER BY doc_id, id LIMIT ?3;", &stmt)) {
+            return;
+        }
+        int last_doc_id = -1;
+        sqlite3_int64 last_id = -1;
+        while (true) {
+            std::vector<InlineParagraph> rows;
+            sqlite3_bind_int(stmt, 1, last_doc_id);
+            sqlite3_bind_int64(stmt, 2, last_id);
+            sqlite3_bind_int(stmt, 3, pack_batch_rows);
+            while (sqlite3_step(stmt) == SQLITE_ROW) {
+                rows.push_back(read_inline_paragraph(stmt));
+            }
+            sqlite3_reset(stmt);
+            if (rows.empty()) break;
+            last_doc_id = rows.back().doc_id;
+            last_id = rows.back().id;
+
+            auto lock = lock_connection(shard);
+            sqlite3_exec(shard, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+            packed[k] += write_blocks(shard, rows, dictionary_id, dictionary ? *dictionary : std::string());
+            sqlite3_exec(shard, "COMMIT;", nullptr, nullptr, nullptr);
+        }
+        sqlite3_finalize(stmt);
+    });
+
+    size_t total = 0;
+    for (size_t n : packed) {
+        total += n;
+    }
+    return total;
+}
+
+void clear_text_block_cache() {
+    std::lock_guard<std::recursive_mutex> lock(g_cache_mutex);
+    g_block_cache.clear();
+}
@@ -0,0 +1,543 @@
+// vector_index.cpp
+
+#include "vector_index.h"
+#include "metrics.h"
+#include "shards.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <queue>
+#include <atomic>
+#include <numeric>
+#include <unordered_map>
+#include <bit>
+
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+#include <immintrin.h>
+#define VECTOR_INDEX_USE_VPOPCNTDQ 1
+#endif
+
+static std::atomic<size_t> g_coarse_documents{ 0 };
+static std::atomic<size_t> g_binary_candidates{ 0 };
+
+void set_coarse_documents(size_t n) {
+    g_coarse_documents = n;
+}
+
+size_t coarse_documents() {
+    return g_coarse_documents;
+}
+
+void set_binary_candidates(size_t n) {
+    g_binary_candidates = n;
+}
+
+size_t binary_candidates() {
+    return g_binary_candidates;
+}
+
+static void pack_signs(const float* vector, size_t dim, uint64_t* code) {
+    for (size_t d = 0; d < dim; ++d) {
+        if (vector[d] > 0.0f) {
+            code[d / 64] |= uint64_t(1) << (d % 64);
+        }
+    }
+}
+
+std::vector<uint64_t> binary_code(const std::vector<float>& vector) {
+    std::vector<uint64_t> code((vector.size() + 63) / 64, 0);
+    pack_signs(vector.data(), vector.size(), code.data());
+    return code;
+}
+
+void index_documents(VectorIndex& index) {
+    index.documents.clear();
+    index.centroids.clear();
+    index.codes.clear();
+    if (index.size() == 0) {
+        return;
+    }
+
+    // Rows are stored in id order, which keeps each document's paragraphs
+    // together unless several runs embedded into the shard at the same time
+    std::unordered_map<int, size_t> seen;
+    bool grouped = true;
+    for (size_t i = 0; i < index.size() && grouped; ++i) {
+        if (i > 0 && index.doc_ids[i] == index.doc_ids[i - 1]) continue;
+        grouped = seen.emplace(index.doc_ids[i], i).second;
+    }
+    if (!grouped) {
+        std::vector<size_t> order(index.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&index](size_t a, size_t b) {
+            return index.doc_ids[a] < index.doc_ids[b];
+        });
+        VectorIndex sorted;
+        sorted.dim = index.dim;
+        sorted.projection = index.projection;
+        sorted.vectors.resize(index.vectors.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            sorted.ids.push_back(index.ids[order[i]]);
+            sorted.doc_ids.push_back(index.doc_ids[order[i]]);
+            sorted.norms.push_back(index.norms[order[i]]);
+            memcpy(sorted.vectors.data() + i * index.dim, index.row(order[i]), index.dim * sizeof(float));
+        }
+        index = std::move(sorted);
+    }
+
+    index.codes.assign(index.size() * index.code_words(), 0);
+    for (size_t i = 0; i < index.size(); ++i) {
+        pack_signs(index.row(i), index.dim, index.codes.data() + i * index.code_words());
+    }
+
+    // Centroid: mean direction of the document's rows, normalized so ranking
+    // documents costs one dot product each
+    for (size_t begin = 0; begin < index.size();) {
+        size_t end = begin + 1;
+        while (end < index.size() && index.doc_ids[end] == index.doc_ids[begin]) {
+            end++;
+        }
+        index.documents.push_back({ index.doc_ids[begin], begin, end });
+
+        size_t offset = index.centroids.size();
+        index.centroids.resize(offset + index.dim, 0.0f);
+        float* centroid = index.centroids.data() + offset;
+        for (size_t i = begin; i < end; ++i) {
+            const float* row = index.row(i);
+            float scale = 1.0f / (index.norms[i] + 1e-8f);
+            for (int d = 0; d < index.dim; ++d) {
+                centroid[d] += row[d] * scale;
+            }
+        }
+        float norm = 0.0f;
+        for (int d = 0; d < index.dim; ++d) {
+            norm += centroid[d] * centroid[d];
+        }
+        norm = std::sqrt(norm) + 1e-8f;
+        for (int d = 0; d < index.dim; ++d) {
+            centroid[d] /= norm;
+        }
+        begin = end;
+    }
+}
+
+bool load_vector_index(sqlite3* db, VectorIndex& index, std::shared_ptr<const VectorProjection> projection) {
+    index = VectorIndex();
+    index.projection = projection;
+
+    const char* select_sql = projection
+        ? "SELECT id, doc_id, embedding FROM reduced_embeddings;"
+        : "SELECT id, doc_id, embedding FROM embeddings;";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, select_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+
+    size_t skipped = 0;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const void* blob_data = sqlite3_column_blob(stmt, 2);
+        int num_floats = sqlite3_column_bytes(stmt, 2) / static_cast<int>(sizeof(float));
+        if (num_floats == 0) continue;
+
+        if (index.dim == 0) {
+            index.dim = num_floats;
+        }
+        else if (num_floats != index.dim) {
+            skipped++;
+            continue;
+        }
+
+        size_t offset = index.vectors.size();
+        index.vectors.resize(offset + index.dim);
+        memcpy(index.vectors.data() + offset, blob_data, index.dim * sizeof(float));
+
+        float norm = 0.0f;
+        for (int i = 0; i < index.dim; ++i) {
+            norm += index.vectors[offset + i] * index.vectors[offset + i];
+        }
+
+        index.ids.push_back(sqlite3_column_int(stmt, 0));
+        index.doc_ids.push_back(sqlite3_column_int(stmt, 1));
+        index.norms.push_back(std::sqrt(norm));
+    }
+
+    sqlite3_finalize(stmt);
+
+    if (skipped > 0) {
+        std::cerr << "Skipped " << skipped << " embeddings with a dimension other than " << index.dim << "." << std::endl;
+    }
+    index_documents(index);
+    return true;
+}
+
+std::vector<SimilarityResult> search_vector_index(const VectorIndex& index, const std::vector<float>& query, size_t top_k) {
+    StageTimer timer(Stage::VectorSearch);
+    std::vector<SimilarityResult> results;
+    if (index.size() == 0 || static_cast<int>(query.size()) != index.dim) {
+        return results;
+    }
+
+    float query_norm = 0.0f;
+    for (float value : query) {
+        query_norm += value * value;
+    }
+    query_norm = std::sqrt(query_norm);
+
+    results.reserve(index.size());
+    for (size_t i = 0; i < index.size(); ++i) {
+        const float* row = index.row(i);
+        float dot_product = 0.0f;
+        for (int d = 0; d < index.dim; ++d) {
+            dot_product += row[d] * query[d];
+        }
+        float sim = dot_product / (index.norms[i] * query_norm + 1e-8f);
+        results.push_back({ index.ids[i], index.doc_ids[i], sim });
+    }
+
+    auto by_similarity = [](const SimilarityResult& a, const SimilarityResult& b) {
+        return a.similarity > b.similarity;
+    };
+    if (top_k < results.size()) {
+        std::partial_sort(results.begin(), results.begin() + top_k, results.end(), by_similarity);
+        results.resize(top_k);
+    }
+    else {
+        std::sort(results.begin(), results.end(), by_similarity);
+    }
+    return results;
+}
+
+std::vector<std::vector<SimilarityResult>> search_vector_index_batch(const VectorIndex& index,
+    const std::vector<std::vector<float>>& queries, size_t top_k) {
+    StageTimer timer(Stage::VectorSearch);
+    const size_t block_rows = 64;
+
+    std::vector<std::vector<SimilarityResult>> results(queries.size());
+    if (index.size() == 0 || top_k == 0) {
+        return results;
+    }
+
+    // Min-heaps keep the current top_k per query, weakest on top
+    auto weaker = [](const SimilarityResult& a, const SimilarityResult& b) {
+        return a.similarity > b.similarity;
+    };
+    using TopK = std::priority_queue<SimilarityResult, std::vector<SimilarityResult>, decltype(weaker)>;
+    std::vector<TopK> heaps(queries.size(), TopK(weaker));
+
+    std::vector<float> query_norms(queries.size(), 0.0f);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        if (static_cast<int>(queries[q].size()) != index.dim) continue;
+        for (float value : queries[q]) {
+            query_norms[q] += value * value;
+        }
+        query_norms[q] = std::sqrt(query_norms[q]);
+    }
+
+    for (size_t block_start = 0; block_start < index.size(); block_start += block_rows) {
+        size_t block_end = std::min(block_start + block_rows, index.size());
+        for (size_t q = 0; q < queries.size(); ++q) {
+            if (static_cast<int>(queries[q].size()) != index.dim) continue;
+            const float* query = queries[q].data();
+            for (size_t i = block_start; i < block_end; ++i) {
+                const float* row = index.row(i);
+                float dot_product = 0.0f;
+                for (int d = 0; d < index.dim; ++d) {
+                    dot_product += row[d] * query[d];
+                }
+                float sim = dot_product / (index.norms[i] * query_norms[q] + 1e-8f);
+                if (heaps[q].size() < top_k) {
+                    heaps[q].push({ index.ids[i], index.doc_ids[i], sim });
+                }
+                else if (sim > heaps[q].top().similarity) {
+                    heaps[q].pop();
+                    heaps[q].push({ index.ids[i], index.doc_ids[i], sim });
+                }
+            }
+        }
+    }
+
+    for (size_t q = 0; q < queries.size(); ++q) {
+        results[q].resize(heaps[q].size());
+        for (size_t i = results[q].size(); i-- > 0;) {
+            results[q][i] = heaps[q].top();
+            heaps[q].pop();
+        }
+    }
+    return results;
+}
+
+// A document of one segment and its centroid similarity to a query
+struct DocumentHit {
+    size_t segment;
+    size_t document;
+    float similarity;
+};
+
+// Coarse-to-fine search: per query, rank the documents of every segment by
+// centroid, keep the best n overall, then score only their rows
+static std::vector<std::vector<SimilarityResult>> search_documents_then_rows(const std::vector<VectorIndex>& segments,
+    const std::vector<std::vector<float>>& queries, size_t top_k, size_t n) {
+    StageTimer timer(Stage::VectorSearch);
+    auto by_similarity = [](const auto& a, const auto& b) {
+        return a.similarity > b.similarity;
+    };
+
+    std::vector<std::vector<SimilarityResult>> results(queries.size());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        const std::vector<float>& query = queries[q];
+        float query_norm = 0.0f;
+        for (float value : query) {
+            query_norm += value * value;
+        }
+        query_norm = std::sqrt(query_norm);
+
+        std::vector<std::vector<DocumentHit>> segment_hits(segments.size());
+        run_on_shards(segments.size(), [&](size_t s) {
+            const VectorIndex& index = segments[s];
+            if (static_cast<int>(query.size()) != index.dim) return;
+            std::vector<DocumentHit>& hits = segment_hits[s];
+            hits.reserve(index.documents.size());
+            for (size_t doc = 0; doc < index.documents.size(); ++doc) {
+                const float* centroid = index.centroid(doc);
+                float dot_product = 0.0f;
+                for (int d = 0; d < index.dim; ++d) {
+                    dot_product += centroid[d] * query[d];
+                }
+                hits.push_back({ s, doc, dot_product / (query_norm + 1e-8f) });
+            }
+            size_t keep = std::min(n, hits.size());
+            std::partial_sort(hits.begin(), hits.begin() + keep, hits.end(), by_similarity);
+            hits.resize(keep);
+        });
+
+        std::vector<DocumentHit> hits;
+        for (const auto& per_segment : segment_hits) {
+            hits.insert(hits.end(), per_segment.begin(), per_segment.end());
+        }
+        size_t keep = std::min(n, hits.size());
+        std::partial_sort(hits.begin(), hits.begin() + keep, hits.end(), by_similarity);
+        hits.resize(keep);
+
+        std::vector<std::vector<size_t>> chosen(segments.size());
+        for (const auto& hit : hits) {
+            chosen[hit.segment].push_back(hit.document);
+        }
+        std::vector<std::vector<SimilarityResult>> segment_rows(segments.size());
+        run_on_shards(segments.size(), [&](size_t s) {
+            const VectorIndex& index = segments[s];
+            std::vector<SimilarityResult>& rows = segment_rows[s];
+            for (size_t doc : chosen[s]) {
+                const DocumentRange& range = index.documents[doc];
+                for (size_t i = range.begin; i < range.end; ++i) {
+                    const float* row = index.row(i);
+                    float dot_product = 0.0f;
+                    for (int d = 0; d < index.dim; ++d) {
+                        dot_product += row[d] * query[d];
+                    }
+                    rows.push_back({ index.ids[i], index.doc_ids[i], dot_product / (index.norms[i] * query_norm + 1e-8f) });
+                }
+            }
+            size_t keep_rows = std::min(top_k, rows.size());
+            std::partial_sort(rows.begin(), rows.begin() + keep_rows, rows.end(), by_similarity);
+            rows.resize(keep_rows);
+        });
+
+        for (auto& per_segment : segment_rows) {
+            results[q].insert(results[q].end(), per_segment.begin(), per_segment.end());
+        }
+        size_t keep_rows = std::min(top_k, results[q].size());
+        std::partial_sort(results[q].begin(), results[q].begin() + keep_rows, results[q].end(), by_similarity);
+        results[q].resize(keep_rows);
+    }
+    return results;
+}
+
+// Hamming distance from a query's code to the code of every row. With AVX-512 VPOPCNTDQ enabled at compile time eight words are counted
+// per instruction, so a 1536-dimension code takes three.
+static void hamming_distances(const VectorIndex& index, const uint64_t* query, uint32_t* distances) {
+    const size_t words = index.code_words();
+#ifdef VECTOR_INDEX_USE_VPOPCNTDQ
+    const __mmask8 tail = static_cast<__mmask8>((1u << (words % 8)) - 1);
+    for (size_t i = 0; i < index.size(); ++i) {
+        const uint64_t* code = index.code(i);
+        __m512i counts = _mm512_setzero_si512();
+        size_t w = 0;
+        for (; w + 8 <= words; w += 8) {
+            __m512i bits = _mm512_xor_si512(_mm512_loadu_si512(code + w), _mm512_loadu_si512(query + w));
+            counts = _mm512_add_epi64(counts, _mm512_popcnt_epi64(bits));
+        }
+        if (w < words) {
+            __m512i bits = _mm512_xor_si512(_mm512_maskz_loadu_epi64(tail, code + w), _mm512_maskz_loadu_epi64(tail, query + w));
+            counts = _mm512_add_epi64(counts, _mm512_popcnt_epi64(bits));
+        }
+        distances[i] = static_cast<uint32_t>(_mm512_reduce_add_epi64(counts));
+    }
+#else
+    for (size_t i = 0; i < index.size(); ++i) {
+        const uint64_t* code = index.code(i);
+        uint32_t distance = 0;
+        for (size_t w = 0; w < words; ++w) {
+            distance += std::popcount(code[w] ^ query[w]);
+        }
+        distances[i] = distance;
+    }
+#endif
+}
+
+// Found by counting how many rows are at each distance rather than sorting
+std::vector<size_t> closest_rows(const std::vector<uint32_t>& distances, int dim, size_t n) {
+    std::vector<size_t> rows;
+    if (n >= distances.size()) {
+        rows.resize(distances.size());
+        std::iota(rows.begin(), rows.end(), 0);
+        return rows;
+    }
+
+    std::vector<size_t> histogram(static_cast<size_t>(dim) + 1, 0);
+    for (uint32_t distance : distances) {
+        histogram[distance]++;
+    }
+    uint32_t cutoff = 0;
+    size_t below = 0;
+    while (below + histogram[cutoff] < n) {
+        below += histogram[cutoff++];
+    }
+
+    size_t at_cutoff = n - below;
+    rows.reserve(n);
+    for (size_t i = 0; i < distances.size(); ++i) {
+        if (distances[i] < cutoff) {
+            rows.push_back(i);
+        }
+        else if (distances[i] == cutoff && at_cutoff > 0) {
+            rows.push_back(i);
+            at_cutoff--;
+        }
+    }
+    return rows;
+}
+
+// Binary prefilter cascade: per query, rank every row of every segment by the
+// Hamming distance of its code, then score only the closest n exactly
+// against the float rows. Each segment gets a share of n in proportion to its size.
+static std::vector<std::vector<SimilarityResult>> search_codes_then_rows(const std::vector<VectorIndex>& segments,
+    const std::vector<std::vector<float>>& queries, size_t top_k, size_t n) {
+    StageTimer timer(Stage::VectorSearch);
+    auto by_similarity = [](const SimilarityResult& a, const SimilarityResult& b) {
+        return a.similarity > b.similarity;
+    };
+
+    size_t total_rows = 0;
+    for (const auto& segment : segments) {
+        total_rows += segment.size();
+    }
+
+    std::vector<std::vector<SimilarityResult>> results(queries.size());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        const std::vector<float>& query = queries[q];
+        float query_norm = 0.0f;
+        for (float value : query) {
+            query_norm += value * value;
+        }
+        query_norm = std::sqrt(query_norm);
+        std::vector<uint64_t> query_code = binary_code(query);
+
+        std::vector<std::vector<SimilarityResult>> segment_rows(segments.size());
+        run_on_shards(segments.size(), [&](size_t s) {
+            const VectorIndex& index = segments[s];
+            if (static_cast<int>(query.size()) != index.dim || index.size() == 0) return;
+
+            std::vector<uint32_t> distances(index.size());
+            hamming_distances(index, query_code.data(), distances.data());
+            size_t share = (n * index.size() + total_rows - 1) / total_rows;
+            std::vector<size_t> candidates = closest_rows(distances, index.dim, std::max(share, top_k));
+
+            std::vector<SimilarityResult>& rows = segment_rows[s];
+            rows.reserve(candidates.size());
+            for (size_t i : candidates) {
+                const float* row = index.row(i);
+                float dot_product = 0.0f;
+                for (int d = 0; d < index.dim; ++d) {
+                    dot_product += row[d] * query[d];
+                }
+                rows.push_back({ index.ids[i], index.doc_ids[i], dot_product / (index.norms[i] * query_norm + 1e-8f) });
+            }
+            size_t keep_rows = std::min(top_k, rows.size());
+            std::partial_sort(rows.begin(), rows.begin() + keep_rows, rows.end(), by_similarity);
+            rows.resize(keep_rows);
+        });
+
+        for (auto& per_segment : segment_rows) {
+            results[q].insert(results[q].end(), per_segment.begin(), per_segment.end());
+        }
+        size_t keep_rows = std::min(top_k, results[q].size());
+        std::partial_sort(results[q].begin(), results[q].begin() + keep_rows, results[q].end(), by_similarity);
+        results[q].resize(keep_rows);
+    }
+    return results;
+}
+
+std::vector<std::vector<SimilarityResult>> search_vector_segments_batch(const std::vector<VectorIndex>& segments,
+    const std::vector<std::vector<float>>& queries, size_t top_k) {
+    return search_vector_segments_batch(segments, queries, top_k, binary_candidates());
+}
+
+std::vector<std::vector<SimilarityResult>> search_vector_segments_batch(const std::vector<VectorIndex>& segments,
+    const std::vector<std::vector<float>>& queries, size_t top_k, size_t candidates) {
+    if (candidates > 0) {
+        size_t rows = 0;
+        for (const auto& segment : segments) {
+            rows += segment.size();
+        }
+        if (rows > candidates) {
+            return search_codes_then_rows(segments, queries, top_k, candidates);
+        }
+    }
+
+    size_t n = coarse_documents();
+    if (n > 0) {
+        size_t documents = 0;
+        for (const auto& segment : segments) {
+            documents += segment.documents.size();
+        }
+        if (documents > n) {
+            return search_documents_then_rows(segments, queries, top_k, n);
+        }
+    }
+
+    if (segments.size() == 1) {
+        return search_vector_index_batch(segments[0], queries, top_k);
+    }
+
+    std::vector<std::vector<std::vector<SimilarityResult>>> segment_results(segments.size());
+    run_on_shards(segments.size(), [&](size_t s) {
+        segment_results[s] = search_vector_index_batch(segments[s], queries, top_k);
+    });
+
+    auto by_similarity = [](const SimilarityResult& a, const SimilarityResult& b) {
+        return a.similarity > b.similarity;
+    };
+    std::vector<std::vector<SimilarityResult>> results(queries.size());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        for (auto& per_segment : segment_results) {
+            if (q < per_segment.size()) {
+                results[q].insert(results[q].end(), per_segment[q].begin(), per_segment[q].end());
+            }
+        }
+        size_t keep = std::min(top_k, results[q].size());
+        std::partial_sort(results[q].begin(), results[q].begin() + keep, results[q].end(), by_similarity);
+        results[q].resize(keep);
+    }
+    return results;
+}
+
+std::vector<SimilarityResult> search_vector_segments(const std::vector<VectorIndex>& segments,
+    const std::vector<float>& query, size_t top_k) {
+    if (segments.size() == 1 && coarse_documents() == 0 && binary_candidates() == 0) {
+        return search_vector_index(segments[0], query, top_k);
+    }
+    return search_vector_segments_batch(segments, { query }, top_k)[0];
+}
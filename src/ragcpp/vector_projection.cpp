@@ -0,0 +1,507 @@
+// vector_projection.cpp
+
+#include "vector_projection.h"
+#include "database.h"
+#include "shards.h"
+#include "thread_pool.h"
+#include "utils.h"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+
+namespace {
+
+// Stored embeddings sampled for training, and subspace iterations run on them
+const size_t pca_sample_size = 4096;
+const int pca_iterations = 6;
+
+// active_projection's copies by primary connection. Recursive, because a
+// failed registration below drops the entry while the lock is held.
+std::recursive_mutex g_projection_cache_mutex;
+
+using CachedProjection = std::shared_ptr<const VectorProjection>;
+std::unordered_map<sqlite3*, CachedProjection> g_projection_cache;
+
+// Destructor of the function registered below, run when its connection
+// closes: a connection opened later at the same address starts afresh
+void forget_cached_projection(void* primary) {
+    std::lock_guard<std::recursive_mutex> lock(g_projection_cache_mutex);
+    g_projection_cache.erase(static_cast<sqlite3*>(primary));
+}
+
+void close_marker(sqlite3_context* context, int, sqlite3_value**) {
+    sqlite3_result_null(context);
+}
+
+// Call with g_projection_cache_mutex held
+void cache_projection(sqlite3* primary, CachedProjection projection) {
+    bool added = g_projection_cache.insert_or_assign(primary, std::move(projection)).second;
+    if (added) {
+        sqlite3_create_function_v2(primary, "ragcpp_projection_cache", 0, SQLITE_UTF8, primary, close_marker, nullptr, nullptr,
+            forget_cached_projection);
+    }
+}
+
+void normalize(std::vector<float>& vector) {
+    float norm = 0.0f;
+    for (float value : vector) {
+        norm += value * value;
+    }
+    norm = std::sqrt(norm);
+    if (norm > 0.0f) {
+        for (float& value : vector) {
+            value /= norm;
+        }
+    }
+}
+
+float dot(const float* a, const float* b, int dim) {
+    float sum = 0.0f;
+    for (int i = 0; i < dim; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Up to sample_size embeddings of the most common dimension's first row,
+// drawn evenly from every shard, as one row-major matrix
+size_t sample_embeddings(sqlite3* primary, size_t sample_size, int& dim, std::vector<float>& rows) {
+    std::vector<sqlite3*> shards = shard_connections(primary);
+    size_t per_shard = (sample_size + shards.size() - 1) / shards.size();
+    const char* select_sql = "SELECT embedding FROM embeddings WHERE id IN "
+        "(SELECT id FROM embeddings ORDER BY RANDOM() LIMIT ?);";
+
+    size_t count = 0;
+    for (sqlite3* shard : shards) {
+        sqlite3_stmt* stmt;
+        if (sqlite3_prepare_v2(shard, select_sql, -1, &stmt, nullptr) != SQLITE_OK) {
+            std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(shard) << std::endl;
+            continue;
+        }
+        sqlite3_bind_int64(stmt, 1, static_cast<sqlite3_int64>(per_shard));
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            int num_floats = sqlite3_column_bytes(stmt, 0) / static_cast<int>(sizeof(float));
+            if (num_floats == 0) continue;
+            if (dim == 0) dim = num_floats;
+            if (num_floats != dim) continue;
+
+            rows.resize(rows.size() + dim);
+            memcpy(rows.data() + count * dim, sqlite3_column_blob(stmt, 0), dim * sizeof(float));
+            count++;
+        }
+        sqlite3_finalize(stmt);
+    }
+    return count;
+}
+
+// Modified Gram-Schmidt over the rows; a row that collapses is re-drawn at random
+void orthonormalize(std::vector<float>& basis, int rows, int dim, std::mt19937& rng) {
+    std::normal_distribution<float> gaussian(0.0f, 1.0f);
+    for (int j = 0; j < rows; ++j) {
+        float* row = basis.data() + static_cast<size_t>(j) * dim;
+        for (int attempt = 0; attempt < 3; ++attempt) {
+            for (int p = 0; p < j; ++p) {
+                const float* prev = basis.data() + static_cast<size_t>(p) * dim;
+                float projection = dot(row, prev, dim);
+                for (int i = 0; i < dim; ++i) {
+                    row[i] -= projection * prev[i];
+                }
+            }
+            float norm = std::sqrt(dot(row, row, dim));
+            if (norm > 1e-6f) {
+                for (int i = 0; i < dim; ++i) {
+                    row[i] /= norm;
+                }
+                break;
+            }
+            for (int i = 0; i < dim; ++i) {
+                row[i] = gaussian(rng);
+            }
+        }
+    }
+}
+
+// Top output_dim principal directions of the centered sample by randomized
+// subspace iteration: C <- orth(X^T X C^T). Only the spanned subspace matters,
+// since reduced vectors are compared by inner product.
+bool train_pca(std::vector<float>& rows, size_t count, int dim, int output_dim, VectorProjection& projection, double& explained) {
+    projection.mean.assign(dim, 0.0f);
+    for (size_t r = 0; r < count; ++r) {
+        const float* row = rows.data() + r * dim;
+        for (int i = 0; i < dim; ++i) {
+            projection.mean[i] += row[i];
+        }
+    }
+    for (float& value : projection.mean) {
+        value /= static_cast<float>(count);
+    }
+    for (size_t r = 0; r < count; ++r) {
+        float* row = rows.data() + r * dim;
+        for (int i = 0; i < dim; ++i) {
+            row[i] -= projection.mean[i];
+        }
+    }
+
+    std::mt19937 rng(42);
+    std::normal_distribution<float> gaussian(0.0f, 1.0f);
+    std::vector<float>& basis = projection.components;
+    basis.resize(static_cast<size_t>(output_dim) * dim);
+    for (float& value : basis) {
+        value = gaussian(rng);
+    }
+    orthonormalize(basis, output_dim, dim, rng);
+
+    ThreadPool pool(0);
+    const size_t blocks = pool.size();
+    std::vector<float> scores(count * output_dim);     // X C^T
+    auto compute_scores = [&]() {
+        for (size_t b = 0; b < blocks; ++b) {
+            pool.submit([&, b]() {
+                for (size_t r = b; r < count; r += blocks) {
+                    const float* row = rows.data() + r * dim;
+                    for (int j = 0; j < output_dim; ++j) {
+                        scores[r * output_dim + j] = dot(row, basis.data() + static_cast<size_t>(j) * dim, dim);
+                    }
+                }
+            });
+        }
+        pool.wait_idle();
+    };
+
+    for (int iteration = 0; iteration < pca_iterations; ++iteration) {
+        compute_scores();
+
+        // C = (X^T S)^T, one component per task so no two tasks write the same row
+        std::fill(basis.begin(), basis.end(), 0.0f);
+        for (size_t b = 0; b < blocks; ++b) {
+            pool.submit([&, b]() {
+                for (size_t j = b; j < static_cast<size_t>(output_dim); j += blocks) {
+                    float* component = basis.data() + j * dim;
+                    for (size_t r = 0; r < count; ++r) {
+                        float weight = scores[r * output_dim + j];
+                        const float* row = rows.data() + r * dim;
+                        for (int i = 0; i < dim; ++i) {
+                            component[i] += weight * row[i];
+                        }
+                    }
+                }
+            });
+        }
+        pool.wait_idle();
+        orthonormalize(basis, output_dim, dim, rng);
+    }
+
+    // Share of the sample's variance the subspace keeps
+    compute_scores();
+    double total = 0.0;
+    double kept = 0.0;
+    for (size_t r = 0; r < count; ++r) {
+        total += dot(rows.data() + r * dim, rows.data() + r * dim, dim);
+    }
+    for (float score : scores) {
+        kept += static_cast<double>(score) * score;
+    }
+    explained = total > 0.0 ? kept / total : 0.0;
+    return true;
+}
+
+bool save_projection(sqlite3* primary, const VectorProjection* projection) {
+    const char* upsert_sql = "INSERT OR REPLACE INTO projection (id, method, input_dim, output_dim, mean, components, version) "
+        "VALUES (1, ?, ?, ?, ?, ?, IFNULL((SELECT version FROM projection WHERE id = 1), 0) + 1);";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(primary, upsert_sql, -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(primary) << std::endl;
+        return false;
+    }
+
+    if (projection) {
+        sqlite3_bind_text(stmt, 1, projection->method.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 2, projection->input_dim);
+        sqlite3_bind_int(stmt, 3, projection->output_dim);
+        sqlite3_bind_blob(stmt, 4, projection->mean.data(), static_cast<int>(projection->mean.size() * sizeof(float)), SQLITE_TRANSIENT);
+        sqlite3_bind_blob(stmt, 5, projection->components.data(), static_cast<int>(projection->components.size() * sizeof(float)), SQLITE_TRANSIENT);
+    }
+    else {
+        sqlite3_bind_text(stmt, 1, "none", -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 2, 0);
+        sqlite3_bind_int(stmt, 3, 0);
+        sqlite3_bind_null(stmt, 4);
+        sqlite3_bind_null(stmt, 5);
+    }
+
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc != SQLITE_DONE) {
+        std::cerr << "Failed to record projection: " << sqlite3_errmsg(primary) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Replace a shard's reduced vectors; returns the number of rows written
+size_t rebuild_reduced_embeddings(sqlite3* shard, const VectorProjection* projection, size_t& skipped) {
+    sqlite3_exec(shard, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    sqlite3_exec(shard, "DELETE FROM reduced_embeddings;", nullptr, nullptr, nullptr);
+
+    size_t written = 0;
+    if (projection) {
+        sqlite3_stmt* select_stmt;
+        sqlite3_stmt* insert_stmt;
+        const char* select_sql = "SELECT id, doc_id, embedding FROM embeddings;";
+        const char* insert_sql = "INSERT INTO reduced_embeddings (id, doc_id, embedding) VALUES (?, ?, ?);";
+        if (sqlite3_prepare_v2(shard, select_sql, -1, &select_stmt, nullptr) != SQLITE_OK) {
+            std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(shard) << std::endl;
+            sqlite3_exec(shard, "ROLLBACK;", nullptr, nullptr, nullptr);
+            return 0;
+        }
+        if (sqlite3_prepare_v2(shard, insert_sql, -1, &insert_stmt, nullptr) != SQLITE_OK) {
+            std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(shard) << std::endl;
+            sqlite3_finalize(select_stmt);
+            sqlite3_exec(shard, "ROLLBACK;", nullptr, nullptr, nullptr);
+            return 0;
+        }
+
+        std::vector<float> embedding;
+        while (sqlite3_step(select_stmt) == SQLITE_ROW) {
+            int num_floats = sqlite3_column_bytes(select_stmt, 2) / static_cast<int>(sizeof(float));
+            embedding.resize(num_floats);
+            memcpy(embedding.data(), sqlite3_column_blob(select_stmt, 2), num_floats * sizeof(float));
+
+            std::vector<float> reduced = project_vector(*projection, embedding);
+            if (reduced.empty()) {
+                skipped++;
+                continue;
+            }
+            sqlite3_bind_int(insert_stmt, 1, sqlite3_column_int(select_stmt, 0));
+            sqlite3_bind_int(insert_stmt, 2, sqlite3_column_int(select_stmt, 1));
+            sqlite3_bind_blob(insert_stmt, 3, reduced.data(), static_cast<int>(reduced.size() * sizeof(float)), SQLITE_TRANSIENT);
+            if (sqlite3_step(insert_stmt) == SQLITE_DONE) {
+                written++;
+            }
+            sqlite3_reset(insert_stmt);
+        }
+        sqlite3_finalize(insert_stmt);
+        sqlite3_finalize(select_stmt);
+    }
+
+    sqlite3_exec(shard, "COMMIT;", nullptr, nullptr, nullptr);
+    return written;
+}
+
+} // namespace
+
+std::shared_ptr<const VectorProjection> load_projection(sqlite3* primary) {
+    const char* select_sql = "SELECT method, input_dim, output_dim, mean, components, version FROM projection WHERE id = 1;";
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(primary, select_sql, -1, &stmt, nullptr) != SQLITE_OK) {
+        std::cerr << "Cannot prepare SQL statement: " << sqlite3_errmsg(primary) << std::endl;
+        return nullptr;
+    }
+
+    std::shared_ptr<VectorProjection> projection;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* method = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        std::string method_name = method ? method : "";
+        if (method_name == "pca" || method_name == "truncate") {
+            projection = std::make_shared<VectorProjection>();
+            projection->method = method_name;
+            projection->input_dim = sqlite3_column_int(stmt, 1);
+            projection->output_dim = sqlite3_column_int(stmt, 2);
+            projection->mean.resize(sqlite3_column_bytes(stmt, 3) / sizeof(float));
+            if (!projection->mean.empty()) {
+                memcpy(projection->mean.data(), sqlite3_column_blob(stmt, 3), projection->mean.size() * sizeof(float));
+            }
+            projection->components.resize(sqlite3_column_bytes(stmt, 4) / sizeof(float));
+            if (!projection->components.empty()) {
+                memcpy(projection->components.data(), sqlite3_column_blob(stmt, 4), projection->components.size() * sizeof(float));
+            }
+            projection->version = sqlite3_column_int(stmt, 5);
+        }
+    }
+    sqlite3_finalize(stmt);
+    return projection;
+}
+
+std::shared_ptr<const VectorProjection> active_projection(sqlite3* primary) {
+    std::lock_guard<std::recursive_mutex> lock(g_projection_cache_mutex);
+    auto it = g_projection_cache.find(primary);
+    if (it != g_projection_cache.end()) {
+        return it->second;
+    }
+    CachedProjection projection = load_projection(primary);
+    cache_projection(primary, projection);
+    return projection;
+}
+
+std::vector<float> project_vector(const VectorProjection& projection, const std::vector<float>& vector) {
+    if (static_cast<int>(vector.size()) != projection.input_dim) {
+        return {};
+    }
+
+    std::vector<float> reduced;
+    if (projection.method == "truncate") {
+        reduced.assign(vector.begin(), vector.begin() + projection.output_dim);
+    }
+    else {
+        std::vector<float> centered(vector.size());
+        for (size_t i = 0; i < vector.size(); ++i) {
+            centered[i] = vector[i] - projection.mean[i];
+        }
+        reduced.resize(projection.output_dim);
+        for (int j = 0; j < projection.output_dim; ++j) {
+            reduced[j] = dot(projection.components.data() + static_cast<size_t>(j) * projection.input_dim, centered.data(), projection.input_dim);
+        }
+    }
+    normalize(reduced);
+    return reduced;
+}
+
+std::shared_ptr<const VectorProjection> train_projection(sqlite3* primary, int output_dim, const std::string& method) {
+    if (method != "pca" && method != "truncate") {
+        std::cerr << "Unknown reduction method: " << method << " (expected pca or truncate)." << std::endl;
+        return nullptr;
+    }
+
+    int dim = 0;
+    std::vector<float> rows;
+    size_t count = sample_embeddings(primary, method == "pca" ? pca_sample_size : 1, dim, rows);
+    if (count == 0) {
+        std::cerr << "No embeddings to train a projection on." << std::endl;
+        return nullptr;
+    }
+    if (output_dim <= 0 || output_dim >= dim) {
+        std::cerr << "Reduced dimension must be below the embedding dimension " << dim << "." << std::endl;
+        return nullptr;
+    }
+
+    auto projection = std::make_shared<VectorProjection>();
+    projection->method = method;
+    projection->input_dim = dim;
+    projection->output_dim = output_dim;
+
+    if (method == "pca") {
+        if (count < static_cast<size_t>(output_dim)) {
+            std::cerr << "PCA to " << output_dim << " dimensions needs at least " << output_dim
+                << " embeddings; found " << count << "." << std::endl;
+            return nullptr;
+        }
+        double explained = 0.0;
+        train_pca(rows, count, dim, output_dim, *projection, explained);
+        std::cout << "Trained PCA " << dim << " -> " << output_dim << " on " << count << " embeddings, keeping "
+            << explained * 100.0 << "% of the variance." << std::endl;
+    }
+    return projection;
+}
+
+bool reduce_embeddings(sqlite3* primary, int output_dim, const std::string& method) {
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<const VectorProjection> projection;
+
+    if (output_dim > 0) {
+        projection = train_projection(primary, output_dim, method);
+        if (!projection) {
+            return false;
+        }
+    }
+
+    // Rows first, then the projection: a reader never sees a projection
+    // without the vectors it describes
+    std::vector<sqlite3*> shards = shard_connections(primary);
+    std::vector<size_t> written(shards.size(), 0);
+    std::vector<size_t> skipped(shards.size(), 0);
+    run_on_shards(shards.size(), [&](size_t k) {
+        written[k] = rebuild_reduced_embeddings(shards[k], projection.get(), skipped[k]);
+    });
+
+    if (!save_projection(primary, projection.get())) {
+        return false;
+    }
+    {
+        std::lock_guard<std::recursive_mutex> lock(g_projection_cache_mutex);
+        cache_projection(primary, load_projection(primary));
+    }
+
+    size_t total_written = 0;
+    size_t total_skipped = 0;
+    for (size_t k = 0; k < shards.size(); ++k) {
+        total_written += written[k];
+        total_skipped += skipped[k];
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (projection) {
+        std::cout << "Reduced " << total_written << " embeddings to " << output_dim << " dimensions in " << seconds << " s." << std::endl;
+        if (total_skipped > 0) {
+            std::cerr << "Skipped " << total_skipped << " embeddings with a dimension other than " << projection->input_dim << "." << std::endl;
+        }
+    }
+    else {
+        std::cout << "Dimension reduction turned off; searches use full embeddings." << std::endl;
+    }
+    return true;
+}
+
+std::vector<SimilarityResult> rerank_full_dimension(sqlite3* primary, const std::vector<float>& query,
+    const std::vector<SimilarityResult>& candidates, size_t top_k) {
+    std::vector<int> ids;
+    ids.reserve(candidates.size());
+    for (const auto& candidate : candidates) {
+        ids.push_back(candidate.id);
+    }
+    std::unordered_map<int, std::vector<float>> embeddings = get_embeddings_by_ids(primary, ids);
+
+    std::vector<SimilarityResult> results;
+    results.reserve(candidates.size());
+    for (const auto& candidate : candidates) {
+        auto it = embeddings.find(candidate.id);
+        if (it == embeddings.end() || it->second.size() != query.size()) continue;
+        results.push_back({ candidate.id, candidate.doc_id, cosine_similarity(query, it->second) });
+    }
+
+    auto by_similarity = [](const SimilarityResult& a, const SimilarityResult& b) {
+        return a.similarity > b.similarity;
+    };
+    size_t keep = std::min(top_k, results.size());
+    std::partial_sort(results.begin(), results.begin() + keep, results.end(), by_similarity);
+    results.resize(keep);
+    return results;
+}
+
+std::vector<std::vector<SimilarityResult>> search_segments_reranked(sqlite3* primary, const std::vector<VectorIndex>& segments,
+    const std::vector<std::vector<float>>& queries, size_t top_k) {
+    return search_segments_reranked(primary, segments, queries, top_k, binary_candidates());
+}
+
+std::vector<std::vector<SimilarityResult>> search_segments_reranked(sqlite3* primary, const std::vector<VectorIndex>& segments,
+    const std::vector<std::vector<float>>& queries, size_t top_k, size_t binary_candidates) {
+    std::shared_ptr<const VectorProjection> projection;
+    for (const auto& segment : segments) {
+        if (segment.projection) {
+            projection = segment.projection;
+            break;
+        }
+    }
+    if (!projection) {
+        return search_vector_segments_batch(segments, queries, top_k, binary_candidates);
+    }
+
+    std::vector<std::vector<float>> reduced_queries(queries.size());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        reduced_queries[q] = project_vector(*projection, queries[q]);
+    }
+    std::vector<std::vector<SimilarityResult>> candidates =
+        search_vector_segments_batch(segments, reduced_queries, std::max(top_k, rerank_candidates), binary_candidates);
+
+    std::vector<std::vector<SimilarityResult>> results(queries.size());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        if (!candidates[q].empty()) {
+            results[q] = rerank_full_dimension(primary, queries[q], candidates[q], top_k);
+        }
+    }
+    return results;
+}
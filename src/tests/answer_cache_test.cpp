@@ -0,0 +1,72 @@
+// answer_cache_test.cpp
+
+#include "answer_cache.h"
+#include "database.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+int count_rows(sqlite3* db, const char* table) {
+    std::string sql = std::string("SELECT COUNT(*) FROM ") + table + ";";
+    sqlite3_stmt* stmt;
+    int count = -1;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+        count = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return count;
+}
+
+class AnswerCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        initialize_database(db_, ":memory:");
+        ASSERT_NE(db_, nullptr);
+    }
+
+    void TearDown() override {
+        configure_answer_cache(true, 0.95f, 10000);
+        sqlite3_close(db_);
+    }
+
+    // Two chunks per answer, distinct for each n
+    static std::vector<SimilarityResult> hits(int n) {
+        return { { 2 * n + 1, 1, 0.9f }, { 2 * n + 2, 1, 0.8f } };
+    }
+
+    sqlite3* db_ = nullptr;
+    const std::vector<float> embedding_ = { 1.0f, 0.0f, 0.0f };
+};
+
+} // namespace
+
+TEST_F(AnswerCacheTest, StoredAnswerIsFoundForTheSameChunks) {
+    configure_answer_cache(true, 0.95f, 10);
+    store_cached_answer(db_, L"question", embedding_, hits(0), L"answer", L"[1] doc");
+
+    std::wstring answer;
+    std::wstring citations;
+    ASSERT_TRUE(lookup_cached_answer(db_, embedding_, hits(0), answer, citations));
+    EXPECT_EQ(answer, L"answer");
+    EXPECT_EQ(citations, L"[1] doc");
+    EXPECT_FALSE(lookup_cached_answer(db_, embedding_, hits(1), answer, citations));
+    EXPECT_FALSE(lookup_cached_answer(db_, { 0.0f, 1.0f, 0.0f }, hits(0), answer, citations));
+}
+
+TEST_F(AnswerCacheTest, OldestAnswersArePrunedPastTheLimit) {
+    configure_answer_cache(true, 0.95f, 3);
+    for (int n = 0; n < 5; ++n) {
+        store_cached_answer(db_, L"question " + std::to_wstring(n), embedding_, hits(n), L"answer " + std::to_wstring(n), L"");
+    }
+    EXPECT_EQ(count_rows(db_, "answer_cache"), 3);
+    EXPECT_EQ(count_rows(db_, "answer_cache_chunks"), 6);
+
+    std::wstring answer;
+    std::wstring citations;
+    EXPECT_FALSE(lookup_cached_answer(db_, embedding_, hits(0), answer, citations));
+    EXPECT_FALSE(lookup_cached_answer(db_, embedding_, hits(1), answer, citations));
+    ASSERT_TRUE(lookup_cached_answer(db_, embedding_, hits(4), answer, citations));
+    EXPECT_EQ(answer, L"answer 4");
+}
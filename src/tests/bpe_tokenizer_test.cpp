@@ -0,0 +1,95 @@
+// bpe_tokenizer_test.cpp
+
+#include "bpe_tokenizer.h"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string base64(const std::string& bytes) {
+    const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string encoded;
+    for (size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t chunk = static_cast<uint8_t>(bytes[i]) << 16;
+        if (i + 1 < bytes.size()) chunk |= static_cast<uint8_t>(bytes[i + 1]) << 8;
+        if (i + 2 < bytes.size()) chunk |= static_cast<uint8_t>(bytes[i + 2]);
+        encoded += alphabet[(chunk >> 18) & 63];
+        encoded += alphabet[(chunk >> 12) & 63];
+        encoded += i + 1 < bytes.size() ? alphabet[(chunk >> 6) & 63] : '=';
+        encoded += i + 2 < bytes.size() ? alphabet[chunk & 63] : '=';
+    }
+    return encoded;
+}
+
+// A small vocabulary in the .tiktoken format: every byte as its own rank,
+// then a few merges. The expected ids below are what tiktoken produces for
+// it with the cl100k split pattern.
+class BpeTokenizerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        path_ = std::filesystem::temp_directory_path() / "ragcpp_test_vocab.tiktoken";
+        std::ofstream vocab(path_, std::ios::binary);
+        for (int byte = 0; byte < 256; ++byte) {
+            vocab << base64(std::string(1, static_cast<char>(byte))) << ' ' << byte << '\n';
+        }
+        const char* merges[] = { "he", "ll", "hell", "hello", " w", "or", " wor", "ld", " world",
+            "\xe4\xb8", "\xe4\xb8\xad", "'s", "12", "123" };
+        int rank = 256;
+        for (const char* merge : merges) {
+            vocab << base64(merge) << ' ' << rank++ << '\n';
+        }
+        vocab.close();
+        ASSERT_TRUE(tokenizer_.load(path_.string()));
+    }
+
+    void TearDown() override {
+        std::filesystem::remove(path_);
+    }
+
+    std::vector<int> encode(const std::string& text) {
+        std::vector<int> tokens;
+        tokenizer_.encode(text, tokens);
+        return tokens;
+    }
+
+    std::filesystem::path path_;
+    BpeTokenizer tokenizer_;
+};
+
+} // namespace
+
+TEST_F(BpeTokenizerTest, MergesByRank) {
+    EXPECT_EQ(encode("hello world"), std::vector<int>({ 259, 264 }));
+    EXPECT_EQ(encode("Hello, world!"), std::vector<int>({ 72, 101, 257, 111, 44, 264, 33 }));
+}
+
+TEST_F(BpeTokenizerTest, SplitsWhitespaceContractionsAndDigits) {
+    EXPECT_EQ(encode("hello  world\n\nit's 12345"), std::vector<int>({ 259, 32, 264, 10, 10, 105, 116, 267, 32, 269, 52, 53 }));
+}
+
+TEST_F(BpeTokenizerTest, MergesMultiByteCharacters) {
+    EXPECT_EQ(encode("\xe4\xb8\xad\xe6\x96\x87 hello"), std::vector<int>({ 266, 230, 150, 135, 32, 259 }));
+}
+
+TEST_F(BpeTokenizerTest, CountMatchesEncode) {
+    std::string text;
+    for (int i = 0; i < 200; ++i) {
+        text += "hello world, it's 12345 \xe4\xb8\xad\xe6\x96\x87\n";
+    }
+    EXPECT_EQ(tokenizer_.count_tokens(text), encode(text).size());
+}
+
+TEST(BpeTokenizer, Cl100kKnownIds) {
+    BpeTokenizer tokenizer;
+    if (!tokenizer.load("./dict/cl100k_base.tiktoken")) {
+        // The vocabulary is downloaded separately; nothing to check without it
+        SUCCEED() << "./dict/cl100k_base.tiktoken not found";
+        return;
+    }
+    std::vector<int> tokens;
+    tokenizer.encode("hello world", tokens);
+    EXPECT_EQ(tokens, std::vector<int>({ 15339, 1917 }));
+}
@@ -0,0 +1,72 @@
+// database_test.cpp
+
+#include "database.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+class DatabaseTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        initialize_database(db_, ":memory:");
+        ASSERT_NE(db_, nullptr);
+        doc_id_ = insert_document(db_, L"notes.txt");
+        ASSERT_GT(doc_id_, 0);
+    }
+
+    void TearDown() override {
+        sqlite3_close(db_);
+    }
+
+    sqlite3* db_ = nullptr;
+    int doc_id_ = 0;
+};
+
+} // namespace
+
+TEST_F(DatabaseTest, InsertEmbeddingStandsAlone) {
+    int id = insert_embedding(db_, doc_id_, L"first", { 1.0f, 0.0f });
+    ASSERT_GT(id, 0);
+    EXPECT_EQ(get_text_by_id(db_, id), L"first");
+    EXPECT_TRUE(sqlite3_get_autocommit(db_));
+}
+
+TEST_F(DatabaseTest, InsertEmbeddingJoinsCallerTransaction) {
+    ASSERT_EQ(sqlite3_exec(db_, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr), SQLITE_OK);
+    int first = insert_embedding(db_, doc_id_, L"first", { 1.0f, 0.0f });
+    int second = insert_embedding(db_, doc_id_, L"second", { 0.0f, 1.0f });
+    EXPECT_GT(first, 0);
+    EXPECT_GT(second, 0);
+    EXPECT_FALSE(sqlite3_get_autocommit(db_));
+    ASSERT_EQ(sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr), SQLITE_OK);
+    EXPECT_TRUE(get_text_by_id(db_, first).empty());
+}
+
+TEST_F(DatabaseTest, DeleteDocumentsRemovesTheirEmbeddings) {
+    int other_doc = insert_document(db_, L"other.txt");
+    int kept = insert_embedding(db_, other_doc, L"kept", { 1.0f, 0.0f });
+    int deleted = insert_embedding(db_, doc_id_, L"deleted", { 0.0f, 1.0f });
+    ASSERT_GT(kept, 0);
+    ASSERT_GT(deleted, 0);
+
+    delete_documents({ doc_id_ }, db_);
+    EXPECT_TRUE(get_texts_by_ids(db_, { deleted }).empty());
+    EXPECT_EQ(get_text_by_id(db_, kept), L"kept");
+    EXPECT_TRUE(get_document_info(db_, doc_id_).empty());
+    EXPECT_TRUE(sqlite3_get_autocommit(db_));
+}
+
+TEST_F(DatabaseTest, MoveDocumentUpdatesItsPath) {
+    int doc_id = insert_document(db_, L"a.txt", L"docs/a.txt", FileVersion());
+    ASSERT_TRUE(move_document(db_, doc_id, L"docs/b.txt"));
+    bool found = false;
+    for (const auto& file : get_stored_files(db_)) {
+        if (file.doc_id == doc_id) {
+            found = true;
+            EXPECT_EQ(file.file_path, L"docs/b.txt");
+        }
+    }
+    EXPECT_TRUE(found);
+}
@@ -0,0 +1,113 @@
+// embedding_parser_test.cpp
+
+#include "embedding_parser.h"
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Little-endian float32 rows, base64 encoded as the API sends them
+std::string base64_floats(const std::vector<float>& values) {
+    const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string bytes(values.size() * sizeof(float), '\0');
+    if (!values.empty()) {
+        memcpy(bytes.data(), values.data(), bytes.size());
+    }
+    std::string encoded;
+    for (size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t chunk = static_cast<uint8_t>(bytes[i]) << 16;
+        if (i + 1 < bytes.size()) chunk |= static_cast<uint8_t>(bytes[i + 1]) << 8;
+        if (i + 2 < bytes.size()) chunk |= static_cast<uint8_t>(bytes[i + 2]);
+        encoded += alphabet[(chunk >> 18) & 63];
+        encoded += alphabet[(chunk >> 12) & 63];
+        encoded += i + 1 < bytes.size() ? alphabet[(chunk >> 6) & 63] : '=';
+        encoded += i + 2 < bytes.size() ? alphabet[chunk & 63] : '=';
+    }
+    return encoded;
+}
+
+// Parse body fed in slices of the given size into count outputs
+bool parse_in_slices(const std::string& body, size_t slice, std::vector<std::vector<float>>& outputs) {
+    EmbeddingResponseParser parser(outputs.data(), outputs.size());
+    for (size_t i = 0; i < body.size(); i += slice) {
+        parser.feed(body.data() + i, std::min(slice, body.size() - i));
+    }
+    return parser.finish();
+}
+
+} // namespace
+
+TEST(EmbeddingResponseParser, DecimalRowsAtEverySliceBoundary) {
+    const std::string body =
+        "{\"object\":\"list\",\"data\":["
+        "{\"object\":\"embedding\",\"index\":0,\"embedding\":[0.5,-1.25e-2,3]},"
+        "{\"object\":\"embedding\",\"index\":1,\"embedding\":[-0.0078125, 1E2 ,0]}"
+        "],\"model\":\"text-embedding-3-small\",\"usage\":{\"prompt_tokens\":4,\"total_tokens\":4}}";
+    for (size_t slice = 1; slice <= body.size(); ++slice) {
+        std::vector<std::vector<float>> outputs(2);
+        ASSERT_TRUE(parse_in_slices(body, slice, outputs)) << "slice of " << slice << " bytes";
+        EXPECT_EQ(outputs[0], std::vector<float>({ 0.5f, -1.25e-2f, 3.0f }));
+        EXPECT_EQ(outputs[1], std::vector<float>({ -0.0078125f, 100.0f, 0.0f }));
+    }
+}
+
+TEST(EmbeddingResponseParser, Base64RowsAtEverySliceBoundary) {
+    const std::vector<float> first = { 0.1f, -0.2f, 0.3f, 1e-7f, -3.5f };
+    const std::vector<float> second = { 42.0f, -0.0f, 7.25f };
+    const std::string body =
+        "{\"data\":[{\"embedding\":\"" + base64_floats(first) + "\",\"index\":0},"
+        "{\"index\":1,\"embedding\":\"" + base64_floats(second) + "\"}]}";
+    for (size_t slice = 1; slice <= body.size(); ++slice) {
+        std::vector<std::vector<float>> outputs(2);
+        ASSERT_TRUE(parse_in_slices(body, slice, outputs)) << "slice of " << slice << " bytes";
+        EXPECT_EQ(outputs[0], first);
+        EXPECT_EQ(outputs[1], second);
+    }
+}
+
+TEST(EmbeddingResponseParser, IndexGivenAfterTheEmbeddingPlacesTheRow) {
+    const std::string body = "{\"data\":[{\"embedding\":[2,2],\"index\":1},{\"embedding\":[1,1],\"index\":0}]}";
+    std::vector<std::vector<float>> outputs(2);
+    ASSERT_TRUE(parse_in_slices(body, 7, outputs));
+    EXPECT_EQ(outputs[0], std::vector<float>({ 1.0f, 1.0f }));
+    EXPECT_EQ(outputs[1], std::vector<float>({ 2.0f, 2.0f }));
+}
+
+TEST(EmbeddingResponseParser, ItemsWithoutIndexAreTakenInOrder) {
+    const std::string body = "{\"data\":[{\"embedding\":[1]},{\"embedding\":[2]}]}";
+    std::vector<std::vector<float>> outputs(2);
+    ASSERT_TRUE(parse_in_slices(body, 1, outputs));
+    EXPECT_EQ(outputs[0], std::vector<float>({ 1.0f }));
+    EXPECT_EQ(outputs[1], std::vector<float>({ 2.0f }));
+}
+
+TEST(EmbeddingResponseParser, TruncatedBodyClearsEveryRow) {
+    const std::string body = "{\"data\":[{\"index\":0,\"embedding\":[1,2]},{\"index\":1,\"embedding\":[3,";
+    std::vector<std::vector<float>> outputs(2);
+    EXPECT_FALSE(parse_in_slices(body, 16, outputs));
+    EXPECT_TRUE(outputs[0].empty());
+    EXPECT_TRUE(outputs[1].empty());
+}
+
+TEST(EmbeddingResponseParser, ErrorBodyFailsAndKeepsAnExcerpt) {
+    const std::string body = "{\"error\":{\"message\":\"Rate limit reached\",\"type\":\"requests\"}}";
+    std::vector<std::vector<float>> outputs(1);
+    EmbeddingResponseParser parser(outputs.data(), outputs.size());
+    parser.feed(body.data(), body.size());
+    EXPECT_FALSE(parser.finish());
+    EXPECT_NE(parser.excerpt().find("Rate limit reached"), std::string::npos);
+}
+
+TEST(EmbeddingResponseParser, ResetForgetsAnAbandonedResponse) {
+    std::vector<std::vector<float>> outputs(1);
+    EmbeddingResponseParser parser(outputs.data(), outputs.size());
+    std::string partial = "{\"data\":[{\"index\":0,\"embedding\":[9,9";
+    parser.feed(partial.data(), partial.size());
+    parser.reset();
+    std::string body = "{\"data\":[{\"index\":0,\"embedding\":[4,5]}]}";
+    parser.feed(body.data(), body.size());
+    ASSERT_TRUE(parser.finish());
+    EXPECT_EQ(outputs[0], std::vector<float>({ 4.0f, 5.0f }));
+}
@@ -0,0 +1,75 @@
+// file_reader_test.cpp
+
+#include "file_reader.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const size_t file_bytes = 100 * 1024;
+
+// Files of file_bytes each, filled with their own index
+class FileReaderTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        dir_ = std::filesystem::temp_directory_path() / "ragcpp_file_reader_test";
+        std::filesystem::remove_all(dir_);
+        std::filesystem::create_directories(dir_);
+        for (int i = 0; i < 24; ++i) {
+            std::filesystem::path path = dir_ / (std::to_string(i) + ".txt");
+            std::ofstream(path, std::ios::binary) << std::string(file_bytes, static_cast<char>('a' + i));
+            paths_.push_back(path.wstring());
+        }
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(dir_);
+    }
+
+    std::filesystem::path dir_;
+    std::vector<std::wstring> paths_;
+};
+
+} // namespace
+
+TEST_F(FileReaderTest, FilesComeOutInOrderWithinTheBudget) {
+    // Room for two and a half files, eight reads at a time
+    FileReader reader(8, 5 * file_bytes / 2);
+    reader.start(paths_);
+    FileContents file;
+    for (size_t i = 0; i < paths_.size(); ++i) {
+        ASSERT_TRUE(reader.next(file));
+        EXPECT_EQ(file.path, paths_[i]);
+        ASSERT_TRUE(file.read);
+        EXPECT_EQ(file.data, std::string(file_bytes, static_cast<char>('a' + i)));
+        reader.release(std::move(file.data));
+    }
+    EXPECT_FALSE(reader.next(file));
+}
+
+TEST_F(FileReaderTest, BuffersReleasedLaterOnAnotherThread) {
+    // The caller holds more than the budget for a while, as the embedding
+    // writers do; reads wait for the releases rather than stopping
+    FileReader reader(8, 2 * file_bytes);
+    reader.start(paths_);
+    std::vector<std::thread> releasers;
+    FileContents file;
+    size_t count = 0;
+    while (reader.next(file)) {
+        EXPECT_EQ(file.data.size(), file_bytes);
+        releasers.emplace_back([&reader, data = std::move(file.data)]() mutable {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            reader.release(std::move(data));
+        });
+        count++;
+    }
+    for (auto& releaser : releasers) {
+        releaser.join();
+    }
+    EXPECT_EQ(count, paths_.size());
+}
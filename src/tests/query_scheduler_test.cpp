@@ -0,0 +1,81 @@
+// query_scheduler_test.cpp
+
+#include "query_scheduler.h"
+#include "http_server.h"
+#include "openai_api.h"
+#include "answer_cache.h"
+#include "database.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Stands in for the API: every text embeds to the same vector, and chat
+// completions stream the given body
+class QuerySchedulerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        initialize_database(db_, ":memory:");
+        ASSERT_NE(db_, nullptr);
+        int doc_id = insert_document(db_, L"notes.txt");
+        ASSERT_GT(insert_embedding(db_, doc_id, L"The answer is in here.", { 1.0f, 0.0f, 0.0f }), 0);
+        segments_.resize(1);
+        ASSERT_TRUE(load_vector_index(db_, segments_[0]));
+
+        ASSERT_TRUE(server_.start(0, [this](const HttpRequest& request) {
+            HttpResponse response;
+            if (request.path == "/v1/embeddings") {
+                response.body = "{\"data\":[{\"index\":0,\"embedding\":[1.0,0.0,0.0]}]}";
+            }
+            else {
+                response.content_type = "text/event-stream";
+                response.body = chat_stream_;
+            }
+            return response;
+        }));
+        set_api_base_url("http://127.0.0.1:" + std::to_string(server_.port()));
+        set_embedding_encoding(false);
+        configure_answer_cache(false, 0.95f, 10000);
+    }
+
+    void TearDown() override {
+        server_.stop();
+        set_embedding_encoding(true);
+        configure_answer_cache(true, 0.95f, 10000);
+        sqlite3_close(db_);
+    }
+
+    // Ask one question and wait for its outcome
+    bool ask(std::wstring& answer, std::wstring& citations) {
+        std::shared_mutex index_mutex;
+        QueryScheduler scheduler(db_, "test", segments_, index_mutex, QuerySchedulerOptions());
+        auto execution = scheduler.submit(L"Where is the answer?", 0);
+        return execution->follow([&answer](const std::wstring& token) { answer += token; }, citations);
+    }
+
+    sqlite3* db_ = nullptr;
+    std::vector<VectorIndex> segments_;
+    HttpServer server_;
+    std::string chat_stream_;
+};
+
+} // namespace
+
+TEST_F(QuerySchedulerTest, StreamedAnswerSucceedsWithCitations) {
+    chat_stream_ = "data: {\"choices\":[{\"delta\":{\"content\":\"In notes\"}}]}\n\ndata: [DONE]\n\n";
+    std::wstring answer;
+    std::wstring citations;
+    EXPECT_TRUE(ask(answer, citations));
+    EXPECT_EQ(answer, L"In notes");
+    EXPECT_NE(citations.find(L"notes.txt"), std::wstring::npos);
+}
+
+TEST_F(QuerySchedulerTest, EmptyAnswerFails) {
+    chat_stream_ = "data: [DONE]\n\n";
+    std::wstring answer;
+    std::wstring citations;
+    EXPECT_FALSE(ask(answer, citations));
+    EXPECT_TRUE(answer.empty());
+    EXPECT_TRUE(citations.empty());
+}
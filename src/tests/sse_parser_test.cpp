@@ -0,0 +1,56 @@
+// sse_parser_test.cpp
+
+#include "sse_parser.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<std::string> parse_in_slices(const std::string& body, size_t slice) {
+    std::vector<std::string> events;
+    SseParser parser([&events](const std::string& data) { events.push_back(data); });
+    for (size_t i = 0; i < body.size(); i += slice) {
+        parser.feed(body.data() + i, std::min(slice, body.size() - i));
+    }
+    parser.finish();
+    return events;
+}
+
+} // namespace
+
+TEST(SseParser, EventsSurviveEverySliceBoundary) {
+    const std::string body =
+        "data: {\"choices\":[{\"delta\":{\"content\":\"Hel\"}}]}\n\n"
+        ": keep-alive\n\n"
+        "event: message\r\ndata: {\"choices\":[{\"delta\":{\"content\":\"lo\"}}]}\r\n\r\n"
+        "data: [DONE]\n\n";
+    const std::vector<std::string> expected = {
+        "{\"choices\":[{\"delta\":{\"content\":\"Hel\"}}]}",
+        "{\"choices\":[{\"delta\":{\"content\":\"lo\"}}]}",
+        "[DONE]",
+    };
+    for (size_t slice = 1; slice <= body.size(); ++slice) {
+        EXPECT_EQ(parse_in_slices(body, slice), expected) << "slice of " << slice << " bytes";
+    }
+}
+
+TEST(SseParser, MultiLineDataIsJoinedWithNewlines) {
+    EXPECT_EQ(parse_in_slices("data: first\ndata:second\n\n", 3), std::vector<std::string>({ "first\nsecond" }));
+}
+
+TEST(SseParser, FinishDispatchesAnUnterminatedEvent) {
+    EXPECT_EQ(parse_in_slices("data: one\n\ndata: two", 4), std::vector<std::string>({ "one", "two" }));
+}
+
+TEST(SseParser, CommentsAndOtherFieldsAreNotEvents) {
+    std::vector<std::string> events = parse_in_slices(": ping\n\nid: 7\nretry: 100\n\nevent: x\n\n", 5);
+    EXPECT_TRUE(events.empty());
+}
+
+TEST(SseParser, CountsEvents) {
+    SseParser parser([](const std::string&) {});
+    std::string body = "data: a\n\ndata: b\n\n";
+    parser.feed(body.data(), body.size());
+    EXPECT_EQ(parser.event_count(), 2u);
+}
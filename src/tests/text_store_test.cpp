@@ -0,0 +1,49 @@
+// text_store_test.cpp
+
+#include "text_store.h"
+#include "database.h"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <string>
+
+namespace {
+
+const char* test_db_path = "text_store_test.db";
+
+void remove_test_db() {
+    std::remove(test_db_path);
+    std::remove((std::string(test_db_path) + "-wal").c_str());
+    std::remove((std::string(test_db_path) + "-shm").c_str());
+}
+
+// Store text as the one packed paragraph of a fresh database file, and read
+// it back
+std::wstring store_and_read(const std::wstring& text) {
+    remove_test_db();
+    sqlite3* db = nullptr;
+    initialize_database(db, test_db_path);
+    if (!db) return L"";
+    int doc_id = insert_document(db, L"notes.txt");
+    int id = insert_embedding(db, doc_id, text, { 1.0f, 0.0f });
+    pack_document_texts(db, doc_id);
+    std::wstring read = get_text_by_id(db, id);
+    sqlite3_close(db);
+    return read;
+}
+
+} // namespace
+
+TEST(TextStoreTest, CompressedBlockRoundTrips) {
+    std::string raw = "the same words, the same words, the same words";
+    std::string compressed = compress_text_block(raw, "the same words");
+    std::string inflated;
+    ASSERT_TRUE(decompress_text_block(compressed.data(), compressed.size(), raw.size(), "the same words", inflated));
+    EXPECT_EQ(inflated, raw);
+}
+
+TEST(TextStoreTest, RecreatedFileDoesNotReadCachedBlocks) {
+    // Both files number their first block 1, under the same file name
+    EXPECT_EQ(store_and_read(L"First file's paragraph."), L"First file's paragraph.");
+    EXPECT_EQ(store_and_read(L"Second file's paragraph."), L"Second file's paragraph.");
+    remove_test_db();
+}
@@ -0,0 +1,181 @@
+// vector_index_test.cpp
+
+#include "vector_index.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace {
+
+// Rows drawn around cluster centres, 40 rows per document, ids from 1. With
+// clusters, every query has real near neighbours for the prefilter to find.
+VectorIndex clustered_index(std::mt19937& rng, int dim, int rows, int clusters, std::vector<std::vector<float>>& centres) {
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    centres.assign(clusters, std::vector<float>(dim));
+    for (auto& centre : centres) {
+        for (float& value : centre) {
+            value = normal(rng);
+        }
+    }
+
+    VectorIndex index;
+    index.dim = dim;
+    for (int i = 0; i < rows; ++i) {
+        const std::vector<float>& centre = centres[i % clusters];
+        float norm = 0.0f;
+        for (int d = 0; d < dim; ++d) {
+            float value = centre[d] + 0.5f * normal(rng);
+            index.vectors.push_back(value);
+            norm += value * value;
+        }
+        index.ids.push_back(i + 1);
+        index.doc_ids.push_back(1 + i / 40);
+        index.norms.push_back(std::sqrt(norm));
+    }
+    index_documents(index);
+    return index;
+}
+
+// Split the rows by document into count segments, as shards split them
+std::vector<VectorIndex> split_segments(const VectorIndex& index, size_t count) {
+    std::vector<VectorIndex> segments(count);
+    for (auto& segment : segments) {
+        segment.dim = index.dim;
+    }
+    for (size_t i = 0; i < index.size(); ++i) {
+        VectorIndex& segment = segments[static_cast<size_t>(index.doc_ids[i]) % count];
+        segment.ids.push_back(index.ids[i]);
+        segment.doc_ids.push_back(index.doc_ids[i]);
+        segment.norms.push_back(index.norms[i]);
+        segment.vectors.insert(segment.vectors.end(), index.row(i), index.row(i) + index.dim);
+    }
+    for (auto& segment : segments) {
+        index_documents(segment);
+    }
+    return segments;
+}
+
+std::vector<std::vector<float>> noisy_queries(std::mt19937& rng, const std::vector<std::vector<float>>& centres, size_t count) {
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    std::vector<std::vector<float>> queries;
+    for (size_t q = 0; q < count; ++q) {
+        std::vector<float> query = centres[q % centres.size()];
+        for (float& value : query) {
+            value += 0.5f * normal(rng);
+        }
+        queries.push_back(std::move(query));
+    }
+    return queries;
+}
+
+void expect_same_results(const std::vector<SimilarityResult>& expected, const std::vector<SimilarityResult>& actual) {
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_EQ(expected[i].id, actual[i].id) << "rank " << i;
+        EXPECT_EQ(expected[i].doc_id, actual[i].doc_id) << "rank " << i;
+        EXPECT_NEAR(expected[i].similarity, actual[i].similarity, 1e-5f) << "rank " << i;
+    }
+}
+
+// Share of the exact top_k ids the prefiltered search also returned
+double recall(const VectorIndex& index, const std::vector<VectorIndex>& segments, const std::vector<std::vector<float>>& queries,
+    size_t top_k, size_t candidates) {
+    std::vector<std::vector<SimilarityResult>> found = search_vector_segments_batch(segments, queries, top_k, candidates);
+    size_t hits = 0;
+    for (size_t q = 0; q < queries.size(); ++q) {
+        std::set<int> exact;
+        for (const auto& result : search_vector_index(index, queries[q], top_k)) {
+            exact.insert(result.id);
+        }
+        for (const auto& result : found[q]) {
+            hits += exact.count(result.id);
+        }
+    }
+    return static_cast<double>(hits) / static_cast<double>(queries.size() * top_k);
+}
+
+}
+
+TEST(VectorIndexTest, CandidatesCoveringEveryRowMatchExactSearch) {
+    std::mt19937 rng(7);
+    std::vector<std::vector<float>> centres;
+    VectorIndex index = clustered_index(rng, 96, 1000, 25, centres);
+    std::vector<std::vector<float>> queries = noisy_queries(rng, centres, 8);
+
+    std::vector<VectorIndex> one(1, index);
+    for (size_t candidates : { index.size(), index.size() + 100 }) {
+        std::vector<std::vector<SimilarityResult>> results = search_vector_segments_batch(one, queries, 10, candidates);
+        ASSERT_EQ(results.size(), queries.size());
+        for (size_t q = 0; q < queries.size(); ++q) {
+            expect_same_results(search_vector_index(index, queries[q], 10), results[q]);
+        }
+    }
+
+    // One short of every row takes the prefilter path, but each of the two
+    // segments' shares still rounds up to all of its rows
+    std::vector<VectorIndex> two = split_segments(index, 2);
+    std::vector<std::vector<SimilarityResult>> results = search_vector_segments_batch(two, queries, 10, index.size() - 1);
+    ASSERT_EQ(results.size(), queries.size());
+    for (size_t q = 0; q < queries.size(); ++q) {
+        expect_same_results(search_vector_index(index, queries[q], 10), results[q]);
+    }
+}
+
+TEST(VectorIndexTest, PrefilterRecallOnOneAndSeveralSegments) {
+    std::mt19937 rng(11);
+    std::vector<std::vector<float>> centres;
+    VectorIndex index = clustered_index(rng, 128, 4000, 40, centres);
+    std::vector<std::vector<float>> queries = noisy_queries(rng, centres, 20);
+
+    for (size_t count : { 1, 3 }) {
+        std::vector<VectorIndex> segments = split_segments(index, count);
+        double found = recall(index, segments, queries, 10, 400);
+        EXPECT_GE(found, 0.9) << count << " segments";
+    }
+}
+
+TEST(VectorIndexTest, ClosestRowsBreaksTiesTowardEarlierRows) {
+    std::vector<uint32_t> distances = { 3, 1, 2, 1, 0, 2, 1 };
+    EXPECT_EQ(closest_rows(distances, 64, 3), (std::vector<size_t>{ 1, 3, 4 }));
+    EXPECT_EQ(closest_rows(distances, 64, 5), (std::vector<size_t>{ 1, 2, 3, 4, 6 }));
+    EXPECT_TRUE(closest_rows(distances, 64, 0).empty());
+    EXPECT_EQ(closest_rows(distances, 64, 7), (std::vector<size_t>{ 0, 1, 2, 3, 4, 5, 6 }));
+    EXPECT_EQ(closest_rows(distances, 64, 100).size(), distances.size());
+
+    // Distances can reach dim itself
+    std::vector<uint32_t> extremes = { 5, 5, 0, 5 };
+    EXPECT_EQ(closest_rows(extremes, 5, 2), (std::vector<size_t>{ 0, 2 }));
+}
+
+TEST(VectorIndexTest, DimensionNotMultipleOf64) {
+    std::vector<float> vector(100, -1.0f);
+    vector[0] = 1.0f;
+    vector[63] = 1.0f;
+    vector[64] = 1.0f;
+    vector[99] = 1.0f;
+    std::vector<uint64_t> code = binary_code(vector);
+    ASSERT_EQ(code.size(), 2u);
+    EXPECT_EQ(code[0], (uint64_t(1) << 63) | 1u);
+    EXPECT_EQ(code[1], (uint64_t(1) << 35) | 1u);
+
+    std::mt19937 rng(13);
+    std::vector<std::vector<float>> centres;
+    VectorIndex index = clustered_index(rng, 100, 2000, 20, centres);
+    ASSERT_EQ(index.code_words(), 2u);
+    ASSERT_EQ(index.codes.size(), index.size() * 2);
+    for (size_t i = 0; i < index.size(); i += 97) {
+        std::vector<float> row(index.row(i), index.row(i) + index.dim);
+        EXPECT_EQ(binary_code(row), std::vector<uint64_t>(index.code(i), index.code(i) + 2)) << "row " << i;
+    }
+
+    std::vector<std::vector<float>> queries = noisy_queries(rng, centres, 10);
+    std::vector<VectorIndex> segments = split_segments(index, 2);
+    EXPECT_GE(recall(index, segments, queries, 10, 300), 0.9);
+    std::vector<std::vector<SimilarityResult>> results = search_vector_segments_batch(segments, queries, 10, index.size() - 1);
+    for (size_t q = 0; q < queries.size(); ++q) {
+        expect_same_results(search_vector_index(index, queries[q], 10), results[q]);
+    }
+}